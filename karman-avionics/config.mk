@@ -67,16 +67,23 @@ src/ASF/xmega/drivers/usart/usart.c \
 src/drivers/ms5607-02ba03.c \
 src/drivers/n25q_512.c \
 src/ASF/xmega/drivers/usb/usb_device.c \
+src/framework/Mailbox.c \
+src/framework/Profiler.c \
 src/framework/Scheduler.c \
+src/framework/SoftTimer.c \
 src/framework/Tasks.c \
 src/framework/Timer.c \
 src/main.c \
 src/tasks/Background.c \
+src/tasks/LogTask.c \
 src/tasks/Pyrotechnics.c \
 src/tasks/RadioTask.c \
 src/tasks/SensorTask.c \
 src/tasks/Spi_bg_task.c \
+src/utils/Altitude.c \
 src/utils/CC2500_regvalues.c \
+src/utils/Crc.c \
+src/utils/DataReady.c \
 src/utils/FlashMem.c \
 src/utils/Spi_service.c \
 src/utils/USBUtils.c \
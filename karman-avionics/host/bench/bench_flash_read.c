@@ -0,0 +1,168 @@
+/**
+ * @file bench_flash_read.c
+ *
+ * @brief Read speed of the whole simulated flash memory
+ *
+ * Created: 10/18/2026 11:20:00 PM
+ *
+ * Fills the simulated N25Q with a full log: header, every sector marked
+ * erased in the erase map, and entries from the start of the log to the end
+ * of the device. init_flashmem recovers it like it would after a flight.
+ * Then reads the whole device back, first through extflash_read in a few
+ * chunk sizes, then through flashmem_read_entries in download blocks and in
+ * the biggest blocks it takes. Each pass is checked against the simulated
+ * flash, and prints MB/s of virtual time next to what the bus can carry.
+ *
+ * Times come from the simulation's guess of a few clocks per access (see
+ * README.md), so compare the ways of reading with it, don't read it as the
+ * part's numbers.
+ *
+ * Usage: bench_flash_read
+ */
+
+#include "sim_devices.h"
+#include "FlashMem.h"
+#include "Crc.h"
+#include "Timer.h"
+#include "n25q_512.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Where the log and the erase map are on the flash, see FlashMem.c */
+#define BENCH_FLASH_LOG_ADDR (EXTFLASH_SECTOR_SIZE)
+#define BENCH_FLASH_MAP_ADDR (0x100)
+/** Entries that fit between the start of the log and the end of the device */
+#define BENCH_FLASH_ENTRIES ((EXTFLASH_SIZE - BENCH_FLASH_LOG_ADDR) / sizeof(flash_data_entry_t))
+/** Biggest read, a request's receive length is 16 bits */
+#define BENCH_FLASH_MAX_READ (32768UL)
+/** Entries in a download block, USB_FLASHBLOCK_ENTRIES in USBUtils.h */
+#define BENCH_FLASH_DNLD_ENTRIES (FLASHMEM_PAGE_SIZE / sizeof(flash_data_entry_t))
+
+/** Chunk sizes read through extflash_read */
+static const uint32_t benchChunks[] = { 256, 4096, BENCH_FLASH_MAX_READ };
+#define BENCH_FLASH_NUM_CHUNKS (sizeof(benchChunks) / sizeof(benchChunks[0]))
+
+static sim_n25q_t benchFlash;
+static uint8_t benchBuf[BENCH_FLASH_MAX_READ];
+
+/** Count a failed check */
+static uint32_t benchFailures = 0;
+
+static void bench_expect(Bool ok, const char *what)
+{
+    if(!ok)
+    {
+        benchFailures++;
+        printf("FAIL: %s\n", what);
+    }
+}
+
+/** Write a full log straight into the simulated flash */
+static void bench_fill_log(void)
+{
+    flash_data_hdr_t header;
+    flash_data_entry_t entry;
+    uint32_t idx;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = MAGIC_NUMBER;
+    strncpy(header.version_str, VERSION_STRING, VERSION_SIZE);
+    header.entry_size = sizeof(flash_data_entry_t);
+    memcpy(benchFlash.mem, &header, sizeof(header));
+
+    memset(&benchFlash.mem[BENCH_FLASH_MAP_ADDR], 0x00, EXTFLASH_SIZE / EXTFLASH_SECTOR_SIZE);
+
+    memset(&entry, 0, sizeof(entry));
+    for(idx = 0; idx < BENCH_FLASH_ENTRIES; idx++)
+    {
+        entry.timestamp = idx + 1;
+        entry.data.altimeter.pressure = (int32_t)(idx * 7);
+        entry.data.altimeter.temp = (int32_t)idx;
+        entry.chksum = crc16_update(CRC16_INIT, (const uint8_t *)&entry, offsetof(flash_data_entry_t, chksum));
+        memcpy(&benchFlash.mem[BENCH_FLASH_LOG_ADDR + (idx * sizeof(entry))], &entry, sizeof(entry));
+    }
+}
+
+/** Print one pass */
+static void bench_report(const char *how, uint32_t chunk, uint32_t bytes, uint64_t counts)
+{
+    double seconds = (double)counts / (1000000.0 * SIM_COUNTS_PER_US);
+
+    printf("%-22s %6u %10u %8.3f %8.3f\n", how, chunk, bytes, seconds, ((double)bytes / seconds) / 1000000.0);
+}
+
+/** Read the whole device through extflash_read, chunk bytes at a time */
+static void bench_extflash_read(uint32_t chunk)
+{
+    uint64_t start = sim_now();
+    uint32_t addr;
+    uint32_t bad = 0;
+    Bool failed = false;
+
+    for(addr = 0; (addr < EXTFLASH_SIZE) && !failed; addr += chunk)
+    {
+        failed = extflash_read(addr, chunk, benchBuf, true);
+        bad += (memcmp(benchBuf, &benchFlash.mem[addr], chunk) != 0) ? 1 : 0;
+    }
+
+    bench_report("extflash_read", chunk, addr, sim_now() - start);
+    bench_expect(!failed, "extflash_read reads the whole device");
+    bench_expect(bad == 0, "extflash_read matches the flash");
+}
+
+/** Read the whole log through flashmem_read_entries, count entries at a time */
+static void bench_flashmem_read(uint16_t count)
+{
+    flash_data_entry_t *entries = (flash_data_entry_t *)benchBuf;
+    uint64_t start = sim_now();
+    uint32_t index;
+    uint32_t bad = 0;
+    uint16_t num;
+    Bool failed = false;
+
+    for(index = 0; (index < BENCH_FLASH_ENTRIES) && !failed; index += num)
+    {
+        num = (uint16_t)min(count, BENCH_FLASH_ENTRIES - index);
+        failed = flashmem_read_entries(entries, index, num, true);
+        bad += (memcmp(entries, &benchFlash.mem[BENCH_FLASH_LOG_ADDR + (index * sizeof(flash_data_entry_t))],
+                       num * sizeof(flash_data_entry_t)) != 0) ? 1 : 0;
+    }
+
+    bench_report("flashmem_read_entries", count * sizeof(flash_data_entry_t), index * sizeof(flash_data_entry_t), sim_now() - start);
+    bench_expect(!failed, "flashmem_read_entries reads the whole log");
+    bench_expect(bad == 0, "flashmem_read_entries matches the flash");
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t i;
+
+    (void)argc;
+    (void)argv;
+
+    sim_n25q_attach(&benchFlash);
+    bench_fill_log();
+
+    /* Same start up as main() */
+    cpu_irq_enable();
+    timer_init();
+    tc_write_clock_source(&TCC0, TC_CLKSEL_DIV1_gc);
+    init_flashmem();
+
+    printf("log: %u entries of %u bytes recovered\n", flashmem_get_num_entries(), (unsigned)sizeof(flash_data_entry_t));
+    bench_expect(flashmem_get_num_entries() == BENCH_FLASH_ENTRIES, "init finds the whole log");
+    bench_expect(benchFlash.stats.erases == 0, "init erases nothing of a full log");
+
+    printf("bus carries %.3f MB/s at %u Hz\n", (double)FLASH_SPI_BAUD / 8.0 / 1000000.0, (unsigned)FLASH_SPI_BAUD);
+    printf("%-22s %6s %10s %8s %8s\n", "read", "chunk", "bytes", "seconds", "MB/s");
+    for(i = 0; i < BENCH_FLASH_NUM_CHUNKS; i++)
+    {
+        bench_extflash_read(benchChunks[i]);
+    }
+    bench_flashmem_read(BENCH_FLASH_DNLD_ENTRIES);
+    bench_flashmem_read(BENCH_FLASH_MAX_READ / sizeof(flash_data_entry_t));
+
+    printf("%s\n", (benchFailures == 0) ? "PASS" : "FAILED");
+    return (benchFailures == 0) ? 0 : 1;
+}
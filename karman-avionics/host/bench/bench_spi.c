@@ -0,0 +1,219 @@
+/**
+ * @file bench_spi.c
+ *
+ * @brief Throughput and overhead of the SPI service on each simulated bus
+ *
+ * Created: 10/18/2026 9:30:00 PM
+ *
+ * Sets the three buses up the way the firmware does: the sensor bus on
+ * USARTD0 and the flash bus on USARTC1 with DMA at their devices' clock
+ * rates, and the radio bus on USARTE1 with an RXC interrupt per byte at the
+ * bus default. Each bus gets a device that sends back the complement of
+ * every byte, so every transfer is checked.
+ *
+ * For each bus and transfer size, a task wakes every scheduler tick period
+ * and fills the queue, and the background loop starts requests between. The
+ * bus runs for a while, then drains. Prints bytes per second of virtual
+ * time, the setup cost of a request and the interrupt cost of a byte from
+ * the master's statistics, and how much of the time the bus was busy.
+ *
+ * Built once for each SPI_MASTER_QUEUE_DEPTH. Times come from the
+ * simulation's guess of a few clocks per access (see README.md), so compare
+ * depths, sizes and buses with it, don't read it as the part's numbers.
+ *
+ * Usage: bench_spi [milliseconds per run]
+ */
+
+#include "sim.h"
+#include "Spi_service.h"
+#include "Spi_bg_task.h"
+#include "Timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Default virtual time each bus and size is run for, ms */
+#define BENCH_SPI_RUN_MS (50)
+/** How often the task fills the queue, TCC0 counts. The fastest task in Tasks.c runs every 2ms. */
+#define BENCH_SPI_TASK_COUNTS (10UL * TIMER_COUNTS_PER_TICK)
+/** Largest transfer */
+#define BENCH_SPI_MAX_LEN (256)
+
+/** Transfer sizes swept */
+static const uint16_t benchSizes[] = { 1, 4, 16, 64, 256 };
+#define BENCH_SPI_NUM_SIZES (sizeof(benchSizes) / sizeof(benchSizes[0]))
+
+/** A bus and the device on it */
+typedef struct
+{
+    const char *name;           /**< What it's called in the output */
+    spi_master_t master;        /**< The bus */
+    chip_select_info_t cs;      /**< The device */
+    sim_spi_device_t device;    /**< Its simulation */
+} bench_bus_t;
+
+static bench_bus_t benchSensor = { .name = "sensor" };
+static bench_bus_t benchFlash = { .name = "flash" };
+static bench_bus_t benchRadio = { .name = "radio" };
+
+static uint8_t benchSend[BENCH_SPI_MAX_LEN];
+static volatile uint8_t benchRecv[SPI_MASTER_QUEUE_DEPTH][BENCH_SPI_MAX_LEN];
+static volatile Bool benchComplete[SPI_MASTER_QUEUE_DEPTH];
+
+/** Count a failed check */
+static uint32_t benchFailures = 0;
+
+static void bench_expect(Bool ok, const char *what)
+{
+    if(!ok)
+    {
+        benchFailures++;
+        printf("FAIL: %s\n", what);
+    }
+}
+
+/** The radio bus interrupt. RadioTask.c isn't built, this stands in for its handler. */
+ISR(RADIO_SPI_INT)
+{
+    spi_master_ISR(&benchRadio.master);
+}
+
+static void bench_select(void *ctx)
+{
+    (void)ctx;
+}
+
+static uint8_t bench_exchange(void *ctx, uint8_t mosi)
+{
+    (void)ctx;
+    return (uint8_t)~mosi;
+}
+
+/** Set a bus up and put the echo device on it */
+static void bench_bus_init(bench_bus_t *bus, USART_t *usart, PORT_t *port, PORT_t *csPort, uint8_t csPin, uint32_t baud)
+{
+    spi_master_hw_init(usart, SPI_MASTER_DEFAULT_BAUD);
+    init_spi_master_service(&bus->master, usart, port, spi_bg_task);
+    spi_bg_add_master(&bus->master);
+
+    bus->cs.csPort = csPort;
+    bus->cs.pinBitMask = csPin;
+    bus->cs.baudCtrl = 0;
+    spi_master_set_cs_baud(&bus->cs, baud);
+    csPort->OUTSET = csPin;
+
+    bus->device.usart = usart;
+    bus->device.csPort = csPort;
+    bus->device.csPin = csPin;
+    bus->device.select = bench_select;
+    bus->device.exchange = bench_exchange;
+    bus->device.deselect = bench_select;
+    bus->device.ctx = bus;
+    sim_attach_device(&bus->device);
+}
+
+/** Check what came back in every receive buffer used */
+static Bool bench_check_recv(uint16_t len)
+{
+    uint16_t slot, i;
+
+    for(slot = 0; slot < SPI_MASTER_QUEUE_DEPTH; slot++)
+    {
+        for(i = 0; i < len; i++)
+        {
+            if(benchRecv[slot][i] != (uint8_t)~benchSend[i])
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/** Run one bus at one transfer size, and print what it did */
+static void bench_run(bench_bus_t *bus, uint16_t len, uint32_t runMs)
+{
+    spi_master_stats_t stats;
+    uint64_t start = sim_now();
+    uint64_t end = start + ((uint64_t)runMs * 1000ULL * SIM_COUNTS_PER_US);
+    uint64_t nextFill = start;
+    uint64_t elapsed;
+    uint8_t slot = 0;
+    double seconds;
+
+    spi_master_reset_stats(&bus->master);
+    memset((void *)benchRecv, 0, sizeof(benchRecv));
+
+    while(sim_now() < end)
+    {
+        if(sim_now() >= nextFill)
+        {
+            while(spi_master_queue_count(&bus->master) < SPI_MASTER_QUEUE_DEPTH)
+            {
+                (void)spi_master_enqueue(&bus->master, &bus->cs, benchSend, len,
+                                         benchRecv[slot], len, &benchComplete[slot]);
+                slot = (slot + 1) % SPI_MASTER_QUEUE_DEPTH;
+            }
+            nextFill += BENCH_SPI_TASK_COUNTS;
+        }
+        spi_bg_task();
+    }
+    while(bus->master.masterBusy || (spi_master_queue_count(&bus->master) != 0))
+    {
+        spi_bg_task();
+    }
+
+    elapsed = sim_now() - start;
+    seconds = (double)elapsed / (1000000.0 * SIM_COUNTS_PER_US);
+    spi_master_get_stats(&bus->master, &stats);
+
+    printf("%-6s %5u %5u %10.0f %12.2f %12.3f %6.1f%%\n",
+           bus->name, (unsigned)SPI_MASTER_QUEUE_DEPTH, len,
+           (double)stats.bytes / seconds,
+           (double)stats.setupCounts / SIM_COUNTS_PER_US / max(stats.requests, 1),
+           (double)stats.isrCounts / SIM_COUNTS_PER_US / max(stats.bytes, 1),
+           100.0 * (double)stats.busyCounts / (double)elapsed);
+
+    bench_expect(stats.requests > 0, "requests went out");
+    bench_expect(stats.queueFull == 0, "task never overfilled the queue");
+    bench_expect(bench_check_recv(len), "every byte came back");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t runMs = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : BENCH_SPI_RUN_MS;
+    bench_bus_t *buses[] = { &benchSensor, &benchFlash, &benchRadio };
+    uint16_t i, j;
+
+    for(i = 0; i < BENCH_SPI_MAX_LEN; i++)
+    {
+        benchSend[i] = (uint8_t)i;
+    }
+
+    /* Same start up as main() */
+    cpu_irq_enable();
+    timer_init();
+    tc_write_clock_source(&TCC0, TC_CLKSEL_DIV1_gc);
+
+    bench_bus_init(&benchSensor, &SENSOR_SPI, &SENSOR_SPI_PORT, &ALTIMETER_PORT, ALTIMETER_CS, ALTIMETER_SPI_BAUD);
+    spi_master_enable_dma(&benchSensor.master,
+                          SENSOR_SPI_DMA_RX, SENSOR_SPI_DMA_RX_TRIG,
+                          SENSOR_SPI_DMA_TX, SENSOR_SPI_DMA_TX_TRIG);
+    bench_bus_init(&benchFlash, &FLASH_SPI, &FLASH_PORT, &FLASH_PORT, FLASH_CS, FLASH_SPI_BAUD);
+    spi_master_enable_dma(&benchFlash.master,
+                          FLASH_SPI_DMA_RX, FLASH_SPI_DMA_RX_TRIG,
+                          FLASH_SPI_DMA_TX, FLASH_SPI_DMA_TX_TRIG);
+    bench_bus_init(&benchRadio, &RADIO_SPI, &RADIO_SPI_PORT, &RADIO_GPIO_PORT, RADIO_CS, 0);
+
+    printf("%-6s %5s %5s %10s %12s %12s %7s\n", "bus", "depth", "size", "bytes/s", "setup us/req", "isr us/byte", "busy");
+    for(i = 0; i < (sizeof(buses) / sizeof(buses[0])); i++)
+    {
+        for(j = 0; j < BENCH_SPI_NUM_SIZES; j++)
+        {
+            bench_run(buses[i], benchSizes[j], runMs);
+        }
+    }
+
+    printf("%s\n", (benchFailures == 0) ? "PASS" : "FAILED");
+    return (benchFailures == 0) ? 0 : 1;
+}
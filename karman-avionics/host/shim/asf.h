@@ -0,0 +1,410 @@
+/**
+ * @file asf.h
+ *
+ * @brief Host stand-in for the ASF include file
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ *
+ * Declares the registers and the slice of the ASF drivers the firmware uses,
+ * backed by the simulated hardware in host/sim. Ports, USARTs and TCC0 are
+ * plain structs. The firmware writes OUTSET, OUTCLR and DATA the same as on
+ * the part, and the simulation picks the writes up the next time the
+ * firmware reads the timer, touches the DMA or the interrupt flag. Reading
+ * TCC0 and turning interrupts on or off both cost a little virtual time, so
+ * busy waits make progress.
+ */
+
+
+#ifndef ASF_H_
+#define ASF_H_
+
+#include <compiler.h>
+#include <board.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+/*                               Interrupts                                  */
+/*****************************************************************************/
+
+/** Saved global interrupt enable */
+typedef uint8_t irqflags_t;
+
+/** Interrupt handler. Vector names below turn it into a plain function. */
+#define ISR(vect) void vect(void)
+
+#define USARTC1_RXC_vect sim_isr_usartc1_rxc  /**< Flash SPI receive complete */
+#define USARTD0_RXC_vect sim_isr_usartd0_rxc  /**< Sensor SPI receive complete */
+#define USARTE1_RXC_vect sim_isr_usarte1_rxc  /**< Radio SPI receive complete */
+#define PORTC_INT0_vect  sim_isr_portc_int0   /**< Port C interrupt 0 */
+#define PORTD_INT0_vect  sim_isr_portd_int0   /**< Port D interrupt 0 */
+#define PORTE_INT0_vect  sim_isr_porte_int0   /**< Port E interrupt 0 */
+#define PORTE_INT1_vect  sim_isr_porte_int1   /**< Port E interrupt 1 */
+#define PORTF_INT0_vect  sim_isr_portf_int0   /**< Port F interrupt 0 */
+
+void cpu_irq_enable(void);
+void cpu_irq_disable(void);
+irqflags_t cpu_irq_save(void);
+void cpu_irq_restore(irqflags_t flags);
+
+/** Nothing to set up, every level is always on */
+static inline void pmic_init(void)
+{
+}
+
+/*****************************************************************************/
+/*                           Clocks and sleep                                */
+/*****************************************************************************/
+
+/** Peripheral clock, the same 32MHz as conf_clock.h */
+#define SIM_PER_HZ (32000000UL)
+
+static inline void sysclk_init(void)
+{
+}
+
+static inline uint32_t sysclk_get_per_hz(void)
+{
+    return SIM_PER_HZ;
+}
+
+static inline void sysclk_enable_peripheral_clock(volatile void *module)
+{
+    (void)module;
+}
+
+/** Sleep modes the scheduler asks for */
+enum sleepmgr_mode
+{
+    SLEEPMGR_ACTIVE = 0,
+    SLEEPMGR_IDLE,
+};
+
+static inline void sleepmgr_init(void)
+{
+}
+
+static inline void sleepmgr_lock_mode(enum sleepmgr_mode mode)
+{
+    (void)mode;
+}
+
+/* Turns interrupts on and skips ahead to the next one */
+void sleepmgr_enter_sleep(void);
+
+/*****************************************************************************/
+/*                                 Ports                                     */
+/*****************************************************************************/
+
+/** I/O port registers */
+typedef struct
+{
+    uint8_t DIR;        /**< Direction */
+    uint8_t DIRSET;     /**< Set direction bits */
+    uint8_t DIRCLR;     /**< Clear direction bits */
+    uint8_t OUT;        /**< Output value */
+    uint8_t OUTSET;     /**< Set output bits */
+    uint8_t OUTCLR;     /**< Clear output bits */
+    uint8_t IN;         /**< Input value */
+    uint8_t INTCTRL;    /**< Interrupt levels */
+    uint8_t INT0MASK;   /**< Pins on interrupt 0 */
+    uint8_t INT1MASK;   /**< Pins on interrupt 1 */
+    uint8_t INTFLAGS;   /**< Interrupt flags */
+    uint8_t PIN0CTRL;   /**< Pin 0 configuration */
+    uint8_t PIN1CTRL;   /**< Pin 1 configuration */
+    uint8_t PIN2CTRL;   /**< Pin 2 configuration */
+    uint8_t PIN3CTRL;   /**< Pin 3 configuration */
+    uint8_t PIN4CTRL;   /**< Pin 4 configuration */
+    uint8_t PIN5CTRL;   /**< Pin 5 configuration */
+    uint8_t PIN6CTRL;   /**< Pin 6 configuration */
+    uint8_t PIN7CTRL;   /**< Pin 7 configuration */
+} PORT_t;
+
+/** Number of simulated ports, A to F */
+#define SIM_NUM_PORTS (6)
+
+extern PORT_t simPorts[SIM_NUM_PORTS];
+
+#define PORTA (simPorts[0]) /**< Port A */
+#define PORTB (simPorts[1]) /**< Port B */
+#define PORTC (simPorts[2]) /**< Port C */
+#define PORTD (simPorts[3]) /**< Port D */
+#define PORTE (simPorts[4]) /**< Port E */
+#define PORTF (simPorts[5]) /**< Port F */
+
+#define PORT_ISC_RISING_gc  (0x01) /**< Sense rising edge */
+#define PORT_ISC_FALLING_gc (0x02) /**< Sense falling edge */
+
+/*****************************************************************************/
+/*                                 USARTs                                    */
+/*****************************************************************************/
+
+/**
+ * USART registers. DATA is wider than on the part: the simulation sets
+ * bit 8 on what it puts there, so a byte written by the firmware, which
+ * never has it, shows up as a new byte to send.
+ */
+typedef struct
+{
+    uint16_t DATA;      /**< Data, see above */
+    uint8_t STATUS;     /**< Status */
+    uint8_t CTRLA;      /**< Interrupt levels */
+    uint8_t CTRLB;      /**< Receiver and transmitter enables */
+    uint8_t CTRLC;      /**< Mode */
+    uint8_t BAUDCTRLA;  /**< Low 8 bits of BSEL */
+    uint8_t BAUDCTRLB;  /**< BSCALE and high 4 bits of BSEL */
+} USART_t;
+
+/** Number of simulated USARTs */
+#define SIM_NUM_USARTS (3)
+
+extern USART_t simUsarts[SIM_NUM_USARTS];
+
+#define USARTC1 (simUsarts[0]) /**< Flash memory SPI */
+#define USARTD0 (simUsarts[1]) /**< Sensor SPI */
+#define USARTE1 (simUsarts[2]) /**< Radio SPI */
+
+#define USART_RXCINTLVL_gm (0x30) /**< Receive complete interrupt level */
+
+/*****************************************************************************/
+/*                                  DMA                                      */
+/*****************************************************************************/
+
+#define DMA_NUMBER_OF_CHANNELS (4) /**< Channels on the XMEGA A3U */
+
+typedef uint8_t dma_channel_num_t;
+
+/** Trigger sources of the simulated USARTs */
+typedef enum
+{
+    DMA_CH_TRIGSRC_OFF_gc = 0x00,
+    DMA_CH_TRIGSRC_USARTC1_RXC_gc = 0x4E,
+    DMA_CH_TRIGSRC_USARTC1_DRE_gc = 0x4F,
+    DMA_CH_TRIGSRC_USARTD0_RXC_gc = 0x6B,
+    DMA_CH_TRIGSRC_USARTD0_DRE_gc = 0x6C,
+    DMA_CH_TRIGSRC_USARTE1_RXC_gc = 0x8E,
+    DMA_CH_TRIGSRC_USARTE1_DRE_gc = 0x8F,
+} DMA_CH_TRIGSRC_t;
+
+typedef enum
+{
+    DMA_CH_SRCDIR_FIXED_gc = 0x00,
+    DMA_CH_SRCDIR_INC_gc = 0x10,
+} DMA_CH_SRCDIR_t;
+
+typedef enum
+{
+    DMA_CH_DESTDIR_FIXED_gc = 0x00,
+    DMA_CH_DESTDIR_INC_gc = 0x01,
+} DMA_CH_DESTDIR_t;
+
+#define DMA_CH_BURSTLEN_1BYTE_gc  (0x00)
+#define DMA_CH_SRCRELOAD_NONE_gc  (0x00)
+#define DMA_CH_DESTRELOAD_NONE_gc (0x00)
+#define DMA_PRIMODE_CH0123_gc     (0x03)
+#define DMA_CH_TRNIF_bm           (0x10)
+#define DMA_CH_ERRIF_bm           (0x20)
+
+enum dma_channel_status
+{
+    DMA_CH_FREE = 0,
+    DMA_CH_BUSY,
+    DMA_CH_PENDING,
+    DMA_CH_TRANSFER_COMPLETED,
+    DMA_CH_TRANSFER_ERROR,
+};
+
+enum dma_int_level_t
+{
+    DMA_INT_LVL_OFF = 0x00,
+    DMA_INT_LVL_LO = 0x01,
+    DMA_INT_LVL_MED = 0x02,
+    DMA_INT_LVL_HI = 0x03,
+};
+
+typedef void (*dma_callback_t)(enum dma_channel_status status);
+
+/** Channel configuration, filled in by the setters then written all at once */
+struct dma_channel_config
+{
+    uint8_t ctrla;          /**< Single shot, burst length */
+    uint8_t ctrlb;          /**< Interrupt level and flags */
+    uint8_t addrctrl;       /**< Address directions */
+    uint8_t trigsrc;        /**< Trigger source */
+    uint16_t trfcnt;        /**< Bytes to move */
+    uint16_t srcaddr;       /**< Source, see SPI_DMA_ADDR */
+    uint16_t destaddr;      /**< Destination, see SPI_DMA_ADDR */
+};
+
+/**
+ * Host pointers don't fit the 16 bit DMA address registers, so buffers are
+ * handed to the DMA as a handle into a table of pointers instead.
+ */
+#define SPI_DMA_ADDR(ptr) sim_dma_addr((const volatile void *)(ptr))
+uint16_t sim_dma_addr(const volatile void *ptr);
+
+void dma_enable(void);
+void dma_set_priority_mode(uint8_t mode);
+void dma_set_callback(dma_channel_num_t num, dma_callback_t callback);
+void dma_channel_write_config(dma_channel_num_t num, struct dma_channel_config *config);
+void dma_channel_enable(dma_channel_num_t num);
+void dma_channel_disable(dma_channel_num_t num);
+
+static inline void dma_channel_set_burst_length(struct dma_channel_config *config, uint8_t burstLen)
+{
+    config->ctrla = (config->ctrla & ~0x03) | burstLen;
+}
+
+static inline void dma_channel_set_single_shot(struct dma_channel_config *config)
+{
+    config->ctrla |= 0x04;
+}
+
+static inline void dma_channel_set_trigger_source(struct dma_channel_config *config, DMA_CH_TRIGSRC_t source)
+{
+    config->trigsrc = (uint8_t)source;
+}
+
+static inline void dma_channel_set_src_reload_mode(struct dma_channel_config *config, uint8_t mode)
+{
+    (void)config;
+    (void)mode;
+}
+
+static inline void dma_channel_set_dest_reload_mode(struct dma_channel_config *config, uint8_t mode)
+{
+    (void)config;
+    (void)mode;
+}
+
+static inline void dma_channel_set_src_dir_mode(struct dma_channel_config *config, DMA_CH_SRCDIR_t mode)
+{
+    config->addrctrl = (config->addrctrl & ~0x30) | (uint8_t)mode;
+}
+
+static inline void dma_channel_set_dest_dir_mode(struct dma_channel_config *config, DMA_CH_DESTDIR_t mode)
+{
+    config->addrctrl = (config->addrctrl & ~0x03) | (uint8_t)mode;
+}
+
+static inline void dma_channel_set_source_address(struct dma_channel_config *config, uint16_t source)
+{
+    config->srcaddr = source;
+}
+
+static inline void dma_channel_set_destination_address(struct dma_channel_config *config, uint16_t destination)
+{
+    config->destaddr = destination;
+}
+
+static inline void dma_channel_set_transfer_count(struct dma_channel_config *config, uint16_t count)
+{
+    config->trfcnt = count;
+}
+
+static inline void dma_channel_set_interrupt_level(struct dma_channel_config *config, enum dma_int_level_t level)
+{
+    config->ctrlb = (config->ctrlb & ~0x03) | (uint8_t)level;
+}
+
+/*****************************************************************************/
+/*                              Timer/Counter                                */
+/*****************************************************************************/
+
+/** Timer/counter 0 registers */
+typedef struct
+{
+    uint8_t CTRLA;      /**< Clock select */
+    uint8_t CTRLB;      /**< Compare enables and waveform mode */
+    uint8_t INTCTRLA;   /**< Overflow interrupt level */
+    uint8_t INTCTRLB;   /**< Compare interrupt levels */
+    uint8_t INTFLAGS;   /**< Interrupt flags */
+    uint16_t CNT;       /**< Count */
+    uint16_t PER;       /**< Period */
+    uint16_t CCA;       /**< Compare A */
+} TC0_t;
+
+/* Brings TCC0 up to the virtual time, then hands it out */
+TC0_t *sim_tcc0(void);
+
+#define TCC0 (*sim_tcc0()) /**< Scheduler timer */
+
+#define TC0_OVFIF_bm (0x01) /**< Overflow interrupt flag */
+#define TC0_CCAIF_bm (0x10) /**< Compare A interrupt flag */
+
+typedef void (*tc_callback_t)(void);
+
+enum tc_clock_sel
+{
+    TC_CLKSEL_OFF_gc = 0x00,
+    TC_CLKSEL_DIV1_gc = 0x01,
+};
+
+enum tc_wg_mode_t
+{
+    TC_WG_NORMAL = 0x00,
+};
+
+enum tc_int_level_t
+{
+    TC_INT_LVL_OFF = 0x00,
+    TC_INT_LVL_LO = 0x01,
+    TC_INT_LVL_MED = 0x02,
+    TC_INT_LVL_HI = 0x03,
+};
+
+enum tc_cc_channel_t
+{
+    TC_CCA = 1,
+};
+
+enum tc_cc_channel_mask_enable_t
+{
+    TC_CCAEN = 0x10,
+};
+
+void tc_enable(volatile void *tc);
+void tc_set_overflow_interrupt_callback(volatile void *tc, tc_callback_t callback);
+void tc_set_cca_interrupt_callback(volatile void *tc, tc_callback_t callback);
+
+static inline void tc_set_wgm(volatile void *tc, enum tc_wg_mode_t wgm)
+{
+    ((TC0_t *)tc)->CTRLB = (((TC0_t *)tc)->CTRLB & ~0x07) | wgm;
+}
+
+static inline void tc_write_period(volatile void *tc, uint16_t per_value)
+{
+    ((TC0_t *)tc)->PER = per_value;
+}
+
+static inline void tc_enable_cc_channels(volatile void *tc, enum tc_cc_channel_mask_enable_t enable)
+{
+    ((TC0_t *)tc)->CTRLB |= enable;
+}
+
+static inline void tc_set_overflow_interrupt_level(volatile void *tc, enum tc_int_level_t level)
+{
+    ((TC0_t *)tc)->INTCTRLA = (((TC0_t *)tc)->INTCTRLA & ~0x03) | level;
+}
+
+static inline void tc_set_cca_interrupt_level(volatile void *tc, enum tc_int_level_t level)
+{
+    ((TC0_t *)tc)->INTCTRLB = (((TC0_t *)tc)->INTCTRLB & ~0x03) | level;
+}
+
+static inline void tc_write_cc(volatile void *tc, enum tc_cc_channel_t channel, uint16_t value)
+{
+    (void)channel;
+    ((TC0_t *)tc)->CCA = value;
+}
+
+static inline void tc_clear_cc_interrupt(volatile void *tc, enum tc_cc_channel_t channel)
+{
+    (void)channel;
+    ((TC0_t *)tc)->INTFLAGS &= ~TC0_CCAIF_bm;
+}
+
+/* Starts the count, it doesn't move before this */
+void tc_write_clock_source(volatile void *tc, enum tc_clock_sel clock_sel);
+
+#endif /* ASF_H_ */
@@ -0,0 +1,19 @@
+/**
+ * @file board.h
+ *
+ * @brief Host stand-in for the ASF board.h
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ */
+
+
+#ifndef BOARD_H_
+#define BOARD_H_
+
+#include <compiler.h>
+#include <conf_board.h>
+
+/* Sets up the pins and the drivers, see ASF/common/boards/user_board/init.c */
+void board_init(void);
+
+#endif /* BOARD_H_ */
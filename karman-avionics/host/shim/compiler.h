@@ -0,0 +1,38 @@
+/**
+ * @file compiler.h
+ *
+ * @brief Host stand-in for the ASF compiler.h
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ *
+ * Only what the firmware outside of ASF uses: the ASF types, min/max,
+ * barrier and the program memory macros. Flash tables are plain const
+ * arrays on the host.
+ */
+
+
+#ifndef COMPILER_H_
+#define COMPILER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef unsigned char Bool; /**< Boolean, one byte like on the AVR */
+
+#define Min(a, b) (((a) < (b)) ? (a) : (b)) /**< Smaller of a and b */
+#define min(a, b) Min(a, b)                 /**< Smaller of a and b */
+#define Max(a, b) (((a) > (b)) ? (a) : (b)) /**< Larger of a and b */
+#define max(a, b) Max(a, b)                 /**< Larger of a and b */
+
+/** Keep the compiler from moving memory accesses across this point */
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+/** Constant table. There is one address space on the host. */
+#define PROGMEM_DECLARE(type, name) const type name
+/** Read a 16 bit word from a constant table */
+#define PROGMEM_READ_WORD(x) (*(x))
+/** Read a 32 bit word from a constant table */
+#define pgm_read_dword(x) (*(const uint32_t *)(x))
+
+#endif /* COMPILER_H_ */
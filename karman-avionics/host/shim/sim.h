@@ -0,0 +1,57 @@
+/**
+ * @file sim.h
+ *
+ * @brief Simulated hardware for the host build
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ *
+ * Virtual time is kept in counts of the 32MHz timer clock. It only moves
+ * when the firmware reads TCC0, turns interrupts on or off, or sleeps, so
+ * a run is the same every time no matter how fast the host is.
+ * Devices hang off a USART and a chip select pin. Each byte clocked on
+ * the bus goes to the device whose chip select is low, and its answer comes
+ * back.
+ */
+
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <asf.h>
+
+/** Virtual time per microsecond */
+#define SIM_COUNTS_PER_US (32)
+
+/** Virtual time an interrupt or timer access costs the firmware */
+#define SIM_ACCESS_COUNTS (8)
+
+/** A device on a simulated SPI bus */
+typedef struct sim_spi_device_s
+{
+    USART_t *usart;                         /**< Bus the device is on */
+    PORT_t *csPort;                         /**< Port of its chip select */
+    uint8_t csPin;                          /**< Chip select pin mask */
+    void (*select)(void *ctx);              /**< Chip select went low */
+    uint8_t (*exchange)(void *ctx, uint8_t mosi); /**< One byte each way */
+    void (*deselect)(void *ctx);            /**< Chip select went high */
+    void *ctx;                              /**< Passed to the functions above */
+    Bool selected;                          /**< Chip select is low */
+    struct sim_spi_device_s *next;          /**< Next device, any bus */
+} sim_spi_device_t;
+
+/* Put a device on a bus. The device struct must stay around. */
+void sim_attach_device(sim_spi_device_t *device);
+
+/* Virtual time since start up, in 32MHz counts */
+uint64_t sim_now(void);
+
+/* Move virtual time ahead, taking interrupts if they are on */
+void sim_advance(uint64_t counts);
+
+/* Stop the run the first time virtual time reaches this, and call done */
+void sim_set_end(uint64_t counts, void (*done)(void));
+
+/* Bytes clocked on a USART since start up */
+uint32_t sim_bus_bytes(USART_t *usart);
+
+#endif /* SIM_H_ */
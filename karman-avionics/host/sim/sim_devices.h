@@ -0,0 +1,74 @@
+/**
+ * @file sim_devices.h
+ *
+ * @brief Simulated devices on the host build's SPI buses
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ */
+
+
+#ifndef SIM_DEVICES_H_
+#define SIM_DEVICES_H_
+
+#include "sim.h"
+
+/** Things the altimeter saw the driver do */
+typedef struct
+{
+    uint32_t conversions;   /**< ADC reads of a finished conversion */
+    uint32_t early_reads;   /**< ADC reads before the conversion was done, read as 0 */
+    uint32_t busy_cmds;     /**< Conversions started on top of one in progress */
+} sim_ms5607_stats_t;
+
+/** Simulated MS5607-02BA03 */
+typedef struct
+{
+    sim_spi_device_t device;            /**< On the sensor bus */
+    uint16_t prom[8];                   /**< Factory data, C1 to C6, CRC */
+    int32_t (*pressure_at)(uint64_t when); /**< Pressure in pascals */
+    int32_t (*temp_at)(uint64_t when);  /**< Temperature in hundredths of a degree C */
+    uint8_t cmd;                        /**< Command of this transaction */
+    uint8_t index;                      /**< Bytes into this transaction */
+    Bool converting;                    /**< A conversion was started and not read */
+    Bool conv_temp;                     /**< It's D2 */
+    uint64_t conv_end;                  /**< When it's done */
+    uint32_t result;                    /**< What the ADC read clocks out */
+    sim_ms5607_stats_t stats;           /**< See above */
+} sim_ms5607_t;
+
+/* Put a simulated altimeter on the sensor bus */
+void sim_ms5607_attach(sim_ms5607_t *sensor,
+                       int32_t (*pressure_at)(uint64_t when),
+                       int32_t (*temp_at)(uint64_t when));
+
+/** Things the flash memory saw the driver do */
+typedef struct
+{
+    uint32_t programs;      /**< Page programs */
+    uint32_t erases;        /**< Subsector and sector erases */
+    uint32_t busy_cmds;     /**< Commands other than read status while busy, ignored */
+    uint32_t no_wren;       /**< Programs and erases without write enable, ignored */
+    uint32_t unerased;      /**< Page programs that needed a 0 bit to go back to 1 */
+} sim_n25q_stats_t;
+
+/** Simulated N25Q flash memory */
+typedef struct
+{
+    sim_spi_device_t device;    /**< On the flash bus */
+    uint8_t *mem;               /**< Contents, EXTFLASH_SIZE bytes */
+    uint8_t page[256];          /**< Data of the page program in progress */
+    uint8_t cmd;                /**< Command of this transaction */
+    uint16_t index;             /**< Bytes into this transaction */
+    uint32_t addr;              /**< Address clocked in */
+    uint16_t data_len;          /**< Data bytes after the address */
+    Bool ignored;               /**< Command came while busy */
+    Bool wel;                   /**< Write enable latch */
+    Bool addr4;                 /**< 4 byte address mode */
+    uint64_t busy_end;          /**< When the program or erase is done */
+    sim_n25q_stats_t stats;     /**< See above */
+} sim_n25q_t;
+
+/* Put a simulated flash memory on the flash bus, erased */
+void sim_n25q_attach(sim_n25q_t *flash);
+
+#endif /* SIM_DEVICES_H_ */
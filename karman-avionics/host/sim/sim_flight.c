@@ -0,0 +1,218 @@
+/**
+ * @file sim_flight.c
+ *
+ * @brief Run the firmware through a simulated flight on the host
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ *
+ * Starts the real main() with a simulated altimeter and flash memory, and
+ * lets the scheduler run for a number of virtual seconds. The altimeter sees
+ * a pad, a climb and a descent. At the end the log on the simulated flash is
+ * read back and checked: every entry has a good CRC, timestamps go up, and
+ * the pressure is what the altimeter was asked to measure at that time.
+ * Every sector the log reached must be marked erased in the erase map, and
+ * entries may only be dropped while a sector is erased in flight.
+ *
+ * Usage: karman_sim [seconds]
+ */
+
+#include "sim_devices.h"
+#include "FlashMem.h"
+#include "Crc.h"
+#include "Tasks.h"
+#include "Scheduler.h"
+#include "n25q_512.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Default length of the run, virtual seconds. Long enough for the log to cross two sectors. */
+#define SIM_FLIGHT_SECONDS (150)
+/** Time on the pad, then climbing, in microseconds. Descends after. The pad
+ * outlasts init, which erases FLASHMEM_PREERASE_SECTORS sectors at 0.7s each. */
+#define SIM_FLIGHT_PAD_US   (8000000LL)
+#define SIM_FLIGHT_CLIMB_US (11000000LL)
+/** Pressure on the pad, and its rate of change in Pa per second climbing and descending */
+#define SIM_FLIGHT_GROUND_PA  (101325)
+#define SIM_FLIGHT_CLIMB_PA_S (-1200)
+#define SIM_FLIGHT_DESC_PA_S  (30)
+/** Pressure an entry may be off by: a conversion and the few ticks until it's read, at the climb rate */
+#define SIM_FLIGHT_PA_SLACK   (20)
+/** Temperature, hundredths of a degree C */
+#define SIM_FLIGHT_TEMP (2500)
+/** Where the log and the erase map are on the flash, see FlashMem.c */
+#define SIM_FLIGHT_LOG_ADDR (EXTFLASH_SECTOR_SIZE)
+#define SIM_FLIGHT_MAP_ADDR (0x100)
+/** Entries one sector erase in flight may cost: 0.7s of samples, less what the page buffers hold */
+#define SIM_FLIGHT_DROPS_PER_ERASE (24)
+
+/* The firmware's main(), renamed by the build */
+int firmware_main(void);
+
+static sim_ms5607_t simAltimeter;
+static sim_n25q_t simFlash;
+
+/** Pressure of the flight profile at a virtual time */
+static int32_t sim_flight_pressure(uint64_t when)
+{
+    int64_t us = (int64_t)(when / SIM_COUNTS_PER_US);
+    int64_t pressure = SIM_FLIGHT_GROUND_PA;
+
+    if(us > SIM_FLIGHT_PAD_US)
+    {
+        pressure += (SIM_FLIGHT_CLIMB_PA_S * (min(us, SIM_FLIGHT_CLIMB_US) - SIM_FLIGHT_PAD_US)) / 1000000LL;
+    }
+    if(us > SIM_FLIGHT_CLIMB_US)
+    {
+        pressure += (SIM_FLIGHT_DESC_PA_S * (us - SIM_FLIGHT_CLIMB_US)) / 1000000LL;
+    }
+    return (int32_t)pressure;
+}
+
+static int32_t sim_flight_temp(uint64_t when)
+{
+    (void)when;
+    return SIM_FLIGHT_TEMP;
+}
+
+/** Count a failed check */
+static uint32_t simFailures = 0;
+
+static void sim_flight_expect(Bool ok, const char *what)
+{
+    if(!ok)
+    {
+        simFailures++;
+        printf("FAIL: %s\n", what);
+    }
+}
+
+/**
+ * @brief Read the log back off the simulated flash and check it
+ *
+ * @return Number of entries
+ */
+static uint32_t sim_flight_check_log(void)
+{
+    const flash_data_hdr_t *header = (const flash_data_hdr_t *)simFlash.mem;
+    flash_data_entry_t entry;
+    uint32_t addr = SIM_FLIGHT_LOG_ADDR;
+    uint32_t count = 0;
+    uint32_t badCrc = 0, badTime = 0, badPress = 0, badTemp = 0;
+    uint64_t lastTime = 0;
+    int32_t expected;
+
+    sim_flight_expect(header->magic == MAGIC_NUMBER, "header magic");
+    sim_flight_expect(strncmp(header->version_str, VERSION_STRING, VERSION_SIZE) == 0, "header version");
+    sim_flight_expect(header->entry_size == sizeof(flash_data_entry_t), "header entry size");
+
+    for(;;)
+    {
+        memcpy(&entry, &simFlash.mem[addr], sizeof(entry));
+        if(entry.timestamp == 0xFFFFFFFFFFFFFFFFULL)
+        {
+            break;
+        }
+        count++;
+        if(entry.chksum != crc16_update(CRC16_INIT, (const uint8_t *)&entry, offsetof(flash_data_entry_t, chksum)))
+        {
+            badCrc++;
+        }
+        if(entry.timestamp <= lastTime)
+        {
+            badTime++;
+        }
+        lastTime = entry.timestamp;
+        expected = sim_flight_pressure(entry.timestamp * SIM_COUNTS_PER_US);
+        if(abs(entry.data.altimeter.pressure - expected) > SIM_FLIGHT_PA_SLACK)
+        {
+            badPress++;
+        }
+        if(abs(entry.data.altimeter.temp - SIM_FLIGHT_TEMP) > 1)
+        {
+            badTemp++;
+        }
+        addr += sizeof(entry);
+    }
+
+    printf("log: %u entries, last at %llu us, %u dropped\n", count, (unsigned long long)lastTime, gFlashmemCtrl.dropped);
+    sim_flight_expect(badCrc == 0, "entry CRCs");
+    sim_flight_expect(badTime == 0, "timestamps go up");
+    sim_flight_expect(badPress == 0, "pressure matches the flight");
+    sim_flight_expect(badTemp == 0, "temperature matches the flight");
+    return count;
+}
+
+/**
+ * @brief Check the erase map covers the log
+ *
+ * @param entries Entries on the flash
+ * @return Number of sectors the log was in that were erased in flight
+ */
+static uint32_t sim_flight_check_map(uint32_t entries)
+{
+    uint32_t lastSector = (SIM_FLIGHT_LOG_ADDR + (gFlashmemCtrl.num_entries * sizeof(flash_data_entry_t))) / EXTFLASH_SECTOR_SIZE;
+    uint32_t sector;
+    uint32_t unmarked = 0;
+
+    for(sector = 1; sector <= lastSector; sector++)
+    {
+        unmarked += (simFlash.mem[SIM_FLIGHT_MAP_ADDR + sector] != 0x00) ? 1 : 0;
+    }
+
+    printf("erase map: log in sectors 1 to %u, %u not marked erased\n", lastSector, unmarked);
+    sim_flight_expect(lastSector >= 3, "log crosses two sectors");
+    sim_flight_expect(unmarked == 0, "every log sector marked erased");
+    sim_flight_expect(entries <= gFlashmemCtrl.num_entries, "log isn't longer than what was written");
+    sim_flight_expect((gFlashmemCtrl.num_entries - entries) <= ((FLASHMEM_NUM_PAGE_BUFS * FLASHMEM_PAGE_SIZE) / sizeof(flash_data_entry_t)),
+                      "only the page buffers are missing from the log");
+
+    return (lastSector > FLASHMEM_PREERASE_SECTORS) ? (lastSector - FLASHMEM_PREERASE_SECTORS) : 0;
+}
+
+/** Called by the simulation when the run is over */
+static void sim_flight_done(void)
+{
+    simple_task_t *tasks = get_task_list();
+    uint8_t numTasks = get_num_tasks();
+    uint8_t i;
+    uint32_t entries = sim_flight_check_log();
+    uint32_t flightErases = sim_flight_check_map(entries);
+
+    printf("altimeter: %u conversions, %u early reads, %u conversions while busy\n",
+           simAltimeter.stats.conversions, simAltimeter.stats.early_reads, simAltimeter.stats.busy_cmds);
+    printf("flash: %u programs, %u erases, %u commands while busy, %u without write enable, %u over unerased bits\n",
+           simFlash.stats.programs, simFlash.stats.erases, simFlash.stats.busy_cmds,
+           simFlash.stats.no_wren, simFlash.stats.unerased);
+    printf("bus bytes: sensor %u, flash %u\n", sim_bus_bytes(&SENSOR_SPI), sim_bus_bytes(&FLASH_SPI));
+    printf("idle: %u%%\n", scheduler_get_idle_percent());
+    for(i = 0; i < numTasks; i++)
+    {
+        printf("task %u: every %u ticks, %u deadline misses\n", i, tasks[i].taskFreq, tasks[i].deadlineMisses);
+    }
+
+    sim_flight_expect(simAltimeter.stats.early_reads == 0, "no early altimeter reads");
+    sim_flight_expect(simAltimeter.stats.busy_cmds == 0, "no conversions on top of each other");
+    sim_flight_expect(simFlash.stats.busy_cmds == 0, "no flash commands while busy");
+    sim_flight_expect(simFlash.stats.no_wren == 0, "every flash write enabled");
+    sim_flight_expect(simFlash.stats.unerased == 0, "every page erased before it's programmed");
+    /* Half the conversions are pressure, one sample each. The last may not have reached the log task. */
+    sim_flight_expect((gFlashmemCtrl.num_entries + gFlashmemCtrl.dropped + 1) >= (simAltimeter.stats.conversions / 2),
+                      "every sample written or counted as dropped");
+    sim_flight_expect(gFlashmemCtrl.dropped <= (flightErases * SIM_FLIGHT_DROPS_PER_ERASE), "entries only dropped by erases in flight");
+    sim_flight_expect(gFlashmemCtrl.write_errors == 0, "no flash write errors");
+
+    printf("%s\n", (simFailures == 0) ? "PASS" : "FAILED");
+    fflush(stdout);
+    exit((simFailures == 0) ? 0 : 1);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : SIM_FLIGHT_SECONDS;
+
+    sim_ms5607_attach(&simAltimeter, sim_flight_pressure, sim_flight_temp);
+    sim_n25q_attach(&simFlash);
+    sim_set_end((uint64_t)seconds * 1000000ULL * SIM_COUNTS_PER_US, sim_flight_done);
+
+    return firmware_main();
+}
@@ -0,0 +1,661 @@
+/**
+ * @file sim_hw.c
+ *
+ * @brief Simulated ports, USARTs, DMA, TCC0 and interrupts
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ *
+ * Everything happens in sim_advance. It steps virtual time from one event
+ * to the next, a TCC0 overflow or compare match or the end of a byte on a
+ * bus, and takes the interrupts that are pending whenever interrupts are on.
+ * A handler runs with interrupts off, like on the part, so an access it makes
+ * moves time along but can't nest another interrupt.
+ *
+ * A bus clocks a byte when the firmware writes DATA or when a DMA channel
+ * triggered by the USART's DRE has bytes left. The byte takes 8 bit times
+ * at the USART's BAUDCTRL. At the end of it the answer goes to a DMA channel
+ * triggered by RXC if there is one, or else into DATA with the RXC interrupt.
+ */
+
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Most buffers the DMA can be pointed at */
+#define SIM_DMA_MAX_ADDRS (1024)
+
+/** A bus with a byte in flight */
+typedef struct
+{
+    Bool busy;          /**< A byte is being clocked */
+    uint64_t byteEnd;   /**< When it's done */
+    uint8_t mosi;       /**< What's being sent */
+    Bool rxcPending;    /**< Receive complete interrupt pending */
+    uint32_t bytes;     /**< Bytes clocked since start up */
+} sim_bus_t;
+
+/** A DMA channel */
+typedef struct
+{
+    struct dma_channel_config config; /**< Last written configuration */
+    volatile uint8_t *src;            /**< Next byte to read */
+    volatile uint8_t *dest;           /**< Next byte to write */
+    uint16_t count;                   /**< Bytes left */
+    Bool enabled;                     /**< Channel is on */
+    Bool pending;                     /**< Transaction complete interrupt pending */
+    dma_callback_t callback;          /**< Transaction complete handler */
+} sim_dma_channel_t;
+
+PORT_t simPorts[SIM_NUM_PORTS];
+
+USART_t simUsarts[SIM_NUM_USARTS] =
+{
+    { .DATA = 0x100 },
+    { .DATA = 0x100 },
+    { .DATA = 0x100 },
+};
+
+/** Receive complete handlers, weak so a bus whose driver isn't built has none */
+extern void sim_isr_usartc1_rxc(void) __attribute__((weak));
+extern void sim_isr_usartd0_rxc(void) __attribute__((weak));
+extern void sim_isr_usarte1_rxc(void) __attribute__((weak));
+
+/** Receive complete handler of each USART */
+static void (*const simRxcIsr[SIM_NUM_USARTS])(void) =
+{
+    sim_isr_usartc1_rxc,
+    sim_isr_usartd0_rxc,
+    sim_isr_usarte1_rxc,
+};
+
+/** DRE and RXC trigger sources of each USART */
+static const uint8_t simDreTrigger[SIM_NUM_USARTS] =
+{
+    DMA_CH_TRIGSRC_USARTC1_DRE_gc, DMA_CH_TRIGSRC_USARTD0_DRE_gc, DMA_CH_TRIGSRC_USARTE1_DRE_gc,
+};
+static const uint8_t simRxcTrigger[SIM_NUM_USARTS] =
+{
+    DMA_CH_TRIGSRC_USARTC1_RXC_gc, DMA_CH_TRIGSRC_USARTD0_RXC_gc, DMA_CH_TRIGSRC_USARTE1_RXC_gc,
+};
+
+static uint64_t simClock = 0;
+static Bool simIrqOn = false;
+static uint64_t simEnd = 0;
+static void (*simDone)(void) = NULL;
+
+static sim_bus_t simBus[SIM_NUM_USARTS];
+static sim_dma_channel_t simDma[DMA_NUMBER_OF_CHANNELS];
+static const volatile void *simDmaAddrs[SIM_DMA_MAX_ADDRS];
+static uint16_t simDmaNumAddrs = 0;
+
+static TC0_t simTcc0;
+static Bool simTcRunning = false;
+static uint64_t simTcPeriodStart = 0;
+static tc_callback_t simTcOvfCallback = NULL;
+static tc_callback_t simTcCcaCallback = NULL;
+
+static sim_spi_device_t *simDevices = NULL;
+
+static void sim_deliver(void);
+
+/** Fail the run on something the simulation can't go on from */
+static void sim_fatal(const char *what)
+{
+    fprintf(stderr, "sim: %s at %llu us\n", what, (unsigned long long)(simClock / SIM_COUNTS_PER_US));
+    exit(2);
+}
+
+/*****************************************************************************/
+/*                                 Ports                                     */
+/*****************************************************************************/
+
+/**
+ * @brief Apply the SET and CLR writes since the last sync, and tell devices about chip select edges
+ *
+ * A pin set and cleared since the last sync reads as a pulse high, the order
+ * Spi_service uses between two requests to the same device.
+ */
+static void sim_sync_ports(void)
+{
+    uint8_t i;
+    uint8_t raised[SIM_NUM_PORTS];
+    sim_spi_device_t *device;
+    PORT_t *port;
+
+    for(i = 0; i < SIM_NUM_PORTS; i++)
+    {
+        port = &simPorts[i];
+        port->DIR = (port->DIR | port->DIRSET) & ~port->DIRCLR;
+        port->DIRSET = 0;
+        port->DIRCLR = 0;
+        raised[i] = port->OUTSET;
+        port->OUT = (port->OUT | port->OUTSET) & ~port->OUTCLR;
+        port->OUTSET = 0;
+        port->OUTCLR = 0;
+    }
+
+    for(device = simDevices; device != NULL; device = device->next)
+    {
+        i = (uint8_t)(device->csPort - simPorts);
+        if(device->selected && (raised[i] & device->csPin))
+        {
+            device->selected = false;
+            device->deselect(device->ctx);
+        }
+        if(!device->selected && !(device->csPort->OUT & device->csPin))
+        {
+            device->selected = true;
+            device->select(device->ctx);
+        }
+    }
+}
+
+void sim_attach_device(sim_spi_device_t *device)
+{
+    device->selected = false;
+    device->next = simDevices;
+    simDevices = device;
+}
+
+/*****************************************************************************/
+/*                                  DMA                                      */
+/*****************************************************************************/
+
+uint16_t sim_dma_addr(const volatile void *ptr)
+{
+    uint16_t i;
+
+    for(i = 0; i < simDmaNumAddrs; i++)
+    {
+        if(simDmaAddrs[i] == ptr)
+        {
+            return i + 1;
+        }
+    }
+    if(simDmaNumAddrs == SIM_DMA_MAX_ADDRS)
+    {
+        sim_fatal("too many DMA buffers");
+    }
+    simDmaAddrs[simDmaNumAddrs++] = ptr;
+    return simDmaNumAddrs;
+}
+
+/** Pointer a DMA address handle stands for */
+static volatile uint8_t *sim_dma_ptr(uint16_t addr)
+{
+    if((addr == 0) || (addr > simDmaNumAddrs))
+    {
+        sim_fatal("DMA address was never handed out");
+    }
+    return (volatile uint8_t *)simDmaAddrs[addr - 1];
+}
+
+void dma_enable(void)
+{
+    uint8_t i;
+
+    for(i = 0; i < DMA_NUMBER_OF_CHANNELS; i++)
+    {
+        simDma[i].enabled = false;
+        simDma[i].pending = false;
+    }
+}
+
+void dma_set_priority_mode(uint8_t mode)
+{
+    (void)mode;
+}
+
+void dma_set_callback(dma_channel_num_t num, dma_callback_t callback)
+{
+    simDma[num].callback = callback;
+}
+
+void dma_channel_write_config(dma_channel_num_t num, struct dma_channel_config *config)
+{
+    simDma[num].config = *config;
+    simDma[num].src = sim_dma_ptr(config->srcaddr);
+    simDma[num].dest = sim_dma_ptr(config->destaddr);
+    simDma[num].count = config->trfcnt;
+}
+
+/** Channel triggered by a trigger source, NULL if none is on */
+static sim_dma_channel_t *sim_dma_find(uint8_t trigger)
+{
+    uint8_t i;
+
+    for(i = 0; i < DMA_NUMBER_OF_CHANNELS; i++)
+    {
+        if(simDma[i].enabled && (simDma[i].config.trigsrc == trigger) && (simDma[i].count > 0))
+        {
+            return &simDma[i];
+        }
+    }
+    return NULL;
+}
+
+/** Count a byte moved on a channel, finishing the transaction on the last one */
+static void sim_dma_moved(sim_dma_channel_t *channel)
+{
+    channel->count--;
+    if(channel->count == 0)
+    {
+        channel->enabled = false;
+        if(channel->config.ctrlb & 0x03)
+        {
+            channel->pending = true;
+        }
+    }
+}
+
+static void sim_bus_kick(void);
+
+void dma_channel_enable(dma_channel_num_t num)
+{
+    simDma[num].enabled = true;
+    sim_bus_kick();
+}
+
+void dma_channel_disable(dma_channel_num_t num)
+{
+    simDma[num].enabled = false;
+}
+
+/*****************************************************************************/
+/*                                 USARTs                                    */
+/*****************************************************************************/
+
+/** Virtual time one byte takes on a USART, 8 bits at f_PER / (2 * (BSEL + 1)) */
+static uint64_t sim_byte_counts(USART_t *usart)
+{
+    uint16_t bsel = (uint16_t)(((usart->BAUDCTRLB & 0x0F) << 8) | usart->BAUDCTRLA);
+
+    return 8ULL * 2ULL * (bsel + 1ULL);
+}
+
+/** Start a byte on every idle bus that has one to send */
+static void sim_bus_kick(void)
+{
+    uint8_t i;
+    sim_dma_channel_t *tx;
+    USART_t *usart;
+
+    sim_sync_ports();
+    for(i = 0; i < SIM_NUM_USARTS; i++)
+    {
+        usart = &simUsarts[i];
+        if(simBus[i].busy)
+        {
+            if(!(usart->DATA & 0x100))
+            {
+                sim_fatal("DATA written with a byte in flight");
+            }
+            continue;
+        }
+        if(!(usart->DATA & 0x100))
+        {
+            simBus[i].mosi = (uint8_t)usart->DATA;
+            usart->DATA = 0x100;
+        }
+        else if((tx = sim_dma_find(simDreTrigger[i])) != NULL)
+        {
+            simBus[i].mosi = *(tx->src);
+            if(tx->config.addrctrl & DMA_CH_SRCDIR_INC_gc)
+            {
+                tx->src++;
+            }
+            sim_dma_moved(tx);
+        }
+        else
+        {
+            continue;
+        }
+        simBus[i].busy = true;
+        simBus[i].byteEnd = simClock + sim_byte_counts(usart);
+    }
+}
+
+/** A bus finished its byte. Trade it with the selected device. */
+static void sim_bus_byte_done(uint8_t i)
+{
+    USART_t *usart = &simUsarts[i];
+    sim_spi_device_t *device;
+    sim_dma_channel_t *rx;
+    uint8_t miso = 0xFF;
+
+    simBus[i].busy = false;
+    simBus[i].bytes++;
+    for(device = simDevices; device != NULL; device = device->next)
+    {
+        if((device->usart == usart) && device->selected)
+        {
+            miso = device->exchange(device->ctx, simBus[i].mosi);
+            break;
+        }
+    }
+
+    if((rx = sim_dma_find(simRxcTrigger[i])) != NULL)
+    {
+        *(rx->dest) = miso;
+        if(rx->config.addrctrl & DMA_CH_DESTDIR_INC_gc)
+        {
+            rx->dest++;
+        }
+        sim_dma_moved(rx);
+    }
+    else
+    {
+        usart->DATA = 0x100 | miso;
+        if(usart->CTRLA & USART_RXCINTLVL_gm)
+        {
+            simBus[i].rxcPending = true;
+        }
+    }
+}
+
+uint32_t sim_bus_bytes(USART_t *usart)
+{
+    return simBus[usart - simUsarts].bytes;
+}
+
+/*****************************************************************************/
+/*                              Timer/Counter                                */
+/*****************************************************************************/
+
+void tc_enable(volatile void *tc)
+{
+    (void)tc;
+}
+
+void tc_set_overflow_interrupt_callback(volatile void *tc, tc_callback_t callback)
+{
+    (void)tc;
+    simTcOvfCallback = callback;
+}
+
+void tc_set_cca_interrupt_callback(volatile void *tc, tc_callback_t callback)
+{
+    (void)tc;
+    simTcCcaCallback = callback;
+}
+
+void tc_write_clock_source(volatile void *tc, enum tc_clock_sel clock_sel)
+{
+    (void)tc;
+    simTcc0.CTRLA = (uint8_t)clock_sel;
+    simTcRunning = (clock_sel != TC_CLKSEL_OFF_gc);
+    simTcPeriodStart = simClock;
+}
+
+/** Length of a TCC0 period in counts */
+static uint64_t sim_tc_period(void)
+{
+    return (uint64_t)simTcc0.PER + 1;
+}
+
+/** When TCC0 next matches compare A, or never */
+static uint64_t sim_tc_next_cca(void)
+{
+    uint64_t match = simTcPeriodStart + simTcc0.CCA;
+
+    if(!(simTcc0.CTRLB & TC_CCAEN) || (simTcc0.CCA > simTcc0.PER))
+    {
+        return UINT64_MAX;
+    }
+    if(match <= simClock)
+    {
+        match += sim_tc_period();
+    }
+    return match;
+}
+
+TC0_t *sim_tcc0(void)
+{
+    sim_advance(SIM_ACCESS_COUNTS);
+    simTcc0.CNT = simTcRunning ? (uint16_t)(simClock - simTcPeriodStart) : 0;
+    return &simTcc0;
+}
+
+/*****************************************************************************/
+/*                           Time and interrupts                             */
+/*****************************************************************************/
+
+/** Time of the next thing that happens by itself */
+static uint64_t sim_next_event(void)
+{
+    uint64_t next = UINT64_MAX;
+    uint64_t cca;
+    uint8_t i;
+
+    if(simTcRunning)
+    {
+        next = simTcPeriodStart + sim_tc_period();
+        cca = sim_tc_next_cca();
+        next = min(next, cca);
+    }
+    for(i = 0; i < SIM_NUM_USARTS; i++)
+    {
+        if(simBus[i].busy)
+        {
+            next = min(next, simBus[i].byteEnd);
+        }
+    }
+    return next;
+}
+
+/** Handle everything due at the current time */
+static void sim_process_events(void)
+{
+    uint8_t i;
+
+    if(simTcRunning)
+    {
+        if(simClock >= (simTcPeriodStart + sim_tc_period()))
+        {
+            simTcPeriodStart += sim_tc_period();
+            simTcc0.INTFLAGS |= TC0_OVFIF_bm;
+        }
+        if((simTcc0.CTRLB & TC_CCAEN) && ((simTcPeriodStart + simTcc0.CCA) == simClock))
+        {
+            simTcc0.INTFLAGS |= TC0_CCAIF_bm;
+        }
+    }
+    for(i = 0; i < SIM_NUM_USARTS; i++)
+    {
+        if(simBus[i].busy && (simBus[i].byteEnd <= simClock))
+        {
+            sim_bus_byte_done(i);
+        }
+    }
+    sim_bus_kick();
+}
+
+/** True if an interrupt is waiting to be taken */
+static Bool sim_irq_pending(void)
+{
+    uint8_t i;
+
+    for(i = 0; i < DMA_NUMBER_OF_CHANNELS; i++)
+    {
+        if(simDma[i].pending)
+        {
+            return true;
+        }
+    }
+    if(((simTcc0.INTFLAGS & TC0_OVFIF_bm) && (simTcc0.INTCTRLA & 0x03)) ||
+       ((simTcc0.INTFLAGS & TC0_CCAIF_bm) && (simTcc0.INTCTRLB & 0x03)))
+    {
+        return true;
+    }
+    for(i = 0; i < SIM_NUM_USARTS; i++)
+    {
+        if(simBus[i].rxcPending)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Take one pending interrupt, highest priority first
+ *
+ * Priority is by vector number like on the part: DMA, then TCC0, then the
+ * USARTs. The handler runs with interrupts off and they're back on after.
+ */
+static void sim_take_one(void)
+{
+    uint8_t i;
+
+    simIrqOn = false;
+    for(i = 0; i < DMA_NUMBER_OF_CHANNELS; i++)
+    {
+        if(simDma[i].pending)
+        {
+            simDma[i].pending = false;
+            if(simDma[i].callback != NULL)
+            {
+                simDma[i].callback(DMA_CH_TRANSFER_COMPLETED);
+            }
+            simIrqOn = true;
+            return;
+        }
+    }
+    if((simTcc0.INTFLAGS & TC0_OVFIF_bm) && (simTcc0.INTCTRLA & 0x03))
+    {
+        simTcc0.INTFLAGS &= ~TC0_OVFIF_bm;
+        if(simTcOvfCallback != NULL)
+        {
+            simTcOvfCallback();
+        }
+        simIrqOn = true;
+        return;
+    }
+    if((simTcc0.INTFLAGS & TC0_CCAIF_bm) && (simTcc0.INTCTRLB & 0x03))
+    {
+        simTcc0.INTFLAGS &= ~TC0_CCAIF_bm;
+        if(simTcCcaCallback != NULL)
+        {
+            simTcCcaCallback();
+        }
+        simIrqOn = true;
+        return;
+    }
+    for(i = 0; i < SIM_NUM_USARTS; i++)
+    {
+        if(simBus[i].rxcPending)
+        {
+            simBus[i].rxcPending = false;
+            if(simRxcIsr[i] == NULL)
+            {
+                sim_fatal("receive complete interrupt with no handler");
+            }
+            simRxcIsr[i]();
+            simIrqOn = true;
+            return;
+        }
+    }
+    simIrqOn = true;
+}
+
+/** Take interrupts until none are pending, if they are on */
+static void sim_deliver(void)
+{
+    sim_bus_kick();
+    while(simIrqOn && sim_irq_pending())
+    {
+        sim_take_one();
+    }
+}
+
+/** End the run if its time has come */
+static void sim_check_end(void)
+{
+    void (*done)(void) = simDone;
+
+    if((done != NULL) && (simClock >= simEnd))
+    {
+        simDone = NULL;
+        done();
+        exit(0);
+    }
+}
+
+uint64_t sim_now(void)
+{
+    return simClock;
+}
+
+void sim_advance(uint64_t counts)
+{
+    uint64_t target = simClock + counts;
+    uint64_t next;
+
+    sim_deliver();
+    while(simClock < target)
+    {
+        next = min(sim_next_event(), target);
+        simClock = next;
+        sim_process_events();
+        sim_check_end();
+        sim_deliver();
+    }
+}
+
+void sim_set_end(uint64_t counts, void (*done)(void))
+{
+    simEnd = counts;
+    simDone = done;
+}
+
+void cpu_irq_enable(void)
+{
+    simIrqOn = true;
+    sim_deliver();
+}
+
+void cpu_irq_disable(void)
+{
+    simIrqOn = false;
+}
+
+irqflags_t cpu_irq_save(void)
+{
+    irqflags_t flags = simIrqOn;
+
+    simIrqOn = false;
+    sim_advance(SIM_ACCESS_COUNTS);
+    return flags;
+}
+
+void cpu_irq_restore(irqflags_t flags)
+{
+    simIrqOn = flags;
+    sim_deliver();
+}
+
+/**
+ * @brief Sleep until an interrupt is taken
+ *
+ * Like the sleep manager, turns interrupts on first, then skips ahead
+ * event by event until one of them raises an interrupt.
+ */
+void sleepmgr_enter_sleep(void)
+{
+    uint64_t next;
+
+    simIrqOn = true;
+    sim_bus_kick();
+    while(!sim_irq_pending())
+    {
+        next = sim_next_event();
+        if(next == UINT64_MAX)
+        {
+            sim_fatal("asleep with nothing to wake up");
+        }
+        simClock = max(next, simClock);
+        sim_process_events();
+        sim_check_end();
+    }
+    sim_deliver();
+}
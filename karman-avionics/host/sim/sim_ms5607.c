@@ -0,0 +1,190 @@
+/**
+ * @file sim_ms5607.c
+ *
+ * @brief Simulated MS5607-02BA03 altimeter
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ *
+ * Answers reset, PROM reads, conversions and ADC reads. Conversions take
+ * the datasheet maximum for their OSR, and an ADC read before that returns
+ * 0, like the part. The raw values are worked back from the pressure and
+ * temperature the test asks for with the datasheet's first order formulas,
+ * so the driver's answer can be checked to the pascal.
+ */
+
+#include "sim_devices.h"
+#include "conf_board.h"
+#include <string.h>
+
+/** Commands */
+#define SIM_MS5607_RESET      (0x1E)
+#define SIM_MS5607_ADC_READ   (0x00)
+#define SIM_MS5607_CONVERT_D1 (0x40)
+#define SIM_MS5607_CONVERT_D2 (0x50)
+#define SIM_MS5607_PROM_BASE  (0xA0)
+
+/** Datasheet maximum conversion times, by OSR, in microseconds */
+static const uint32_t simMs5607ConvUs[5] = {600, 1170, 2280, 4540, 9040};
+
+/** Typical coefficients from the datasheet */
+static const uint16_t simMs5607Cal[6] = {46372, 43981, 29059, 27842, 31553, 28165};
+
+/**
+ * @brief CRC-4 of the PROM, from Measurement Specialties AN520
+ *
+ * @param prom All eight words, the CRC nibble is ignored
+ * @return The CRC for the low nibble of the last word
+ */
+static uint16_t sim_ms5607_crc4(const uint16_t *prom)
+{
+    uint16_t remainder = 0;
+    uint16_t word;
+    uint8_t cnt, bit;
+
+    for(cnt = 0; cnt < 16; cnt++)
+    {
+        word = prom[cnt >> 1];
+        if((cnt >> 1) == 7)
+        {
+            word &= 0xFF00;
+        }
+        remainder ^= (cnt & 1) ? (word & 0x00FF) : (word >> 8);
+        for(bit = 0; bit < 8; bit++)
+        {
+            remainder = (remainder & 0x8000) ? ((remainder << 1) ^ 0x3000) : (remainder << 1);
+        }
+    }
+    return (remainder >> 12) & 0x000F;
+}
+
+/** D2 for a temperature, TEMP = 2000 + dT * C6 / 2^23 run backwards */
+static int64_t sim_ms5607_dt(const sim_ms5607_t *sensor, int32_t temp)
+{
+    return (((int64_t)temp - 2000) << 23) / sensor->prom[6];
+}
+
+/** Raw value a conversion ends with */
+static uint32_t sim_ms5607_raw(sim_ms5607_t *sensor, Bool temperature, uint64_t when)
+{
+    int32_t temp = sensor->temp_at(when);
+    int64_t dT = sim_ms5607_dt(sensor, temp);
+    int64_t off, sens, d1;
+
+    if(temperature)
+    {
+        return (uint32_t)(((int64_t)sensor->prom[5] << 8) + dT);
+    }
+
+    /* P = (D1 * SENS / 2^21 - OFF) / 2^15, first order. Round D1 up so P doesn't come out one low. */
+    off = ((int64_t)sensor->prom[2] << 17) + ((sensor->prom[4] * dT) >> 6);
+    sens = ((int64_t)sensor->prom[1] << 16) + ((sensor->prom[3] * dT) >> 7);
+    d1 = ((((int64_t)sensor->pressure_at(when) << 15) + off) << 21);
+    d1 = (d1 + sens - 1) / sens;
+    return (uint32_t)d1;
+}
+
+static void sim_ms5607_select(void *ctx)
+{
+    sim_ms5607_t *sensor = ctx;
+
+    sensor->index = 0;
+}
+
+static uint8_t sim_ms5607_exchange(void *ctx, uint8_t mosi)
+{
+    sim_ms5607_t *sensor = ctx;
+    uint8_t miso = 0x00;
+    uint64_t now = sim_now();
+    uint8_t osr;
+
+    if(sensor->index == 0)
+    {
+        sensor->cmd = mosi;
+        if(mosi == SIM_MS5607_RESET)
+        {
+            sensor->converting = false;
+            sensor->result = 0;
+        }
+        else if((mosi & 0xE0) == SIM_MS5607_CONVERT_D1)
+        {
+            osr = (mosi & 0x0F) >> 1;
+            if(sensor->converting && (now < sensor->conv_end))
+            {
+                sensor->stats.busy_cmds++;
+            }
+            sensor->converting = true;
+            sensor->conv_temp = ((mosi & 0xF0) == SIM_MS5607_CONVERT_D2);
+            sensor->conv_end = now + ((uint64_t)simMs5607ConvUs[min(osr, 4)] * SIM_COUNTS_PER_US);
+            sensor->result = 0;
+        }
+        else if(mosi == SIM_MS5607_ADC_READ)
+        {
+            if(sensor->converting && (now >= sensor->conv_end))
+            {
+                sensor->result = sim_ms5607_raw(sensor, sensor->conv_temp, sensor->conv_end);
+                sensor->stats.conversions++;
+            }
+            else
+            {
+                sensor->result = 0;
+                sensor->stats.early_reads++;
+            }
+            sensor->converting = false;
+        }
+    }
+    else if(sensor->cmd == SIM_MS5607_ADC_READ)
+    {
+        if(sensor->index <= 3)
+        {
+            miso = (uint8_t)(sensor->result >> (8 * (3 - sensor->index)));
+        }
+    }
+    else if((sensor->cmd & 0xF0) == SIM_MS5607_PROM_BASE)
+    {
+        if(sensor->index <= 2)
+        {
+            miso = (uint8_t)(sensor->prom[(sensor->cmd >> 1) & 0x07] >> (8 * (2 - sensor->index)));
+        }
+    }
+
+    sensor->index++;
+    return miso;
+}
+
+static void sim_ms5607_deselect(void *ctx)
+{
+    (void)ctx;
+}
+
+/**
+ * @brief Put a simulated altimeter on the sensor bus
+ *
+ * @param sensor The altimeter, must stay around
+ * @param pressure_at Pressure in pascals at a virtual time
+ * @param temp_at Temperature in hundredths of a degree C at a virtual time, 2000 or more
+ */
+void sim_ms5607_attach(sim_ms5607_t *sensor,
+                       int32_t (*pressure_at)(uint64_t when),
+                       int32_t (*temp_at)(uint64_t when))
+{
+    uint8_t i;
+
+    memset(sensor, 0, sizeof(*sensor));
+    for(i = 0; i < 6; i++)
+    {
+        sensor->prom[i + 1] = simMs5607Cal[i];
+    }
+    sensor->prom[7] = 0x4500;
+    sensor->prom[7] |= sim_ms5607_crc4(sensor->prom);
+    sensor->pressure_at = pressure_at;
+    sensor->temp_at = temp_at;
+
+    sensor->device.usart = &SENSOR_SPI;
+    sensor->device.csPort = &ALTIMETER_PORT;
+    sensor->device.csPin = ALTIMETER_CS;
+    sensor->device.select = sim_ms5607_select;
+    sensor->device.exchange = sim_ms5607_exchange;
+    sensor->device.deselect = sim_ms5607_deselect;
+    sensor->device.ctx = sensor;
+    sim_attach_device(&sensor->device);
+}
@@ -0,0 +1,229 @@
+/**
+ * @file sim_n25q.c
+ *
+ * @brief Simulated N25Q flash memory
+ *
+ * Created: 10/17/2026 10:05:00 PM
+ *
+ * Reads, page programs, subsector and sector erases, write enable, the
+ * status register, the JEDEC ID and 4 byte address mode. Programs and
+ * erases take their typical time, and only status reads are answered until
+ * they're done. Programs only clear bits like the real part, and one that
+ * needed an erase first is counted.
+ */
+
+#include "sim_devices.h"
+#include "conf_board.h"
+#include "n25q_512.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Commands */
+#define SIM_N25Q_WREN           (0x06)
+#define SIM_N25Q_WRDI           (0x04)
+#define SIM_N25Q_READ_SR        (0x05)
+#define SIM_N25Q_READ_ID        (0x9F)
+#define SIM_N25Q_4BYTE_MODE     (0xB7)
+#define SIM_N25Q_READ           (0x03)
+#define SIM_N25Q_FAST_READ      (0x0B)
+#define SIM_N25Q_FAST_READ_4B   (0x0C)
+#define SIM_N25Q_PAGE_PROGRAM   (0x02)
+#define SIM_N25Q_SUBSECTOR_ERASE (0x20)
+#define SIM_N25Q_SECTOR_ERASE   (0xD8)
+
+/** Typical times, in microseconds */
+#define SIM_N25Q_PROGRAM_US     (500UL)
+#define SIM_N25Q_SUBSECTOR_US   (250000UL)
+#define SIM_N25Q_SECTOR_US      (700000UL)
+
+/** JEDEC ID: Micron, serial NOR, 512Mb */
+static const uint8_t simN25qId[3] = {0x20, 0xBA, 0x20};
+
+/** Address bytes a command takes, 0 if it has none */
+static uint8_t sim_n25q_addr_bytes(const sim_n25q_t *flash, uint8_t cmd)
+{
+    uint8_t bytes = 0;
+
+    switch(cmd)
+    {
+        case SIM_N25Q_FAST_READ_4B:
+            bytes = 4;
+            break;
+        case SIM_N25Q_READ:
+        case SIM_N25Q_FAST_READ:
+        case SIM_N25Q_PAGE_PROGRAM:
+        case SIM_N25Q_SUBSECTOR_ERASE:
+        case SIM_N25Q_SECTOR_ERASE:
+            bytes = flash->addr4 ? 4 : 3;
+            break;
+        default:
+            break;
+    }
+    return bytes;
+}
+
+static void sim_n25q_select(void *ctx)
+{
+    sim_n25q_t *flash = ctx;
+
+    flash->index = 0;
+    flash->addr = 0;
+    flash->data_len = 0;
+    flash->ignored = false;
+}
+
+static uint8_t sim_n25q_exchange(void *ctx, uint8_t mosi)
+{
+    sim_n25q_t *flash = ctx;
+    uint8_t miso = 0xFF;
+    uint8_t addrBytes;
+    uint16_t dummyBytes;
+    Bool busy = (sim_now() < flash->busy_end);
+
+    if(flash->index == 0)
+    {
+        flash->cmd = mosi;
+        if(busy && (mosi != SIM_N25Q_READ_SR))
+        {
+            flash->ignored = true;
+            flash->stats.busy_cmds++;
+        }
+    }
+    else if(!flash->ignored)
+    {
+        addrBytes = sim_n25q_addr_bytes(flash, flash->cmd);
+        dummyBytes = ((flash->cmd == SIM_N25Q_FAST_READ) || (flash->cmd == SIM_N25Q_FAST_READ_4B)) ? 1 : 0;
+
+        if(flash->cmd == SIM_N25Q_READ_SR)
+        {
+            miso = (uint8_t)((busy ? 0x01 : 0x00) | (flash->wel ? 0x02 : 0x00));
+        }
+        else if(flash->cmd == SIM_N25Q_READ_ID)
+        {
+            miso = (flash->index <= 3) ? simN25qId[flash->index - 1] : 0x00;
+        }
+        else if(flash->index <= addrBytes)
+        {
+            flash->addr = (flash->addr << 8) | mosi;
+        }
+        else if(flash->index > (addrBytes + dummyBytes))
+        {
+            if(flash->cmd == SIM_N25Q_PAGE_PROGRAM)
+            {
+                /* Past the end of the page wraps to its start */
+                flash->page[(flash->addr + flash->data_len) & 0xFF] = mosi;
+                flash->data_len = min(flash->data_len + 1, 256);
+            }
+            else if((flash->cmd == SIM_N25Q_READ) || (flash->cmd == SIM_N25Q_FAST_READ) ||
+                    (flash->cmd == SIM_N25Q_FAST_READ_4B))
+            {
+                miso = flash->mem[(flash->addr + flash->data_len) & (EXTFLASH_SIZE - 1)];
+                flash->data_len++;
+            }
+        }
+    }
+
+    if(flash->index < 0xFFFF)
+    {
+        flash->index++;
+    }
+    return miso;
+}
+
+/** Start a program or erase that came with write enable set */
+static Bool sim_n25q_start_write(sim_n25q_t *flash, uint32_t micros)
+{
+    Bool go = flash->wel;
+
+    if(!go)
+    {
+        flash->stats.no_wren++;
+    }
+    else
+    {
+        flash->wel = false;
+        flash->busy_end = sim_now() + ((uint64_t)micros * SIM_COUNTS_PER_US);
+    }
+    return go;
+}
+
+/** Commands that take effect when chip select goes back high */
+static void sim_n25q_deselect(void *ctx)
+{
+    sim_n25q_t *flash = ctx;
+    uint32_t addr = flash->addr & (EXTFLASH_SIZE - 1);
+    uint32_t pageBase = addr & ~0xFFUL;
+    uint16_t i;
+    uint32_t offset;
+    Bool complete = (flash->index > sim_n25q_addr_bytes(flash, flash->cmd));
+
+    if(flash->ignored || (flash->index == 0))
+    {
+        return;
+    }
+
+    switch(flash->cmd)
+    {
+        case SIM_N25Q_WREN:
+            flash->wel = true;
+            break;
+        case SIM_N25Q_WRDI:
+            flash->wel = false;
+            break;
+        case SIM_N25Q_4BYTE_MODE:
+            flash->addr4 = true;
+            break;
+        case SIM_N25Q_PAGE_PROGRAM:
+            if(complete && (flash->data_len > 0) && sim_n25q_start_write(flash, SIM_N25Q_PROGRAM_US))
+            {
+                flash->stats.programs++;
+                for(i = 0; i < flash->data_len; i++)
+                {
+                    offset = pageBase | ((addr + i) & 0xFF);
+                    if((flash->page[offset & 0xFF] & ~flash->mem[offset]) != 0)
+                    {
+                        flash->stats.unerased++;
+                    }
+                    flash->mem[offset] &= flash->page[offset & 0xFF];
+                }
+            }
+            break;
+        case SIM_N25Q_SUBSECTOR_ERASE:
+            if(complete && sim_n25q_start_write(flash, SIM_N25Q_SUBSECTOR_US))
+            {
+                flash->stats.erases++;
+                memset(&flash->mem[addr & ~(EXTFLASH_SUBSECTOR_SIZE - 1UL)], 0xFF, EXTFLASH_SUBSECTOR_SIZE);
+            }
+            break;
+        case SIM_N25Q_SECTOR_ERASE:
+            if(complete && sim_n25q_start_write(flash, SIM_N25Q_SECTOR_US))
+            {
+                flash->stats.erases++;
+                memset(&flash->mem[addr & ~(EXTFLASH_SECTOR_SIZE - 1UL)], 0xFF, EXTFLASH_SECTOR_SIZE);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Put a simulated flash memory on the flash bus
+ *
+ * @param flash The flash memory, must stay around. Starts out erased.
+ */
+void sim_n25q_attach(sim_n25q_t *flash)
+{
+    memset(flash, 0, sizeof(*flash));
+    flash->mem = malloc(EXTFLASH_SIZE);
+    memset(flash->mem, 0xFF, EXTFLASH_SIZE);
+
+    flash->device.usart = &FLASH_SPI;
+    flash->device.csPort = &FLASH_PORT;
+    flash->device.csPin = FLASH_CS;
+    flash->device.select = sim_n25q_select;
+    flash->device.exchange = sim_n25q_exchange;
+    flash->device.deselect = sim_n25q_deselect;
+    flash->device.ctx = flash;
+    sim_attach_device(&flash->device);
+}
@@ -0,0 +1,198 @@
+/**
+ * @file test_crc.c
+ *
+ * @brief Known answers and a speed check for the CRC module
+ *
+ * Created: 10/18/2026 1:10:00 AM
+ *
+ * Built once for each setting of CRC_USE_BYTE_TABLES. Checks the standard
+ * "123456789" answers, that a CRC done in pieces matches one done all at
+ * once, and random buffers against a bit at a time CRC. Then times both CRCs
+ * on the host in bytes per cycle. That is the host's cycle, not the AVR's:
+ * it shows how the two table sizes compare, not what the part will do.
+ *
+ * Usage: test_crc [random cases]
+ */
+
+#include "Crc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CRC_TEST_HAVE_TSC (1)
+#endif
+
+/** Default number of random buffers checked against the bitwise CRCs */
+#define CRC_TEST_CASES (20000UL)
+/** Longest random buffer */
+#define CRC_TEST_MAX_LEN (300)
+/** Buffer timed, and how many times over */
+#define CRC_TEST_BENCH_LEN (4096)
+#define CRC_TEST_BENCH_REPS (2000)
+
+/** The check string from the CRC catalogue, and its answers */
+static const uint8_t crcCheckString[] = "123456789";
+#define CRC_CHECK_LEN     (9)
+#define CRC16_CHECK       (0x29B1)
+#define CRC32_CHECK       (0xCBF43926UL)
+
+/** Count a failed check */
+static uint32_t crcFailures = 0;
+
+static void crc_expect(Bool ok, const char *what)
+{
+    if(!ok)
+    {
+        crcFailures++;
+        printf("FAIL: %s\n", what);
+    }
+}
+
+/** xorshift32 */
+static uint32_t crcRandom = 0xC0FFEE11;
+
+static uint32_t crc_random(void)
+{
+    crcRandom ^= crcRandom << 13;
+    crcRandom ^= crcRandom >> 17;
+    crcRandom ^= crcRandom << 5;
+    return crcRandom;
+}
+
+/** CRC-16/CCITT-FALSE, a bit at a time */
+static uint16_t crc16_bitwise(uint16_t crc, const uint8_t *buf, uint16_t len)
+{
+    uint8_t bit;
+
+    while(len-- > 0)
+    {
+        crc ^= (uint16_t)(*buf++) << 8;
+        for(bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/** CRC-32 as in zlib, a bit at a time, without the final inversion */
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t *buf, uint16_t len)
+{
+    uint8_t bit;
+
+    while(len-- > 0)
+    {
+        crc ^= *buf++;
+        for(bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320UL) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static void crc_test_answers(uint32_t cases)
+{
+    uint8_t buf[CRC_TEST_MAX_LEN];
+    uint32_t badSplit = 0, bad16 = 0, bad32 = 0;
+    uint32_t i;
+    uint16_t len, split, j;
+    uint16_t crc16;
+    uint32_t crc32;
+
+    crc_expect(crc16_update(CRC16_INIT, crcCheckString, CRC_CHECK_LEN) == CRC16_CHECK,
+               "CRC-16 of 123456789 is 0x29B1");
+    crc_expect(crc32_final(crc32_update(CRC32_INIT, crcCheckString, CRC_CHECK_LEN)) == CRC32_CHECK,
+               "CRC-32 of 123456789 is 0xCBF43926");
+    crc_expect(crc16_update(CRC16_INIT, crcCheckString, 0) == CRC16_INIT, "nothing leaves CRC-16 alone");
+    crc_expect(crc32_update(CRC32_INIT, crcCheckString, 0) == CRC32_INIT, "nothing leaves CRC-32 alone");
+
+    for(split = 0; split <= CRC_CHECK_LEN; split++)
+    {
+        crc16 = crc16_update(CRC16_INIT, crcCheckString, split);
+        crc16 = crc16_update(crc16, &crcCheckString[split], CRC_CHECK_LEN - split);
+        crc32 = crc32_update(CRC32_INIT, crcCheckString, split);
+        crc32 = crc32_update(crc32, &crcCheckString[split], CRC_CHECK_LEN - split);
+        badSplit += ((crc16 != CRC16_CHECK) || (crc32_final(crc32) != CRC32_CHECK)) ? 1 : 0;
+    }
+    crc_expect(badSplit == 0, "CRC in two pieces matches CRC all at once");
+
+    for(i = 0; i < cases; i++)
+    {
+        len = (uint16_t)(crc_random() % (CRC_TEST_MAX_LEN + 1));
+        for(j = 0; j < len; j++)
+        {
+            buf[j] = (uint8_t)crc_random();
+        }
+        crc16 = (uint16_t)crc_random();
+        crc32 = crc_random();
+        bad16 += (crc16_update(crc16, buf, len) != crc16_bitwise(crc16, buf, len)) ? 1 : 0;
+        bad32 += (crc32_update(crc32, buf, len) != crc32_bitwise(crc32, buf, len)) ? 1 : 0;
+    }
+    printf("%u random buffers: %u CRC-16, %u CRC-32 mismatches with the bitwise CRCs\n", cases, bad16, bad32);
+    crc_expect(bad16 == 0, "CRC-16 matches the bitwise CRC-16");
+    crc_expect(bad32 == 0, "CRC-32 matches the bitwise CRC-32");
+}
+
+/** Now, in TSC ticks where there is one, otherwise nanoseconds */
+static uint64_t crc_clock(void)
+{
+#ifdef CRC_TEST_HAVE_TSC
+    return __rdtsc();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static void crc_bench(void)
+{
+    static uint8_t buf[CRC_TEST_BENCH_LEN];
+    volatile uint32_t sink = 0;
+    uint64_t start, ticks16, ticks32;
+    double bytes = (double)CRC_TEST_BENCH_LEN * CRC_TEST_BENCH_REPS;
+    uint32_t i;
+
+    for(i = 0; i < CRC_TEST_BENCH_LEN; i++)
+    {
+        buf[i] = (uint8_t)crc_random();
+    }
+
+    start = crc_clock();
+    for(i = 0; i < CRC_TEST_BENCH_REPS; i++)
+    {
+        sink += crc16_update(CRC16_INIT, buf, CRC_TEST_BENCH_LEN);
+    }
+    ticks16 = crc_clock() - start;
+
+    start = crc_clock();
+    for(i = 0; i < CRC_TEST_BENCH_REPS; i++)
+    {
+        sink += crc32_update(CRC32_INIT, buf, CRC_TEST_BENCH_LEN);
+    }
+    ticks32 = crc_clock() - start;
+
+#ifdef CRC_TEST_HAVE_TSC
+    printf("%s tables, host bytes per TSC tick: CRC-16 %.3f, CRC-32 %.3f\n",
+#else
+    printf("%s tables, host bytes per nanosecond: CRC-16 %.3f, CRC-32 %.3f\n",
+#endif
+           CRC_USE_BYTE_TABLES ? "256 entry" : "16 entry",
+           bytes / (double)ticks16, bytes / (double)ticks32);
+    (void)sink;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t cases = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : CRC_TEST_CASES;
+
+    crc_test_answers(cases);
+    crc_bench();
+
+    printf("%s\n", (crcFailures == 0) ? "PASS" : "FAILED");
+    return (crcFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,354 @@
+/**
+ * @file test_ms5607_math.c
+ *
+ * @brief Check the altimeter's wide math against plain 64 bit math
+ *
+ * Created: 10/18/2026 12:30:00 AM
+ *
+ * The driver builds its 64 bit products and shifts from 32 bit halves so
+ * avr-gcc doesn't call its 64 bit library. This checks, bit for bit, that
+ * mul32, shr64 and scaled_square agree with int64_t, and that the whole
+ * first and second order compensation agrees with the datasheet formulas
+ * written in int64_t. Inputs are random: half anywhere the types allow,
+ * half around real part values from -40 C to 85 C, which covers negative dT
+ * and the extra terms below -15 C.
+ *
+ * It also times both versions. That is on the host, where 64 bit math is
+ * native, so it says nothing about the AVR: the cycle counts there need the
+ * part or a simulator, see the sensor task's profile over USB.
+ *
+ * Usage: test_ms5607_math [cases]
+ */
+
+/* The helpers are static, so build the driver right into the test */
+#include "ms5607-02ba03.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MATH_TEST_HAVE_TSC (1)
+#endif
+
+/** Default number of random cases of each kind */
+#define MATH_TEST_CASES (1000000UL)
+/** Cases timed, from the part-like set */
+#define MATH_TEST_TIMED (4096)
+/** Datasheet example: C1 to C6, D1, D2, and what they come out to */
+static const uint16_t mathExampleCal[ALTIMETER_NUM_CAL] = {46372, 43981, 29059, 27842, 31553, 28165};
+#define MATH_EXAMPLE_D1    (6465444UL)
+#define MATH_EXAMPLE_D2    (8077636UL)
+#define MATH_EXAMPLE_TEMP  (2000)
+#define MATH_EXAMPLE_PRESS (110002)
+
+/** One set of inputs to the compensation */
+typedef struct
+{
+    ms5607_02ba03_cal_t cal;
+    uint32_t d1;
+    uint32_t d2;
+} math_case_t;
+
+/** What the compensation works out */
+typedef struct
+{
+    int32_t t_diff;
+    int64_t offset2;
+    int64_t sens2;
+    int32_t temp;
+    int32_t pressure;
+} math_result_t;
+
+/** Count a failed check */
+static uint32_t mathFailures = 0;
+
+static void math_expect(Bool ok, const char *what)
+{
+    if(!ok)
+    {
+        mathFailures++;
+        printf("FAIL: %s\n", what);
+    }
+}
+
+/** xorshift64 */
+static uint64_t mathRandom = 0x2545F4914F6CDD1DULL;
+
+static uint64_t math_random(void)
+{
+    mathRandom ^= mathRandom << 13;
+    mathRandom ^= mathRandom >> 7;
+    mathRandom ^= mathRandom << 17;
+    return mathRandom;
+}
+
+/** Random value from lo to hi */
+static int32_t math_random_range(int32_t lo, int32_t hi)
+{
+    return lo + (int32_t)(math_random() % (uint64_t)((int64_t)hi - lo + 1));
+}
+
+/** The datasheet's first and second order compensation, in plain int64_t */
+static void math_reference(const math_case_t *in, math_result_t *out)
+{
+    int64_t dT = (int64_t)in->d2 - ((int64_t)in->cal.t_ref << 8);
+    int64_t temp = 2000 + ((dT * in->cal.temp_sens) >> 23);
+    int64_t off = ((int64_t)in->cal.offset << 17) + ((in->cal.tco * dT) >> 6);
+    int64_t sens = ((int64_t)in->cal.sens << 16) + ((in->cal.tcs * dT) >> 7);
+    int64_t t2 = 0, off2 = 0, sens2 = 0;
+
+    if(temp < 2000)
+    {
+        t2 = (dT * dT) >> 31;
+        off2 = (61 * (temp - 2000) * (temp - 2000)) >> 4;
+        sens2 = 2 * (temp - 2000) * (temp - 2000);
+        if(temp < -1500)
+        {
+            off2 += 15 * (temp + 1500) * (temp + 1500);
+            sens2 += 8 * (temp + 1500) * (temp + 1500);
+        }
+    }
+    off -= off2;
+    sens -= sens2;
+
+    out->t_diff = (int32_t)dT;
+    out->offset2 = off2;
+    out->sens2 = sens2;
+    out->temp = (int32_t)(temp - t2);
+    out->pressure = (int32_t)(((((int64_t)in->d1 * sens) >> 21) - off) >> 15);
+}
+
+/** The driver's compensation */
+static void math_driver(const math_case_t *in, math_result_t *out)
+{
+    gAltimeterControl.calibration_vals = in->cal;
+    gAltimeterControl.raw_vals.dig_press = in->d1;
+    gAltimeterControl.raw_vals.dig_temp = in->d2;
+    ms5607_02ba03_calculate_temp();
+    ms5607_02ba03_calculate_press();
+
+    out->t_diff = gAltimeterControl.raw_vals.t_diff;
+    out->offset2 = gAltimeterControl.raw_vals.offset2;
+    out->sens2 = gAltimeterControl.raw_vals.sens2;
+    out->temp = gAltimeterControl.final_vals.temp;
+    out->pressure = gAltimeterControl.final_vals.pressure;
+}
+
+static Bool math_same(const math_result_t *a, const math_result_t *b)
+{
+    return (a->t_diff == b->t_diff) && (a->offset2 == b->offset2) && (a->sens2 == b->sens2) &&
+           (a->temp == b->temp) && (a->pressure == b->pressure);
+}
+
+static void math_set_cal(math_case_t *in, const uint16_t *cal)
+{
+    in->cal.sens = cal[0];
+    in->cal.offset = cal[1];
+    in->cal.tcs = cal[2];
+    in->cal.tco = cal[3];
+    in->cal.t_ref = cal[4];
+    in->cal.temp_sens = cal[5];
+}
+
+/** Anything the types allow: any coefficients and any 24 bit ADC values */
+static void math_case_any(math_case_t *in)
+{
+    uint16_t cal[ALTIMETER_NUM_CAL];
+    uint8_t i;
+
+    for(i = 0; i < ALTIMETER_NUM_CAL; i++)
+    {
+        cal[i] = (uint16_t)math_random();
+    }
+    math_set_cal(in, cal);
+    in->d1 = (uint32_t)math_random() & 0xFFFFFF;
+    in->d2 = (uint32_t)math_random() & 0xFFFFFF;
+}
+
+/** Like a real part: coefficients near the datasheet's, -40 C to 85 C, 10 to 1200 mbar */
+static void math_case_part(math_case_t *in)
+{
+    uint16_t cal[ALTIMETER_NUM_CAL];
+    int32_t temp = math_random_range(-4000, 8500);
+    int32_t dT;
+    uint8_t i;
+
+    for(i = 0; i < ALTIMETER_NUM_CAL; i++)
+    {
+        cal[i] = (uint16_t)math_random_range(mathExampleCal[i] - (mathExampleCal[i] / 8),
+                                             mathExampleCal[i] + (mathExampleCal[i] / 8));
+    }
+    math_set_cal(in, cal);
+    dT = (int32_t)(((int64_t)(temp - 2000) << 23) / cal[5]) + math_random_range(-64, 64);
+    in->d2 = (uint32_t)(((int32_t)cal[4] << 8) + dT);
+    in->d1 = (uint32_t)math_random_range(500000, 8000000);
+}
+
+/** The helpers on their own, at their edges and at random */
+static void math_test_helpers(uint32_t cases)
+{
+    static const int32_t edgeA[] = {0, 1, -1, 0x7FFF, -0x8000, 0xFFFF, -0x10000, INT32_MAX, INT32_MIN};
+    static const uint32_t edgeB[] = {0, 1, 0xFFFF, 0x10000, 0x7FFFFFFF, 0x80000000, UINT32_MAX};
+    uint32_t badMul = 0, badShr = 0, badSquare = 0;
+    uint32_t i, j;
+    int32_t a;
+    uint32_t b;
+    int64_t x;
+    uint8_t shift, factor;
+
+    for(i = 0; i < (sizeof(edgeA) / sizeof(edgeA[0])); i++)
+    {
+        for(j = 0; j < (sizeof(edgeB) / sizeof(edgeB[0])); j++)
+        {
+            badMul += (ms5607_02ba03_mul32(edgeA[i], edgeB[j]) != ((int64_t)edgeA[i] * edgeB[j])) ? 1 : 0;
+        }
+    }
+    for(shift = 1; shift < 32; shift++)
+    {
+        badShr += (ms5607_02ba03_shr64(INT64_MIN, shift) != (INT64_MIN >> shift)) ? 1 : 0;
+        badShr += (ms5607_02ba03_shr64(INT64_MAX, shift) != (INT64_MAX >> shift)) ? 1 : 0;
+        badShr += (ms5607_02ba03_shr64(-1, shift) != -1) ? 1 : 0;
+    }
+
+    for(i = 0; i < cases; i++)
+    {
+        a = (int32_t)math_random();
+        b = (uint32_t)math_random();
+        badMul += (ms5607_02ba03_mul32(a, b) != ((int64_t)a * b)) ? 1 : 0;
+
+        x = (int64_t)math_random();
+        shift = (uint8_t)math_random_range(1, 31);
+        badShr += (ms5607_02ba03_shr64(x, shift) != (x >> shift)) ? 1 : 0;
+
+        factor = (uint8_t)math_random_range(1, 255);
+        a = math_random_range(-(INT32_MAX / factor), INT32_MAX / factor);
+        badSquare += (ms5607_02ba03_scaled_square(a, factor) != ((int64_t)factor * a * a)) ? 1 : 0;
+    }
+
+    printf("helpers: %u random cases, %u mul32, %u shr64, %u scaled_square mismatches\n",
+           cases, badMul, badShr, badSquare);
+    math_expect(badMul == 0, "mul32 is exact");
+    math_expect(badShr == 0, "shr64 matches the 64 bit shift");
+    math_expect(badSquare == 0, "scaled_square is exact");
+}
+
+/** The whole compensation against the datasheet formulas */
+static void math_test_compensation(uint32_t cases)
+{
+    math_case_t in;
+    math_result_t want, got;
+    uint32_t badAny = 0, badPart = 0;
+    uint32_t negative = 0, cold = 0, veryCold = 0;
+    uint32_t i;
+
+    math_set_cal(&in, mathExampleCal);
+    in.d1 = MATH_EXAMPLE_D1;
+    in.d2 = MATH_EXAMPLE_D2;
+    math_driver(&in, &got);
+    math_expect((got.temp == MATH_EXAMPLE_TEMP) && (got.pressure == MATH_EXAMPLE_PRESS), "datasheet example");
+
+    for(i = 0; i < cases; i++)
+    {
+        math_case_any(&in);
+        math_reference(&in, &want);
+        math_driver(&in, &got);
+        badAny += math_same(&want, &got) ? 0 : 1;
+
+        math_case_part(&in);
+        math_reference(&in, &want);
+        math_driver(&in, &got);
+        badPart += math_same(&want, &got) ? 0 : 1;
+        negative += (want.t_diff < 0) ? 1 : 0;
+        cold += (want.offset2 != 0) ? 1 : 0;
+        veryCold += ((want.temp + ((int32_t)(((int64_t)want.t_diff * want.t_diff) >> 31))) < -1500) ? 1 : 0;
+    }
+
+    printf("compensation: %u cases anywhere, %u mismatches; %u like a part, %u mismatches "
+           "(%u with negative dT, %u below 20 C, %u below -15 C)\n",
+           cases, badAny, cases, badPart, negative, cold, veryCold);
+    math_expect(badAny == 0, "compensation matches anywhere the types allow");
+    math_expect(badPart == 0, "compensation matches like a part");
+    math_expect((negative > 0) && (cold > 0) && (veryCold > 0), "negative dT and both cold ranges were covered");
+}
+
+/** Now, in TSC ticks where there is one, otherwise nanoseconds */
+static uint64_t math_clock(void)
+{
+#ifdef MATH_TEST_HAVE_TSC
+    return __rdtsc();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/** How long each version takes on this machine */
+static void math_time(void)
+{
+    static math_case_t inputs[MATH_TEST_TIMED];
+    math_result_t result;
+    volatile int64_t sink = 0;
+    uint64_t start, driverTicks, referenceTicks, mulTicks, int64Ticks;
+    uint32_t i;
+
+    for(i = 0; i < MATH_TEST_TIMED; i++)
+    {
+        math_case_part(&inputs[i]);
+    }
+
+    start = math_clock();
+    for(i = 0; i < MATH_TEST_TIMED; i++)
+    {
+        math_driver(&inputs[i], &result);
+        sink += result.pressure;
+    }
+    driverTicks = math_clock() - start;
+
+    start = math_clock();
+    for(i = 0; i < MATH_TEST_TIMED; i++)
+    {
+        math_reference(&inputs[i], &result);
+        sink += result.pressure;
+    }
+    referenceTicks = math_clock() - start;
+
+    start = math_clock();
+    for(i = 0; i < MATH_TEST_TIMED; i++)
+    {
+        sink += ms5607_02ba03_mul32((int32_t)inputs[i].d2, inputs[i].d1);
+    }
+    mulTicks = math_clock() - start;
+
+    start = math_clock();
+    for(i = 0; i < MATH_TEST_TIMED; i++)
+    {
+        sink += (int64_t)(int32_t)inputs[i].d2 * inputs[i].d1;
+    }
+    int64Ticks = math_clock() - start;
+
+#ifdef MATH_TEST_HAVE_TSC
+    printf("host TSC ticks per call: ");
+#else
+    printf("host nanoseconds per call: ");
+#endif
+    printf("compensation %.1f driver, %.1f int64; multiply %.1f mul32, %.1f int64\n",
+           (double)driverTicks / MATH_TEST_TIMED, (double)referenceTicks / MATH_TEST_TIMED,
+           (double)mulTicks / MATH_TEST_TIMED, (double)int64Ticks / MATH_TEST_TIMED);
+    printf("64 bit math is native on the host. AVR cycles weren't measured, that needs the part or a simulator.\n");
+    (void)sink;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t cases = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : MATH_TEST_CASES;
+
+    math_test_helpers(cases);
+    math_test_compensation(cases);
+    math_time();
+
+    printf("%s\n", (mathFailures == 0) ? "PASS" : "FAILED");
+    return (mathFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+/**
+ * @file test_spi_ring.c
+ *
+ * @brief Stress the SPI service's request ring against a simulated interrupt
+ *
+ * Created: 10/17/2026 11:40:00 PM
+ *
+ * First walks the ring through full, empty and the wrap of the 8 bit
+ * counters by hand. Then main() enqueues like a task, without ever masking
+ * anything, while a fast interval timer plays the SPI interrupt. Its signal
+ * handler lands wherever the task happens to be, like an interrupt on the
+ * part, and finishes a random number of requests from the front: it checks
+ * each is the next one and that every field made it across, completes it and
+ * dequeues it, the same way spi_master_finish_front does.
+ *
+ * Usage: test_spi_ring [requests]
+ */
+
+#include "Spi_service.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/** Default number of requests pushed through the ring against the interrupt */
+#define RING_TEST_REQUESTS (100000UL)
+/** How often the simulated interrupt fires, microseconds */
+#define RING_TEST_ISR_US (20)
+/** Complete flags handed out round robin. More than the queue can hold, so a flag
+ * comes around again only after its last request is done. */
+#define RING_TEST_FLAGS (64)
+/** Send buffers handed out round robin, so each request points somewhere different */
+#define RING_TEST_BUFFERS (251)
+/** Longest random stall of the task between enqueues, in spins */
+#define RING_TEST_MAX_STALL (8192)
+
+static spi_master_t ringMaster;
+static chip_select_info_t ringCs = { &PORTC, 0x10, 0 };
+static volatile Bool ringFlags[RING_TEST_FLAGS];
+static uint8_t ringBuffers[RING_TEST_BUFFERS];
+static uint32_t ringRequests = RING_TEST_REQUESTS;
+
+/** Count a failed check */
+static uint32_t ringFailures = 0;
+
+static void ring_expect(Bool ok, const char *what)
+{
+    if(!ok)
+    {
+        ringFailures++;
+        printf("FAIL: %s\n", what);
+    }
+}
+
+/** The background task the master is registered with, never run here */
+static void ring_bg_task(void)
+{
+}
+
+/** xorshift32 */
+static uint32_t ring_random(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/** Enqueue request number seq, which says who it is in every field */
+static Bool ring_enqueue(uint32_t seq)
+{
+    return spi_master_enqueue(&ringMaster, &ringCs,
+                              &ringBuffers[seq % RING_TEST_BUFFERS], (uint16_t)(seq & 0xFFFF),
+                              NULL, (uint16_t)(seq >> 16),
+                              &ringFlags[seq % RING_TEST_FLAGS]);
+}
+
+/** Is this request number seq, as ring_enqueue left it? */
+static Bool ring_request_ok(volatile spi_request_t *request, uint32_t seq)
+{
+    return (request->sendBuff == &ringBuffers[seq % RING_TEST_BUFFERS]) &&
+           (request->sendLen == (uint16_t)(seq & 0xFFFF)) &&
+           (request->recvLen == (uint16_t)(seq >> 16)) &&
+           (request->complete == &ringFlags[seq % RING_TEST_FLAGS]) &&
+           (request->csInfo.csPort == ringCs.csPort) &&
+           (request->csInfo.pinBitMask == ringCs.pinBitMask) &&
+           (request->raise_cs == true) &&
+           (*(request->complete) == false);
+}
+
+/** Full, empty and the counter wrap, one step at a time */
+static void ring_test_edges(void)
+{
+    uint32_t seq = 0;
+    uint32_t done = 0;
+    uint32_t i;
+    Bool ok = true;
+
+    for(i = 0; i < SPI_MASTER_QUEUE_DEPTH; i++)
+    {
+        ok &= ring_enqueue(seq++);
+    }
+    ring_expect(ok, "every slot of the ring can be used");
+    ring_expect(spi_master_queue_count(&ringMaster) == SPI_MASTER_QUEUE_DEPTH, "full ring counts its depth");
+    ring_expect(!ring_enqueue(seq), "enqueue on a full ring is refused");
+    ring_expect(ringMaster.stats.queueFull == 1, "refused enqueue is counted");
+    ring_expect(ringMaster.stats.maxQueued == SPI_MASTER_QUEUE_DEPTH, "high water mark is the depth");
+
+    ok = true;
+    for(i = 0; i < SPI_MASTER_QUEUE_DEPTH; i++)
+    {
+        ok &= ring_request_ok(spi_master_front_request(&ringMaster), done);
+        *(spi_master_front_request(&ringMaster)->complete) = true;
+        ok &= spi_master_dequeue(&ringMaster);
+        done++;
+    }
+    ring_expect(ok, "requests come out in order");
+    ring_expect(spi_master_queue_count(&ringMaster) == 0, "drained ring is empty");
+    ring_expect(!spi_master_dequeue(&ringMaster), "dequeue on an empty ring is refused");
+
+    /* Go around the 8 bit counters a few times, at every fill level */
+    ok = true;
+    for(i = 0; i < (3 * 256); i++)
+    {
+        while(spi_master_queue_count(&ringMaster) < ((i % SPI_MASTER_QUEUE_DEPTH) + 1))
+        {
+            ok &= ring_enqueue(seq++);
+        }
+        ok &= ring_request_ok(spi_master_front_request(&ringMaster), done);
+        *(spi_master_front_request(&ringMaster)->complete) = true;
+        ok &= spi_master_dequeue(&ringMaster);
+        done++;
+    }
+    while(spi_master_dequeue(&ringMaster))
+    {
+        done++;
+    }
+    ring_expect(ok, "requests come out in order across the counter wrap");
+    ring_expect(done == seq, "everything enqueued is dequeued once");
+}
+
+/** Things the simulated interrupt saw */
+static volatile uint32_t isrDone;          /**< Requests finished */
+static volatile uint32_t isrCalls;         /**< Times it ran */
+static volatile uint32_t isrEmpty;         /**< Times it found the ring empty */
+static volatile uint32_t isrInEnqueue;     /**< Times it landed in the middle of an enqueue */
+static volatile uint32_t isrBadRequest;    /**< Requests that weren't what was enqueued */
+static volatile uint32_t isrBadDequeue;    /**< Dequeues that were refused with a request in front */
+static volatile uint8_t isrMostQueued;     /**< Most requests it saw waiting */
+static uint32_t isrRandom = 0x9E3779B9;
+/** Set by the task around each enqueue */
+static volatile Bool taskInEnqueue;
+
+/** The SPI interrupt: finish up to a queue's worth of requests from the front */
+static void ring_isr(int sig)
+{
+    uint8_t finish = (uint8_t)(ring_random(&isrRandom) % (SPI_MASTER_QUEUE_DEPTH + 1));
+    uint8_t count;
+    volatile spi_request_t *request;
+
+    (void)sig;
+    isrCalls++;
+    if(taskInEnqueue)
+    {
+        isrInEnqueue++;
+    }
+
+    while(finish > 0)
+    {
+        count = spi_master_queue_count(&ringMaster);
+        if(count == 0)
+        {
+            isrEmpty++;
+            break;
+        }
+        isrMostQueued = max(isrMostQueued, count);
+
+        request = spi_master_front_request(&ringMaster);
+        if(!ring_request_ok(request, isrDone))
+        {
+            isrBadRequest++;
+        }
+        *(request->complete) = true;
+        if(!spi_master_dequeue(&ringMaster))
+        {
+            isrBadDequeue++;
+        }
+        isrDone++;
+        finish--;
+    }
+}
+
+/** Start or stop the simulated interrupt */
+static void ring_isr_timer(uint32_t micros)
+{
+    struct itimerval timer;
+
+    memset(&timer, 0, sizeof(timer));
+    timer.it_interval.tv_usec = micros;
+    timer.it_value.tv_usec = micros;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/** The task: enqueue every request, spinning while the ring is full */
+static void ring_test_stress(void)
+{
+    struct sigaction action;
+    uint32_t state = 0x12345678;
+    uint32_t refused = 0;
+    uint32_t badFlag = 0;
+    uint32_t seq;
+    volatile uint32_t spins;
+    uint32_t stall;
+    Bool queued;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = ring_isr;
+    sigaction(SIGALRM, &action, NULL);
+
+    spi_master_reset_stats(&ringMaster);
+    ring_isr_timer(RING_TEST_ISR_US);
+
+    for(seq = 0; seq < ringRequests; seq++)
+    {
+        if((seq >= RING_TEST_FLAGS) && !ringFlags[seq % RING_TEST_FLAGS])
+        {
+            badFlag++;
+        }
+        do
+        {
+            taskInEnqueue = true;
+            queued = ring_enqueue(seq);
+            taskInEnqueue = false;
+            refused += queued ? 0 : 1;
+        } while(!queued);
+
+        stall = ring_random(&state) % RING_TEST_MAX_STALL;
+        for(spins = 0; spins < stall; spins++)
+        {
+            ;
+        }
+    }
+    while(isrDone < ringRequests)
+    {
+        ;
+    }
+    ring_isr_timer(0);
+
+    printf("%u requests, %u interrupts, %u in the middle of an enqueue, "
+           "%u enqueues refused, %u interrupts found it empty, most waiting %u\n",
+           ringRequests, isrCalls, isrInEnqueue, refused, isrEmpty, isrMostQueued);
+    ring_expect(isrBadRequest == 0, "every request arrives whole and in order");
+    ring_expect(isrBadDequeue == 0, "dequeue never refuses a waiting request");
+    ring_expect(badFlag == 0, "a request is done before its flag comes around");
+    ring_expect(spi_master_queue_count(&ringMaster) == 0, "ring ends empty");
+    ring_expect(ringMaster.stats.queueFull == (uint16_t)refused, "every refused enqueue is counted");
+    ring_expect(isrInEnqueue > 0, "the interrupt landed inside enqueues");
+    ring_expect(refused > 0, "the ring ran full");
+    ring_expect(isrEmpty > 0, "the ring ran empty");
+    ring_expect(isrMostQueued == SPI_MASTER_QUEUE_DEPTH, "the ring filled every slot");
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1)
+    {
+        ringRequests = (uint32_t)strtoul(argv[1], NULL, 0);
+    }
+
+    ring_expect(init_spi_master_service(&ringMaster, &USARTC1, &PORTC, ring_bg_task), "master starts");
+    ring_test_edges();
+    ring_test_stress();
+
+    printf("%s\n", (ringFailures == 0) ? "PASS" : "FAILED");
+    return (ringFailures == 0) ? 0 : 1;
+}
@@ -14,6 +14,8 @@
 #include "SensorTask.h"
 #include "RadioTask.h"
 #include "FlashMem.h"
+#include "LogTask.h"
+#include "Pyrotechnics.h"
 #include "USBUtils.h"
 
 void board_init(void)
@@ -100,7 +102,11 @@ void board_init(void)
     //init_radio_task();
 
     /* Initializes SPI for External Flash Memory, sets up CS pin for it */
-    //init_flashmem();
+    init_flashmem();
+
+    /* Subscribes the logging and pyro tasks to the sensor samples */
+    init_log_task();
+    init_pyro_task();
 
     /* Initializes the USB CDC interface */
     //init_usb();
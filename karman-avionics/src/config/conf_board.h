@@ -33,6 +33,11 @@
 #define FLASH_SCLK (1 << 5) /**< Output */
 #define FLASH_CS   (1 << 0) /**< Output */
 #define FLASH_SPI_INT (USARTC1_RXC_vect) /**< Data RX interrupt */
+#define FLASH_SPI_DMA_RX (2) /**< DMA channel for received data */
+#define FLASH_SPI_DMA_RX_TRIG (DMA_CH_TRIGSRC_USARTC1_RXC_gc) /**< DMA trigger on data received */
+#define FLASH_SPI_DMA_TX (3) /**< DMA channel for sent data */
+#define FLASH_SPI_DMA_TX_TRIG (DMA_CH_TRIGSRC_USARTC1_DRE_gc) /**< DMA trigger on data register empty */
+#define FLASH_SPI_BAUD (16000000) /**< N25Q is good for 54MHz, the USART tops out at half the peripheral clock */
 
 /*** SENSORS ***/
 #define SENSOR_SPI_PORT (PORTD) /**< See schematic */
@@ -41,6 +46,10 @@
 #define SENSOR_MISO (1 << 2) /**< Input  */
 #define SENSOR_SCLK (1 << 1) /**< Output */
 #define SENSOR_SPI_INT (USARTD0_RXC_vect) /**< Data RX interrupt */
+#define SENSOR_SPI_DMA_RX (0) /**< DMA channel for received data */
+#define SENSOR_SPI_DMA_RX_TRIG (DMA_CH_TRIGSRC_USARTD0_RXC_gc) /**< DMA trigger on data received */
+#define SENSOR_SPI_DMA_TX (1) /**< DMA channel for sent data */
+#define SENSOR_SPI_DMA_TX_TRIG (DMA_CH_TRIGSRC_USARTD0_DRE_gc) /**< DMA trigger on data register empty */
 
 /* USB */
 #define USB_PORT (PORTD) /**< See schematic */
@@ -52,11 +61,15 @@
 #define HIGHG_ACC1_CS  (1 << 4) /**< Output */
 #define HIGHG_ACC1_INT (1 << 3) /**< Input  */
 #define HIGHG_ACC1_INT_PINCTRL PIN3CTRL /**< Config w/rising/falling edge. DO NOT add parentheses! */
+#define HIGHG_ACC1_INT_NUM (0) /**< Port interrupt 0 or 1 the data ready line uses */
+#define HIGHG_ACC1_INT_VECT (PORTC_INT0_vect) /**< Data ready interrupt */
 
 #define HIGHG_ACC2_PORT (PORTE) /**< See schematic */
 #define HIGHG_ACC2_CS  (1 << 3) /**< Output */
 #define HIGHG_ACC2_INT (1 << 2) /**< Input  */
 #define HIGHG_ACC2_INT_PINCTRL PIN2CTRL /**< Config w/rising/falling edge. DO NOT add parentheses! */
+#define HIGHG_ACC2_INT_NUM (0) /**< Port interrupt 0 or 1 the data ready line uses */
+#define HIGHG_ACC2_INT_VECT (PORTE_INT0_vect) /**< Data ready interrupt */
 
 /*** GPS ***/
 #define GPS_PORT (PORTC) /**< See schematic */
@@ -69,10 +82,14 @@
 #define IMU_ACC1_INT_PORT (PORTE) /**< See schematic */
 #define IMU_ACC1_INT (1 << 0) /**< Input  */
 #define IMU_ACC1_INT_PINCTRL PIN0CTRL /**< Config w/rising/falling edge. DO NOT add parentheses! */
+#define IMU_ACC1_INT_NUM (1) /**< Port interrupt 0 or 1, HIGHG_ACC2 has the other one on this port */
+#define IMU_ACC1_INT_VECT (PORTE_INT1_vect) /**< Data ready interrupt */
 
 #define IMU_ACC2_PORT (PORTF) /**< See schematic */
 #define IMU_ACC2_INT  (1 << 2) /**< Input  */
 #define IMU_ACC2_INT_PINCTRL PIN2CTRL /**< Config w/rising/falling edge. DO NOT add parentheses! */
+#define IMU_ACC2_INT_NUM (0) /**< Port interrupt 0 or 1 the data ready line uses */
+#define IMU_ACC2_INT_VECT (PORTF_INT0_vect) /**< Data ready interrupt */
 #define IMU_ACC2_CS   (1 << 1) /**< Output */
 
 #define IMU_GYRO1_PORT (PORTD) /**< See schematic */
@@ -90,6 +107,7 @@
 /*** ALTIMETER ***/
 #define ALTIMETER_PORT (PORTF) /**< See schematic */
 #define ALTIMETER_CS   (1 << 0) /**< Output */
+#define ALTIMETER_SPI_BAUD (16000000) /**< MS5607 is good for 20MHz, the USART tops out at half the peripheral clock */
 
 /*** PYROTECHNICS ***/
 #define PYRO_12_PORT (PORTA) /**< See schematic */
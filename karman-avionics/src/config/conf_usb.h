@@ -126,7 +126,7 @@
 //! Interface callback definition
 #define  UDI_CDC_ENABLE_EXT(port)          usb_utils_cdc_enabled(port)
 #define  UDI_CDC_DISABLE_EXT(port)         usb_utils_cdc_disabled(port)
-#define  UDI_CDC_RX_NOTIFY(port)
+#define  UDI_CDC_RX_NOTIFY(port)          usb_utils_rx_notify(port)
 #define  UDI_CDC_TX_EMPTY_NOTIFY(port)
 #define  UDI_CDC_SET_CODING_EXT(port,cfg)
 #define  UDI_CDC_SET_DTR_EXT(port,set)
@@ -134,6 +134,7 @@
 
 extern bool usb_utils_cdc_enabled(uint8_t port);
 extern void usb_utils_cdc_disabled(uint8_t port);
+extern void usb_utils_rx_notify(uint8_t port);
 
 // #define UDI_CDC_ENABLE_EXT(port) my_callback_cdc_enable()
 // extern bool my_callback_cdc_enable(void);
@@ -152,7 +153,8 @@ extern void usb_utils_cdc_disabled(uint8_t port);
 
 //! Define it when the transfer CDC Device to Host is a low rate (<512000 bauds)
 //! to reduce CDC buffers size
-#define  UDI_CDC_LOW_RATE
+//! Left undefined: flash downloads stream at full speed, which needs the 5 packet buffers
+// #define  UDI_CDC_LOW_RATE
 
 //! Default configuration of communication port
 #define  UDI_CDC_DEFAULT_RATE             115200
@@ -28,11 +28,20 @@
  #define ALTIMETER_CONVERT_D2_1024  (0x54) /**< D2 Conversion command with 10 bits of data */
  #define ALTIMETER_CONVERT_D2_2048  (0x56) /**< D2 Conversion command with 11 bits of data */
  #define ALTIMETER_CONVERT_D2_4096  (0x58) /**< D2 Conversion command with 12 bits of data */
- #define ALTIMETER_CONVERT_D1       (ALTIMETER_CONVERT_D1_2048) /**< Use most ADC bits */
- #define ALTIMETER_CONVERT_D2       (ALTIMETER_CONVERT_D2_2048) /**< Use most ADC bits */
  #define ALTIMETER_PROM_BASE        (0xA0) /**< PROM addresses are 0xA0 to 0xAE */
  #define ALTIMETER_ADC_READ         (0x00) /**< ADC Read command */
  #define ALTIMETER_NUM_CAL          (6)    /**< There are six calibration values */
+ #define ALTIMETER_PROM_WORDS       (8)    /**< Factory data, six calibration values, then the CRC */
+ #define ALTIMETER_PROM_CRC_MASK    (0x000F) /**< CRC is the low nibble of the last PROM word */
+
+ /**
+  * Timer ticks each conversion takes, by OSR. The datasheet maximums,
+  * 0.60, 1.17, 2.28, 4.54 and 9.04 ms, rounded up to 200 us ticks.
+  * Conversion commands for each OSR are two apart, starting at the 256 command.
+  */
+ static const uint8_t altimeterConvTicks[ALTIMETER_NUM_OSR] = {3, 6, 12, 23, 46};
+
+ static void ms5607_02ba03_conversion_done(void *arg);
 
  /** File scope global variable with control data for the altimeter */
  ms5607_02ba03_control_t gAltimeterControl;
@@ -53,15 +62,33 @@ void ms5607_02ba03_init(spi_master_t *spi_master)
     memset((void *)gAltimeterControl.spi_recv_buffer, 0, sizeof(gAltimeterControl.spi_recv_buffer));
     memset((void *)gAltimeterControl.spi_send_buffer, 0, sizeof(gAltimeterControl.spi_send_buffer));
     gAltimeterControl.send_complete = false;
+    gAltimeterControl.cmd_complete = false;
+    gAltimeterControl.get_data_state = ENQUEUE_CONVERT;
+    gAltimeterControl.next_queued = false;
+    gAltimeterControl.conv_done = false;
+    gAltimeterControl.conv_time = 0;
+    gAltimeterControl.press_time = 0;
+    gAltimeterControl.have_temp = false;
+    gAltimeterControl.press_count = 0;
+    soft_timer_init(&(gAltimeterControl.conv_timer), ms5607_02ba03_conversion_done, NULL);
+    ms5607_02ba03_configure(ALTIMETER_DEFAULT_PRESS_OSR, ALTIMETER_DEFAULT_TEMP_OSR, 1, false);
 
     memset((void *)(&(gAltimeterControl.raw_vals)), 0, sizeof(gAltimeterControl.raw_vals));
     memset((void *)(&(gAltimeterControl.final_vals)), 0, sizeof(gAltimeterControl.final_vals));
 
+    /** Run as fast as the part allows, as long as the PROM reads back with a good CRC at that speed */
+    spi_master_set_cs_baud(&(gAltimeterControl.cs_info), ALTIMETER_SPI_BAUD);
+
     /** Call initial functions to prepare altimeter. */
     ms5607_02ba03_reset();
     timer_delay_ms(3); /** Delay 3 ms to allow for reset */
     gAltimeterControl.cs_info.csPort->OUTSET = gAltimeterControl.cs_info.pinBitMask; /** Pull CS High to allow continued operation */
-    ms5607_02ba03_read_prom();
+    if(!ms5607_02ba03_read_prom())
+    {
+        /** Fall back to the bus default and try again */
+        spi_master_set_cs_baud(&(gAltimeterControl.cs_info), 0);
+        ms5607_02ba03_read_prom();
+    }
 }
 
 
@@ -86,23 +113,70 @@ void ms5607_02ba03_init(spi_master_t *spi_master)
                        &(gAltimeterControl.send_complete));
  }
 
+ /**
+  * @brief Check the CRC of the altimeter PROM
+  *
+  * @param prom All eight PROM words
+  * @return True if the CRC matches, false otherwise
+  *
+  * CRC-4 from Measurement Specialties AN520. The CRC covers all 128 bits,
+  * with the low byte of the last word, where the CRC lives, read as zero. A bus stuck low reads as all zeros,
+  * which has a good CRC, so a zero or all-ones first coefficient fails too.
+  */
+ static Bool ms5607_02ba03_prom_valid(uint16_t *prom)
+ {
+    uint16_t remainder = 0;
+    uint16_t word;
+    uint8_t cnt, bit;
+
+    for(cnt = 0; cnt < (2 * ALTIMETER_PROM_WORDS); cnt++)
+    {
+        word = prom[cnt >> 1];
+        if((cnt >> 1) == (ALTIMETER_PROM_WORDS - 1))
+        {
+            word &= 0xFF00;
+        }
+        remainder ^= (cnt & 1) ? (word & 0x00FF) : (word >> 8);
+
+        for(bit = 8; bit > 0; bit--)
+        {
+            if(remainder & 0x8000)
+            {
+                remainder = (remainder << 1) ^ 0x3000;
+            }
+            else
+            {
+                remainder = (remainder << 1);
+            }
+        }
+    }
+    remainder = (remainder >> 12) & ALTIMETER_PROM_CRC_MASK;
+
+    return (remainder == (prom[ALTIMETER_PROM_WORDS - 1] & ALTIMETER_PROM_CRC_MASK)) &&
+           (prom[1] != 0x0000) && (prom[1] != 0xFFFF);
+ }
+
  /** 
   * @brief Read configuratin values from the Altimeter PROM
   *
+  * @return True if the PROM CRC is good, false otherwise
+  *
   * Where PROM is Programmable Read Only Memory 
-  * It reads 6 16 bit words of data.
+  * It reads all 8 16 bit words of data, keeps the 6 calibration values, and
+  * checks the CRC in the last one.
   */
- void ms5607_02ba03_read_prom(void)
+ Bool ms5607_02ba03_read_prom(void)
  {
     uint8_t i;
-    uint16_t *calptr = (uint16_t *)&(gAltimeterControl.calibration_vals);
-    /** Grab addresses 1 through 6 of PROM (datasheet page 11) */
-    /** Each one is 16 bits. */
+    uint16_t prom[ALTIMETER_PROM_WORDS];
+
+    /** Grab addresses 0 through 7 of PROM (datasheet page 11) */
+    /** Each one is 16 bits, MSB first, after the command byte. */
     memset((void *)gAltimeterControl.spi_send_buffer, 0, sizeof(gAltimeterControl.spi_send_buffer));
 
-    for(i = ALTIMETER_PROM_BASE + 2; i < ALTIMETER_PROM_BASE + 0x0E; i = i+2)
+    for(i = 0; i < ALTIMETER_PROM_WORDS; i++)
     {
-        gAltimeterControl.spi_send_buffer[0] = i;
+        gAltimeterControl.spi_send_buffer[0] = ALTIMETER_PROM_BASE + (i << 1);
         /** Send BLOCKING request as this is done during initialization */
         spi_master_blocking_send_request(gAltimeterControl.spi_master,
                                         &(gAltimeterControl.cs_info),
@@ -112,51 +186,75 @@ void ms5607_02ba03_init(spi_master_t *spi_master)
                                         3,
                                         &(gAltimeterControl.send_complete));
 
-        *calptr = ((uint16_t)gAltimeterControl.spi_recv_buffer[1] << 8) | gAltimeterControl.spi_recv_buffer[0];
-        calptr++;
+        prom[i] = ((uint16_t)gAltimeterControl.spi_recv_buffer[1] << 8) | gAltimeterControl.spi_recv_buffer[2];
     }
+
+    /** Words 1 through 6 are the calibration values, in struct order */
+    memcpy((void *)&(gAltimeterControl.calibration_vals), (void *)&(prom[1]), sizeof(ms5607_02ba03_cal_t));
+
+    return ms5607_02ba03_prom_valid(prom);
  }
 
- /** 
-  * @brief Get the pressure value and convert it to reasonable units.
+ /**
+  * @brief Set how the altimeter samples
   *
-  * After calling this you have to wait 8.2 ms between conversion and ADC read 
+  * @param press_osr OSR for pressure conversions
+  * @param temp_osr OSR for temperature conversions
+  * @param press_per_temp Pressure conversions for each temperature conversion, at least 1.
+  *        Pressures in between use the last temperature.
+  * @param pipelined True to queue each conversion right behind the ADC read before it,
+  *        instead of on the next pass through the state machine
+  *
+  * Safe to call at any time. A conversion already started finishes with the old settings.
+  * Temperature drifts slowly, so during the fast part of a flight a low OSR and several
+  * pressures per temperature give many more pressure samples.
   */
- void ms5607_02ba03_d1_convert(void)
+ void ms5607_02ba03_configure(ms5607_02ba03_osr_t press_osr, ms5607_02ba03_osr_t temp_osr,
+                              uint8_t press_per_temp, Bool pipelined)
  {
-    memset((void *)gAltimeterControl.spi_send_buffer, 0, sizeof(gAltimeterControl.spi_send_buffer));
-    
-    gAltimeterControl.spi_send_buffer[0] = ALTIMETER_CONVERT_D1;
+    gAltimeterControl.press_osr = min(press_osr, ALTIMETER_OSR_4096);
+    gAltimeterControl.temp_osr = min(temp_osr, ALTIMETER_OSR_4096);
+    gAltimeterControl.press_per_temp = max(press_per_temp, 1);
+    gAltimeterControl.pipelined = pipelined;
+ }
 
-    spi_master_enqueue(gAltimeterControl.spi_master,
-                       &(gAltimeterControl.cs_info),
-                       gAltimeterControl.spi_send_buffer,
-                       1,
-                       gAltimeterControl.spi_recv_buffer,
-                       0,
-                       &(gAltimeterControl.send_complete));
+ /**
+  * @brief Start a pressure (D1) or temperature (D2) conversion
+  *
+  * @param temperature True for D2, false for D1
+  *
+  * Uses the configured OSR. The ADC can be read conv_wait timer ticks after
+  * the command completes. The command has its own buffer, so it can be queued
+  * right behind an ADC read.
+  *
+  * @return True if the command was queued, false if the SPI queue is full
+  */
+ Bool ms5607_02ba03_convert(Bool temperature)
+ {
+    ms5607_02ba03_osr_t osr = temperature ? gAltimeterControl.temp_osr : gAltimeterControl.press_osr;
+
+    gAltimeterControl.spi_cmd_buffer[0] = (temperature ? ALTIMETER_CONVERT_D2_256 : ALTIMETER_CONVERT_D1_256) + (osr << 1);
+    gAltimeterControl.conv_wait = altimeterConvTicks[osr];
+    gAltimeterControl.converting_temp = temperature;
+
+    return spi_master_enqueue(gAltimeterControl.spi_master,
+                              &(gAltimeterControl.cs_info),
+                              gAltimeterControl.spi_cmd_buffer,
+                              1,
+                              gAltimeterControl.spi_recv_buffer,
+                              0,
+                              &(gAltimeterControl.cmd_complete));
  }
 
-/** 
- * @brief Get the temperature value and converts it into reasonable units
- *
- * After calling this you have to wait 8.2 ms between conversion and ADC read 
- * It partially relies on the pressure value and must be called after the d1 convert is called
- *
- */
- void ms5607_02ba03_d2_convert(void)
+ /**
+  * @brief Whether the next conversion should be temperature
+  *
+  * Temperature first, then press_per_temp pressures for each temperature.
+  */
+ static inline Bool ms5607_02ba03_next_is_temp(void)
  {
-     memset((void *)gAltimeterControl.spi_send_buffer, 0, sizeof(gAltimeterControl.spi_send_buffer));
-     
-     gAltimeterControl.spi_send_buffer[0] = ALTIMETER_CONVERT_D2;
-
-     spi_master_enqueue(gAltimeterControl.spi_master,
-                        &(gAltimeterControl.cs_info),
-                        gAltimeterControl.spi_send_buffer,
-                        1,
-                        gAltimeterControl.spi_recv_buffer,
-                        0,
-                        &(gAltimeterControl.send_complete));
+    return (!gAltimeterControl.have_temp) ||
+           (gAltimeterControl.press_count >= gAltimeterControl.press_per_temp);
  }
 
  /** 
@@ -166,14 +264,16 @@ void ms5607_02ba03_init(spi_master_t *spi_master)
   * into the recieve buffer
   *
   * 24 bits for pressure/temperature. NOTE: Always convert d1 and d2 first 
+  *
+  * @return True if the read was queued, false if the SPI queue is full
   */
-void ms5607_02ba03_read_data(void)
+Bool ms5607_02ba03_read_data(void)
 {
     memset((void *)gAltimeterControl.spi_send_buffer, 0, sizeof(gAltimeterControl.spi_send_buffer));
         
     gAltimeterControl.spi_send_buffer[0] = ALTIMETER_ADC_READ;
 
-    spi_master_enqueue(gAltimeterControl.spi_master,
+    return spi_master_enqueue(gAltimeterControl.spi_master,
                        &(gAltimeterControl.cs_info),
                        gAltimeterControl.spi_send_buffer,
                        1,
@@ -193,6 +293,32 @@ void ms5607_02ba03_read_data(void)
     return (uint32_t)(((uint32_t)buff[1] << 16) | ((uint32_t)buff[2] << 8) | (uint32_t)buff[3]);
  }
 
+/**
+ * @brief Conversion timer callback
+ *
+ * @param arg Unused
+ *
+ * Runs from the scheduler when the conversion time is up. Only flags it, the
+ * ADC read is queued from ms5607_02ba03_run so it counts against the sensor
+ * task's bus budget.
+ */
+static void ms5607_02ba03_conversion_done(void *arg)
+{
+    (void)arg;
+
+    gAltimeterControl.conv_time = get_timer_us();
+    gAltimeterControl.conv_done = true;
+}
+
+/**
+ * @brief Start the conversion timer for the conversion that was just started
+ */
+static void ms5607_02ba03_start_conv_timer(void)
+{
+    gAltimeterControl.conv_done = false;
+    soft_timer_start(&(gAltimeterControl.conv_timer), gAltimeterControl.conv_wait + 1, 0);
+}
+
 /**
  * @brief State machine for Altimeter
  * 
@@ -201,103 +327,225 @@ void ms5607_02ba03_read_data(void)
  * this objects state to the next value. 
  * Eventually this will return successful and the data will be pulled out of the
  * appropriate global buffers.
+ *
+ * Returns SENSOR_COMPLETE after every pressure read, once there is a temperature
+ * to go with it. Returns SENSOR_BUSY when it queued something on the SPI bus,
+ * and SENSOR_WAITING when it's only waiting.
  */
  sensor_status_t ms5607_02ba03_run(void)
  {
-    /** 1. Enqueue D1 convert command */
+    /** 1. Enqueue D1 or D2 convert command */
     /** 2. Wait for that to finish */
-    /** 3. Wait additional 8.2ms for conversion */
-    /** 4. Do adc read to get D1 */
-    /** 5. Enqueue D2 convert command */
-    /** 6. Wait for that to finish */
-    /** 7. Wait additional 8.2ms for conversion */
-    /** 8. Do adc read to get D2 */
-    /** 9. Calculate new temperature and pressure */
+    /** 3. Wait the conversion time for its OSR on the conversion timer */
+    /** 4. Once the timer fires, enqueue the adc read. Pipelined, enqueue the next convert right behind it. */
+    /** 5. Calculate new temperature, or new pressure with the last temperature */
+    /** 6. Pipelined, back to 3, otherwise back to 1 */
 
-    sensor_status_t returnStatus = SENSOR_BUSY;
+    sensor_status_t returnStatus = SENSOR_WAITING;
+    Bool readDone;
 
     switch(gAltimeterControl.get_data_state)
     {
-        case ENQUEUE_D1_CONVERT:
-            ms5607_02ba03_d1_convert();
-            gAltimeterControl.get_data_state = WAIT_D1_CONVERT;
-            break;        
-        case WAIT_D1_CONVERT:
-            if(true == gAltimeterControl.send_complete)
+        case ENQUEUE_CONVERT:
+            if(ms5607_02ba03_convert(ms5607_02ba03_next_is_temp()))
             {
-                /* Record time when we started conversion */
-                gAltimeterControl.time_start = get_timer_count();
-                gAltimeterControl.get_data_state = WAIT_8ms_D1;
+                gAltimeterControl.get_data_state = WAIT_CONVERT;
+                returnStatus = SENSOR_BUSY;
             }
             break;
-        case WAIT_8ms_D1:
-            /* wait 8ms */
-            /* if 8ms done */
-            if(get_timer_count() - gAltimeterControl.time_start > EIGHT_MS)
+        case WAIT_CONVERT:
+            if(true == gAltimeterControl.cmd_complete)
             {
-                ms5607_02ba03_read_data();
-                gAltimeterControl.get_data_state = WAIT_D1_READ;
-                returnStatus = SENSOR_WAITING;
+                /* Conversion started, the timer says when it's done */
+                ms5607_02ba03_start_conv_timer();
+                gAltimeterControl.get_data_state = WAIT_CONVERSION;
             }
             break;
-        case WAIT_D1_READ:
-            if(true == gAltimeterControl.send_complete)
+        case WAIT_CONVERSION:
+            /* If the SPI queue is full the result stays in the ADC, try again next pass */
+            if(gAltimeterControl.conv_done && ms5607_02ba03_read_data())
             {
-                gAltimeterControl.raw_vals.dig_press = get_data_from_buffer24(gAltimeterControl.spi_recv_buffer);
-                gAltimeterControl.get_data_state = ENQUEUE_D2_CONVERT;
-            }
-            break;
-        case ENQUEUE_D2_CONVERT:
-            ms5607_02ba03_d2_convert();
-            gAltimeterControl.get_data_state = WAIT_D2_CONVERT;
-            break;
-        case WAIT_D2_CONVERT:
-            if(true == gAltimeterControl.send_complete)
-            {
-                /* Record time when we started conversion */
-                gAltimeterControl.time_start = get_timer_count();
-                gAltimeterControl.get_data_state = WAIT_8ms_D2;
+                gAltimeterControl.reading_temp = gAltimeterControl.converting_temp;
+                if(gAltimeterControl.reading_temp)
+                {
+                    gAltimeterControl.have_temp = true;
+                    gAltimeterControl.press_count = 0;
+                }
+                else
+                {
+                    gAltimeterControl.press_count++;
+                    gAltimeterControl.press_time = gAltimeterControl.conv_time;
+                }
+
+                /* Starts converting as soon as the read is clocked out. If the queue
+                 * is full it gets started the usual way after the read. */
+                gAltimeterControl.next_queued = gAltimeterControl.pipelined &&
+                                                ms5607_02ba03_convert(ms5607_02ba03_next_is_temp());
+                gAltimeterControl.get_data_state = WAIT_READ;
+                returnStatus = SENSOR_BUSY;
             }
             break;
-        case WAIT_8ms_D2:
-            /* wait 8ms */
-            /* if 8ms done */
-            if(get_timer_count() - gAltimeterControl.time_start > EIGHT_MS)
+        case WAIT_READ:
+            readDone = gAltimeterControl.send_complete;
+            if(gAltimeterControl.next_queued)
             {
-                ms5607_02ba03_read_data();
-                gAltimeterControl.get_data_state = WAIT_D2_READ;
-                returnStatus = SENSOR_WAITING;
+                readDone = readDone && gAltimeterControl.cmd_complete;
             }
-            break;
-        case WAIT_D2_READ:
-            if(true == gAltimeterControl.send_complete)
+
+            if(readDone)
             {
-                gAltimeterControl.raw_vals.dig_temp = get_data_from_buffer24(gAltimeterControl.spi_recv_buffer);
-                /* Do math */
-                ms5607_02ba03_calculate_temp();
-                ms5607_02ba03_calculate_press();
-                gAltimeterControl.get_data_state = ENQUEUE_D1_CONVERT;
-                returnStatus = SENSOR_COMPLETE;
+                if(gAltimeterControl.reading_temp)
+                {
+                    gAltimeterControl.raw_vals.dig_temp = get_data_from_buffer24(gAltimeterControl.spi_recv_buffer);
+                    ms5607_02ba03_calculate_temp();
+                }
+                else
+                {
+                    gAltimeterControl.raw_vals.dig_press = get_data_from_buffer24(gAltimeterControl.spi_recv_buffer);
+                    ms5607_02ba03_calculate_press();
+                    returnStatus = SENSOR_COMPLETE;
+                }
+
+                if(gAltimeterControl.next_queued)
+                {
+                    /* The next conversion is already running */
+                    ms5607_02ba03_start_conv_timer();
+                    gAltimeterControl.get_data_state = WAIT_CONVERSION;
+                }
+                else
+                {
+                    gAltimeterControl.get_data_state = ENQUEUE_CONVERT;
+                }
             }
             break;
     }
     return returnStatus;
  }
 
+/**
+ * @brief 64 bit value made of two 32 bit halves
+ *
+ * The compensation math needs 64 bit intermediates, but avr-gcc turns every
+ * 64 bit multiply and shift into a slow library call. Building the results
+ * from 32 bit halves keeps it to hardware 16 x 16 multiplies and 32 bit
+ * adds. The AVR is little endian, so lo comes first.
+ */
+typedef union
+{
+    int64_t value;          /**< The whole thing */
+    struct
+    {
+        uint32_t lo;        /**< Bits 0 to 31 */
+        int32_t  hi;        /**< Bits 32 to 63 */
+    } half;                 /**< The halves */
+} ms5607_02ba03_wide_t;
+
+/**
+ * @brief Signed 32 x unsigned 32 bit multiply with a 64 bit result
+ *
+ * @param a Signed factor
+ * @param b Unsigned factor
+ * @return a * b, exactly
+ *
+ * Four 16 x 16 -> 32 bit multiplies on the magnitude, then the sign.
+ */
+static int64_t ms5607_02ba03_mul32(int32_t a, uint32_t b)
+{
+    ms5607_02ba03_wide_t result;
+    Bool negative = (a < 0);
+    uint32_t mag = negative ? ((uint32_t)0 - (uint32_t)a) : (uint32_t)a;
+    uint32_t lowLow = (uint32_t)(uint16_t)mag * (uint16_t)b;
+    uint32_t lowHigh = (uint32_t)(uint16_t)mag * (uint16_t)(b >> 16);
+    uint32_t highLow = (uint32_t)(uint16_t)(mag >> 16) * (uint16_t)b;
+    uint32_t highHigh = (uint32_t)(uint16_t)(mag >> 16) * (uint16_t)(b >> 16);
+    /* Bits 16 to 31 of the three low products, with their carry */
+    uint32_t middle = (lowLow >> 16) + (uint16_t)lowHigh + (uint16_t)highLow;
+
+    result.half.lo = (lowLow & 0xFFFF) | (middle << 16);
+    result.half.hi = (int32_t)(highHigh + (lowHigh >> 16) + (highLow >> 16) + (middle >> 16));
+
+    return negative ? -result.value : result.value;
+}
+
+/**
+ * @brief Arithmetic shift right of a 64 bit value
+ *
+ * @param x Value to shift
+ * @param shift 1 to 31 bits
+ * @return x >> shift, rounded toward minus infinity like the 64 bit shift
+ */
+static int64_t ms5607_02ba03_shr64(int64_t x, uint8_t shift)
+{
+    ms5607_02ba03_wide_t wide;
+
+    wide.value = x;
+    wide.half.lo = (wide.half.lo >> shift) | ((uint32_t)wide.half.hi << (32 - shift));
+    wide.half.hi = wide.half.hi >> shift;
+
+    return wide.value;
+}
+
+/**
+ * @brief Square of a signed value, times a small factor
+ *
+ * @param x Value to square
+ * @param factor Multiplier, small enough that factor * |x| fits in 31 bits
+ * @return factor * x^2, exactly
+ */
+static int64_t ms5607_02ba03_scaled_square(int32_t x, uint8_t factor)
+{
+    uint32_t mag = (x < 0) ? ((uint32_t)0 - (uint32_t)x) : (uint32_t)x;
+
+    return ms5607_02ba03_mul32((int32_t)(mag * factor), mag);
+}
+
 /**
  * @brief Convert raw adc temp value to sensible units. 
  * 
  * This does some fun math to figure out the temp.
  * If you want details I suggest seeing the driver doc 
  *
+ * Includes the datasheet's second order compensation, which matters below
+ * 20 C. It also works out the second order pressure corrections, since they
+ * depend on the first order temperature.
  */
 void ms5607_02ba03_calculate_temp(void)
 {    
+    int32_t temp;
+    int32_t tempLow;
+    int32_t tempVeryLow;
+    int32_t tempSecond = 0;
+
     /* dT = D2 - TREF = D2 - C5 * 2^8 */
     gAltimeterControl.raw_vals.t_diff = (int32_t)(gAltimeterControl.raw_vals.dig_temp - ((uint32_t)gAltimeterControl.calibration_vals.t_ref << 8));
 
     /* TEMP =20°C +dT* TEMPSENS =2000 + dT * C6 / 2^23 */
-    gAltimeterControl.final_vals.temp = (int32_t)(2000 + ((gAltimeterControl.raw_vals.t_diff * (uint32_t)gAltimeterControl.calibration_vals.temp_sens) >> 23));
+    temp = (int32_t)(2000 + ms5607_02ba03_shr64(ms5607_02ba03_mul32(gAltimeterControl.raw_vals.t_diff,
+                                                                    gAltimeterControl.calibration_vals.temp_sens), 23));
+
+    gAltimeterControl.raw_vals.offset2 = 0;
+    gAltimeterControl.raw_vals.sens2 = 0;
+
+    if(temp < 2000)
+    {
+        /* T2 = dT^2 / 2^31 */
+        tempSecond = (int32_t)ms5607_02ba03_shr64(ms5607_02ba03_scaled_square(gAltimeterControl.raw_vals.t_diff, 1), 31);
+
+        /* OFF2 = 61 * (TEMP - 2000)^2 / 2^4, SENS2 = 2 * (TEMP - 2000)^2 */
+        tempLow = temp - 2000;
+        gAltimeterControl.raw_vals.offset2 = ms5607_02ba03_shr64(ms5607_02ba03_scaled_square(tempLow, 61), 4);
+        gAltimeterControl.raw_vals.sens2 = ms5607_02ba03_scaled_square(tempLow, 2);
+
+        if(temp < -1500)
+        {
+            /* OFF2 = OFF2 + 15 * (TEMP + 1500)^2, SENS2 = SENS2 + 8 * (TEMP + 1500)^2 */
+            tempVeryLow = temp + 1500;
+            gAltimeterControl.raw_vals.offset2 += ms5607_02ba03_scaled_square(tempVeryLow, 15);
+            gAltimeterControl.raw_vals.sens2 += ms5607_02ba03_scaled_square(tempVeryLow, 8);
+        }
+    }
+
+    gAltimeterControl.final_vals.temp = temp - tempSecond;
 }
 
 /** 
@@ -306,31 +554,54 @@ void ms5607_02ba03_calculate_temp(void)
  * This does some fun math to figure out the pressure.
  * If you want details I suggest seeing the driver doc 
  *
+ * Call ms5607_02ba03_calculate_temp first, for dT and the second order corrections.
  */
 void ms5607_02ba03_calculate_press(void)
 {
     int64_t press_offs, press_sens;
+    ms5607_02ba03_wide_t offsT1;
+    ms5607_02ba03_wide_t sensT1;
+    ms5607_02ba03_wide_t sens;
+    ms5607_02ba03_wide_t product;
+
+    /* C2 * 2^17 and C1 * 2^16, put together by halves */
+    offsT1.half.lo = (uint32_t)gAltimeterControl.calibration_vals.offset << 17;
+    offsT1.half.hi = (int32_t)(gAltimeterControl.calibration_vals.offset >> 15);
+    sensT1.half.lo = (uint32_t)gAltimeterControl.calibration_vals.sens << 16;
+    sensT1.half.hi = 0;
 
     /* OFF = OFFT1 +TCO* dT = C2 * 2^17 +(C4 *dT )/2^6 */
-    press_offs = (int64_t)(((int64_t)gAltimeterControl.calibration_vals.offset << 17) +
-               (((int64_t)gAltimeterControl.calibration_vals.tco * (int64_t)gAltimeterControl.raw_vals.t_diff) >> 6));
+    press_offs = offsT1.value +
+                 ms5607_02ba03_shr64(ms5607_02ba03_mul32(gAltimeterControl.raw_vals.t_diff, gAltimeterControl.calibration_vals.tco), 6);
 
     /* SENS = SENST1 + TCS* dT= C1 * 2^16 + (C3 * dT ) / 2^7 */
-    press_sens = (int64_t)(((int64_t)gAltimeterControl.calibration_vals.sens << 16) + 
-                (((int64_t)gAltimeterControl.calibration_vals.tcs * (int64_t)gAltimeterControl.raw_vals.t_diff) >> 7));
+    press_sens = sensT1.value +
+                 ms5607_02ba03_shr64(ms5607_02ba03_mul32(gAltimeterControl.raw_vals.t_diff, gAltimeterControl.calibration_vals.tcs), 7);
 
-    /* P = D1 * SENS - OFF = (D1 * SENS / 2^21 - OFF) / 2^15  */
-    gAltimeterControl.final_vals.pressure = (int32_t)( ( ( ((int64_t)gAltimeterControl.raw_vals.dig_press * press_sens) >> 21) - press_offs) >> 15 );
+    /* Second order */
+    press_offs -= gAltimeterControl.raw_vals.offset2;
+    press_sens -= gAltimeterControl.raw_vals.sens2;
 
+    /* D1 * SENS. D1 is 24 bits and SENS about 34, so do the low half of SENS
+     * with the wide multiply and add the small high half into the top. */
+    sens.value = press_sens;
+    product.value = ms5607_02ba03_mul32((int32_t)gAltimeterControl.raw_vals.dig_press, sens.half.lo);
+    product.half.hi += (int32_t)gAltimeterControl.raw_vals.dig_press * sens.half.hi;
+
+    /* P = D1 * SENS - OFF = (D1 * SENS / 2^21 - OFF) / 2^15  */
+    gAltimeterControl.final_vals.pressure = (int32_t)ms5607_02ba03_shr64(ms5607_02ba03_shr64(product.value, 21) - press_offs, 15);
 }
 
 /**
  * @brief Copies Altimeter data
  *
  * @param[out] out_data The caller's struct that data will be copied into
+ * @return get_timer_us when the pressure conversion finished
  */
-void ms5607_02ba03_get_data(ms5607_02ba03_data_t *out_data)
+uint64_t ms5607_02ba03_get_data(ms5607_02ba03_data_t *out_data)
 {
     out_data->temp = gAltimeterControl.final_vals.temp;
     out_data->pressure = gAltimeterControl.final_vals.pressure;
+
+    return gAltimeterControl.press_time;
 }
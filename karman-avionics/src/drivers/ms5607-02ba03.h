@@ -15,6 +15,7 @@
 
 #include "Spi_service.h"
 #include "SensorTask.h"
+#include "SoftTimer.h"
 
 /** Holds the current SPI input/output */
 #define ALTIMETER_SPI_BUFF_SIZE (18)
@@ -36,6 +37,8 @@ typedef struct altimeter_raw_s
     uint32_t dig_press;     /**< d1 */
     uint32_t dig_temp;      /**< d2 */
     int32_t t_diff;         /**< dt */
+    int64_t offset2;        /**< Second order pressure offset correction, OFF2 */
+    int64_t sens2;          /**< Second order pressure sensitivity correction, SENS2 */
 } ms5607_02ba03_raw_t;
 
 /** Final computed data */
@@ -45,17 +48,29 @@ typedef struct altimeter_data_s
     int32_t pressure;       /**< Pressure in the form YYYYYY.XX millibar (bizzare right?) */
 } ms5607_02ba03_data_t;
 
+/** Oversampling ratio. More samples is less noise and a longer conversion. */
+typedef enum
+{
+    ALTIMETER_OSR_256 = 0,  /**< 0.6 ms conversion */
+    ALTIMETER_OSR_512,      /**< 1.17 ms conversion */
+    ALTIMETER_OSR_1024,     /**< 2.28 ms conversion */
+    ALTIMETER_OSR_2048,     /**< 4.54 ms conversion */
+    ALTIMETER_OSR_4096,     /**< 9.04 ms conversion */
+    ALTIMETER_NUM_OSR       /**< Number of settings */
+} ms5607_02ba03_osr_t;
+
+/** Pressure OSR out of reset */
+#define ALTIMETER_DEFAULT_PRESS_OSR (ALTIMETER_OSR_2048)
+/** Temperature OSR out of reset */
+#define ALTIMETER_DEFAULT_TEMP_OSR  (ALTIMETER_OSR_2048)
+
 /** State machine for altimeter */
 typedef enum
 {
-    ENQUEUE_D1_CONVERT, /**< Take Pressure Measurement */
-    WAIT_D1_CONVERT,    /**< Wait for SPI transaction to complete */
-    WAIT_8ms_D1,        /**< Wait for measurement to complete */
-    WAIT_D1_READ,       /**< Read Pressure ADC value */
-    ENQUEUE_D2_CONVERT, /**< Take Temperature Measurement */
-    WAIT_D2_CONVERT,    /**< Wait for SPI transaction to complete */
-    WAIT_8ms_D2,        /**< Wait for measurement to complete */
-    WAIT_D2_READ        /**< Read Temp ADC value and convert both measurements */
+    ENQUEUE_CONVERT,    /**< Start a pressure or temperature conversion */
+    WAIT_CONVERT,       /**< Wait for SPI transaction to complete */
+    WAIT_CONVERSION,    /**< Wait for measurement to complete, then queue the ADC read */
+    WAIT_READ           /**< Read the ADC value, and convert it */
 } ms5607_02ba03_state_t;
 
 /** Control structure for Altimeter */
@@ -66,11 +81,26 @@ typedef struct altimeter_control_s
     volatile uint8_t    spi_send_buffer[ALTIMETER_SPI_BUFF_SIZE]; /**< Data to be sent out */
     volatile uint8_t    spi_recv_buffer[ALTIMETER_SPI_BUFF_SIZE]; /**< Data received by the device */
     volatile Bool       send_complete; /**< Boolean to know when transaction complete */
+    volatile uint8_t    spi_cmd_buffer[1]; /**< Convert command, its own buffer so it can queue behind an ADC read */
+    volatile Bool       cmd_complete;  /**< Boolean to know when the convert command is out */
     ms5607_02ba03_cal_t calibration_vals; /**< PROM calibration values */
     ms5607_02ba03_raw_t raw_vals;         /**< Raw ADC Values */
     ms5607_02ba03_data_t final_vals;      /**< Usable values */
     ms5607_02ba03_state_t get_data_state; /**< state machine */
-    uint32_t            time_start;       /**< For keeping track of time */
+    soft_timer_t        conv_timer;       /**< Fires when the conversion in progress is done */
+    Bool                conv_done;        /**< Set by conv_timer, the ADC result is ready to read */
+    uint64_t            conv_time;        /**< get_timer_us when conv_timer fired, within a tick of the end of the conversion */
+    uint64_t            press_time;       /**< conv_time of the pressure in final_vals */
+    ms5607_02ba03_osr_t press_osr;        /**< OSR for the next pressure conversion */
+    ms5607_02ba03_osr_t temp_osr;         /**< OSR for the next temperature conversion */
+    uint8_t             press_per_temp;   /**< Pressure conversions for each temperature conversion */
+    Bool                pipelined;        /**< Queue the next conversion right behind each ADC read */
+    uint8_t             conv_wait;        /**< Timer ticks the conversion in progress takes */
+    Bool                converting_temp;  /**< The conversion in progress is D2 */
+    Bool                reading_temp;     /**< The ADC read in progress is D2 */
+    Bool                next_queued;      /**< The next convert command is queued behind the ADC read */
+    Bool                have_temp;        /**< A D2 has been converted since init */
+    uint8_t             press_count;      /**< Pressure conversions since the last temperature conversion */
 } ms5607_02ba03_control_t;
 
 
@@ -78,19 +108,20 @@ void ms5607_02ba03_init(spi_master_t *spi_master);
 
 sensor_status_t ms5607_02ba03_run(void);
 
-void ms5607_02ba03_get_data(ms5607_02ba03_data_t *out_data);
+uint64_t ms5607_02ba03_get_data(ms5607_02ba03_data_t *out_data);
 
 void ms5607_02ba03_reset(void);
 
 /* 128 bits of calibration */
-void ms5607_02ba03_read_prom(void);
+Bool ms5607_02ba03_read_prom(void);
 
-void ms5607_02ba03_d1_convert(void);
+void ms5607_02ba03_configure(ms5607_02ba03_osr_t press_osr, ms5607_02ba03_osr_t temp_osr,
+                             uint8_t press_per_temp, Bool pipelined);
 
-void ms5607_02ba03_d2_convert(void);
+Bool ms5607_02ba03_convert(Bool temperature);
 
 /* 24 bits pressure/temperature */
-void ms5607_02ba03_read_data(void);
+Bool ms5607_02ba03_read_data(void);
 
 void ms5607_02ba03_calculate_temp(void);
 
@@ -15,6 +15,8 @@
 #include "Spi_service.h"
 #include "Spi_bg_task.h"
 #include "ISRUtils.h"
+#include "Timer.h"
+#include "Background.h"
 
 #define EXTFLASH_MOSI (FLASH_MOSI) /**< Internal definition of flash MOSI */
 #define EXTFLASH_MISO (FLASH_MISO) /**< Internal definition of flash MISO */
@@ -28,24 +30,24 @@
 #define EXTFLASH_WRITE_ENABLE   (0x06) /**< Write enable command. Write enable must be sent before page program */
 #define EXTFLASH_4BYTEMODE      (0xB7) /**< Config value for 4 byte address mode */
 #define EXTFLASH_PAGE_PROGRAM   (0x02) /**< Page program command. i.e. actually write something. */
+#define EXTFLASH_READ_ID_CMD    (0x9F) /**< Read JEDEC ID command */
+#define EXTFLASH_FAST_READ_4B   (0x0C) /**< 4 byte address fast read. Followed by 8 dummy clocks */
+#define EXTFLASH_SUBSECTOR_ERASE (0x20) /**< Erase the 4 KiB subsector at the address. 4 byte address in 4 byte mode */
+#define EXTFLASH_SECTOR_ERASE   (0xD8) /**< Erase the 64 KiB sector at the address. 4 byte address in 4 byte mode */
+
+#define EXTFLASH_ID_MANUFACTURER (0x20) /**< Micron */
+#define EXTFLASH_ID_CAPACITY     (0x20) /**< 512Mb */
 
 #define EXTFLASH_CS_PORT (FLASH_PORT) /**< Internal definition of chip select port */
 #define EXTFLASH_CS_BM   (FLASH_CS)   /**< Internal definition of chip select pin */
 
 #define EXTFLASH_WREN_LATCH  (1 << 1) /**< Status register mask for write enable */
+#define EXTFLASH_WIP         (1 << 0) /**< Status register mask for write in progress */
 
-#define SPI_BAUD_RATE (1000000) /**< 1MHz */
-
-#ifndef F_CPU
-#define F_CPU (sysclk_get_per_hz()) /**< CPU Frequency */
-#endif
-
-/**
- * @brief Calculate Baud control value for USART.
- * 
- * See https://github.com/abcminiuser/lufa/blob/master/LUFA/Drivers/Peripheral/XMEGA/SerialSPI_XMEGA.h 
- */
-#define SPI_BAUDCTRLVAL(Baud)       ((Baud < (F_CPU / 2)) ? ((F_CPU / (2 * Baud)) - 1) : 0)
+#define EXTFLASH_WREN_TIMEOUT    (5)  /**< 1ms, in timer ticks. Write enable is immediate */
+#define EXTFLASH_PROGRAM_TIMEOUT (50) /**< 10ms, in timer ticks. Page program is 5ms max */
+#define EXTFLASH_SUBSECTOR_TIMEOUT (5000UL)  /**< 1s, in timer ticks. Subsector erase is 0.8s max */
+#define EXTFLASH_SECTOR_TIMEOUT    (17500UL) /**< 3.5s, in timer ticks. Sector erase is 3s max */
 
 /** SPI Master instance. */
 spi_master_t extflashSpiMaster;
@@ -61,17 +63,13 @@ void init_extflash(void)
     /** Initialize USART in SPI Master Mode */
     /* See XMEGA AU Manual page 146, page 280 */
     /* NOTE PINS ARE SETUP TO USE USART IN SPI MASTER MODE! */
-
-    uint16_t baudrate = SPI_BAUDCTRLVAL(SPI_BAUD_RATE);
-
-    sysclk_enable_peripheral_clock(&EXTFLASH_SPI);
-    EXTFLASH_SPI.BAUDCTRLB = (uint8_t)((baudrate) >> 8); /* MSBs of Baud rate value. */
-    EXTFLASH_SPI.BAUDCTRLA = (uint8_t)(baudrate & 0xFF); /* LSBs of Baud rate value. */
-    EXTFLASH_SPI.CTRLA = 0x10; /* RXCINTLVL = 1, other 2 disabled */
-    EXTFLASH_SPI.CTRLB = 0x18; /* Enable RX and TX */
-    EXTFLASH_SPI.CTRLC = 0xC0; /* MSB first, mode 0. PMODE, SBMODE, CHSIZE ignored by SPI */
+    spi_master_hw_init(&EXTFLASH_SPI, SPI_MASTER_DEFAULT_BAUD);
 
     init_spi_master_service(&extflashSpiMaster, &EXTFLASH_SPI, &EXTFLASH_SPI_PORT, spi_bg_task);
+    /* Page programs are 261 bytes, let the DMA move them */
+    spi_master_enable_dma(&extflashSpiMaster,
+                          FLASH_SPI_DMA_RX, FLASH_SPI_DMA_RX_TRIG,
+                          FLASH_SPI_DMA_TX, FLASH_SPI_DMA_TX_TRIG);
     spi_bg_add_master(&extflashSpiMaster);
 
     /* Initialize chip select and other control variables */
@@ -81,6 +79,16 @@ void init_extflash(void)
     
     gExtflashControl.send_complete = false;
     gExtflashControl.task_inprog = false;
+    memset((void *)&(gExtflashControl.write_engine), 0, sizeof(gExtflashControl.write_engine));
+    gExtflashControl.write_engine.state = EXTFLASH_WR_IDLE;
+    add_background_function(extflash_write_task);
+
+    /* Run as fast as the part allows, as long as the ID reads back right at that speed */
+    spi_master_set_cs_baud(&(gExtflashControl.cs_info), FLASH_SPI_BAUD);
+    if(!extflash_check_id())
+    {
+        spi_master_set_cs_baud(&(gExtflashControl.cs_info), 0);
+    }
 
     extflash_initialize_regs();
 }
@@ -91,6 +99,36 @@ ISR(FLASH_SPI_INT)
     spi_master_ISR(&extflashSpiMaster);
 }
 
+/** 
+ * @brief Read the JEDEC ID and check it's the part we expect
+ *
+ * @return True if the ID matches, false otherwise
+ *
+ * Used at init to make sure the bus works at the chosen clock rate.
+ */
+Bool extflash_check_id(void)
+{
+    Bool idMatch = false;
+
+    memset((void *)(gExtflashControl.spi_recv_buffer), 0, 4);
+    gExtflashControl.spi_send_buffer[0] = EXTFLASH_READ_ID_CMD;
+
+    /* Command byte, then manufacturer, memory type, capacity */
+    if(spi_master_blocking_send_request(&(extflashSpiMaster),
+                                        &(gExtflashControl.cs_info),
+                                        (void *)(gExtflashControl.spi_send_buffer),
+                                        1,
+                                        (void *)(gExtflashControl.spi_recv_buffer),
+                                        4,
+                                        &(gExtflashControl.send_complete)))
+    {
+        idMatch = (gExtflashControl.spi_recv_buffer[1] == EXTFLASH_ID_MANUFACTURER) &&
+                  (gExtflashControl.spi_recv_buffer[3] == EXTFLASH_ID_CAPACITY);
+    }
+
+    return idMatch;
+}
+
 /** Initialize non-volatile control registers */
 void extflash_initialize_regs(void)
 {
@@ -123,7 +161,9 @@ void extflash_initialize_regs(void)
  * @param block Use blocking/nonblocking path
  * @return false--No error, true--error
  *
- * Read num_bytes from the flash memory starting at address addr and store them in buf
+ * Read num_bytes from the flash memory starting at address addr and store them in buf.
+ * Any length works, the data goes straight into buf with nothing in front of it.
+ * In non-blocking mode buf must stay untouched until extflash_get_status returns false.
  * NOTE: Using 4 byte address mode -- 
  *        http://www.micron.com/~/media/Documents/Products/Data%20Sheet/NOR%20Flash/Serial%20NOR/N25Q/n25q_512mb_1ce_3v_65nm.pdf
  */
@@ -131,47 +171,71 @@ Bool extflash_read(uint32_t addr, size_t num_bytes, uint8_t *buf, Bool block)
 {
     Bool retVal = false; /* False means no error! */
 
-    if(gExtflashControl.task_inprog)
+    if(gExtflashControl.task_inprog || extflash_write_busy())
     {
-        retVal = true; /* BUSY yo */
+        retVal = true; /* BUSY yo. Reads during a page program return garbage */
     }
-    else
+    else if((addr > EXTFLASH_SIZE) || ((addr + num_bytes) > EXTFLASH_SIZE))
     {
-        /* READ Command is 0x03 for normal read. Format: CMD ADDR[3 - 0] {DUMMY BYTES} */
-        /* We're not using any dummy clock cycles in standard SPI mode. */
-        memset((void *)(gExtflashControl.spi_send_buffer), 0, sizeof(gExtflashControl.spi_send_buffer)/sizeof(gExtflashControl.spi_send_buffer[0]));
-
+        retVal = true;
+    }
+    else if(num_bytes > 0)
+    {
+        /* FAST READ is CMD ADDR[3 - 0] DUMMY, then data for as long as the clock keeps going. */
         /* SPI is MSB FIRST in mode 0. AVR-GCC treats larger integers as little endian. */
-        gExtflashControl.spi_send_buffer[0] = EXTFLASH_READ_DATA_CMD;
+        gExtflashControl.read_cmd_buffer[0] = EXTFLASH_FAST_READ_4B;
         /* Ensure that our bytes are sent MSB first. */
-        gExtflashControl.spi_send_buffer[1] = (uint8_t)((num_bytes & 0xFF000000) >> 24);
-        gExtflashControl.spi_send_buffer[2] = (uint8_t)((num_bytes & 0x00FF0000) >> 16);
-        gExtflashControl.spi_send_buffer[3] = (uint8_t)((num_bytes & 0x0000FF00) >> 8);
-        gExtflashControl.spi_send_buffer[4] = (uint8_t)((num_bytes & 0x000000FF));
-
+        gExtflashControl.read_cmd_buffer[1] = (uint8_t)((addr & 0xFF000000) >> 24);
+        gExtflashControl.read_cmd_buffer[2] = (uint8_t)((addr & 0x00FF0000) >> 16);
+        gExtflashControl.read_cmd_buffer[3] = (uint8_t)((addr & 0x0000FF00) >> 8);
+        gExtflashControl.read_cmd_buffer[4] = (uint8_t)((addr & 0x000000FF));
+        gExtflashControl.read_cmd_buffer[5] = 0x00; /* 8 dummy clocks */
+
+        /* Two requests with chip select held low in between. The first sends the command,
+         * the second clocks the data straight into the caller's buffer, so there are no
+         * command bytes to strip and no copy. The second request sends nothing, the
+         * service clocks out filler bytes that the flash ignores. */
         if(block)
         {
-            /* We want to send 5 bytes and recieive as many as the caller asked for. */
-            retVal = spi_master_blocking_send_request(&(extflashSpiMaster),
-                                                      &(gExtflashControl.cs_info),
-                                                      (void *)(gExtflashControl.spi_send_buffer),
-                                                      EXTFLASH_CMDADDR_SIZE,
-                                                      (void *)(gExtflashControl.spi_recv_buffer),
-                                                      EXTFLASH_CMDADDR_SIZE + num_bytes,
-                                                      &(gExtflashControl.send_complete));
-            /* Copy data into caller's buffer, ignoring garbage data from sending command */
-            memcpy((void *)buf, (void *)(&(gExtflashControl.spi_recv_buffer[5])), num_bytes);
+            retVal = !spi_master_blocking_send_req_cslow(&(extflashSpiMaster),
+                                                         &(gExtflashControl.cs_info),
+                                                         (void *)(gExtflashControl.read_cmd_buffer),
+                                                         EXTFLASH_FAST_READ_HDR_SIZE,
+                                                         (void *)(gExtflashControl.spi_recv_buffer),
+                                                         0,
+                                                         &(gExtflashControl.read_cmd_complete));
+            if(!retVal)
+            {
+                retVal = !spi_master_blocking_send_request(&(extflashSpiMaster),
+                                                           &(gExtflashControl.cs_info),
+                                                           (void *)(gExtflashControl.read_cmd_buffer),
+                                                           0,
+                                                           (void *)buf,
+                                                           num_bytes,
+                                                           &(gExtflashControl.send_complete));
+            }
+        }
+        else if((SPI_MASTER_QUEUE_DEPTH - spi_master_queue_count(&extflashSpiMaster)) < 2)
+        {
+            /* Both halves have to go in, or chip select is left low */
+            retVal = true;
         }
         else
         {
-            /* NOTE: It is the responsiblity of the CALLER to discard the first 5 bytes of this buffer!!! */
-            retVal = spi_master_enqueue(&(extflashSpiMaster),
-                                    &(gExtflashControl.cs_info),
-                                    (void *)(gExtflashControl.spi_send_buffer),
-                                    EXTFLASH_CMDADDR_SIZE,
-                                    (void *)buf,
-                                    num_bytes,
-                                    &(gExtflashControl.send_complete));
+            (void)spi_master_enqueue_cslow(&(extflashSpiMaster),
+                                           &(gExtflashControl.cs_info),
+                                           (void *)(gExtflashControl.read_cmd_buffer),
+                                           EXTFLASH_FAST_READ_HDR_SIZE,
+                                           (void *)(gExtflashControl.spi_recv_buffer),
+                                           0,
+                                           &(gExtflashControl.read_cmd_complete));
+            (void)spi_master_enqueue(&(extflashSpiMaster),
+                                     &(gExtflashControl.cs_info),
+                                     (void *)(gExtflashControl.read_cmd_buffer),
+                                     0,
+                                     (void *)buf,
+                                     num_bytes,
+                                     &(gExtflashControl.send_complete));
 
             gExtflashControl.task_inprog = true;
         }
@@ -237,7 +301,7 @@ Bool extflash_read_status_reg(uint16_t *buf, Bool block)
     if(block)
     {
         /* Send a blocking request. NOTE: In order to finish the request, the status register needs to be clocked out. */
-        retVal = spi_master_blocking_send_request(&(extflashSpiMaster),
+        retVal = !spi_master_blocking_send_request(&(extflashSpiMaster),
                                                   &(gExtflashControl.cs_info),
                                                   (void *)(gExtflashControl.spi_send_buffer),
                                                   1,
@@ -254,15 +318,94 @@ Bool extflash_read_status_reg(uint16_t *buf, Bool block)
     return retVal;
 }
 
+/**
+ * @brief Wait for the flash to finish a program or erase
+ *
+ * @param timeout How long to wait, in timer ticks
+ * @return True on failure or timeout, false once the flash is ready
+ *
+ * Polls the Write In Progress bit of the status register. Blocking only!
+ */
+static Bool extflash_wait_ready(uint32_t timeout)
+{
+    Bool retVal = false;
+    uint16_t statusreg = 0;
+    uint32_t startTime = get_timer_count();
+
+    do
+    {
+        if(extflash_read_status_reg(&statusreg, true) || ((get_timer_count() - startTime) > timeout))
+        {
+            retVal = true;
+            break;
+        }
+    } while(((statusreg & 0xFF00) >> 8) & EXTFLASH_WIP);
+
+    return retVal;
+}
+
+/**
+ * @brief Number of bytes that can be programmed at addr before the page ends
+ *
+ * @param addr Address the program starts at
+ * @param num_bytes Bytes left to write
+ * @return The smaller of num_bytes and the room left in addr's page
+ */
+static uint16_t extflash_page_chunk(uint32_t addr, size_t num_bytes)
+{
+    uint16_t pageRoom = EXTFLASH_PAGE_SIZE - (uint16_t)(addr & EXTFLASH_PAGE_MASK);
+
+    return (num_bytes < pageRoom) ? (uint16_t)num_bytes : pageRoom;
+}
+
+/**
+ * @brief Fill a send buffer with a command and a 4 byte address
+ *
+ * @param[out] sendBuff Buffer of at least EXTFLASH_CMDADDR_SIZE
+ * @param cmd Command byte
+ * @param addr Address the command works on
+ */
+static void extflash_fill_cmd_addr(volatile uint8_t *sendBuff, uint8_t cmd, uint32_t addr)
+{
+    sendBuff[0] = cmd;
+    /* Ensure that the address is MSB first */
+    sendBuff[1] = (uint8_t)((addr & 0xFF000000) >> 24);
+    sendBuff[2] = (uint8_t)((addr & 0x00FF0000) >> 16);
+    sendBuff[3] = (uint8_t)((addr & 0x0000FF00) >> 8);
+    sendBuff[4] = (uint8_t)((addr & 0x000000FF));
+}
+
+/**
+ * @brief Fill a send buffer with a page program command
+ *
+ * @param[out] sendBuff Buffer of at least EXTFLASH_CMDADDR_SIZE + num_bytes
+ * @param addr Address to program
+ * @param data Data to program
+ * @param num_bytes Number of bytes, must not cross a page boundary
+ */
+static void extflash_fill_page_program(volatile uint8_t *sendBuff, uint32_t addr, const uint8_t *data, uint16_t num_bytes)
+{
+    /* We want a page program at the address the caller gave us. */
+    extflash_fill_cmd_addr(sendBuff, EXTFLASH_PAGE_PROGRAM, addr);
+
+    /* Copy the request into the send buffer. The request can be up to 256 bytes. */
+    memcpy((void *)(&(sendBuff[EXTFLASH_CMDADDR_SIZE])), (void *)data, num_bytes);
+}
+
 /** @brief Enable writing to the flash memory module. 
+ *
+ * @param block Use blocking/nonblocking path
+ * @return True on failure, false on success
  *
  * This is finished when a read of the status regsiter shows that the write enable latch
- *  Is clear
+ * is set. Gives up after EXTFLASH_WREN_TIMEOUT.
+ * Non-blocking writes go through extflash_write_async, which sends its own write enables.
 */
 Bool extflash_write_enable(Bool block)
 {
      Bool retVal = false;
-     uint16_t statusreg;
+     uint16_t statusreg = 0;
+     uint32_t startTime;
 
      /* Clear the send buffer. */
      memset((void *)(gExtflashControl.spi_send_buffer), 0, sizeof(gExtflashControl.spi_send_buffer)/sizeof(gExtflashControl.spi_send_buffer[0]));
@@ -273,7 +416,7 @@ Bool extflash_write_enable(Bool block)
         gExtflashControl.spi_send_buffer[0] = EXTFLASH_WRITE_ENABLE;
 
         /* Send that one byte to the peripheral */
-        retVal = spi_master_blocking_send_request(&(extflashSpiMaster),
+        retVal = !spi_master_blocking_send_request(&(extflashSpiMaster),
                                                    &(gExtflashControl.cs_info),
                                                    (void *)(gExtflashControl.spi_send_buffer),
                                                    1,
@@ -281,17 +424,22 @@ Bool extflash_write_enable(Bool block)
                                                    0,
                                                    &(gExtflashControl.send_complete));
 
-        /* Keep reading the status regsiter until the write enable is confirmed. No timeout. this is pretty dangerous tbh. */
-        do 
+        /* Keep reading the status register until the write enable is confirmed, or we give up. */
+        startTime = get_timer_count();
+        while((retVal == false) && !(((statusreg & 0xFF00) >> 8) & EXTFLASH_WREN_LATCH))
         {
             /* Read status register to confirm that write has been enabled. */
             retVal = extflash_read_status_reg(&statusreg, block);
 
-        } while (~((statusreg & 0xFF00) >> 8) & EXTFLASH_WREN_LATCH); /* This do while ensures the write enable is completed */
+            if((get_timer_count() - startTime) > EXTFLASH_WREN_TIMEOUT)
+            {
+                retVal = true;
+            }
+        }
      }
      else
      {
-        /* Non-blocking not implemented yet... */
+        /* Use extflash_write_async */
          retVal = true;
      }
 
@@ -299,6 +447,8 @@ Bool extflash_write_enable(Bool block)
 }
 
 /** @brief Send a valid number of bytes to the flash memory.
+ *
+ * @return True on failure, false on success
  *
  * The caller is responsible for write enable and for read status register
  * NOTE: For internal use only! use extflash_write instead! It has the proper error checking
@@ -307,24 +457,12 @@ Bool extflash_write_one(uint16_t num_bytes, uint32_t addr, uint8_t *buf, uint16_
 {
     Bool retVal = false; /* no issues */
 
-    /* Clear the send buffer. */
-    memset((void *)(gExtflashControl.spi_send_buffer), 0, sizeof(gExtflashControl.spi_send_buffer)/sizeof(gExtflashControl.spi_send_buffer[0]));
-
     if(block)
     {
-        /* We want a page program at the address the caller gave us. */
-        gExtflashControl.spi_send_buffer[0] = EXTFLASH_PAGE_PROGRAM;
-        /* Ensure that the address is MSB first */
-        gExtflashControl.spi_send_buffer[1] = (uint8_t)((addr & 0xFF000000) >> 24);
-        gExtflashControl.spi_send_buffer[2] = (uint8_t)((addr & 0x00FF0000) >> 16);
-        gExtflashControl.spi_send_buffer[3] = (uint8_t)((addr & 0x0000FF00) >> 8);
-        gExtflashControl.spi_send_buffer[4] = (uint8_t)((addr & 0x000000FF));
-
-        /* Copy the request into the send buffer. The request can be up to 256 bytes. */
-        memcpy((void *)(&(gExtflashControl.spi_send_buffer[5])), (void *)(&(buf[buff_offset])), num_bytes);
+        extflash_fill_page_program(gExtflashControl.spi_send_buffer, addr, &(buf[buff_offset]), num_bytes);
 
         /* Send up to 256 + 5 bytes, expecting none in return. */
-        retVal = spi_master_blocking_send_request(&(extflashSpiMaster),
+        retVal = !spi_master_blocking_send_request(&(extflashSpiMaster),
                                                    &(gExtflashControl.cs_info),
                                                    (void *)(gExtflashControl.spi_send_buffer),
                                                    num_bytes + EXTFLASH_CMDADDR_SIZE,
@@ -334,7 +472,7 @@ Bool extflash_write_one(uint16_t num_bytes, uint32_t addr, uint8_t *buf, uint16_
     }
     else
     {
-        /* non-blocking not implemented... */
+        /* Use extflash_write_async */
          retVal = true;
     }
 
@@ -350,31 +488,25 @@ Bool extflash_write_one(uint16_t num_bytes, uint32_t addr, uint8_t *buf, uint16_
  * @return True on failure, false on success 
  *
  * Cannot write more than 65536 bytes. Why we would ever need to write that many is a mystery.
+ * The non-blocking path queues the write on the write engine, see extflash_write_async.
+ * buf must then stay untouched until extflash_write_busy() returns false.
 */
 Bool extflash_write(uint32_t addr, size_t num_bytes, uint8_t *buf, Bool block)
 {
     /** ALL WRITES MUST BE 256 BYTE ALIGNED
-     *  This means that if the address you want to write to is 0xXXXXXXF0 and you want to write more than more than 8 bytes, you must use more than one write operation.
+     *  This means that if the address you want to write to is 0xXXXXXXF0 and you want to write more than more than 16 bytes, you must use more than one write operation.
      *  Any write that goes over the 256 byte page boundary will reset to the beginning of the 256 byte page. (NOT GOOD).
      *
-     * Steps:
-     *      1) IF address is page aligned, go to step 3
-     *      2) Write bytes up to page boundary (256 byte pages)
-     *      3) Loop while > 256 bytes left: Write 256 bytes per page
-     *      4) Write excess bytes (up to 256) on new page (i.e. what's left over after: writing to first page boundary AND writing integer number of pages)
-     *  
-     *  For each write:
+     *  So the write is split at every page boundary. For each piece:
      *      Send Write Enable command (RAISE CS)
-     *      Send Page program + 4 byte address (DON'T RAISE CS)
-     *      Send up to ***256*** bytes of data (RAISE CS)
-     *      Send Read Status Register Command (CLK OUT 1 READ BYTE)
+     *      Send Page program + 4 byte address + up to ***256*** bytes of data (RAISE CS)
+     *      Read Status Register until Write In Progress clears
      */
 
     Bool retVal = false; /* no issues. */
-    uint16_t dummy = 0;
     uint32_t curr_addr = addr;
     size_t rem_bytes = num_bytes;
-    uint16_t num_bytes_to_send = num_bytes;
+    uint16_t num_bytes_to_send;
     uint16_t buffer_offset = 0;
 
     /* Validate address. Not too big and won't overflow the max number of bytes. */
@@ -385,70 +517,378 @@ Bool extflash_write(uint32_t addr, size_t num_bytes, uint8_t *buf, Bool block)
 
     if(block)
     {
-        /* If we're not page aligned, we need to write up to a page boundary in one write cycle. */
-        if(curr_addr & EXTFLASH_PAGE_MASK) /* not page aligned */
+        while((rem_bytes > 0) && (retVal == false))
         {
-            /* If we have enough bytes that we would overflow the page, and need a new one. */
-            if((EXTFLASH_PAGE_MASK - (curr_addr & EXTFLASH_PAGE_MASK)) < rem_bytes) /* write would overflow page boundary */
-            {
-                /* Enable writing. */
-                retVal = extflash_write_enable(block);
-
-                /* Send 0xFF - address & 0xff bytes. This will fill up the rest of the page. */
-                num_bytes_to_send = EXTFLASH_PAGE_MASK - (curr_addr & EXTFLASH_PAGE_MASK);
-                rem_bytes -= num_bytes_to_send;
-                /* Send that many bytes over SPI */
-                retVal |= extflash_write_one(num_bytes_to_send, curr_addr, buf, buffer_offset, block);
-                /* Page align curr_addr. If the lsb is not 0x00 we have a problem. */
-                /* (Num bytes to send + curr_addr) & 0xff is 0xFF by design.*/
-                curr_addr = curr_addr + num_bytes_to_send + 1;
-                buffer_offset += num_bytes_to_send;
-
-                /* Read the status register to finish the transaction. true means there is something wrong. */
-                retVal |= extflash_read_status_reg(&dummy, block);
-            }
-        }
+            /* Write up to the end of the current page */
+            num_bytes_to_send = extflash_page_chunk(curr_addr, rem_bytes);
 
-        /* Write full pages while we have more than 256 bytes left. */
-        while((rem_bytes > EXTFLASH_PAGE_SIZE) && (retVal == false)) /* Write full pages */
-        {
             /* Enable writing. */
-            retVal |= extflash_write_enable(block);
-
-            /* Send 256 bytes */
-            num_bytes_to_send = EXTFLASH_PAGE_SIZE;
-            rem_bytes -= num_bytes_to_send;
-            /* Send 256 bytes over SPI */
+            retVal = extflash_write_enable(block);
+            /* Send that many bytes over SPI */
             retVal |= extflash_write_one(num_bytes_to_send, curr_addr, buf, buffer_offset, block);
+            /* Wait for the program to finish before starting the next one. true means there is something wrong. */
+            retVal |= extflash_wait_ready(EXTFLASH_PROGRAM_TIMEOUT);
 
-            /* Add 256 to how many bytes we've sent. */
             curr_addr += num_bytes_to_send;
             buffer_offset += num_bytes_to_send;
-
-            /* Read the status register to finish the transaction. */
-            retVal |= extflash_read_status_reg(&dummy, block);
+            rem_bytes -= num_bytes_to_send;
         }
+    }
+    else
+    {
+        retVal = extflash_write_async(addr, num_bytes, buf, NULL, NULL);
+    }
+
+    return retVal;
+
+}
+
+/**
+ * @brief Check an erase request
+ *
+ * @param addr Start of the sector or subsector
+ * @param size EXTFLASH_SECTOR_SIZE or EXTFLASH_SUBSECTOR_SIZE
+ * @return True if it's a whole sector or subsector on the chip, false otherwise
+ */
+static Bool extflash_erase_valid(uint32_t addr, uint32_t size)
+{
+    return ((size == EXTFLASH_SECTOR_SIZE) || (size == EXTFLASH_SUBSECTOR_SIZE)) &&
+           ((addr & (size - 1)) == 0) && (addr < EXTFLASH_SIZE);
+}
+
+/**
+ * @brief Erase a sector or a subsector of the flash memory
+ *
+ * @param addr Start of the sector or subsector, aligned to its size
+ * @param size EXTFLASH_SECTOR_SIZE or EXTFLASH_SUBSECTOR_SIZE
+ * @param block Use blocking/nonblocking path
+ * @return True on failure, false on success
+ *
+ * Programming can only clear bits, so anything written over old data has to
+ * be erased back to 0xFF first. The blocking path waits up to a second for a
+ * subsector and three and a half for a sector, so only use it at startup.
+ * The non-blocking path queues the erase on the write engine, see extflash_erase_async.
+ */
+Bool extflash_erase(uint32_t addr, uint32_t size, Bool block)
+{
+    Bool retVal = false;
 
-        /* If we still have bytes to write, write the rest to a new page. Because of the checks above, */
-        /* this is guaranteed not to overflow the page. */
-        if((rem_bytes > 0) && (retVal == false)) /* Write remaining bytes to new page*/
+    if(!extflash_erase_valid(addr, size))
+    {
+        retVal = true;
+    }
+    else if(block)
+    {
+        retVal = extflash_write_enable(block);
+        if(!retVal)
+        {
+            extflash_fill_cmd_addr(gExtflashControl.spi_send_buffer,
+                                   (size == EXTFLASH_SECTOR_SIZE) ? EXTFLASH_SECTOR_ERASE : EXTFLASH_SUBSECTOR_ERASE,
+                                   addr);
+            /* The erase starts when chip select goes high */
+            retVal = !spi_master_blocking_send_request(&(extflashSpiMaster),
+                                                       &(gExtflashControl.cs_info),
+                                                       (void *)(gExtflashControl.spi_send_buffer),
+                                                       EXTFLASH_CMDADDR_SIZE,
+                                                       (void *)(gExtflashControl.spi_recv_buffer),
+                                                       0,
+                                                       &(gExtflashControl.send_complete));
+        }
+        if(!retVal)
         {
-            retVal |= extflash_write_enable(block);
+            retVal = extflash_wait_ready((size == EXTFLASH_SECTOR_SIZE) ? EXTFLASH_SECTOR_TIMEOUT : EXTFLASH_SUBSECTOR_TIMEOUT);
+        }
+    }
+    else
+    {
+        retVal = extflash_erase_async(addr, size, NULL, NULL);
+    }
 
-            num_bytes_to_send = rem_bytes;
-            /* Send that many bytes over SPI */
-            retVal |= extflash_write_one(num_bytes_to_send, curr_addr, buf, buffer_offset, block);
+    return retVal;
+}
 
-            retVal |= extflash_read_status_reg(&dummy, block);
+/**
+ * @brief Queue an erase of a sector or a subsector
+ *
+ * @param addr Start of the sector or subsector, aligned to its size
+ * @param size EXTFLASH_SECTOR_SIZE or EXTFLASH_SUBSECTOR_SIZE
+ * @param callback Called from the background task when the erase is done, with true on failure. May be NULL.
+ * @param[out] done Set true when the erase is done. May be NULL.
+ * @return True on failure (bad address or queue full), false on success
+ *
+ * Erases go through the same queue as writes, in order, so a write queued
+ * after the erase of its sector always lands on erased flash. The flash can't
+ * program while it erases, so writes behind an erase wait for it.
+ */
+Bool extflash_erase_async(uint32_t addr, uint32_t size, extflash_callback_t callback, volatile Bool *done)
+{
+    Bool retVal = false;
+    extflash_write_engine_t *engine = &(gExtflashControl.write_engine);
+    extflash_write_req_t *newRequest;
+
+    if(!extflash_erase_valid(addr, size))
+    {
+        retVal = true;
+    }
+    else if(extflash_write_queue_free() == 0)
+    {
+        retVal = true;
+    }
+    else
+    {
+        newRequest = &(engine->queue[engine->back & EXTFLASH_WRITE_QUEUE_MASK]);
+        newRequest->addr = addr;
+        newRequest->num_bytes = 0;
+        newRequest->buf = NULL;
+        newRequest->callback = callback;
+        newRequest->done = done;
+        newRequest->erase_cmd = (size == EXTFLASH_SECTOR_SIZE) ? EXTFLASH_SECTOR_ERASE : EXTFLASH_SUBSECTOR_ERASE;
+        if(done != NULL)
+        {
+            *done = false;
         }
+        engine->back++;
     }
-    else /* non-blocking flash memory code not implemented! */
+
+    return retVal;
+}
+
+/**
+ * @brief Queue a write to the flash memory
+ *
+ * @param addr Address to write to
+ * @param num_bytes Number of bytes to write
+ * @param buf Buffer to send bytes from. Must stay untouched until the write is done.
+ * @param callback Called from the background task when the write is done, with true on failure. May be NULL.
+ * @param[out] done Set true when the write is done. May be NULL.
+ * @return True on failure (bad address or queue full), false on success
+ *
+ * The write is split at page boundaries and run by extflash_write_task, one
+ * WRITE ENABLE, PAGE PROGRAM, poll Write In Progress cycle per page. Nothing
+ * here waits on the flash, so a page program never holds up a task.
+ */
+Bool extflash_write_async(uint32_t addr, size_t num_bytes, const uint8_t *buf, extflash_callback_t callback, volatile Bool *done)
+{
+    Bool retVal = false;
+    extflash_write_engine_t *engine = &(gExtflashControl.write_engine);
+    extflash_write_req_t *newRequest;
+
+    if((addr > EXTFLASH_SIZE) || ((addr + num_bytes) > EXTFLASH_SIZE) || (num_bytes == 0))
+    {
+        retVal = true;
+    }
+    else if(extflash_write_queue_free() == 0)
     {
         retVal = true;
     }
+    else
+    {
+        newRequest = &(engine->queue[engine->back & EXTFLASH_WRITE_QUEUE_MASK]);
+        newRequest->addr = addr;
+        newRequest->num_bytes = num_bytes;
+        newRequest->buf = buf;
+        newRequest->callback = callback;
+        newRequest->done = done;
+        newRequest->erase_cmd = 0;
+        if(done != NULL)
+        {
+            *done = false;
+        }
+        engine->back++;
+    }
 
     return retVal;
+}
+
+/**
+ * @brief Is the write engine doing anything?
+ *
+ * @return True if a write is queued or in progress, false otherwise
+ */
+Bool extflash_write_busy(void)
+{
+    extflash_write_engine_t *engine = &(gExtflashControl.write_engine);
+
+    return (engine->state != EXTFLASH_WR_IDLE) || (engine->back != engine->front);
+}
 
+/**
+ * @brief Room left in the write engine's queue
+ *
+ * @return Writes and erases that can still be queued
+ *
+ * For callers that need several to go in together.
+ */
+uint8_t extflash_write_queue_free(void)
+{
+    extflash_write_engine_t *engine = &(gExtflashControl.write_engine);
+
+    return EXTFLASH_WRITE_QUEUE_DEPTH - (uint8_t)(engine->back - engine->front);
 }
 
+/**
+ * @brief Finish the write at the front of the queue
+ *
+ * @param error True if the write failed
+ */
+static void extflash_write_finish(Bool error)
+{
+    extflash_write_engine_t *engine = &(gExtflashControl.write_engine);
+    extflash_write_req_t *currRequest = &(engine->queue[engine->front & EXTFLASH_WRITE_QUEUE_MASK]);
+
+    if(currRequest->done != NULL)
+    {
+        *(currRequest->done) = true;
+    }
+    if(currRequest->callback != NULL)
+    {
+        currRequest->callback(error);
+    }
 
+    engine->front++;
+    engine->state = EXTFLASH_WR_IDLE;
+}
+
+/**
+ * @brief Queue the status register read used to poll Write In Progress
+ */
+static Bool extflash_write_poll(void)
+{
+    extflash_write_engine_t *engine = &(gExtflashControl.write_engine);
+
+    engine->send_buffer[0] = EXTFLASH_READ_SR_CMD;
+    return spi_master_enqueue(&extflashSpiMaster,
+                              &(gExtflashControl.cs_info),
+                              (void *)(engine->send_buffer),
+                              1,
+                              (void *)(engine->recv_buffer),
+                              2,
+                              &(engine->complete));
+}
+
+/**
+ * @brief Background function that runs queued flash writes and erases
+ *
+ * One page, or one whole erase, at a time:
+ *      IDLE:    Queue WRITE ENABLE and PAGE PROGRAM (or the erase command) back
+ *               to back. The SPI queue keeps them in order, so there's no need
+ *               to wait in between.
+ *      PROGRAM: Wait for the command to go out, then queue a status read.
+ *      POLL:    Wait for the status read. If Write In Progress is still set,
+ *               read it again, until the timeout for the command. Otherwise move
+ *               on to the next page, or finish the write.
+ */
+void extflash_write_task(void)
+{
+    extflash_write_engine_t *engine = &(gExtflashControl.write_engine);
+    extflash_write_req_t *currRequest = &(engine->queue[engine->front & EXTFLASH_WRITE_QUEUE_MASK]);
+    uint16_t chunk;
+    uint16_t sendLen;
+    uint32_t timeout;
+
+    switch(engine->state)
+    {
+        case EXTFLASH_WR_IDLE:
+            if(engine->back == engine->front)
+            {
+                break;
+            }
+            /* Need room for both requests, or the page program could be refused after the write enable went out */
+            if((SPI_MASTER_QUEUE_DEPTH - spi_master_queue_count(&extflashSpiMaster)) < 2)
+            {
+                break;
+            }
+
+            engine->wren_buffer[0] = EXTFLASH_WRITE_ENABLE;
+            if(currRequest->erase_cmd != 0)
+            {
+                extflash_fill_cmd_addr(engine->send_buffer, currRequest->erase_cmd, currRequest->addr);
+                sendLen = EXTFLASH_CMDADDR_SIZE;
+            }
+            else
+            {
+                chunk = extflash_page_chunk(currRequest->addr + engine->offset, currRequest->num_bytes - engine->offset);
+                engine->chunk = chunk;
+                extflash_fill_page_program(engine->send_buffer, currRequest->addr + engine->offset,
+                                           &(currRequest->buf[engine->offset]), chunk);
+                sendLen = chunk + EXTFLASH_CMDADDR_SIZE;
+            }
+
+            (void)spi_master_enqueue(&extflashSpiMaster,
+                                     &(gExtflashControl.cs_info),
+                                     (void *)(engine->wren_buffer),
+                                     1,
+                                     (void *)(engine->recv_buffer),
+                                     0,
+                                     &(engine->wren_complete));
+            (void)spi_master_enqueue(&extflashSpiMaster,
+                                     &(gExtflashControl.cs_info),
+                                     (void *)(engine->send_buffer),
+                                     sendLen,
+                                     (void *)(engine->recv_buffer),
+                                     0,
+                                     &(engine->complete));
+            engine->state = EXTFLASH_WR_PROGRAM;
+            break;
+        case EXTFLASH_WR_PROGRAM:
+            if(engine->complete && extflash_write_poll())
+            {
+                /* The page program or erase starts when chip select goes high */
+                engine->start_time = get_timer_count();
+                engine->state = EXTFLASH_WR_POLL;
+            }
+            break;
+        case EXTFLASH_WR_POLL:
+            if(!engine->complete)
+            {
+                break;
+            }
+            if(currRequest->erase_cmd == 0)
+            {
+                timeout = EXTFLASH_PROGRAM_TIMEOUT;
+            }
+            else if(currRequest->erase_cmd == EXTFLASH_SECTOR_ERASE)
+            {
+                timeout = EXTFLASH_SECTOR_TIMEOUT;
+            }
+            else
+            {
+                timeout = EXTFLASH_SUBSECTOR_TIMEOUT;
+            }
+
+            if(engine->recv_buffer[1] & EXTFLASH_WIP)
+            {
+                if((get_timer_count() - engine->start_time) > timeout)
+                {
+                    engine->offset = 0;
+                    extflash_write_finish(true);
+                }
+                else
+                {
+                    (void)extflash_write_poll();
+                }
+            }
+            else if(currRequest->erase_cmd != 0)
+            {
+                extflash_write_finish(false);
+            }
+            else
+            {
+                engine->offset += engine->chunk;
+                if(engine->offset >= currRequest->num_bytes)
+                {
+                    engine->offset = 0;
+                    extflash_write_finish(false);
+                }
+                else
+                {
+                    /* Next page */
+                    engine->state = EXTFLASH_WR_IDLE;
+                }
+            }
+            break;
+        default:
+            engine->state = EXTFLASH_WR_IDLE;
+            break;
+    }
+}
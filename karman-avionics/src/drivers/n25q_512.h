@@ -16,9 +16,60 @@
 #include "FlashMem.h"
 
 #define EXTFLASH_CMDADDR_SIZE   (5)         /**< 5 bytes for 1 byte command and 4 byte address */
+#define EXTFLASH_FAST_READ_HDR_SIZE (6)     /**< Fast read command, 4 byte address, one dummy byte */
 #define EXTFLASH_PAGE_SIZE      (0x100)     /**< Writes that cross page boundary cause unwanted behavior */
+#define EXTFLASH_SUBSECTOR_SIZE (0x1000)    /**< Smallest erase, 4 KiB */
+#define EXTFLASH_SECTOR_SIZE    (0x10000)   /**< Sector erase, 64 KiB */
 #define EXTFLASH_SIZE           (0x1000000) /**< 128 Mebibit */
 
+/** Max number of writes waiting for the write engine. MUST be a power of two. */
+#define EXTFLASH_WRITE_QUEUE_DEPTH (8)
+/** Turns a free-running write queue counter into an index */
+#define EXTFLASH_WRITE_QUEUE_MASK  (EXTFLASH_WRITE_QUEUE_DEPTH - 1)
+
+#if ((EXTFLASH_WRITE_QUEUE_DEPTH & EXTFLASH_WRITE_QUEUE_MASK) != 0) || (EXTFLASH_WRITE_QUEUE_DEPTH > 128)
+#error "EXTFLASH_WRITE_QUEUE_DEPTH must be a power of two, no more than 128"
+#endif
+
+/** Called by the write engine when a queued write is done. error is true if it failed. */
+typedef void (*extflash_callback_t)(Bool error);
+
+/** A write waiting for the write engine */
+typedef struct
+{
+    uint32_t            addr;       /**< Address to write to */
+    size_t              num_bytes;  /**< Number of bytes to write */
+    const uint8_t       *buf;       /**< Caller's data. Must stay untouched until done */
+    extflash_callback_t callback;   /**< Called when done, may be NULL */
+    volatile Bool       *done;      /**< Set true when done, may be NULL */
+    uint8_t             erase_cmd;  /**< Sector or subsector erase command to run at addr instead, 0 for a write */
+} extflash_write_req_t;
+
+/** Write engine states */
+typedef enum
+{
+    EXTFLASH_WR_IDLE,       /**< Waiting for a write, or ready for the next page */
+    EXTFLASH_WR_PROGRAM,    /**< Write enable and page program or erase queued on the SPI master */
+    EXTFLASH_WR_POLL,       /**< Reading the status register until the program or erase is done */
+} extflash_write_state_t;
+
+/** Asynchronous write engine, run from the background task */
+typedef struct
+{
+    extflash_write_req_t    queue[EXTFLASH_WRITE_QUEUE_DEPTH]; /**< Queued writes */
+    uint8_t                 front;      /**< Free-running count of writes finished */
+    uint8_t                 back;       /**< Free-running count of writes queued */
+    extflash_write_state_t  state;      /**< Where the front write is at */
+    uint16_t                offset;     /**< Bytes of the front write already programmed */
+    uint16_t                chunk;      /**< Bytes in the page program in flight */
+    uint32_t                start_time; /**< When the page program or erase started, for the timeout */
+    volatile uint8_t        wren_buffer[1]; /**< Write enable command */
+    volatile uint8_t        send_buffer[EXTFLASH_CMDADDR_SIZE + EXTFLASH_PAGE_SIZE]; /**< Page program, erase or status read command */
+    volatile uint8_t        recv_buffer[2]; /**< Status register */
+    volatile Bool           wren_complete;  /**< Write enable sent */
+    volatile Bool           complete;       /**< Page program or status read done */
+} extflash_write_engine_t;
+
 /** Control structure. */
 typedef struct  
 {
@@ -27,14 +78,19 @@ typedef struct
     volatile uint8_t    spi_send_buffer[EXTFLASH_CMDADDR_SIZE + EXTFLASH_PAGE_SIZE]; /**< Need to support writing entire page at once ... */
     volatile uint8_t    spi_recv_buffer[EXTFLASH_CMDADDR_SIZE + EXTFLASH_PAGE_SIZE]; /**< Default read buffer. */
     volatile Bool       send_complete; /**< Keep track of if our transfers are complete */
+    volatile uint8_t    read_cmd_buffer[EXTFLASH_FAST_READ_HDR_SIZE]; /**< Fast read command and address */
+    volatile Bool       read_cmd_complete; /**< Fast read command sent */
     Bool                task_inprog;   /**< Are we in progress? */
     uint8_t             num_active_requests; /**< How many active requests there are */
+    extflash_write_engine_t write_engine; /**< Non-blocking writes */
 } extflash_ctrl_t;
 
 void init_extflash(void);
 
 void extflash_initialize_regs(void);
 
+Bool extflash_check_id(void);
+
 Bool extflash_get_status(void);
 
 Bool extflash_read(uint32_t addr, size_t num_bytes, uint8_t *buf, Bool block);
@@ -47,4 +103,16 @@ Bool extflash_read_status_reg(uint16_t *buf, Bool block);
 
 Bool extflash_write_one(uint16_t num_bytes, uint32_t addr, uint8_t *buf, uint16_t buff_offset, Bool block);
 
+Bool extflash_write_async(uint32_t addr, size_t num_bytes, const uint8_t *buf, extflash_callback_t callback, volatile Bool *done);
+
+Bool extflash_erase(uint32_t addr, uint32_t size, Bool block);
+
+Bool extflash_erase_async(uint32_t addr, uint32_t size, extflash_callback_t callback, volatile Bool *done);
+
+Bool extflash_write_busy(void);
+
+uint8_t extflash_write_queue_free(void);
+
+void extflash_write_task(void);
+
 #endif /* N25Q_512_H_ */
@@ -0,0 +1,167 @@
+/**
+ * @file Mailbox.c
+ *
+ * @brief Mailboxes and Event Flags
+ *
+ * Created: 10/17/2026 11:05:00 PM
+ *
+ *  Posting copies the message in with interrupts off, since the sender can be
+ *  interrupted by another sender. Messages are a few tens of bytes, so that's
+ *  a few microseconds. Receiving copies the message out with interrupts on:
+ *  the oldest slot isn't reused until count goes down, and only the receiver
+ *  does that.
+ */
+
+#include <asf.h>
+#include "Mailbox.h"
+#include <string.h>
+
+/**
+ * @brief Set up an empty mailbox
+ *
+ * @param box The mailbox
+ * @param buffer Storage for depth messages
+ * @param msg_size Bytes in a message, sizeof the message type
+ * @param depth Messages the buffer holds, at least 1
+ */
+void mailbox_init(mailbox_t *box, void *buffer, uint8_t msg_size, uint8_t depth)
+{
+    box->buffer = (uint8_t *)buffer;
+    box->msg_size = msg_size;
+    box->depth = depth;
+    box->head = 0;
+    box->count = 0;
+    memset((void *)&(box->stats), 0, sizeof(box->stats));
+}
+
+/**
+ * @brief Put a copy of a message in the mailbox
+ *
+ * @param box The mailbox
+ * @param msg The message, msg_size bytes
+ * @return True if it was posted, false if the mailbox was full and it was dropped
+ *
+ * Safe to call from an interrupt.
+ */
+Bool mailbox_post(mailbox_t *box, const void *msg)
+{
+    Bool posted = false;
+    uint8_t slot;
+    irqflags_t flags = cpu_irq_save();
+
+    if(box->count < box->depth)
+    {
+        slot = box->head + box->count;
+        if(slot >= box->depth)
+        {
+            slot -= box->depth;
+        }
+        memcpy(&(box->buffer[slot * box->msg_size]), msg, box->msg_size);
+
+        box->count++;
+        box->stats.posted++;
+        if(box->count > box->stats.high_water)
+        {
+            box->stats.high_water = box->count;
+        }
+        posted = true;
+    }
+    else
+    {
+        box->stats.dropped++;
+    }
+    cpu_irq_restore(flags);
+    return posted;
+}
+
+/**
+ * @brief Take the oldest message out of the mailbox
+ *
+ * @param box The mailbox
+ * @param[out] msg Where to copy the message, msg_size bytes
+ * @return True if there was a message, false if the mailbox was empty
+ *
+ * Never waits. Only the mailbox's receiver may call it.
+ */
+Bool mailbox_receive(mailbox_t *box, void *msg)
+{
+    Bool received = (box->count > 0);
+    irqflags_t flags;
+
+    if(received)
+    {
+        memcpy(msg, &(box->buffer[box->head * box->msg_size]), box->msg_size);
+
+        flags = cpu_irq_save();
+        box->head = (box->head + 1 < box->depth) ? (box->head + 1) : 0;
+        box->count--;
+        cpu_irq_restore(flags);
+    }
+    return received;
+}
+
+/**
+ * @brief Messages waiting in the mailbox
+ *
+ * @param box The mailbox
+ * @return Number of messages waiting
+ */
+uint8_t mailbox_count(mailbox_t *box)
+{
+    return box->count;
+}
+
+/**
+ * @brief Copy out a mailbox's counters
+ *
+ * @param box The mailbox
+ * @param[out] stats Where to copy the counters
+ */
+void mailbox_get_stats(mailbox_t *box, mailbox_stats_t *stats)
+{
+    irqflags_t flags = cpu_irq_save();
+    memcpy(stats, (void *)&(box->stats), sizeof(mailbox_stats_t));
+    cpu_irq_restore(flags);
+}
+
+/**
+ * @brief Clear all the flags
+ *
+ * @param events The event flags
+ */
+void event_flags_init(event_flags_t *events)
+{
+    events->flags = 0;
+}
+
+/**
+ * @brief Set flags
+ *
+ * @param events The event flags
+ * @param mask Bits to set
+ *
+ * Safe to call from an interrupt.
+ */
+void event_flags_set(event_flags_t *events, uint8_t mask)
+{
+    irqflags_t flags = cpu_irq_save();
+    events->flags |= mask;
+    cpu_irq_restore(flags);
+}
+
+/**
+ * @brief Take flags that are set, clearing them
+ *
+ * @param events The event flags
+ * @param mask Bits to look at
+ * @return The bits in mask that were set. Never waits, 0 if none were.
+ */
+uint8_t event_flags_take(event_flags_t *events, uint8_t mask)
+{
+    uint8_t taken;
+    irqflags_t flags = cpu_irq_save();
+    taken = events->flags & mask;
+    events->flags &= ~taken;
+    cpu_irq_restore(flags);
+    return taken;
+}
@@ -0,0 +1,73 @@
+/**
+ * @file Mailbox.h
+ *
+ * @brief Mailboxes and Event Flags
+ *
+ * Created: 10/17/2026 11:05:00 PM
+ *
+ * How tasks talk to each other. A mailbox is a queue of fixed size messages,
+ * a copy of each goes in and a copy comes out, so the sender can reuse its
+ * message right away and the receiver never sees one half written. Event
+ * flags are a byte of bits for commands that carry no data, setting a bit
+ * that's already set does nothing.
+ *
+ * Posting and setting are safe from interrupts and from any number of tasks.
+ * Each mailbox has a single receiver, a task, which never waits: receive
+ * returns false when there is nothing there. A full mailbox drops the new
+ * message and counts it, so a receiver that can't keep up shows in the stats
+ * instead of stalling the sender.
+ */
+
+
+#ifndef MAILBOX_H_
+#define MAILBOX_H_
+
+#include <compiler.h>
+
+/** Counters for a mailbox */
+typedef struct
+{
+    uint16_t posted;        /**< Messages put in the mailbox */
+    uint16_t dropped;       /**< Messages thrown away because the mailbox was full */
+    uint8_t  high_water;    /**< Most messages waiting at once */
+} mailbox_stats_t;
+
+/**
+ * @brief A queue of fixed size messages
+ *
+ * The owner provides the storage, an array of depth messages, usually next to
+ * the mailbox. Don't touch the fields, use the functions.
+ */
+typedef struct
+{
+    uint8_t                 *buffer;    /**< depth messages of msg_size bytes */
+    uint8_t                 msg_size;   /**< Bytes in a message */
+    uint8_t                 depth;      /**< Messages the buffer holds */
+    volatile uint8_t        head;       /**< Slot of the oldest message */
+    volatile uint8_t        count;      /**< Messages waiting */
+    volatile mailbox_stats_t stats;     /**< Counters */
+} mailbox_t;
+
+/** Bits for commands, what each bit means is up to the receiver */
+typedef struct
+{
+    volatile uint8_t flags; /**< Bits set and not taken yet */
+} event_flags_t;
+
+void mailbox_init(mailbox_t *box, void *buffer, uint8_t msg_size, uint8_t depth);
+
+Bool mailbox_post(mailbox_t *box, const void *msg);
+
+Bool mailbox_receive(mailbox_t *box, void *msg);
+
+uint8_t mailbox_count(mailbox_t *box);
+
+void mailbox_get_stats(mailbox_t *box, mailbox_stats_t *stats);
+
+void event_flags_init(event_flags_t *events);
+
+void event_flags_set(event_flags_t *events, uint8_t mask);
+
+uint8_t event_flags_take(event_flags_t *events, uint8_t mask);
+
+#endif /* MAILBOX_H_ */
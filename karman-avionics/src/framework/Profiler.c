@@ -0,0 +1,84 @@
+/**
+ * @file Profiler.c
+ *
+ * @brief Execution Time Profiler
+ *
+ * Created: 10/17/2026 2:10:00 PM
+ *
+ *  Keeps min, max, mean and a histogram of how long a function takes.
+ *  The scheduler times every task with the TCC0 counter, the background
+ *  task times each background function. The results can be sent to the
+ *  host over USB, see dump_profile_to_usb.
+ */ 
+
+#include "Profiler.h"
+#include <string.h>
+
+/**
+ * @brief Clear a profile
+ *
+ * @param profile The profile to clear
+ */
+void profiler_reset(exec_profile_t *profile)
+{
+    memset((void *)profile, 0, sizeof(exec_profile_t));
+    profile->minCounts = UINT32_MAX;
+}
+
+/**
+ * @brief Add one run to a profile
+ *
+ * @param profile The profile to add to
+ * @param counts How long the run took, in TCC0 counts
+ * @param budget Longest a run may take before it's an overrun. 0 for no budget.
+ */
+void profiler_record(exec_profile_t *profile, uint32_t counts, uint32_t budget)
+{
+    uint8_t bucket = 0;
+    uint32_t scaled = counts >> PROFILE_BUCKET0_SHIFT;
+
+    profile->numCalls++;
+    profile->totalCounts += counts;
+
+    if(counts < profile->minCounts)
+    {
+        profile->minCounts = counts;
+    }
+    if(counts > profile->maxCounts)
+    {
+        profile->maxCounts = counts;
+    }
+
+    if((budget != 0) && (counts > budget) && (profile->overruns < UINT16_MAX))
+    {
+        profile->overruns++;
+    }
+
+    /** Bucket is the position of the highest set bit, so each bucket doubles in width */
+    while((scaled != 0) && (bucket < (PROFILE_NUM_BUCKETS - 1)))
+    {
+        scaled >>= 1;
+        bucket++;
+    }
+    if(profile->histogram[bucket] < UINT16_MAX)
+    {
+        profile->histogram[bucket]++;
+    }
+}
+
+/**
+ * @brief Mean run time of a profile
+ *
+ * @param profile The profile
+ * @return Mean run time in TCC0 counts, 0 if it never ran
+ */
+uint32_t profiler_mean(exec_profile_t *profile)
+{
+    uint32_t mean = 0;
+
+    if(profile->numCalls != 0)
+    {
+        mean = (uint32_t)(profile->totalCounts / profile->numCalls);
+    }
+    return mean;
+}
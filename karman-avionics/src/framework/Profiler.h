@@ -0,0 +1,56 @@
+/**
+ * @file Profiler.h
+ *
+ * @brief Execution Time Profiler
+ *
+ * Created: 10/17/2026 2:10:00 PM
+ */ 
+
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <compiler.h>
+
+/** Number of histogram buckets. Bucket 0 is under 8us, each one after is twice as wide. */
+#define PROFILE_NUM_BUCKETS (8)
+
+/** TCC0 counts that fit in the first histogram bucket, as a shift. 256 counts is 8us. */
+#define PROFILE_BUCKET0_SHIFT (8)
+
+/** Execution time statistics for one function. All times are in TCC0 counts (1/32 us). */
+typedef struct
+{
+    uint32_t numCalls;      /**< How many times the function ran */
+    uint32_t minCounts;     /**< Shortest run */
+    uint32_t maxCounts;     /**< Longest run */
+    uint64_t totalCounts;   /**< Sum of every run, for the mean */
+    uint16_t overruns;      /**< Runs that took longer than the budget */
+    uint16_t histogram[PROFILE_NUM_BUCKETS]; /**< Runs per bucket, saturates at 0xFFFF */
+} exec_profile_t;
+
+/**
+ * @brief Clear a profile
+ *
+ * @param profile The profile to clear
+ */
+void profiler_reset(exec_profile_t *profile);
+
+/**
+ * @brief Add one run to a profile
+ *
+ * @param profile The profile to add to
+ * @param counts How long the run took, in TCC0 counts
+ * @param budget Longest a run may take before it's an overrun. 0 for no budget.
+ */
+void profiler_record(exec_profile_t *profile, uint32_t counts, uint32_t budget);
+
+/**
+ * @brief Mean run time of a profile
+ *
+ * @param profile The profile
+ * @return Mean run time in TCC0 counts, 0 if it never ran
+ */
+uint32_t profiler_mean(exec_profile_t *profile);
+
+#endif /* PROFILER_H_ */
@@ -11,57 +11,314 @@
  *  and this just loops through tasks such that each task
  *  does its duty or at least part of it and waits for 
  *  the next call.
+ *
+ *  Tasks are run earliest deadline first. Every periodic task is released
+ *  once per taskFreq ticks, and has to be done before its next release.
+ *  Released tasks wait in a min-heap ordered by deadline, tasks that aren't
+ *  released yet wait in a min-heap ordered by release time. Tasks are still
+ *  cooperative, so a task that runs long can't be interrupted, but it only
+ *  delays tasks with a later deadline, and a miss is counted against it.
+ *  The background task only gets time when no periodic task is ready.
+ *  Software timer callbacks (see SoftTimer.h) run at the top of every pass,
+ *  ahead of the tasks.
+ *  Every call is timed with the TCC0 counter and added to the task's profile.
+ *  After it runs, the CPU sleeps in IDLE mode until the next interrupt.
+ *  Ticking, that is at most one tick away. Tickless (see Timer.h), the timer
+ *  is asked to wake us when the next task is released or the next software
+ *  timer fires, whichever is first. Time spent asleep is
+ *  added up, and turned into an idle percentage once a second.
+ *  Undefine CONFIG_SLEEPMGR_ENABLE in conf_sleepmgr.h to spin instead.
  */ 
 #include "Scheduler.h"
 #include "Tasks.h"
 #include "Timer.h"
+#include "SoftTimer.h"
+
+/** Min-heap of indexes into the task array */
+typedef struct
+{
+    uint8_t items[MAX_TASKS]; /**< Task indexes, heap ordered */
+    uint8_t size;             /**< Number of tasks in the heap */
+} task_heap_t;
+
+/** Key a heap is ordered on */
+typedef uint32_t (*task_key_func_t)(uint8_t taskIdx);
 
 /** Pointer to the task array from Task.c */
 static simple_task_t *taskArry;
 /** The number of tasks in the task array from Task.c */
 static uint8_t numTasks;
+/** Index of the background task, numTasks if there isn't one */
+static uint8_t backgroundIdx;
+
+/** Tasks waiting to be released, earliest release first */
+static task_heap_t waitHeap;
+/** Released tasks, earliest deadline first */
+static task_heap_t readyHeap;
+
+/** Timer count the current idle measurement window started at */
+static uint32_t idleWindowStart;
+/** TCC0 counts spent asleep in the current window */
+static uint32_t idleWindowCounts;
+/** Percent of the last full window spent asleep */
+static volatile uint8_t idlePercent;
+
+/** Time a task is released at */
+static uint32_t task_release_key(uint8_t taskIdx)
+{
+    return taskArry[taskIdx].nextDue;
+}
+
+/** Time a task must be done by. Deadlines are implicit, one period after release. */
+static uint32_t task_deadline_key(uint8_t taskIdx)
+{
+    return taskArry[taskIdx].nextDue + taskArry[taskIdx].taskFreq;
+}
+
+/** Add a task to a heap, sifting it up to keep the smallest key on top */
+static void task_heap_push(task_heap_t *heap, task_key_func_t key, uint8_t taskIdx)
+{
+    uint8_t pos = heap->size;
+    uint8_t parent;
+    uint32_t taskKey = key(taskIdx);
+
+    heap->size++;
+    while(pos > 0)
+    {
+        parent = (pos - 1) >> 1;
+        if(!time_before(taskKey, key(heap->items[parent])))
+        {
+            break;
+        }
+        heap->items[pos] = heap->items[parent];
+        pos = parent;
+    }
+    heap->items[pos] = taskIdx;
+}
+
+/** Remove and return the task with the smallest key. Heap must not be empty. */
+static uint8_t task_heap_pop(task_heap_t *heap, task_key_func_t key)
+{
+    uint8_t top = heap->items[0];
+    uint8_t last;
+    uint32_t lastKey;
+    uint8_t pos = 0;
+    uint8_t child;
+
+    heap->size--;
+    if(heap->size > 0)
+    {
+        last = heap->items[heap->size];
+        lastKey = key(last);
+        for(;;)
+        {
+            child = (pos << 1) + 1;
+            if(child >= heap->size)
+            {
+                break;
+            }
+            if(((child + 1) < heap->size) &&
+               time_before(key(heap->items[child + 1]), key(heap->items[child])))
+            {
+                child++;
+            }
+            if(!time_before(key(heap->items[child]), lastKey))
+            {
+                break;
+            }
+            heap->items[pos] = heap->items[child];
+            pos = child;
+        }
+        heap->items[pos] = last;
+    }
+    return top;
+}
 
 /**
     @brief Intialize the scheduler.
 
-    Sets up the scheduler's global data.
+    Sets up the scheduler's global data. Every periodic task is released
+    right away.
 */
 void init_scheduler(void){
+    uint8_t i;
+    uint32_t timeCount = get_timer_count();
+
     taskArry = get_task_list();
     numTasks = get_num_tasks();
+    backgroundIdx = numTasks;
+
+    waitHeap.size = 0;
+    readyHeap.size = 0;
+
+    idleWindowStart = timeCount;
+    idleWindowCounts = 0;
+    idlePercent = 0;
+    /** Peripherals and TCC0 have to keep running while we sleep, so go no deeper than IDLE */
+    sleepmgr_lock_mode(SLEEPMGR_IDLE);
+
+    for(i = 0; (i < numTasks) && (i < MAX_TASKS); i++)
+    {
+        taskArry[i].lastCount = timeCount;
+        taskArry[i].nextDue = timeCount;
+        taskArry[i].deadlineMisses = 0;
+        profiler_reset(&(taskArry[i].profile));
+
+        if(taskArry[i].taskFreq == TASK_FREQ_BACKGROUND)
+        {
+            backgroundIdx = i;
+        }
+        else
+        {
+            task_heap_push(&waitHeap, task_release_key, i);
+        }
+    }
+}
+
+/**
+    @brief Run one periodic task and schedule its next release
+
+    @param taskIdx The task to run
+
+    Releases are on a fixed grid of taskFreq ticks, so a task doesn't drift
+    when it runs late. If it fell more than a period behind, it skips ahead
+    to now instead of running back to back to catch up.
+*/
+static void run_task(uint8_t taskIdx)
+{
+    simple_task_t *currTask = &taskArry[taskIdx];
+    uint32_t deadline = task_deadline_key(taskIdx);
+    uint32_t timeCount;
+    uint32_t startCounts = get_timer_fine_count();
+
+    currTask->task();
+    /** A task's budget is its period */
+    profiler_record(&(currTask->profile), get_timer_fine_count() - startCounts,
+                    (uint32_t)currTask->taskFreq * TIMER_COUNTS_PER_TICK);
+    timeCount = get_timer_count();
+    currTask->lastCount = timeCount;
+
+    if(time_before(deadline, timeCount))
+    {
+        currTask->deadlineMisses++;
+    }
+
+    currTask->nextDue += currTask->taskFreq;
+    if(time_before(currTask->nextDue, timeCount))
+    {
+        currTask->nextDue = timeCount;
+    }
+    task_heap_push(&waitHeap, task_release_key, taskIdx);
+}
+
+/**
+    @brief Sleep until the next interrupt
+
+    @param timeCount The timer count this pass of the scheduler started with
+
+    Interrupts are turned off before checking the timer, so a tick that comes in
+    after the check still wakes us up: the sleep manager turns them back on
+    with the instruction right before sleeping. Tickless, the wakeup is set
+    for the next release or software timer, if there is one.
+*/
+static void scheduler_idle(uint32_t timeCount)
+{
+    uint32_t sleepStart;
+    uint32_t timerExpiry;
+    /** With nothing waiting, any far off tick will do, the counter overflow wakes us anyway */
+    uint32_t wakeTick = (waitHeap.size > 0) ? task_release_key(waitHeap.items[0]) : (timeCount + TASK_FREQ_1s);
+
+    if(soft_timer_next_expiry(&timerExpiry) && time_before(timerExpiry, wakeTick))
+    {
+        wakeTick = timerExpiry;
+    }
+
+    cpu_irq_disable();
+    if((get_timer_count() != timeCount) || !timer_set_wakeup(wakeTick))
+    {
+        /** A tick came in while the background task ran, something may be due */
+        cpu_irq_enable();
+    }
+    else
+    {
+        sleepStart = get_timer_fine_count();
+        sleepmgr_enter_sleep();
+        idleWindowCounts += get_timer_fine_count() - sleepStart;
+    }
+}
+
+/**
+    @brief Update the idle percentage once every second
+
+    @param timeCount The timer count this pass of the scheduler started with
+*/
+static void scheduler_update_idle(uint32_t timeCount)
+{
+    uint32_t windowTicks = timeCount - idleWindowStart;
+
+    if(windowTicks >= TASK_FREQ_1s)
+    {
+        /** counts / (ticks * counts per tick) * 100, ordered to stay in 32 bits */
+        idlePercent = (uint8_t)(idleWindowCounts / ((windowTicks * TIMER_COUNTS_PER_TICK) / 100));
+        idleWindowStart = timeCount;
+        idleWindowCounts = 0;
+    }
+}
+
+/**
+    @brief Percent of the last second the CPU spent asleep
+    @return Idle percentage, 0 to 100
+*/
+uint8_t scheduler_get_idle_percent(void)
+{
+    return idlePercent;
 }
 
 /**  
     @brief Main Scheduler function.
 
-    Runs in an infinite loop, calling each task at its requested interval,
-    When possible. When there is time, if not possible.
+    Runs in an infinite loop. Fires the software timers that are due,
+    releases every task whose time has come, then runs the released task
+    with the earliest deadline. When nothing is released, runs the background
+    task and sleeps until the next interrupt.
 */
 void run_scheduler(void){
     
-    static uint8_t i = 0;
-    static volatile uint32_t timeCount = 0;
-    static volatile uint32_t prevTimeCount = 0;
-    /** Loop infinitely, comparing every task's last time to the current time */
+    uint32_t timeCount;
+    uint32_t startCounts;
+    /** Loop infinitely, releasing and running tasks */
     for (;;){
-        /** Wait for 500us interrupt */
-        do {
-            timeCount = get_timer_count();
-        } while (timeCount == prevTimeCount);
-        
-        prevTimeCount = timeCount;
-
-        for(i = 0; i < numTasks; i++)
+        timeCount = get_timer_count();
+        scheduler_update_idle(timeCount);
+
+        /** Software timers that are due */
+        soft_timer_dispatch(timeCount);
+
+        /** Move every task that is due onto the ready heap */
+        while((waitHeap.size > 0) &&
+              !time_before(timeCount, task_release_key(waitHeap.items[0])))
         {
-            /** Run the background task unconditionally, otherwise 
-              * see if it's time to run the task or not 
-            */
-            if((taskArry[i].taskFreq == TASK_FREQ_BACKGROUND) ||
-               ((timeCount - taskArry[i].lastCount) >= taskArry[i].taskFreq))
-            {
-                taskArry[i].task();
-                taskArry[i].lastCount = timeCount;
-            }
-        } /* End loop over tasks */
+            task_heap_push(&readyHeap, task_deadline_key,
+                           task_heap_pop(&waitHeap, task_release_key));
+        }
+
+        if(readyHeap.size > 0)
+        {
+            /** Earliest deadline first. Go back and look for new releases after each task. */
+            run_task(task_heap_pop(&readyHeap, task_deadline_key));
+        }
+        else if(backgroundIdx < numTasks)
+        {
+            /** Nothing is due, the time is the background task's */
+            startCounts = get_timer_fine_count();
+            taskArry[backgroundIdx].task();
+            profiler_record(&(taskArry[backgroundIdx].profile), get_timer_fine_count() - startCounts, 0);
+            taskArry[backgroundIdx].lastCount = timeCount;
+            scheduler_idle(timeCount);
+        }
+        else
+        {
+            scheduler_idle(timeCount);
+        }
     } /* End infinite loop */
 } /* End function run_scheduler */
@@ -15,16 +15,24 @@
 /**  
     @brief Main Scheduler function.
 
-    Runs in an infinite loop, calling each task at its requested interval,
-    When possible. When there is time, if not possible.
+    Runs in an infinite loop. Releases every task whose time has come,
+    then runs the released task with the earliest deadline. When nothing
+    is released, runs the background task and sleeps until the next interrupt.
 */
 void run_scheduler(void) __attribute__((noreturn));
 
 /**
     @brief Intialize the scheduler.
 
-    Sets up the scheduler's global data.
+    Sets up the scheduler's global data. Every periodic task is released
+    right away.
 */
 void init_scheduler(void);
 
+/**
+    @brief Percent of the last second the CPU spent asleep
+    @return Idle percentage, 0 to 100
+*/
+uint8_t scheduler_get_idle_percent(void);
+
 #endif /* SCHEDULER_H_ */
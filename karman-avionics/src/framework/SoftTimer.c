@@ -0,0 +1,160 @@
+/**
+ * @file SoftTimer.c
+ *
+ * @brief Software Timers
+ *
+ * Created: 10/17/2026 10:20:00 PM
+ *
+ *  One shot and periodic timers on the scheduler's tick. Armed timers wait
+ *  in a list sorted by expiry, so the scheduler only has to look at the
+ *  head to know if anything is due, and when to wake up for it.
+ *  Callbacks run from the scheduler loop between tasks, like a very short
+ *  task, so they can use the SPI queues and start or stop timers, their
+ *  own included. Keep them short.
+ *
+ *  Timers are for task level code only. Don't start or stop them from an interrupt.
+ */
+
+#include "SoftTimer.h"
+#include "Timer.h"
+
+/** Armed timers, earliest expiry first */
+static soft_timer_t *timerList = NULL;
+
+/** Put a timer in the list after every timer that expires at or before it */
+static void soft_timer_insert(soft_timer_t *timer)
+{
+    soft_timer_t **link = &timerList;
+
+    while((*link != NULL) && !time_before(timer->expires, (*link)->expires))
+    {
+        link = &((*link)->next);
+    }
+    timer->next = *link;
+    *link = timer;
+    timer->armed = true;
+}
+
+/**
+ * @brief Set up a timer
+ *
+ * @param timer The timer
+ * @param callback Called when it fires
+ * @param arg Passed to the callback
+ *
+ * The timer starts out stopped.
+ */
+void soft_timer_init(soft_timer_t *timer, soft_timer_callback_t callback, void *arg)
+{
+    timer->next = NULL;
+    timer->expires = 0;
+    timer->period = 0;
+    timer->armed = false;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/**
+ * @brief Start a timer, or restart it if it's running
+ *
+ * @param timer The timer, set up with soft_timer_init
+ * @param delay Ticks until it first fires. It fires once the timer count has
+ *        gone up by at least delay, so at least delay - 1 whole ticks from now.
+ * @param period Ticks between firings after that, 0 for one shot
+ *
+ * Periodic timers stay on their grid when they fire late. If one falls more
+ * than a period behind, it skips ahead instead of firing back to back.
+ */
+void soft_timer_start(soft_timer_t *timer, uint32_t delay, uint16_t period)
+{
+    soft_timer_stop(timer);
+    timer->expires = get_timer_count() + delay;
+    timer->period = period;
+    soft_timer_insert(timer);
+}
+
+/**
+ * @brief Stop a timer
+ *
+ * @param timer The timer
+ *
+ * Nothing happens if it isn't running.
+ */
+void soft_timer_stop(soft_timer_t *timer)
+{
+    soft_timer_t **link = &timerList;
+
+    if(timer->armed)
+    {
+        while((*link != NULL) && (*link != timer))
+        {
+            link = &((*link)->next);
+        }
+        if(*link != NULL)
+        {
+            *link = timer->next;
+        }
+        timer->next = NULL;
+        timer->armed = false;
+    }
+}
+
+/**
+ * @brief Is the timer running?
+ *
+ * @param timer The timer
+ * @return True if it will fire, false otherwise
+ */
+Bool soft_timer_is_armed(soft_timer_t *timer)
+{
+    return timer->armed;
+}
+
+/**
+ * @brief Fire every timer that is due
+ *
+ * @param timeCount The current timer count
+ *
+ * Called from the scheduler loop. A periodic timer is put back in the list
+ * before its callback runs, so the callback can stop it.
+ */
+void soft_timer_dispatch(uint32_t timeCount)
+{
+    soft_timer_t *timer;
+
+    while((timerList != NULL) && !time_before(timeCount, timerList->expires))
+    {
+        timer = timerList;
+        timerList = timer->next;
+        timer->next = NULL;
+        timer->armed = false;
+
+        if(timer->period != 0)
+        {
+            timer->expires += timer->period;
+            if(!time_before(timeCount, timer->expires))
+            {
+                timer->expires = timeCount + timer->period;
+            }
+            soft_timer_insert(timer);
+        }
+        timer->callback(timer->arg);
+    }
+}
+
+/**
+ * @brief When the next timer fires
+ *
+ * @param[out] expires Timer count the first timer in the list fires at
+ * @return True if a timer is running, false otherwise
+ */
+Bool soft_timer_next_expiry(uint32_t *expires)
+{
+    Bool anyArmed = (timerList != NULL);
+
+    if(anyArmed)
+    {
+        *expires = timerList->expires;
+    }
+    return anyArmed;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file SoftTimer.h
+ *
+ * @brief Software Timers
+ *
+ * Created: 10/17/2026 10:20:00 PM
+ */
+
+
+#ifndef SOFTTIMER_H_
+#define SOFTTIMER_H_
+
+#include <compiler.h>
+
+/** Function a timer calls when it expires */
+typedef void (*soft_timer_callback_t)(void *arg);
+
+/**
+ * @brief A software timer
+ *
+ * The owner keeps the storage, usually in its control structure, so there is
+ * no limit on the number of timers and nothing to allocate.
+ * Don't touch the fields, use the functions.
+ */
+typedef struct soft_timer_s
+{
+    struct soft_timer_s   *next;      /**< Next timer in the deadline list */
+    uint32_t              expires;    /**< Timer count it fires at */
+    uint16_t              period;     /**< Ticks between firings, 0 for one shot */
+    Bool                  armed;      /**< In the deadline list */
+    soft_timer_callback_t callback;   /**< Called when it fires */
+    void                  *arg;       /**< Passed to the callback */
+} soft_timer_t;
+
+void soft_timer_init(soft_timer_t *timer, soft_timer_callback_t callback, void *arg);
+
+void soft_timer_start(soft_timer_t *timer, uint32_t delay, uint16_t period);
+
+void soft_timer_stop(soft_timer_t *timer);
+
+Bool soft_timer_is_armed(soft_timer_t *timer);
+
+void soft_timer_dispatch(uint32_t timeCount);
+
+Bool soft_timer_next_expiry(uint32_t *expires);
+
+#endif /* SOFTTIMER_H_ */
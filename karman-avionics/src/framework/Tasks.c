@@ -17,6 +17,7 @@
 #include "Pyrotechnics.h"
 #include "SensorTask.h"
 #include "RadioTask.h"
+#include "LogTask.h"
 #include "USBTask.h"
 
 /** The inital count for when the tasks were last ran. */
@@ -34,17 +35,23 @@ simple_task_t TaskList[] =
     },*/
     /** Task to check status of global sensor data to see if it's time to
     * perform Pyrotechnics activities */
-    /*{ 
+    { 
         .taskFreq = TASK_FREQ_10ms,
         .lastCount = INITIAL_COUNT,
         .task = check_pyro_task_func,
-    },*/
+    },
     /** Radio task to manage reciept and transfer of messages to and from the RF modules */
    /* {
         .taskFreq = TASK_FREQ_10ms,
         .lastCount = INITIAL_COUNT,
         .task = radio_task_func,
     },*/
+    /** Logging task to write the sensor samples to the flash memory */
+    {
+        .taskFreq = TASK_FREQ_10ms,
+        .lastCount = INITIAL_COUNT,
+        .task = log_task_func,
+    },
     /** Sensor task to keep track of timings for all sensors and when they need called */
     {
         .taskFreq = TASK_FREQ_2ms,
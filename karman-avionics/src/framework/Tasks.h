@@ -13,12 +13,19 @@
 #include <compiler.h>
 
 #include "Timer.h"
+#include "Profiler.h"
+
+/** Most tasks the scheduler can keep track of, background task included */
+#define MAX_TASKS (8)
 
 /** Structure to define a task. */
 typedef struct simple_task_s {
     task_freq_enum_t taskFreq; /**< How often should this task be run? */
     uint32_t lastCount;        /**< The last timer count we ran at */
     void(*task)(void);         /**< Pointer to task function */
+    uint32_t nextDue;          /**< Timer count the task is next released at. Set by the scheduler. */
+    uint16_t deadlineMisses;   /**< Times the task finished after its deadline. Set by the scheduler. */
+    exec_profile_t profile;    /**< Execution time of each call. Overrun budget is taskFreq. */
 } simple_task_t;
 
 /** Inline function that returns a pointer to the task list */
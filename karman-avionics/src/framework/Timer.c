@@ -5,6 +5,17 @@
  *
  *  Created: 11/5/2016 5:24:55 PM
  *  Author: Andrew Kaster
+ *
+ *  Two ways to run TCC0, picked with TIMER_TICKLESS in Timer.h.
+ *
+ *  Ticking, TCC0 overflows every 200us tick and the interrupt counts ticks.
+ *  The CPU is woken 5000 times a second whether anything is due or not.
+ *
+ *  Tickless, TCC0 runs the whole 16 bit range, and the interrupt only counts
+ *  overflows, every 2.048ms. The tick count is worked out from the counter
+ *  when someone asks for it. When the scheduler goes to sleep it asks for a
+ *  compare match at the next deadline with timer_set_wakeup, so it is woken
+ *  when something is due, not on every tick.
  */ 
 
 #include "Timer.h"
@@ -12,8 +23,224 @@
 
 /** Number of scheduler ticks per millisecond */
 #define TICKS_PER_MS (5)
-/** Number of scheduler microseconds per tick */
-#define US_PER_TICK (200)
+
+/** 64 bit value made of two 32 bit halves. The AVR is little endian, so lo comes first. */
+typedef union
+{
+    uint64_t value;         /**< The whole thing */
+    struct
+    {
+        uint32_t lo;        /**< Bits 0 to 31 */
+        uint32_t hi;        /**< Bits 32 to 63 */
+    } half;                 /**< The halves */
+} timer_wide_t;
+
+#if TIMER_TICKLESS
+
+/** Ticks ahead a compare match can be set, all within one pass of the 16 bit counter */
+#define TIMER_WAKEUP_MAX_TICKS (0xFFFFUL / TIMER_COUNTS_PER_TICK)
+/** A wakeup closer than this many counts might be passed before we get to sleep */
+#define TIMER_WAKEUP_MIN_COUNTS (64)
+
+/** TCC0 overflows since timer_init, the clock above the 16 bit counter */
+static volatile uint32_t timerOverflows = 0;
+/** Upper bits of the overflow count, bumped every time ::timerOverflows wraps (about 100 days) */
+static volatile uint16_t timerOverflowsHigh = 0;
+/** A recent tick count. Brought up to date by the overflow interrupt. */
+static volatile uint32_t tickBase = 0;
+/** Low 32 bits of the clock when tick ::tickBase started */
+static volatile uint32_t tickBaseClock = 0;
+
+/**
+    @brief Read the overflow count and the counter together
+
+    @param[out] overflows Low 32 bits of the overflow count
+    @param[out] overflowsHigh High bits of the overflow count
+    @return The counter
+
+    Interrupts must be off. If the counter overflowed but the interrupt hasn't
+    been serviced yet, the pending overflow is counted here.
+*/
+static inline uint16_t timer_read_raw(uint32_t *overflows, uint16_t *overflowsHigh)
+{
+    uint16_t counts = TCC0.CNT;
+
+    *overflows = timerOverflows;
+    *overflowsHigh = timerOverflowsHigh;
+
+    /** Overflow pending. Re-read the counter, it may have wrapped after the first read. */
+    if(TCC0.INTFLAGS & TC0_OVFIF_bm)
+    {
+        counts = TCC0.CNT;
+        (*overflows)++;
+        if(*overflows == 0)
+        {
+            (*overflowsHigh)++;
+        }
+    }
+    return counts;
+}
+
+/**
+    @brief Tick count at a clock value
+
+    @param clock Low 32 bits of the clock, no more than a couple of overflows past ::tickBaseClock
+    @param[out] tickStart Low 32 bits of the clock when that tick started, may be NULL
+    @return The tick count
+
+    Interrupts must be off. At most a couple dozen subtractions, no division.
+*/
+static uint32_t timer_ticks_at(uint32_t clock, uint32_t *tickStart)
+{
+    uint32_t ticks = tickBase;
+    uint32_t start = tickBaseClock;
+
+    while((clock - start) >= TIMER_COUNTS_PER_TICK)
+    {
+        start += TIMER_COUNTS_PER_TICK;
+        ticks++;
+    }
+    if(tickStart != NULL)
+    {
+        *tickStart = start;
+    }
+    return ticks;
+}
+
+/**
+    @brief Callback for the TCC0 interrupt
+
+    Counts an overflow, and brings ::tickBase up to date so the tick count
+    never has far to go from it.
+*/
+void timer0_callback(void){
+    uint32_t start;
+
+    timerOverflows++;
+    if(timerOverflows == 0)
+    {
+        timerOverflowsHigh++;
+    }
+    tickBase = timer_ticks_at(timerOverflows << 16, &start);
+    tickBaseClock = start;
+}
+
+/**
+    @brief Callback for the TCC0 compare A interrupt
+
+    Only here to wake the scheduler. Turns itself off, it's one shot.
+*/
+static void timer_wakeup_callback(void){
+    tc_set_cca_interrupt_level(&TCC0, TC_INT_LVL_OFF);
+}
+
+/**
+    @brief Intialize timer interrupt
+
+    Free running TCC0, overflow interrupt at low level.
+    Compare A is turned on for wakeups, its interrupt only when one is set.
+*/
+void timer_init(void){
+    tc_enable(&TCC0);
+    tc_set_overflow_interrupt_callback(&TCC0, timer0_callback);
+    tc_set_cca_interrupt_callback(&TCC0, timer_wakeup_callback);
+    tc_set_wgm(&TCC0, TC_WG_NORMAL);
+    tc_write_period(&TCC0, 0xFFFF); /* Whole 16 bit range, overflows every 2.048ms */
+    tc_enable_cc_channels(&TCC0, TC_CCAEN);
+    tc_set_cca_interrupt_level(&TCC0, TC_INT_LVL_OFF);
+    tc_set_overflow_interrupt_level(&TCC0, TC_INT_LVL_LO);
+}
+
+/**
+    @brief Provides interrupt-safe access to the current time count.
+    @return The current time count
+*/
+inline uint32_t get_timer_count(void){
+    uint32_t overflows;
+    uint16_t overflowsHigh;
+    irqflags_t flags = cpu_irq_save();
+    uint16_t counts = timer_read_raw(&overflows, &overflowsHigh);
+    uint32_t timerVal = timer_ticks_at((overflows << 16) | counts, NULL);
+    cpu_irq_restore(flags);
+    return timerVal;
+}
+
+/**
+    @brief Provides interrupt-safe access to the time in TCC0 counts.
+    @return The current time, in counts of the 32MHz timer clock
+
+    Wraps about every 134 seconds, so only use it for differences.
+*/
+uint32_t get_timer_fine_count(void){
+    uint32_t overflows;
+    uint16_t overflowsHigh;
+    irqflags_t flags = cpu_irq_save();
+    uint16_t counts = timer_read_raw(&overflows, &overflowsHigh);
+    cpu_irq_restore(flags);
+
+    return (overflows << 16) | counts;
+}
+
+/**
+    @brief Provides interrupt-safe access to the wrap-free time in TCC0 counts.
+    @return The time since timer_init, in counts of the 32MHz timer clock (31.25ns)
+*/
+uint64_t get_timer_clock(void){
+    timer_wide_t clock;
+    uint32_t overflows;
+    uint16_t overflowsHigh;
+    irqflags_t flags = cpu_irq_save();
+    uint16_t counts = timer_read_raw(&overflows, &overflowsHigh);
+    cpu_irq_restore(flags);
+
+    clock.half.lo = (overflows << 16) | counts;
+    clock.half.hi = ((uint32_t)overflowsHigh << 16) | (overflows >> 16);
+
+    return clock.value;
+}
+
+/**
+    @brief Ask for an interrupt when a tick starts
+
+    @param wakeTick Timer count to be woken at
+    @return True if it's safe to sleep, false if the tick is already here or too close
+
+    Call with interrupts off, right before sleeping. Ticks further out than one
+    pass of the counter don't need a compare match, the overflow comes first and
+    the scheduler sets the wakeup again.
+*/
+Bool timer_set_wakeup(uint32_t wakeTick){
+    Bool canSleep = true;
+    uint32_t overflows;
+    uint16_t overflowsHigh;
+    uint16_t counts = timer_read_raw(&overflows, &overflowsHigh);
+    uint32_t now = (overflows << 16) | counts;
+    uint32_t tickStart;
+    int32_t ticksAhead = (int32_t)(wakeTick - timer_ticks_at(now, &tickStart));
+    uint32_t wakeClock;
+
+    if(ticksAhead <= 0)
+    {
+        canSleep = false;
+    }
+    else if((uint32_t)ticksAhead <= TIMER_WAKEUP_MAX_TICKS)
+    {
+        wakeClock = tickStart + ((uint32_t)ticksAhead * TIMER_COUNTS_PER_TICK);
+        if((wakeClock - now) < TIMER_WAKEUP_MIN_COUNTS)
+        {
+            canSleep = false;
+        }
+        else
+        {
+            tc_write_cc(&TCC0, TC_CCA, (uint16_t)wakeClock);
+            tc_clear_cc_interrupt(&TCC0, TC_CCA);
+            tc_set_cca_interrupt_level(&TCC0, TC_INT_LVL_LO);
+        }
+    }
+    return canSleep;
+}
+
+#else /* TIMER_TICKLESS */
 
 /**
     @brief The current timer count as set by the TCC0 interrupt. 
@@ -23,13 +250,21 @@
 */
 static volatile uint32_t timerCount = 0;
 
+/** Upper 32 bits of the tick count, bumped every time ::timerCount wraps (about 9.9 days) */
+static volatile uint32_t timerCountHigh = 0;
+
 /**
     @brief Callback for the TCC0 interrupt
 
-    Increments ::timerCount every time TCC0 overflows
+    Increments ::timerCount every time TCC0 overflows, and ::timerCountHigh
+    when that wraps.
 */
 void timer0_callback(void){
     timerCount++;
+    if(timerCount == 0)
+    {
+        timerCountHigh++;
+    }
 }
 
 /**
@@ -46,7 +281,7 @@ void timer_init(void){
     tc_enable(&TCC0);
     tc_set_overflow_interrupt_callback(&TCC0, timer0_callback);
     tc_set_wgm(&TCC0, TC_WG_NORMAL);
-    tc_write_period(&TCC0, 6400); /* Trigger interrupt when timer hits 6400, 200us */
+    tc_write_period(&TCC0, TIMER_COUNTS_PER_TICK - 1); /* Counts 0 to 6399 then overflows, exactly 200us */
     tc_set_overflow_interrupt_level(&TCC0, TC_INT_LVL_LO);
 }
 
@@ -64,6 +299,98 @@ inline uint32_t get_timer_count(void){
     return timerVal;
 }
 
+/**
+    @brief Provides interrupt-safe access to the time in TCC0 counts.
+    @return The current time, in counts of the 32MHz timer clock
+
+    Combines the tick count with the live TCC0 counter. If the counter
+    overflowed but the interrupt hasn't been serviced yet (we have interrupts
+    off), the pending tick is counted here. Wraps about every 134 seconds,
+    so only use it for differences.
+*/
+uint32_t get_timer_fine_count(void){
+    irqflags_t flags = cpu_irq_save();
+    uint32_t ticks = timerCount;
+    uint16_t counts = TCC0.CNT;
+
+    /** Overflow pending. Re-read the counter, it may have wrapped after the first read. */
+    if(TCC0.INTFLAGS & TC0_OVFIF_bm)
+    {
+        counts = TCC0.CNT;
+        ticks++;
+    }
+    cpu_irq_restore(flags);
+
+    return (ticks * TIMER_COUNTS_PER_TICK) + counts;
+}
+
+/**
+    @brief Provides interrupt-safe access to the wrap-free time in TCC0 counts.
+    @return The time since timer_init, in counts of the 32MHz timer clock (31.25ns)
+
+    Same pending overflow handling as get_timer_fine_count, but with all 64 bits
+    of the tick count, so it never wraps. The multiply by TIMER_COUNTS_PER_TICK
+    is done in 32 bit halves, avr-gcc would make a 64 bit multiply a library call.
+*/
+uint64_t get_timer_clock(void){
+    timer_wide_t clock;
+    uint32_t low, high;
+    irqflags_t flags = cpu_irq_save();
+    uint32_t ticks = timerCount;
+    uint32_t ticksHigh = timerCountHigh;
+    uint16_t counts = TCC0.CNT;
+
+    /** Overflow pending. Re-read the counter, it may have wrapped after the first read. */
+    if(TCC0.INTFLAGS & TC0_OVFIF_bm)
+    {
+        counts = TCC0.CNT;
+        ticks++;
+        if(ticks == 0)
+        {
+            ticksHigh++;
+        }
+    }
+    cpu_irq_restore(flags);
+
+    /** ticks * TIMER_COUNTS_PER_TICK + counts, 16 bits of ticks at a time */
+    low = ((uint32_t)(uint16_t)ticks * TIMER_COUNTS_PER_TICK) + counts;
+    high = (uint32_t)(uint16_t)(ticks >> 16) * TIMER_COUNTS_PER_TICK;
+    clock.half.lo = low + (high << 16);
+    clock.half.hi = (high >> 16) + (ticksHigh * TIMER_COUNTS_PER_TICK) + ((clock.half.lo < low) ? 1 : 0);
+
+    return clock.value;
+}
+
+/**
+    @brief Ask for an interrupt when a tick starts
+
+    @param wakeTick Timer count to be woken at
+    @return True, always safe to sleep
+
+    Every tick is an interrupt already, so there is nothing to set.
+*/
+Bool timer_set_wakeup(uint32_t wakeTick){
+    (void)wakeTick;
+    return true;
+}
+
+#endif /* TIMER_TICKLESS */
+
+/**
+    @brief Provides interrupt-safe access to the wrap-free time in microseconds.
+    @return The time since timer_init in microseconds
+*/
+uint64_t get_timer_us(void){
+    timer_wide_t clock;
+
+    clock.value = get_timer_clock();
+    /** Divide by TIMER_COUNTS_PER_US, 32, with 32 bit shifts */
+    clock.half.lo = (clock.half.lo >> 5) | (clock.half.hi << 27);
+    clock.half.hi = clock.half.hi >> 5;
+
+    return clock.value;
+}
+
 /**
     @brief Sleep for \a millis \a milliseconds
     @param millis The number of milliseconds to wait.
@@ -88,13 +415,13 @@ void timer_delay_ms(uint8_t millis)
 */
 void timer_delay_us(uint32_t micros)
 {
-    /** Get the start time and calculate the duration in counts.
-     *  Then, twiddle thumbs until \a millis \a milliseconds have
-     *  expired.
+    /** Get the start time and calculate the duration in TCC0 counts.
+     *  Then, twiddle thumbs until \a micros \a microseconds have
+     *  expired. Good down to about a microsecond, the time to read the clock.
      */
-    uint32_t timer_begin = get_timer_count();
-    uint32_t wait_len = micros/US_PER_TICK;
-    while((get_timer_count() - timer_begin) < wait_len)
+    uint64_t timer_begin = get_timer_clock();
+    uint64_t wait_len = (uint64_t)micros * TIMER_COUNTS_PER_US;
+    while((get_timer_clock() - timer_begin) < wait_len)
     {
         /* Do nothing */
     }
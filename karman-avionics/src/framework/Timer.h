@@ -16,7 +16,7 @@
 /** With default settings, system clock runs at 2MHz, and our timer interrupt occurs every
   * 1000 cycles (see Timer.c). So, Our timer interrupt occurs at 5KHz. This has a period of 1/5KHz = 200us
   * Background (continuous) tasks run every 200us/while no one else is running.
-  * 10ms tasks run every 10ms, etc. Task priority/order is determined by ordering in the task list.
+  * 10ms tasks run every 10ms, etc. When several tasks are due, the one with the earliest deadline runs first.
 */
 typedef enum task_freq_e {
     TASK_FREQ_BACKGROUND = 0,   /**< Run every loop */
@@ -31,6 +31,27 @@ Eight MS -- Timer is a 200us interrupt
 */
 #define EIGHT_MS (40) 
 
+/**
+ * Set to 1 to run TCC0 tickless. There is no interrupt every tick, only when
+ * the 16 bit counter overflows and when the scheduler asks for a wakeup.
+ * The tick count still reads the same. See Timer.c.
+ */
+#ifndef TIMER_TICKLESS
+#define TIMER_TICKLESS (0)
+#endif
+
+/** TCC0 counts per tick. At 32MHz, 6400 counts is 200us */
+#define TIMER_COUNTS_PER_TICK (6400)
+
+/** TCC0 counts per microsecond */
+#define TIMER_COUNTS_PER_US (32)
+
+/** Compare timer counts, allowing for wrap-around. True if a is before b. */
+static inline Bool time_before(uint32_t a, uint32_t b)
+{
+    return ((int32_t)(a - b) < 0);
+}
+
 /**
     @brief Callback for the TCC0 interrupt
 
@@ -52,6 +73,33 @@ void timer_init(void);
 */
 uint32_t get_timer_count(void);
 
+/**
+    @brief Provides interrupt-safe access to the time in TCC0 counts.
+    @return The current time, in counts of the 32MHz timer clock
+*/
+uint32_t get_timer_fine_count(void);
+
+/**
+    @brief Provides interrupt-safe access to the wrap-free time in TCC0 counts.
+    @return The time since timer_init, in counts of the 32MHz timer clock (31.25ns)
+*/
+uint64_t get_timer_clock(void);
+
+/**
+    @brief Provides interrupt-safe access to the wrap-free time in microseconds.
+    @return The time since timer_init in microseconds
+*/
+uint64_t get_timer_us(void);
+
+/**
+    @brief Ask for an interrupt when a tick starts
+    @param wakeTick Timer count to be woken at
+    @return True if it's safe to sleep, false if the tick is already here or too close
+
+    Call with interrupts off, right before sleeping. Does nothing unless TIMER_TICKLESS is set.
+*/
+Bool timer_set_wakeup(uint32_t wakeTick);
+
 /**
     @brief Sleep for \a millis \a milliseconds
     @param millis The number of milliseconds to wait.
@@ -33,6 +33,7 @@ __attribute__((OS_main)) int main(void)
 {
     pmic_init(); /** Enable the Programmable Multiple Interrupt Controller */
     sysclk_init(); /** Enable the system clock (32MHz). See conf_clock.h */
+    sleepmgr_init(); /** Clear sleep locks. The scheduler sleeps when it's idle */
 
     /** Enable global interrupts and enable timer */
     cpu_irq_enable();
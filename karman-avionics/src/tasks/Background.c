@@ -13,6 +13,7 @@
 
 
 #include "Background.h"
+#include "Timer.h"
 
 /**
  * @brief Holds currently registered background functions
@@ -22,6 +23,9 @@
  */
 static background_func_t backgroundFuncArry[MAX_BACKGROUND_FUNCS];
 
+/** Execution time of each registered background function */
+static exec_profile_t backgroundProfileArry[MAX_BACKGROUND_FUNCS];
+
  /**
   * @brief Number of background functions that are currently registered
   *
@@ -36,6 +40,7 @@ void background_task_func(void){
     /* Run everybody's background stuff here,
      * This includes polling, calculations, etc */
     static uint8_t funcArryIdx = 0;
+    uint32_t startCounts;
     for(funcArryIdx = 0; funcArryIdx < numBackgroundFunc; funcArryIdx++)
     {
         if(backgroundFuncArry[funcArryIdx] == NULL)
@@ -46,8 +51,10 @@ void background_task_func(void){
         }
         else
         {
-            /* Call background functions that have been registered */
+            /* Call background functions that have been registered, and time them */
+            startCounts = get_timer_fine_count();
             backgroundFuncArry[funcArryIdx]();
+            profiler_record(&backgroundProfileArry[funcArryIdx], get_timer_fine_count() - startCounts, 0);
         }
     }
 }
@@ -59,9 +66,8 @@ void background_task_func(void){
  * @returns a background_status_t enum to indicate success or failure
  *
  * The function will be added to the list of background functions.
- * Communicate with your background function via global variables,
- * i.e. a mailbox: A structure with a "doOperation" flag, a "operationDone" flag
- * and possibly some information for the background function to use.
+ * Communicate with your background function through a mailbox or event
+ * flags, see Mailbox.h.
  * background functions should be registered inside some init function.
  */
 uint8_t add_background_function(background_func_t function){
@@ -70,6 +76,7 @@ uint8_t add_background_function(background_func_t function){
     if(numBackgroundFunc < MAX_BACKGROUND_FUNCS)
     {
         backgroundFuncArry[numBackgroundFunc] = function;
+        profiler_reset(&backgroundProfileArry[numBackgroundFunc]);
         numBackgroundFunc++;
     }
     else
@@ -100,3 +107,30 @@ Bool is_background_function(background_func_t key)
     }
     return found;
 }
+
+/**
+ * @brief Number of registered background functions
+ *
+ * @returns How many background functions have been added
+ */
+uint8_t get_num_background_funcs(void)
+{
+    return numBackgroundFunc;
+}
+
+/**
+ * @brief Execution time profile of a background function
+ *
+ * @param idx Index of the function, in the order they were added
+ * @returns Pointer to the profile, NULL if idx is out of range
+ */
+exec_profile_t *get_background_profile(uint8_t idx)
+{
+    exec_profile_t *profile = NULL;
+
+    if(idx < numBackgroundFunc)
+    {
+        profile = &backgroundProfileArry[idx];
+    }
+    return profile;
+}
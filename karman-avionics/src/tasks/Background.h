@@ -12,6 +12,7 @@
 #define BACKGROUND_H_
 
 #include <compiler.h>
+#include "Profiler.h"
 
 /** Size of backround function array */
 #define MAX_BACKGROUND_FUNCS (20)
@@ -31,4 +32,8 @@ uint8_t add_background_function(background_func_t function);
 
 Bool is_background_function(background_func_t key);
 
+uint8_t get_num_background_funcs(void);
+
+exec_profile_t *get_background_profile(uint8_t idx);
+
 #endif /* BACKGROUND_H_ */
@@ -0,0 +1,87 @@
+/**
+ * @file LogTask.c
+ *
+ * @brief Logging Task Function and Initialization
+ *
+ * Created: 10/17/2026 11:20:00 PM
+ *
+ * Writes every sensor sample to the flash memory. Samples come from the
+ * sensor task through a mailbox, commands through gLogEvents.
+ */
+
+#include "LogTask.h"
+#include "FlashMem.h"
+#include "SensorDefs.h"
+
+/** Commands for the logging task */
+event_flags_t gLogEvents;
+
+/** Storage for logMailbox */
+static sensor_sample_t logSamples[LOG_SAMPLE_DEPTH];
+
+/** Samples from the sensor task */
+static mailbox_t logMailbox;
+
+/** Writing samples to the flash memory */
+static Bool logEnabled = false;
+
+/**
+ * @brief Initialize all things the logging task needs
+ *
+ * Subscribes to the sensor samples and starts logging.
+ * Call after init_sensor_task and init_flashmem.
+ */
+void init_log_task(void)
+{
+    mailbox_init(&logMailbox, logSamples, sizeof(sensor_sample_t), LOG_SAMPLE_DEPTH);
+    event_flags_init(&gLogEvents);
+    (void)sensor_subscribe(&logMailbox);
+    logEnabled = true;
+}
+
+/**
+ * @brief Write the waiting samples to the flash memory
+ *
+ * Handles commands first, so a stop applies to every sample still waiting.
+ * A sample the flash memory can't take is counted there as dropped.
+ */
+void log_task_func(void)
+{
+    sensor_sample_t sample;
+    flash_data_entry_t entry;
+    uint8_t events = event_flags_take(&gLogEvents, LOG_EVENT_START | LOG_EVENT_STOP | LOG_EVENT_FLUSH);
+
+    if(events & LOG_EVENT_STOP)
+    {
+        logEnabled = false;
+    }
+    else if(events & LOG_EVENT_START)
+    {
+        logEnabled = true;
+    }
+
+    while(mailbox_receive(&logMailbox, &sample))
+    {
+        if(logEnabled)
+        {
+            entry.timestamp = sample.timestamp;
+            entry.data = sample.data;
+            (void)flashmem_write_entry(&entry);
+        }
+    }
+
+    if(events & LOG_EVENT_FLUSH)
+    {
+        (void)flashmem_flush();
+    }
+}
+
+/**
+ * @brief Copy out the counters of the logging task's mailbox
+ *
+ * @param[out] stats Where to copy the counters
+ */
+void log_get_stats(mailbox_stats_t *stats)
+{
+    mailbox_get_stats(&logMailbox, stats);
+}
@@ -0,0 +1,35 @@
+/**
+ * @file LogTask.h
+ *
+ * @brief Logging Task Function and Initialization
+ *
+ * Created: 10/17/2026 11:20:00 PM
+ */
+
+
+#ifndef LOGTASK_H_
+#define LOGTASK_H_
+
+#include <compiler.h>
+#include "Mailbox.h"
+
+/** Sensor samples the logging task can fall behind by. 10ms task, 2ms sensor passes, with room to spare. */
+#define LOG_SAMPLE_DEPTH (8)
+
+/** Log event: start writing samples to the flash memory */
+#define LOG_EVENT_START (1 << 0)
+/** Log event: stop writing samples, they are still taken out of the mailbox */
+#define LOG_EVENT_STOP  (1 << 1)
+/** Log event: program the partly filled page now */
+#define LOG_EVENT_FLUSH (1 << 2)
+
+/** Commands for the logging task. Set from anywhere with event_flags_set. */
+extern event_flags_t gLogEvents;
+
+void log_task_func(void);
+
+void init_log_task(void);
+
+void log_get_stats(mailbox_stats_t *stats);
+
+#endif /* LOGTASK_H_ */
@@ -12,9 +12,70 @@
  */ 
 
 #include "Pyrotechnics.h"
+#include "SensorDefs.h"
+
+/** Commands for the pyro task */
+event_flags_t gPyroEvents;
+
+/** Storage for pyroMailbox */
+static sensor_sample_t pyroSamples[PYRO_SAMPLE_DEPTH];
+
+/** Samples from the sensor task */
+static mailbox_t pyroMailbox;
+
+/** Newest sample from the sensor task */
+static sensor_sample_t pyroLastSample;
+
+/** Charges are allowed to fire */
+static Bool pyroArmed = false;
+
+/**
+ * @brief Initialize all things the pyro task needs
+ *
+ * Subscribes to the sensor samples. Starts out disarmed.
+ * Call after init_sensor_task.
+ */
+void init_pyro_task(void)
+{
+    mailbox_init(&pyroMailbox, pyroSamples, sizeof(sensor_sample_t), PYRO_SAMPLE_DEPTH);
+    event_flags_init(&gPyroEvents);
+    pyroArmed = false;
+    (void)sensor_subscribe(&pyroMailbox);
+}
 
 /** Template. */
 void check_pyro_task_func(void){
+    uint8_t events = event_flags_take(&gPyroEvents, PYRO_EVENT_ARM | PYRO_EVENT_DISARM);
+
+    /* The altitude stage runs in the sensor task. Tasks don't preempt each
+     * other, so its ground reference can be frozen or let go from here. */
+    if(events & PYRO_EVENT_DISARM)
+    {
+        pyroArmed = false;
+        altitude_disarm();
+    }
+    else if(events & PYRO_EVENT_ARM)
+    {
+        pyroArmed = true;
+        altitude_arm();
+    }
+
+    /* Only the newest sample matters */
+    while(mailbox_receive(&pyroMailbox, &pyroLastSample))
+    {
+        ;
+    }
+
     /* Do some pyro stuff*/
     /* Do stuff if it's time to trigger pyrotechnics*/
 }
+
+/**
+ * @brief Copy out the counters of the pyro task's mailbox
+ *
+ * @param[out] stats Where to copy the counters
+ */
+void pyro_get_stats(mailbox_stats_t *stats)
+{
+    mailbox_get_stats(&pyroMailbox, stats);
+}
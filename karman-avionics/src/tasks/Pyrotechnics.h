@@ -11,9 +11,23 @@
 #ifndef PYROTECHNICS_H_
 #define PYROTECHNICS_H_
 #include <compiler.h>
+#include "Mailbox.h"
+
+/** Sensor samples the pyro task keeps. It only needs the newest, two covers one arriving while it runs. */
+#define PYRO_SAMPLE_DEPTH (2)
+
+/** Pyro event: allow the charges to fire, and freeze the altitude's ground reference */
+#define PYRO_EVENT_ARM    (1 << 0)
+/** Pyro event: don't fire anything, and let the ground reference follow the pressure again. Wins over an arm set at the same time. */
+#define PYRO_EVENT_DISARM (1 << 1)
+
+/** Commands for the pyro task. Set from anywhere with event_flags_set. */
+extern event_flags_t gPyroEvents;
 
 void check_pyro_task_func(void);
 
+void init_pyro_task(void);
 
+void pyro_get_stats(mailbox_stats_t *stats);
 
 #endif /* PYROTECHNICS_H_ */
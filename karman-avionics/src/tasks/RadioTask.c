@@ -12,26 +12,23 @@
 #include <asf.h>
 #include "Spi_service.h"
 #include "Spi_bg_task.h"
+#include "SensorDefs.h"
 
 /* See XMEGA AU manual page 146 and XMEGA 128A4U datasheet page 59*/
 /*#define RADIO_SPI_CTRL_VALUE (SPI_MODE_0_gc | SPI_PRESCALER_DIV4_gc | SPI_ENABLE_bm | SPI_MASTER_bm)
  Using USART in SPI master mode instead */
 
-#define SPI_BAUD_RATE (1000000) /**< 1MHz */
+/** SPI Master object for the radio bus */
+spi_master_t radioSpiMaster;
 
-#ifndef F_CPU
-#define F_CPU (sysclk_get_per_hz()) /**< System clock speed */
-#endif
+/** Storage for radioMailbox */
+static sensor_sample_t radioSamples[RADIO_SAMPLE_DEPTH];
 
-/**
- * @brief Control value to write to USART baud control regs
- *
- *  Ref https://github.com/abcminiuser/lufa/blob/master/LUFA/Drivers/Peripheral/XMEGA/SerialSPI_XMEGA.h
- */
-#define SPI_BAUDCTRLVAL(Baud)       ((Baud < (F_CPU / 2)) ? ((F_CPU / (2 * Baud)) - 1) : 0)
+/** Samples from the sensor task */
+static mailbox_t radioMailbox;
 
-/** SPI Master object for the radio bus */
-spi_master_t radioSpiMaster;
+/** Newest sample from the sensor task, what goes out in the next telemetry packet */
+static sensor_sample_t radioTelemetry;
 
 
 /** 
@@ -40,6 +37,7 @@ spi_master_t radioSpiMaster;
  * Setup USART in SPI Master Mode.
  * Setup SPI master
  * Intialize radio driver
+ * Subscribe to the sensor samples
  *
  */
 void init_radio_task(void)
@@ -47,21 +45,16 @@ void init_radio_task(void)
     /* Initialize SPI interface on port E*/
     /* See XMEGA AU Manual page 146, page 280 */
     /* NOTE PINS ARE SETUP TO USE USART IN SPI MASTER MODE! */
-
-    uint16_t baudrate = SPI_BAUDCTRLVAL(SPI_BAUD_RATE);
-
-    sysclk_enable_peripheral_clock(&RADIO_SPI);
-    RADIO_SPI.BAUDCTRLB = (uint8_t)((baudrate) >> 8); /* MSBs of Baud rate value. */
-    RADIO_SPI.BAUDCTRLA = (uint8_t)(baudrate & 0xFF); /* LSBs of Baud rate value. */
-    RADIO_SPI.CTRLA = 0x10; /* RXCINTLVL = 1, other 2 disabled */
-    RADIO_SPI.CTRLB = 0x18; /* Enable RX and TX */
-    RADIO_SPI.CTRLC = 0xC0; /* MSB first, mode 0. PMODE, SBMODE, CHSIZE ignored by SPI */
+    spi_master_hw_init(&RADIO_SPI, SPI_MASTER_DEFAULT_BAUD);
 
     init_spi_master_service(&radioSpiMaster, &RADIO_SPI, &RADIO_SPI_PORT, spi_bg_task);
     spi_bg_add_master(&radioSpiMaster);
 
     /* run initialization for radio driver */
     /* init_xbee(); */
+
+    mailbox_init(&radioMailbox, radioSamples, sizeof(sensor_sample_t), RADIO_SAMPLE_DEPTH);
+    (void)sensor_subscribe(&radioMailbox);
 }
 
 /**
@@ -69,11 +62,27 @@ void init_radio_task(void)
  *
  * This task receives messages from the sensors and from the control loop, and
  * sends them to the radio. It also receives messages from the radio and 
- * transfers them to the control loop.
+ * transfers them to the control loop. Commands for the other tasks go
+ * out as their event flags, gPyroEvents and gLogEvents.
  */
 void radio_task_func(void)
 {
-   /* Do the stuff*/
+    /* Telemetry only needs the newest sample */
+    while(mailbox_receive(&radioMailbox, &radioTelemetry))
+    {
+        ;
+    }
+    /* Do the stuff*/
+}
+
+/**
+ * @brief Copy out the counters of the radio task's mailbox
+ *
+ * @param[out] stats Where to copy the counters
+ */
+void radio_get_stats(mailbox_stats_t *stats)
+{
+    mailbox_get_stats(&radioMailbox, stats);
 }
 
 /** Interrupt service routine for the USART RXC interrupt on port E. */
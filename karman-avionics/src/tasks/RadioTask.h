@@ -12,11 +12,17 @@
 #define RADIOTASK_H_
 
 #include "Spi_service.h"
+#include "Mailbox.h"
+
+/** Sensor samples the radio task can fall behind by */
+#define RADIO_SAMPLE_DEPTH (4)
 
 void radio_task_func(void);
 
 void init_radio_task(void);
 
+void radio_get_stats(mailbox_stats_t *stats);
+
 
 
 #endif /* RADIOTASK_H_ */
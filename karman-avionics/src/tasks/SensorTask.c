@@ -13,6 +13,8 @@
 #include "Spi_service.h"
 #include "Spi_bg_task.h"
 #include "Tasks.h"
+#include "Timer.h"
+#include <string.h>
 
 #include "ms5607-02ba03.h"
 
@@ -22,24 +24,147 @@
 /*#define SENSOR_SPI_CTRL_VALUE (SPI_MODE_0_gc | SPI_PRESCALER_DIV4_gc | SPI_ENABLE_bm | SPI_MASTER_bm)
  Using USART in SPI master mode instead */
 
-#define SPI_BAUD_RATE (1000000) /**< 1MHz */
+/** SPI Master object for the sensor bus */
+spi_master_t sensorSpiMaster;
+
+/**
+ * Working copy of all current sensor values. Drivers write it field by field,
+ * so everyone else reads sensorSnapshot, see sensor_get_snapshot.
+ */
+static sensor_data_t gCurrSensorValues;
 
-#ifndef F_CPU
-#define F_CPU (sysclk_get_per_hz()) /**< System clock speed */
-#endif
+/** gCurrSensorValues as of the last pass with new data */
+static sensor_snapshot_t sensorSnapshot;
+
+/** Mailboxes that get a sensor_sample_t after every pass with new data */
+static mailbox_t *sensorSubscribers[SENSOR_MAX_SUBSCRIBERS];
+
+/** Number of entries in sensorSubscribers */
+static uint8_t numSensorSubscribers = 0;
+
+static uint64_t sensor_altimeter_get_data(sensor_data_t *out_data);
 
 /**
- * @brief Control value to write to USART baud control regs
+ * @brief Every sensor driver on the sensor bus
  *
- *  Ref https://github.com/abcminiuser/lufa/blob/master/LUFA/Drivers/Peripheral/XMEGA/SerialSPI_XMEGA.h
+ * Add a sensor with one entry here. Keep the worst case bus use explicit:
+ * spi_bytes per call to run, at most one call per pass, all within
+ * SENSOR_SPI_BYTES_PER_PASS. Most names for the sensors still to come are out of date:
+ * mma6855bkcw (1 axis accelerometer), fxls8471qr1 (3 axis accelerometer),
+ * i3g4250d (3 axis gyro), si7021-a20 (temp/humidity).
  */
-#define SPI_BAUDCTRLVAL(Baud)       ((Baud < (F_CPU / 2)) ? ((F_CPU / (2 * Baud)) - 1) : 0)
+static sensor_driver_t SensorDrivers[] =
+{
+    /** Altimeter/pressure. Worst call is after a conversion: the ADC read, and pipelined the next convert behind it. */
+    {
+        .init = ms5607_02ba03_init,
+        .run = ms5607_02ba03_run,
+        .get_data = sensor_altimeter_get_data,
+        .period = 0,
+        .priority = 4,
+        .spi_slots = 2,
+        .spi_bytes = 5,
+    },
+};
 
-/** SPI Master object for the sensor bus */
-spi_master_t sensorSpiMaster;
+/** Number of entries in SensorDrivers */
+#define NUM_SENSORS (sizeof(SensorDrivers) / sizeof(sensor_driver_t))
+
+/** SensorDrivers indexes, highest priority first */
+static uint8_t sensorOrder[NUM_SENSORS];
+
+/** Returns a pointer to the sensor driver list */
+sensor_driver_t *get_sensor_list(void)
+{
+    return SensorDrivers;
+}
+
+/** Returns the number of sensor drivers in the list */
+uint8_t get_num_sensors(void)
+{
+    return NUM_SENSORS;
+}
+
+/**
+ * @brief Get a copy of the sensor data after every pass that has new data
+ *
+ * @param box Mailbox for sensor_sample_t messages. Size it for how long the
+ *        receiver can go between emptying it, a full mailbox drops samples.
+ * @return True on success, false if there are already SENSOR_MAX_SUBSCRIBERS
+ *
+ * Call from the receiver's init.
+ */
+Bool sensor_subscribe(mailbox_t *box)
+{
+    Bool subscribed = false;
+
+    if(numSensorSubscribers < SENSOR_MAX_SUBSCRIBERS)
+    {
+        sensorSubscribers[numSensorSubscribers] = box;
+        numSensorSubscribers++;
+        subscribed = true;
+    }
+    return subscribed;
+}
+
+/**
+ * @brief Get the newest sensor sample
+ *
+ * @param[out] sample Where to copy the sample
+ * @return Samples published so far, modulo 128. Compare with the last
+ *         return to tell if the sample is new.
+ *
+ * Never sees a sample the sensor task is halfway through. Safe to call from
+ * anywhere, interrupts included, and never turns interrupts off.
+ */
+uint8_t sensor_get_snapshot(sensor_sample_t *sample)
+{
+    uint8_t seq;
+
+    do
+    {
+        seq = sensorSnapshot.seq;
+        barrier();
+        memcpy(sample, &(sensorSnapshot.copies[seq & 1]), sizeof(sensor_sample_t));
+        barrier();
+    } while(seq != sensorSnapshot.seq);
+
+    return seq >> 1;
+}
+
+/**
+ * @brief Publish a new sample to sensor_get_snapshot
+ *
+ * @param sample The sample
+ *
+ * Writes both copies, each one while readers are pointed at the other.
+ */
+static void sensor_publish_snapshot(sensor_sample_t *sample)
+{
+    sensorSnapshot.seq++;
+    barrier();
+    sensorSnapshot.copies[0] = *sample;
+    barrier();
+    sensorSnapshot.seq++;
+    barrier();
+    sensorSnapshot.copies[1] = *sample;
+}
+
+/**
+ * @brief Copy out the altimeter data, and update the altitude from it
+ *
+ * @param[out] out_data All the sensor data
+ * @return get_timer_us when the pressure was measured
+ */
+static uint64_t sensor_altimeter_get_data(sensor_data_t *out_data)
+{
+    uint64_t measured = ms5607_02ba03_get_data(&(out_data->altimeter));
 
-/** Contains all current sensor values for use in ... TBD. Processing. */
-sensor_data_t gCurrSensorValues;
+    /* Altitude wants timer ticks, 200 us each. Divide by 8 then 25 to stay in 32 bits. */
+    altitude_update(out_data->altimeter.pressure, (uint32_t)(measured >> 3) / 25, &(out_data->altitude));
+
+    return measured;
+}
 
 /** 
  * @brief Initialize all things the radio task needs
@@ -50,68 +175,118 @@ sensor_data_t gCurrSensorValues;
  */
 void init_sensor_task(void)
 {
+    uint8_t idx, pos;
+    uint32_t now;
+
     /* Initialize SPI interface on port D*/
     /* See XMEGA AU Manual page 146, page 280 */
     /* NOTE PINS ARE SETUP TO USE USART IN SPI MASTER MODE! */
-
-    uint16_t baudrate = SPI_BAUDCTRLVAL(SPI_BAUD_RATE);
-
-    sysclk_enable_peripheral_clock(&SENSOR_SPI);
-    SENSOR_SPI.BAUDCTRLB = (uint8_t)((baudrate) >> 8); /* MSBs of Baud rate value. */
-    SENSOR_SPI.BAUDCTRLA = (uint8_t)(baudrate & 0xFF); /* LSBs of Baud rate value. */
-    SENSOR_SPI.CTRLA = 0x10; /* RXCINTLVL = 1, other 2 disabled */
-    SENSOR_SPI.CTRLB = 0x18; /* Enable RX and TX */
-    SENSOR_SPI.CTRLC = 0xC0; /* MSB first, mode 0. PMODE, SBMODE, CHSIZE ignored by SPI */
+    spi_master_hw_init(&SENSOR_SPI, SPI_MASTER_DEFAULT_BAUD);
 
     init_spi_master_service(&sensorSpiMaster, &SENSOR_SPI, &SENSOR_SPI_PORT, spi_bg_task);
+    /* Move whole transfers with DMA instead of an interrupt per byte */
+    spi_master_enable_dma(&sensorSpiMaster,
+                          SENSOR_SPI_DMA_RX, SENSOR_SPI_DMA_RX_TRIG,
+                          SENSOR_SPI_DMA_TX, SENSOR_SPI_DMA_TX_TRIG);
     spi_bg_add_master(&sensorSpiMaster);
 
-    /* run initialization for all sensors. Most of these names are out of date */
+    altitude_init();
 
-    /* 1 axis accelerometer */
-    /* init_mma6855bkcw() */
-
-    /* 3 axis accelerometer*/
-    /* init_fxls8471qr1() */
-
-    /* 3 axis gyro */
-    /* init_i3g4250d() */
-
-    /* temp/humidity */
-    /* init_si7021-a20() */
+    /* run initialization for all sensors, and sort them by priority */
+    now = get_timer_count();
+    for(idx = 0; idx < NUM_SENSORS; idx++)
+    {
+        SensorDrivers[idx].init(&sensorSpiMaster);
+        /* First sample is due right away */
+        SensorDrivers[idx].release = now - SensorDrivers[idx].period;
+        SensorDrivers[idx].active = false;
+        SensorDrivers[idx].samples = 0;
+        SensorDrivers[idx].deferrals = 0;
 
-    /* altimeter/pressure */
-    ms5607_02ba03_init(&sensorSpiMaster);
+        /* Insertion sort, equal priorities stay in table order */
+        for(pos = idx; (pos > 0) && (SensorDrivers[sensorOrder[pos - 1]].priority > SensorDrivers[idx].priority); pos--)
+        {
+            sensorOrder[pos] = sensorOrder[pos - 1];
+        }
+        sensorOrder[pos] = idx;
+    }
 }
 
 /**
  * @brief High level sensor operations
  *
  * This task runs all sensor state machine functions and passes the updated data to
- * the main control loop and the radio.
+ * the snapshot (see sensor_get_snapshot) and every subscriber (see sensor_subscribe). Drivers run in priority order, each
+ * one only if what it might queue still fits in this pass.
  */
 void sensor_task_func(void)
 {
     sensor_status_t curr_status;
+    sensor_driver_t *driver;
+    uint8_t idx;
+    Bool newData = false;
+    sensor_sample_t sample;
+    uint64_t measured;
+    uint64_t newest = 0;
+    uint8_t busBytes = SENSOR_SPI_BYTES_PER_PASS;
+    uint8_t queueSlots = SPI_MASTER_QUEUE_DEPTH - spi_master_queue_count(&sensorSpiMaster);
+    uint32_t now = get_timer_count();
 
-    curr_status = ms5607_02ba03_run();
-
-    if (curr_status == SENSOR_COMPLETE)
+    for(idx = 0; idx < NUM_SENSORS; idx++)
     {
-        /* Do fancy things with current temp/pressure data */
-        ms5607_02ba03_get_data(&(gCurrSensorValues.altimeter));
-    }
+        driver = &SensorDrivers[sensorOrder[idx]];
+
+        if(!driver->active && ((now - driver->release) >= driver->period))
+        {
+            /* Next sample is due. Start it now. */
+            driver->release = now;
+            driver->active = true;
+        }
 
-    /* ----TEMPLATE----
-     * curr_status = <foo>_run();
-     * if (curr_status == SENSOR_COMPLETE)
-     * {
-     *    Do fancy things with current sensor's data
-     *    <foo>_get_data(&(gCurrSensorValues.<foo_type>))
-     * }
-     *
-     */
+        if(!driver->active)
+        {
+            /* Nothing due */
+        }
+        else if((driver->spi_bytes > busBytes) || (driver->spi_slots > queueSlots))
+        {
+            /* Bus is spoken for this pass, try again next pass */
+            driver->deferrals++;
+        }
+        else
+        {
+            busBytes -= driver->spi_bytes;
+            queueSlots -= driver->spi_slots;
 
+            curr_status = driver->run();
+            if(curr_status == SENSOR_WAITING)
+            {
+                /* Didn't queue anything, the budget is still there for the rest of the pass */
+                busBytes += driver->spi_bytes;
+                queueSlots += driver->spi_slots;
+            }
+            else if(curr_status == SENSOR_COMPLETE)
+            {
+                measured = driver->get_data(&gCurrSensorValues);
+                newest = max(newest, measured);
+                driver->samples++;
+                driver->active = false;
+                newData = true;
+            }
+        }
+    }
+
+    if(newData)
+    {
+        /* One sample for the pass, with everything that came in */
+        sample.timestamp = newest;
+        sample.data = gCurrSensorValues;
+        sensor_publish_snapshot(&sample);
+        for(idx = 0; idx < numSensorSubscribers; idx++)
+        {
+            /* A full mailbox counts the drop, nothing else to do about it here */
+            (void)mailbox_post(sensorSubscribers[idx], &sample);
+        }
+    }
 }
 
 /** Interrupt service routine for the USART RXC interrupt on port D. */
@@ -16,8 +16,8 @@
 /** Return for all sensor state machines */
 typedef enum
 {
-    SENSOR_WAITING,     /**< In a sleep state */
-    SENSOR_BUSY,        /**< Transaction in progress */
+    SENSOR_WAITING,     /**< In a sleep state. Nothing queued on the bus this call. */
+    SENSOR_BUSY,        /**< Transaction in progress, may have queued on the bus this call */
     SENSOR_COMPLETE,    /**< New data available */
 } sensor_status_t;
 
@@ -52,16 +52,14 @@ Bool spi_bg_add_master(spi_master_t *master)
 void spi_bg_task(void)
 {
     uint8_t idx = 0;
-    spi_master_t *currMaster = gSpiMasters[0];
+    spi_master_t *currMaster = NULL;
 
-    for(idx = 0; idx < MAX_SPI_MASTER_MODULES; idx++, currMaster++)
+    for(idx = 0; idx < MAX_SPI_MASTER_MODULES; idx++)
     {
+        currMaster = gSpiMasters[idx];
         if(currMaster != NULL)
         {
-            if(!currMaster->masterBusy)
-            {
-                (void)spi_master_initate_request(currMaster);
-            } /* End of check on busy */
+            (void)spi_master_start_if_idle(currMaster);
         } /* End of NULL check */
     } /* End of loop over master modules */
 }
@@ -0,0 +1,224 @@
+/**
+ * @file Altitude.c
+ *
+ * Created: 10/17/2026 8:05:00 PM
+ *
+ * @brief Altitude and vertical speed from barometric pressure
+ *
+ * Pressure altitude comes from the standard atmosphere,
+ * h = 44330.77 m * (1 - (P / 101325 Pa)^0.190263), looked up in a table and
+ * interpolated. The table is spaced like a float: each power of two of
+ * pressure gets 64 evenly spaced points. That keeps the error within about
+ * 20 cm everywhere, close to the sensor's own resolution, with 513 points
+ * (2 KB of program memory). The lookup is a short bit scan, one multiply and
+ * one shift, whatever the pressure.
+ *
+ * Altitude is reported above a ground reference. Until the stage is armed the
+ * reference follows the pressure altitude slowly, so weather drift on the pad
+ * reads as zero. Arming freezes it.
+ */
+
+#include "Altitude.h"
+
+/** log2 of the lowest pressure in the table */
+#define ALTITUDE_MIN_EXP (9)
+/** log2 of the number of table points per power of two of pressure */
+#define ALTITUDE_STEP_BITS (6)
+/** Timer ticks per second, for the vertical speed. 200 us ticks. */
+#define ALTITUDE_TICKS_PER_SEC (5000L)
+/** Biggest altitude change between samples used for the speed, in cm */
+#define ALTITUDE_MAX_STEP (400000L)
+
+/**
+ * Pressure altitude in cm at each table pressure. Point i is at
+ * 2^(9 + i / 64) + (i % 64) * 2^(3 + i / 64) Pa.
+ */
+static PROGMEM_DECLARE(int32_t, altitudeTable[513]) = {
+    2812102, 2807313, 2802583, 2797912, 2793296, 2788735, 2784227, 2779771,
+    2775366, 2771010, 2766702, 2762440, 2758225, 2754054, 2749927, 2745842,
+    2741800, 2737798, 2733835, 2729912, 2726026, 2722178, 2718367, 2714591,
+    2710850, 2707144, 2703471, 2699831, 2696223, 2692646, 2689101, 2685586,
+    2682101, 2678646, 2675219, 2671820, 2668449, 2665105, 2661788, 2658497,
+    2655231, 2651992, 2648777, 2645586, 2642419, 2639277, 2636157, 2633060,
+    2629986, 2626934, 2623904, 2620895, 2617907, 2614941, 2611994, 2609068,
+    2606161, 2603274, 2600407, 2597558, 2594728, 2591917, 2589123, 2586348,
+    2583590, 2578126, 2572730, 2567400, 2562133, 2556929, 2551786, 2546702,
+    2541675, 2536705, 2531790, 2526928, 2522118, 2517359, 2512650, 2507990,
+    2503377, 2498811, 2494290, 2489814, 2485381, 2480990, 2476641, 2472333,
+    2468065, 2463836, 2459645, 2455492, 2451375, 2447295, 2443250, 2439240,
+    2435263, 2431321, 2427410, 2423532, 2419686, 2415871, 2412086, 2408331,
+    2404606, 2400909, 2397241, 2393600, 2389987, 2386402, 2382842, 2379309,
+    2375801, 2372319, 2368862, 2365429, 2362020, 2358635, 2355273, 2351934,
+    2348618, 2345324, 2342052, 2338802, 2335573, 2332365, 2329178, 2326011,
+    2322865, 2316630, 2310474, 2304392, 2298383, 2292446, 2286577, 2280776,
+    2275041, 2269370, 2263762, 2258215, 2252727, 2247297, 2241925, 2236607,
+    2231344, 2226134, 2220976, 2215869, 2210811, 2205801, 2200839, 2195924,
+    2191054, 2186229, 2181447, 2176708, 2172012, 2167356, 2162741, 2158165,
+    2153628, 2149130, 2144668, 2140244, 2135855, 2131502, 2127183, 2122899,
+    2118648, 2114431, 2110245, 2106092, 2101970, 2097878, 2093817, 2089786,
+    2085784, 2081811, 2077866, 2073949, 2070060, 2066197, 2062361, 2058552,
+    2054768, 2051010, 2047277, 2043568, 2039884, 2036224, 2032588, 2028975,
+    2025384, 2018271, 2011247, 2004307, 1997452, 1990677, 1983981, 1977363,
+    1970819, 1964349, 1957950, 1951621, 1945359, 1939164, 1933034, 1926967,
+    1920962, 1915018, 1909133, 1903305, 1897534, 1891818, 1886157, 1880549,
+    1874992, 1869487, 1864031, 1858624, 1853265, 1847953, 1842688, 1837467,
+    1832290, 1827158, 1822067, 1817019, 1812012, 1807045, 1802118, 1797229,
+    1792380, 1787567, 1782792, 1778053, 1773350, 1768681, 1764048, 1759448,
+    1754882, 1750349, 1745848, 1741379, 1736941, 1732534, 1728158, 1723811,
+    1719494, 1715206, 1710947, 1706715, 1702512, 1698336, 1694187, 1690064,
+    1685968, 1677852, 1669837, 1661920, 1654097, 1646368, 1638728, 1631177,
+    1623711, 1616328, 1609027, 1601806, 1594662, 1587593, 1580599, 1573677,
+    1566825, 1560043, 1553328, 1546679, 1540094, 1533573, 1527113, 1520714,
+    1514375, 1508093, 1501868, 1495699, 1489585, 1483524, 1477516, 1471559,
+    1465653, 1459797, 1453989, 1448229, 1442516, 1436849, 1431227, 1425650,
+    1420116, 1414625, 1409177, 1403770, 1398403, 1393077, 1387790, 1382542,
+    1377332, 1372160, 1367024, 1361925, 1356862, 1351834, 1346841, 1341881,
+    1336956, 1332063, 1327203, 1322376, 1317580, 1312815, 1308081, 1303377,
+    1298703, 1289443, 1280298, 1271265, 1262340, 1253521, 1244804, 1236188,
+    1227670, 1219246, 1210916, 1202677, 1194525, 1186461, 1178480, 1170582,
+    1162765, 1155026, 1147365, 1139778, 1132265, 1124825, 1117455, 1110154,
+    1102920, 1095753, 1088651, 1081612, 1074636, 1067721, 1060866, 1054069,
+    1047330, 1040648, 1034022, 1027450, 1020931, 1014465, 1008051, 1001687,
+    995374, 989109, 982892, 976723, 970600, 964523, 958491, 952503,
+    946559, 940657, 934798, 928980, 923203, 917466, 911769, 906110,
+    900490, 894908, 889363, 883855, 878383, 872946, 867545, 862178,
+    856845, 846280, 835846, 825539, 815356, 805293, 795348, 785517,
+    775798, 766187, 756683, 747282, 737981, 728780, 719674, 710663,
+    701744, 692914, 684172, 675516, 666944, 658455, 650046, 641715,
+    633462, 625285, 617181, 609150, 601191, 593301, 585479, 577725,
+    570036, 562412, 554851, 547353, 539915, 532538, 525219, 517959,
+    510755, 503607, 496514, 489475, 482489, 475555, 468673, 461841,
+    455058, 448325, 441639, 435001, 428410, 421864, 415364, 408908,
+    402496, 396126, 389800, 383515, 377271, 371068, 364906, 358782,
+    352698, 340643, 328738, 316978, 305360, 293878, 282531, 271315,
+    260225, 249260, 238415, 227689, 217077, 206579, 196190, 185908,
+    175731, 165657, 155683, 145807, 136026, 126340, 116745, 107241,
+    97824, 88494, 79248, 70085, 61003, 52001, 43077, 34229,
+    25457, 16758, 8131, -424, -8910, -17328, -25678, -33962,
+    -42182, -50337, -58430, -66461, -74432, -82343, -90196, -97991,
+    -105730, -113412, -121040, -128614, -136135, -143603, -151020, -158386,
+    -165702, -172969, -180188, -187359, -194482, -201560, -208591, -215578,
+    -222520
+};
+
+/** Control data for the altitude stage */
+altitude_ctrl_t gAltitudeCtrl;
+
+/**
+ * @brief Start the altitude stage disarmed, with no samples
+ */
+void altitude_init(void)
+{
+    gAltitudeCtrl.ground = 0;
+    gAltitudeCtrl.last_alt = 0;
+    gAltitudeCtrl.last_time = 0;
+    gAltitudeCtrl.velocity = 0;
+    gAltitudeCtrl.armed = false;
+    gAltitudeCtrl.have_sample = false;
+}
+
+/**
+ * @brief Standard atmosphere pressure altitude
+ *
+ * @param pressure Pressure in Pa, as the altimeter driver reports it
+ * @return Pressure altitude in cm
+ */
+int32_t altitude_from_pressure(int32_t pressure)
+{
+    uint32_t press;
+    uint8_t exp = ALTITUDE_MIN_EXP;
+    uint8_t shift;
+    uint16_t idx;
+    int32_t high;
+    uint32_t drop;
+
+    if(pressure < ALTITUDE_MIN_PRESSURE)
+    {
+        pressure = ALTITUDE_MIN_PRESSURE;
+    }
+    else if(pressure > ALTITUDE_MAX_PRESSURE)
+    {
+        pressure = ALTITUDE_MAX_PRESSURE;
+    }
+    press = (uint32_t)pressure;
+
+    /* Which power of two, at most 7 steps */
+    while((press >> (exp + 1)) != 0)
+    {
+        exp++;
+    }
+    shift = exp - ALTITUDE_STEP_BITS;
+    idx = ((uint16_t)(exp - ALTITUDE_MIN_EXP) << ALTITUDE_STEP_BITS) +
+          (uint16_t)((press >> shift) & ((1 << ALTITUDE_STEP_BITS) - 1));
+
+    /* Altitude falls as pressure rises, so interpolate down from the point below */
+    high = (int32_t)pgm_read_dword(&altitudeTable[idx]);
+    drop = (uint32_t)(high - (int32_t)pgm_read_dword(&altitudeTable[idx + 1]));
+
+    return high - (int32_t)((drop * (press & ((1UL << shift) - 1))) >> shift);
+}
+
+/**
+ * @brief Add a pressure sample
+ *
+ * @param pressure Pressure in Pa
+ * @param time Timer count when the sample was taken
+ * @param[out] out_data Altitude above the ground reference and vertical speed
+ *
+ * Speed is the change in altitude over the change in time, smoothed
+ * with a first order filter. Takes the same time for every sample.
+ */
+void altitude_update(int32_t pressure, uint32_t time, altitude_data_t *out_data)
+{
+    int32_t alt = altitude_from_pressure(pressure);
+    uint32_t elapsed = time - gAltitudeCtrl.last_time;
+    int32_t speed;
+
+    if(!gAltitudeCtrl.have_sample)
+    {
+        /* First sample, start the ground reference here */
+        gAltitudeCtrl.ground = alt;
+        gAltitudeCtrl.velocity = 0;
+        gAltitudeCtrl.have_sample = true;
+    }
+    else
+    {
+        if(elapsed > 0)
+        {
+            /* Keep a glitch from overflowing the multiply */
+            speed = alt - gAltitudeCtrl.last_alt;
+            speed = min(speed, ALTITUDE_MAX_STEP);
+            speed = max(speed, -ALTITUDE_MAX_STEP);
+            speed = (speed * ALTITUDE_TICKS_PER_SEC) / (int32_t)elapsed;
+            gAltitudeCtrl.velocity += (speed - gAltitudeCtrl.velocity) / ALTITUDE_VSPEED_FILTER;
+        }
+        if(!gAltitudeCtrl.armed)
+        {
+            gAltitudeCtrl.ground += (alt - gAltitudeCtrl.ground) / ALTITUDE_GROUND_FILTER;
+        }
+    }
+    gAltitudeCtrl.last_alt = alt;
+    gAltitudeCtrl.last_time = time;
+
+    out_data->altitude = alt - gAltitudeCtrl.ground;
+    out_data->velocity = gAltitudeCtrl.velocity;
+}
+
+/**
+ * @brief Freeze the ground reference
+ *
+ * Call on the pad right before launch. Altitude is measured from wherever
+ * the reference has settled.
+ */
+void altitude_arm(void)
+{
+    gAltitudeCtrl.armed = true;
+}
+
+/**
+ * @brief Let the ground reference follow the pressure again
+ */
+void altitude_disarm(void)
+{
+    gAltitudeCtrl.armed = false;
+}
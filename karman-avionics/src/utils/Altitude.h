@@ -0,0 +1,53 @@
+/**
+ * @file Altitude.h
+ *
+ * @brief Altitude and vertical speed from barometric pressure
+ *
+ * Created: 10/17/2026 8:05:00 PM
+ */
+
+
+#ifndef ALTITUDE_H_
+#define ALTITUDE_H_
+
+#include <compiler.h>
+
+/** Altitude stage output */
+typedef struct
+{
+    int32_t altitude;       /**< Height above the ground reference in cm */
+    int32_t velocity;       /**< Vertical speed in cm/s, up is positive */
+} altitude_data_t;
+
+/** Control structure for the altitude stage */
+typedef struct
+{
+    int32_t  ground;        /**< Pressure altitude of the ground reference in cm */
+    int32_t  last_alt;      /**< Pressure altitude of the last sample in cm */
+    uint32_t last_time;     /**< Timer count of the last sample */
+    int32_t  velocity;      /**< Filtered vertical speed in cm/s */
+    Bool     armed;         /**< Ground reference is frozen */
+    Bool     have_sample;   /**< last_alt and last_time are good */
+} altitude_ctrl_t;
+
+/** Lowest pressure in the table in Pa, about 28 km. Lower pressures read as this. */
+#define ALTITUDE_MIN_PRESSURE (512L)
+/** Highest pressure in the table in Pa. Higher pressures read as this. */
+#define ALTITUDE_MAX_PRESSURE (131071L)
+
+/** Vertical speed filter, each sample moves it 1/ALTITUDE_VSPEED_FILTER of the way */
+#define ALTITUDE_VSPEED_FILTER (4)
+/** Ground reference filter while disarmed, each sample moves it 1/ALTITUDE_GROUND_FILTER of the way */
+#define ALTITUDE_GROUND_FILTER (16)
+
+void altitude_init(void);
+
+int32_t altitude_from_pressure(int32_t pressure);
+
+void altitude_update(int32_t pressure, uint32_t time, altitude_data_t *out_data);
+
+void altitude_arm(void);
+
+void altitude_disarm(void);
+
+#endif /* ALTITUDE_H_ */
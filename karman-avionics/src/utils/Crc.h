@@ -0,0 +1,44 @@
+/**
+ * @file Crc.h
+ *
+ * @brief CRC-16-CCITT and CRC-32 for flash log entries and USB packets
+ *
+ * Created: 10/17/2026 6:40:00 PM
+ */ 
+
+
+#ifndef CRC_H_
+#define CRC_H_
+
+#include <compiler.h>
+
+/**
+ * Pick the lookup tables. 1 uses 256 entry tables, a byte per step, 1.5 KB
+ * of program memory. 0 uses 16 entry tables, a nibble per step, 96 bytes.
+ *
+ * 0 by default. The byte tables are about twice as fast (host/tests/test_crc
+ * measures both), but the only CRC on the flight path is one CRC-16 per log
+ * entry, tens of bytes each log period. The bulk CRC-32 only runs during a
+ * USB download on the ground, where the flash read is the bottleneck.
+ * Switch to 1 if a profile ever shows the CRC.
+ */
+#ifndef CRC_USE_BYTE_TABLES
+#define CRC_USE_BYTE_TABLES (0)
+#endif
+
+/** Starting value for CRC-16-CCITT (the 0xFFFF "FALSE" variant, no final XOR) */
+#define CRC16_INIT (0xFFFF)
+
+/** Starting value for CRC-32 */
+#define CRC32_INIT (0xFFFFFFFFUL)
+
+/** Finish a CRC-32 after the last crc32_update. Matches zlib's crc32(). */
+#define crc32_final(crc) (~(crc))
+
+/* Add bytes to a running CRC-16-CCITT */
+uint16_t crc16_update(uint16_t crc, const uint8_t *buf, uint16_t len);
+
+/* Add bytes to a running CRC-32 */
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, uint16_t len);
+
+#endif /* CRC_H_ */
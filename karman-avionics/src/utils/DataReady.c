@@ -0,0 +1,275 @@
+/**
+ * @file DataReady.c
+ *
+ * Created: 10/17/2026 9:10:00 PM
+ *
+ * @brief Sensor data ready interrupts
+ *
+ * Each line has its own port interrupt vector. HIGHG_ACC2 and IMU_ACC1 share
+ * PORTE, so they use INT0 and INT1 there. The interrupts run at the same
+ * level as the SPI masters and the timer, so none of them preempt each other.
+ */
+
+#include "conf_board.h"
+#include "DataReady.h"
+#include "Timer.h"
+#include <string.h>
+
+#if (DRDY_NUM_LINES > SPI_MASTER_ISR_SLOTS)
+#error "Every data ready line needs its own SPI master interrupt slot"
+#endif
+
+/** Bits of a port interrupt's level in INTCTRL */
+#define DRDY_INTCTRL_MASK(intNum) (0x03 << ((intNum) << 1))
+/** Interrupt flag of a port interrupt in INTFLAGS */
+#define DRDY_INTFLAG(intNum) (1 << (intNum))
+
+/** All the data ready lines. Pins come from conf_board.h, reads are registered by the drivers. */
+drdy_line_info_t gDrdyLines[DRDY_NUM_LINES] =
+{
+    [DRDY_HIGHG_ACC1] =
+    {
+        .port = &HIGHG_ACC1_PORT,
+        .pin_bit_mask = HIGHG_ACC1_INT,
+        .pin_ctrl = &(HIGHG_ACC1_PORT.HIGHG_ACC1_INT_PINCTRL),
+        .int_num = HIGHG_ACC1_INT_NUM,
+    },
+    [DRDY_HIGHG_ACC2] =
+    {
+        .port = &HIGHG_ACC2_PORT,
+        .pin_bit_mask = HIGHG_ACC2_INT,
+        .pin_ctrl = &(HIGHG_ACC2_PORT.HIGHG_ACC2_INT_PINCTRL),
+        .int_num = HIGHG_ACC2_INT_NUM,
+    },
+    [DRDY_IMU_ACC1] =
+    {
+        .port = &IMU_ACC1_INT_PORT,
+        .pin_bit_mask = IMU_ACC1_INT,
+        .pin_ctrl = &(IMU_ACC1_INT_PORT.IMU_ACC1_INT_PINCTRL),
+        .int_num = IMU_ACC1_INT_NUM,
+    },
+    [DRDY_IMU_ACC2] =
+    {
+        .port = &IMU_ACC2_PORT,
+        .pin_bit_mask = IMU_ACC2_INT,
+        .pin_ctrl = &(IMU_ACC2_PORT.IMU_ACC2_INT_PINCTRL),
+        .int_num = IMU_ACC2_INT_NUM,
+    },
+};
+
+/**
+ * @brief Register the read to start on a line's data ready edge
+ *
+ * @param line The data ready line
+ * @param spi_master Bus the device is on
+ * @param cs_info Chip select info for the device
+ * @param send_buffer Read command, sent as is on every edge
+ * @param send_len Bytes of read command
+ * @param recv_buffer Where the SPI service puts the sample
+ * @param recv_len Bytes to read
+ * @param sense Edge to trigger on, PORT_ISC_RISING_gc or PORT_ISC_FALLING_gc
+ * @return True on success, false if the line is out of range
+ *
+ * Sets the pin up as an input, but leaves the interrupt off. Call
+ * drdy_enable once the device is configured to raise it.
+ */
+Bool drdy_register(drdy_line_t line,
+                   spi_master_t *spi_master,
+                   chip_select_info_t *cs_info,
+                   volatile uint8_t *send_buffer,
+                   uint16_t send_len,
+                   volatile uint8_t *recv_buffer,
+                   uint16_t recv_len,
+                   uint8_t sense)
+{
+    Bool registerStatus = true;
+    drdy_line_info_t *info;
+
+    if(line >= DRDY_NUM_LINES)
+    {
+        registerStatus = false;
+    }
+    else
+    {
+        info = &gDrdyLines[line];
+        drdy_disable(line);
+
+        info->spi_master = spi_master;
+        info->cs_info = cs_info;
+        info->send_buffer = send_buffer;
+        info->send_len = send_len;
+        info->recv_buffer = recv_buffer;
+        info->recv_len = recv_len;
+        info->complete = false;
+        info->in_flight = false;
+        memset((void *)&(info->stats), 0, sizeof(info->stats));
+
+        info->port->DIRCLR = info->pin_bit_mask;
+        *(info->pin_ctrl) = sense;
+    }
+    return registerStatus;
+}
+
+/**
+ * @brief Turn on a line's data ready interrupt
+ *
+ * @param line The data ready line, already registered
+ */
+void drdy_enable(drdy_line_t line)
+{
+    drdy_line_info_t *info = &gDrdyLines[line];
+    irqflags_t flags = cpu_irq_save();
+
+    if(info->int_num == 0)
+    {
+        info->port->INT0MASK |= info->pin_bit_mask;
+    }
+    else
+    {
+        info->port->INT1MASK |= info->pin_bit_mask;
+    }
+    /** Forget any edge from before it was turned on */
+    info->port->INTFLAGS = DRDY_INTFLAG(info->int_num);
+    info->port->INTCTRL = (info->port->INTCTRL & ~DRDY_INTCTRL_MASK(info->int_num)) |
+                          (DRDY_INT_LVL << (info->int_num << 1));
+    cpu_irq_restore(flags);
+}
+
+/**
+ * @brief Turn off a line's data ready interrupt
+ *
+ * @param line The data ready line
+ *
+ * A read already posted still finishes and can still be picked up.
+ */
+void drdy_disable(drdy_line_t line)
+{
+    drdy_line_info_t *info = &gDrdyLines[line];
+    irqflags_t flags = cpu_irq_save();
+
+    if(info->int_num == 0)
+    {
+        info->port->INT0MASK &= ~(info->pin_bit_mask);
+        if(info->port->INT0MASK == 0)
+        {
+            info->port->INTCTRL &= ~DRDY_INTCTRL_MASK(0);
+        }
+    }
+    else
+    {
+        info->port->INT1MASK &= ~(info->pin_bit_mask);
+        if(info->port->INT1MASK == 0)
+        {
+            info->port->INTCTRL &= ~DRDY_INTCTRL_MASK(1);
+        }
+    }
+    cpu_irq_restore(flags);
+}
+
+/**
+ * @brief Pick up a finished sample
+ *
+ * @param line The data ready line
+ * @param[out] out_data Where to copy the sample, recv_len bytes
+ * @param[out] timestamp get_timer_clock at the data ready edge, in TCC0 counts
+ * @return True if there was a new sample, false otherwise
+ *
+ * Frees the line for the next edge, so call it at least as often as the
+ * device's data rate or samples are dropped as overruns.
+ */
+Bool drdy_get_sample(drdy_line_t line, uint8_t *out_data, uint64_t *timestamp)
+{
+    drdy_line_info_t *info = &gDrdyLines[line];
+    Bool sampleReady = info->in_flight && info->complete;
+
+    if(sampleReady)
+    {
+        memcpy(out_data, (void *)info->recv_buffer, info->recv_len);
+        *timestamp = info->timestamp;
+        /** The interrupt won't touch the buffer or the timestamp until this is cleared */
+        info->in_flight = false;
+    }
+    return sampleReady;
+}
+
+/**
+ * @brief Copy out a line's counters
+ *
+ * @param line The data ready line
+ * @param[out] stats Where to copy the counters
+ */
+void drdy_get_stats(drdy_line_t line, drdy_stats_t *stats)
+{
+    irqflags_t flags = cpu_irq_save();
+    memcpy(stats, (void *)&(gDrdyLines[line].stats), sizeof(drdy_stats_t));
+    cpu_irq_restore(flags);
+}
+
+/**
+ * @brief Common data ready interrupt
+ *
+ * @param line The line that had the edge
+ *
+ * Timestamps the edge, posts the registered read in the line's slot, and
+ * starts it if the bus is idle. Drops the edge if the last sample hasn't been picked up.
+ */
+static void drdy_isr(drdy_line_t line)
+{
+    drdy_line_info_t *info = &gDrdyLines[line];
+    uint64_t now = get_timer_clock();
+
+    info->stats.edges++;
+
+    if(info->spi_master == NULL)
+    {
+        /** Nothing registered, nothing to do */
+    }
+    else if(info->in_flight)
+    {
+        info->stats.overruns++;
+    }
+    else
+    {
+        info->timestamp = now;
+        if(spi_master_post_isr_request(info->spi_master,
+                                       (uint8_t)line,
+                                       info->cs_info,
+                                       info->send_buffer,
+                                       info->send_len,
+                                       info->recv_buffer,
+                                       info->recv_len,
+                                       &(info->complete)))
+        {
+            info->in_flight = true;
+            (void)spi_master_start_if_idle(info->spi_master);
+        }
+        else
+        {
+            info->stats.slot_busy++;
+        }
+    }
+}
+
+/** Interrupt service routine for the first high-g accelerometer's data ready line */
+ISR(HIGHG_ACC1_INT_VECT)
+{
+    drdy_isr(DRDY_HIGHG_ACC1);
+}
+
+/** Interrupt service routine for the second high-g accelerometer's data ready line */
+ISR(HIGHG_ACC2_INT_VECT)
+{
+    drdy_isr(DRDY_HIGHG_ACC2);
+}
+
+/** Interrupt service routine for the first IMU accelerometer's data ready line */
+ISR(IMU_ACC1_INT_VECT)
+{
+    drdy_isr(DRDY_IMU_ACC1);
+}
+
+/** Interrupt service routine for the second IMU accelerometer's data ready line */
+ISR(IMU_ACC2_INT_VECT)
+{
+    drdy_isr(DRDY_IMU_ACC2);
+}
@@ -0,0 +1,88 @@
+/**
+ * @file DataReady.h
+ *
+ * @brief Sensor data ready interrupts
+ *
+ * Created: 10/17/2026 9:10:00 PM
+ *
+ * Sensors with a data ready line get their reads started from the pin
+ * interrupt instead of the sensor task. A driver registers the read it wants
+ * for its line once. On every edge the interrupt records the time and posts
+ * that read in the line's own slot on the SPI master (see
+ * spi_master_post_isr_request), starting it if the bus is idle. The driver
+ * picks up the finished sample, with the time of the edge, from its run
+ * function with drdy_get_sample. If the bus is busy the read goes next, ahead
+ * of the task queue, and the timestamp is still the edge. The task queue is
+ * never touched from here, so it keeps its single producer.
+ *
+ * There is one read in flight per line. An edge that comes before the driver
+ * has picked up the last sample is counted as an overrun and dropped, the
+ * sample waiting is older but its timestamp still matches it.
+ */
+
+
+#ifndef DATAREADY_H_
+#define DATAREADY_H_
+
+#include <compiler.h>
+#include <asf.h>
+#include "Spi_service.h"
+
+/** Interrupt level of the data ready lines, low. Keep it the same as the SPI masters, see Spi_service.h */
+#define DRDY_INT_LVL (0x01)
+
+/** Data ready lines, see conf_board.h */
+typedef enum
+{
+    DRDY_HIGHG_ACC1 = 0,    /**< High-G accelerometer 1 */
+    DRDY_HIGHG_ACC2,        /**< High-G accelerometer 2 */
+    DRDY_IMU_ACC1,          /**< IMU accelerometer 1 */
+    DRDY_IMU_ACC2,          /**< IMU accelerometer 2 */
+    DRDY_NUM_LINES          /**< Number of lines */
+} drdy_line_t;
+
+/** Counters for a data ready line */
+typedef struct
+{
+    uint16_t edges;         /**< Data ready edges seen */
+    uint16_t overruns;      /**< Edges dropped because the last sample wasn't picked up */
+    uint16_t slot_busy;     /**< Edges dropped because the line's SPI slot was still in use */
+} drdy_stats_t;
+
+/** Everything about one data ready line */
+typedef struct
+{
+    PORT_t              *port;          /**< Port the line is on */
+    uint8_t             pin_bit_mask;   /**< The bitmask for the pin. (1 << pinNum) */
+    volatile uint8_t    *pin_ctrl;      /**< PINnCTRL register of the pin */
+    uint8_t             int_num;        /**< Port interrupt, 0 or 1 */
+    spi_master_t        *spi_master;    /**< Bus to read on, NULL if nothing registered */
+    chip_select_info_t  *cs_info;       /**< Device to read */
+    volatile uint8_t    *send_buffer;   /**< Read command */
+    uint16_t            send_len;       /**< Bytes of read command */
+    volatile uint8_t    *recv_buffer;   /**< Where the sample goes */
+    uint16_t            recv_len;       /**< Bytes to read */
+    volatile Bool       complete;       /**< SPI complete flag for the read */
+    volatile Bool       in_flight;      /**< A read was posted and not picked up yet */
+    volatile uint64_t   timestamp;      /**< get_timer_clock at the edge that started the read */
+    volatile drdy_stats_t stats;        /**< Counters */
+} drdy_line_info_t;
+
+Bool drdy_register(drdy_line_t line,
+                   spi_master_t *spi_master,
+                   chip_select_info_t *cs_info,
+                   volatile uint8_t *send_buffer,
+                   uint16_t send_len,
+                   volatile uint8_t *recv_buffer,
+                   uint16_t recv_len,
+                   uint8_t sense);
+
+void drdy_enable(drdy_line_t line);
+
+void drdy_disable(drdy_line_t line);
+
+Bool drdy_get_sample(drdy_line_t line, uint8_t *out_data, uint64_t *timestamp);
+
+void drdy_get_stats(drdy_line_t line, drdy_stats_t *stats);
+
+#endif /* DATAREADY_H_ */
@@ -3,25 +3,69 @@
  *
  * Created: 3/16/2017 7:22:59 PM
  * Author: Andrew Kaster
- * 
+ *
  * @brief Flash Memory API
  *
+ * The header lives in page 0, the erase map in page 1, and the log starts at
+ * sector 1. Entries are packed back to back into one of two 256 byte page
+ * buffers. When a buffer fills up it's handed to the flash driver as one page
+ * program, and entries keep going into the other buffer while it's written.
+ *
+ * Flash can only clear bits, so nothing is written over old data until it's
+ * been erased. A new header erases the header subsector, leaving an all 0xFF
+ * erase map. Each log sector erase clears that sector's byte in the map once
+ * it succeeds. Init erases FLASHMEM_PREERASE_SECTORS sectors from the end of
+ * the log before anything runs, so a flight never waits on an erase. Past
+ * those, sectors are erased one ahead of the page being programmed. Page
+ * programs queue behind that erase, and while it runs (0.7s typical, 3s max)
+ * the page buffers fill up and entries are dropped.
  *
- */ 
+ * The entry count in the header is never rewritten, that would need an erase
+ * too. Instead, init reads the erase map to find how far the log could
+ * reach, and searches that for the first erased entry.
+ */
 
 #include "FlashMem.h"
 #include "n25q_512.h"
+#include "Background.h"
+#include "Crc.h"
 
+#include <stddef.h>
 #include <string.h>
 
-/** Address for the first data entry. 0 + sizeof header */
-#define INITIAL_DATA_ADDR (0x00000010L)
+/** Address for the first data entry. Sector 1, so the header sector is never erased under the log */
+#define INITIAL_DATA_ADDR (EXTFLASH_SECTOR_SIZE)
+
+/** Erase map, one byte per sector. 0x00 once the sector is erased for the current header */
+#define FLASHMEM_ERASE_MAP_ADDR (0x00000100L)
+
+/** Number of sectors on the flash memory, and bytes in the erase map */
+#define FLASHMEM_NUM_SECTORS (EXTFLASH_SIZE / EXTFLASH_SECTOR_SIZE)
+
+/** Erase map value of a sector erased since the header was written */
+#define FLASHMEM_SECTOR_ERASED (0x00)
+
+/** Timestamp of an entry that was never written */
+#define FLASHMEM_ERASED_TIMESTAMP (0xFFFFFFFFFFFFFFFFULL)
+
+#if (FLASHMEM_PAGE_SIZE != EXTFLASH_PAGE_SIZE)
+#error "FLASHMEM_PAGE_SIZE must match the flash page size"
+#endif
+
+#if (FLASHMEM_NUM_SECTORS > FLASHMEM_PAGE_SIZE)
+#error "The erase map must fit in one page"
+#endif
 
 /** Flash memory control data */
 flashmem_ctrl_t gFlashmemCtrl;
 
+static uint32_t flashmem_recover_erased(void);
+static void flashmem_erase_run(void);
+static uint32_t flashmem_recover_entries(uint32_t maxEntries);
+static void flashmem_start_log(uint32_t numEntries);
+
 /**
- * @brief Initialize the flash memory module 
+ * @brief Initialize the flash memory module
  */
 void init_flashmem(void)
 {
@@ -30,6 +74,8 @@ void init_flashmem(void)
     gFlashmemCtrl.header.entry_size = sizeof(flash_data_entry_t);
     gFlashmemCtrl.header.magic = MAGIC_NUMBER;
     gFlashmemCtrl.header.num_entries = 0;
+    gFlashmemCtrl.dropped = 0;
+    gFlashmemCtrl.write_errors = 0;
     sprintf(gFlashmemCtrl.header.version_str, VERSION_STRING);
 
     /** Initialize flash memory driver */
@@ -55,15 +101,24 @@ void init_flashmem(void)
     /** If the header is invalid, write the one we formed at the top of the function */
     if(headerStatus != HDR_VALID)
     {
+        /** Clear the old header and erase map. Up to 0.8s, but only when the version changes.
+         * The old log is left alone, every sector is erased again before the new log reaches it.
+         */
+        (void)extflash_erase(0x00000000L, EXTFLASH_SUBSECTOR_SIZE, true);
+
         /** Try to write the default header twice */
         flashmem_write_header();
-        
+
         /** If what we read isn't what we wrote, try again... */
         if(HDR_VALID != flashmem_verify_header(&header))
         {
             /** If this fails we're kinda screwed as far as flash memory goes. */
             flashmem_write_header();
         }
+
+        /** Fresh log */
+        gFlashmemCtrl.erase_addr = INITIAL_DATA_ADDR;
+        flashmem_start_log(0);
     }
     else
     {
@@ -73,16 +128,314 @@ void init_flashmem(void)
          * must be different from what the code expects. Or the magic number is not correct.
          */
         memcpy((void *)&gFlashmemCtrl.header, (void *)&header, sizeof(flash_data_hdr_t));
+
+        /** The header's count is stale, find the real end of the log. It can't be past the last erased sector. */
+        gFlashmemCtrl.erase_addr = flashmem_recover_erased();
+        flashmem_start_log(flashmem_recover_entries((gFlashmemCtrl.erase_addr - INITIAL_DATA_ADDR) / sizeof(flash_data_entry_t)));
     }
 
-    /* FOR DEBUG ONLY */
-    headerStatus = flashmem_verify_header(&header);
+    /** Get the erases out of the way now, while nothing else is running */
+    flashmem_erase_run();
+}
+
+/**
+ * @brief Find how far the log sectors have been erased
+ *
+ * @return Address of the first log sector not marked in the erase map
+ *
+ * Sectors are erased in order, so the marked ones run from the start of the
+ * log. A read failure counts as not erased, so the log restarts at a sector
+ * boundary that will be erased again rather than trusting what's there.
+ */
+static uint32_t flashmem_recover_erased(void)
+{
+    /** Page buffers aren't in use yet, borrow one for the map */
+    uint8_t *map = gFlashmemCtrl.page_buf[0];
+    uint16_t sector = INITIAL_DATA_ADDR / EXTFLASH_SECTOR_SIZE;
+
+    if(extflash_read(FLASHMEM_ERASE_MAP_ADDR, FLASHMEM_NUM_SECTORS, map, true))
+    {
+        return INITIAL_DATA_ADDR;
+    }
+
+    while((sector < FLASHMEM_NUM_SECTORS) && (map[sector] == FLASHMEM_SECTOR_ERASED))
+    {
+        sector++;
+    }
+
+    return (uint32_t)sector * EXTFLASH_SECTOR_SIZE;
+}
+
+/**
+ * @brief Erase FLASHMEM_PREERASE_SECTORS sectors from the end of the log
+ *
+ * Blocking, for init only. Sectors already marked in the erase map are
+ * skipped. Stops at the first failure and leaves the rest to
+ * flashmem_erase_ahead.
+ */
+static void flashmem_erase_run(void)
+{
+    uint32_t sectorAddr = gFlashmemCtrl.data_addr & ~((uint32_t)EXTFLASH_SECTOR_SIZE - 1);
+    uint32_t endAddr = min(sectorAddr + ((uint32_t)FLASHMEM_PREERASE_SECTORS * EXTFLASH_SECTOR_SIZE), EXTFLASH_SIZE);
+    uint8_t mark = FLASHMEM_SECTOR_ERASED;
+
+    while(gFlashmemCtrl.erase_addr < endAddr)
+    {
+        if(extflash_erase(gFlashmemCtrl.erase_addr, EXTFLASH_SECTOR_SIZE, true) ||
+           extflash_write(FLASHMEM_ERASE_MAP_ADDR + (gFlashmemCtrl.erase_addr / EXTFLASH_SECTOR_SIZE), 1, &mark, true))
+        {
+            gFlashmemCtrl.write_errors++;
+            break;
+        }
+        gFlashmemCtrl.erase_addr += EXTFLASH_SECTOR_SIZE;
+    }
+
+    /** Nothing is queued on the flash driver */
+    gFlashmemCtrl.erased_addr = gFlashmemCtrl.erase_addr;
+}
+
+/**
+ * @brief Find how many entries are on the flash memory
+ *
+ * @param maxEntries Entries that fit in the erased sectors
+ * @return Number of entries written
+ *
+ * Entries are written in order from the start of the log, so every entry before
+ * the end has a timestamp and every one after is erased. Binary search for the
+ * first erased timestamp, about 20 reads for the whole chip. Only the erased
+ * sectors are searched, anything past them is left over from an old log.
+ * A read failure counts as written, so we never write over data we couldn't see.
+ */
+static uint32_t flashmem_recover_entries(uint32_t maxEntries)
+{
+    uint32_t low = 0;
+    uint32_t high = maxEntries;
+    uint32_t mid;
+    uint64_t timestamp;
+
+    while(low < high)
+    {
+        mid = low + ((high - low) >> 1);
+
+        if(extflash_read(INITIAL_DATA_ADDR + (mid * sizeof(flash_data_entry_t)),
+                         sizeof(timestamp), (uint8_t *)&timestamp, true) ||
+           (timestamp != FLASHMEM_ERASED_TIMESTAMP))
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Set up the page buffers to append after numEntries entries
+ *
+ * @param numEntries Entries already on the flash memory
+ *
+ * If the log ends partway through a page, the start of the buffer is left
+ * as 0xFF. Programming 0xFF leaves a byte as it is, so the whole page can be
+ * programmed again without touching the entries already there.
+ */
+static void flashmem_start_log(uint32_t numEntries)
+{
+    uint8_t idx;
+
+    gFlashmemCtrl.num_entries = numEntries;
+    gFlashmemCtrl.data_addr = INITIAL_DATA_ADDR + (numEntries * sizeof(flash_data_entry_t));
+    gFlashmemCtrl.page_addr = gFlashmemCtrl.data_addr & ~((uint32_t)FLASHMEM_PAGE_SIZE - 1);
+    gFlashmemCtrl.fill_offset = (uint16_t)(gFlashmemCtrl.data_addr - gFlashmemCtrl.page_addr);
+    gFlashmemCtrl.fill_buf = 0;
+    gFlashmemCtrl.page_dirty = false;
+    gFlashmemCtrl.retry_page = false;
+
+    /** Nothing is queued on the flash driver yet */
+    gFlashmemCtrl.erased_addr = gFlashmemCtrl.erase_addr;
+
+    for(idx = 0; idx < FLASHMEM_NUM_PAGE_BUFS; idx++)
+    {
+        gFlashmemCtrl.page_free[idx] = true;
+    }
+    memset((void *)gFlashmemCtrl.page_buf[0], 0xFF, FLASHMEM_PAGE_SIZE);
+}
+
+/**
+ * @brief Called by the flash driver when a log page is programmed
+ *
+ * @param error True if the page program failed
+ */
+static void flashmem_page_written(Bool error)
+{
+    if(error)
+    {
+        gFlashmemCtrl.write_errors++;
+    }
+}
+
+/**
+ * @brief Called by the flash driver when a log sector is erased
+ *
+ * @param error True if the erase failed
+ *
+ * Erases finish in the order they were queued. The map write queued behind
+ * this erase hasn't been sent yet, so a failed erase leaves its map byte 0xFF.
+ */
+static void flashmem_sector_erased(Bool error)
+{
+    uint8_t mark = (uint8_t)(gFlashmemCtrl.erased_addr / EXTFLASH_SECTOR_SIZE) & (FLASHMEM_ERASE_MARKS - 1);
+
+    if(error)
+    {
+        gFlashmemCtrl.write_errors++;
+    }
+    else
+    {
+        gFlashmemCtrl.erase_mark[mark] = FLASHMEM_SECTOR_ERASED;
+    }
+}
+
+/**
+ * @brief Called by the flash driver when a sector's erase map byte is written
+ *
+ * @param error True if the program failed
+ *
+ * The sector's erase mark is free for another erase after this.
+ */
+static void flashmem_map_written(Bool error)
+{
+    if(error)
+    {
+        gFlashmemCtrl.write_errors++;
+    }
+    gFlashmemCtrl.erased_addr += EXTFLASH_SECTOR_SIZE;
+}
+
+/**
+ * @brief Queue erases up to the sector after the one addr is in
+ *
+ * @param addr Log address about to be programmed
+ * @return True if addr's own sector still hasn't had its erase queued, false on success
+ *
+ * Each erase goes in with the write of its erase map byte right behind it, so
+ * it needs two places in the flash driver's queue. If there isn't room, the
+ * sector ahead is tried again on the next page. Does nothing until the log
+ * is within a sector of the end of flashmem_erase_run's sectors.
+ */
+static Bool flashmem_erase_ahead(uint32_t addr)
+{
+    uint32_t sectorAddr = addr & ~((uint32_t)EXTFLASH_SECTOR_SIZE - 1);
+    uint8_t mark;
+
+    while((gFlashmemCtrl.erase_addr <= (sectorAddr + EXTFLASH_SECTOR_SIZE)) &&
+          (gFlashmemCtrl.erase_addr < EXTFLASH_SIZE) &&
+          (extflash_write_queue_free() >= 2) &&
+          (((gFlashmemCtrl.erase_addr - gFlashmemCtrl.erased_addr) / EXTFLASH_SECTOR_SIZE) < FLASHMEM_ERASE_MARKS))
+    {
+        mark = (uint8_t)(gFlashmemCtrl.erase_addr / EXTFLASH_SECTOR_SIZE) & (FLASHMEM_ERASE_MARKS - 1);
+        gFlashmemCtrl.erase_mark[mark] = 0xFF;
+
+        (void)extflash_erase_async(gFlashmemCtrl.erase_addr, EXTFLASH_SECTOR_SIZE, flashmem_sector_erased, NULL);
+        (void)extflash_write_async(FLASHMEM_ERASE_MAP_ADDR + (gFlashmemCtrl.erase_addr / EXTFLASH_SECTOR_SIZE), 1,
+                                   &(gFlashmemCtrl.erase_mark[mark]), flashmem_map_written, NULL);
+        gFlashmemCtrl.erase_addr += EXTFLASH_SECTOR_SIZE;
+    }
+
+    return (gFlashmemCtrl.erase_addr <= sectorAddr);
+}
+
+/**
+ * @brief Hand a page buffer to the flash driver
+ *
+ * @param buf Page buffer, already marked busy by the caller
+ * @param addr Flash address of the page
+ * @return True if the driver didn't take it, false on success
+ */
+static Bool flashmem_program_page(uint8_t buf, uint32_t addr)
+{
+    Bool retVal = flashmem_erase_ahead(addr);
+
+    if(!retVal)
+    {
+        retVal = extflash_write_async(addr,
+                                      FLASHMEM_PAGE_SIZE,
+                                      gFlashmemCtrl.page_buf[buf],
+                                      flashmem_page_written,
+                                      &(gFlashmemCtrl.page_free[buf]));
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Hand over the full page the flash driver turned down last time
+ *
+ * @return True if it's still waiting, false if there's none or it was taken
+ */
+static Bool flashmem_retry_page(void)
+{
+    if(gFlashmemCtrl.retry_page && !flashmem_program_page(gFlashmemCtrl.retry_buf, gFlashmemCtrl.retry_addr))
+    {
+        gFlashmemCtrl.retry_page = false;
+    }
+
+    return gFlashmemCtrl.retry_page;
+}
+
+/**
+ * @brief Hand the fill buffer to the flash driver and switch to the other one
+ *
+ * @param nextPage True to start the next flash page, false to keep filling this one
+ * @return True if the driver didn't take it, false on success
+ *
+ * The caller must have checked that the other buffer is free. A full page
+ * the driver turns down (its queue is full) keeps its buffer and is handed
+ * over again by flashmem_retry_page before anything else, so the log never
+ * has an erased hole in it. A partial page just stays the fill buffer.
+ */
+static Bool flashmem_program_fill_buf(Bool nextPage)
+{
+    Bool retVal = false;
+    uint8_t fillBuf = gFlashmemCtrl.fill_buf;
+
+    gFlashmemCtrl.page_free[fillBuf] = false;
+    retVal = flashmem_program_page(fillBuf, gFlashmemCtrl.page_addr);
+
+    if(retVal && !nextPage)
+    {
+        /** Keep filling it, the next flush tries again */
+        gFlashmemCtrl.page_free[fillBuf] = true;
+    }
+    else
+    {
+        if(retVal)
+        {
+            gFlashmemCtrl.retry_page = true;
+            gFlashmemCtrl.retry_buf = fillBuf;
+            gFlashmemCtrl.retry_addr = gFlashmemCtrl.page_addr;
+        }
+
+        /** Switch buffers. Partway through a page the new buffer's start stays 0xFF, see flashmem_start_log */
+        gFlashmemCtrl.page_dirty = false;
+        gFlashmemCtrl.fill_buf = (fillBuf + 1) % FLASHMEM_NUM_PAGE_BUFS;
+        memset((void *)gFlashmemCtrl.page_buf[gFlashmemCtrl.fill_buf], 0xFF, FLASHMEM_PAGE_SIZE);
+        if(nextPage)
+        {
+            gFlashmemCtrl.page_addr += FLASHMEM_PAGE_SIZE;
+            gFlashmemCtrl.fill_offset = 0;
+        }
+    }
+
+    return retVal;
 }
 
 /** @brief Write the header to flash
  *  @return True on failure, false on success
- * 
- * Write the data header stored in gFlashmemCtrl.header to the flash memory 
+ *
+ * Write the data header stored in gFlashmemCtrl.header to the flash memory
  */
 Bool flashmem_write_header(void)
 {
@@ -95,7 +448,7 @@ Bool flashmem_write_header(void)
     return retVal;
 }
 
-/** 
+/**
  * @brief Determine the validity of the flash memory data header
  *
  * @param header The header to verify
@@ -107,11 +460,11 @@ flashmem_hdrstatus_t flashmem_verify_header(flash_data_hdr_t *header)
     Bool block = true;
 
     /** read sizeof(data_hdr) bytes from flash memory starting at byte 0x0000_0000 */
-    if(true == extflash_read( 0x00000000L,  sizeof(flash_data_hdr_t), (uint8_t *)&header, block))
+    if(true == extflash_read( 0x00000000L,  sizeof(flash_data_hdr_t), (uint8_t *)header, block))
     {
         retVal = HDR_READFAIL;
     }
-    
+
     /** If we successfully read the data from the flash memory, verify the information we read */
     if(retVal != HDR_READFAIL)
     {
@@ -124,10 +477,8 @@ flashmem_hdrstatus_t flashmem_verify_header(flash_data_hdr_t *header)
                 break;
             case MAGIC_NUMBER:
                 /** If we found the magic number, we're halfway there. Check the data entry size and version string next */
-                if((header->entry_size == sizeof(flash_data_entry_t)) && (0 == strcmp(header->version_str, gFlashmemCtrl.header.version_str)))
+                if((header->entry_size == sizeof(flash_data_entry_t)) && (0 == strncmp(header->version_str, gFlashmemCtrl.header.version_str, VERSION_SIZE)))
                 {
-                    /** If there is a pre-existing header, record address for new entries based off existing entry address */
-                    gFlashmemCtrl.data_addr += (header->num_entries * sizeof(flash_data_entry_t));
                     /* The header is valid */
                     retVal = HDR_VALID;
                 }
@@ -142,34 +493,107 @@ flashmem_hdrstatus_t flashmem_verify_header(flash_data_hdr_t *header)
 
 /**
  * @brief Write a data entry to the flash memory
- * 
- * @param entry Pointer to the data entry to write
+ *
+ * @param entry Pointer to the data entry to write. Its chksum is filled in.
  * @returns True on failure, false on success
+ *
+ * Never waits on the flash. An entry that runs off the end of the fill buffer
+ * carries on into the other one, so that one has to be free first.
  */
 Bool flashmem_write_entry(flash_data_entry_t *entry)
 {
     Bool retVal = false;
-    Bool block = true;
+    uint8_t *src = (uint8_t *)entry;
+    uint16_t remBytes = sizeof(flash_data_entry_t);
+    uint16_t chunk;
+    uint8_t nextBuf = (gFlashmemCtrl.fill_buf + 1) % FLASHMEM_NUM_PAGE_BUFS;
 
-    /** Increment the number of entries */
-    gFlashmemCtrl.header.num_entries++;
-    /** Write the new number of entries to the data header at the beginning of the flash memory */
-    retVal = extflash_write(FLASHMEM_ENTRIES_ADDR, 2, (uint8_t *)(gFlashmemCtrl.header.num_entries), block);
+    /** A page the driver turned down goes first, its buffer is the other one */
+    (void)flashmem_retry_page();
 
-    /** If no bad things happened, go ahead and write the data. */
-    if(retVal == false)
+    /** Out of room on the flash memory */
+    if((gFlashmemCtrl.data_addr + sizeof(flash_data_entry_t)) > EXTFLASH_SIZE)
     {
-        /** Write to the current data address. This might fail if the data memory is full (i.e. already 512Mb of data on it) */
-        retVal = extflash_write(gFlashmemCtrl.data_addr, sizeof(flash_data_entry_t), (uint8_t *)entry, block);
-        /** If there were still no bad things that happend, increment the data addresss. */
-        if(retVal == false)
+        retVal = true;
+    }
+    /** This entry fills the page, but the other buffer is still being programmed or waiting to be */
+    else if(((gFlashmemCtrl.fill_offset + remBytes) >= FLASHMEM_PAGE_SIZE) && !gFlashmemCtrl.page_free[nextBuf])
+    {
+        gFlashmemCtrl.dropped++;
+        retVal = true;
+    }
+    else
+    {
+        entry->chksum = crc16_update(CRC16_INIT, (uint8_t *)entry, offsetof(flash_data_entry_t, chksum));
+
+        while(remBytes > 0)
         {
-            gFlashmemCtrl.data_addr+= sizeof(flash_data_entry_t);
+            chunk = min(remBytes, FLASHMEM_PAGE_SIZE - gFlashmemCtrl.fill_offset);
+            memcpy((void *)&(gFlashmemCtrl.page_buf[gFlashmemCtrl.fill_buf][gFlashmemCtrl.fill_offset]), (void *)src, chunk);
+            gFlashmemCtrl.fill_offset += chunk;
+            gFlashmemCtrl.page_dirty = true;
+            src += chunk;
+            remBytes -= chunk;
+
+            /** Page is full, program it and carry on in the other buffer */
+            if(gFlashmemCtrl.fill_offset == FLASHMEM_PAGE_SIZE)
+            {
+                (void)flashmem_program_fill_buf(true);
+            }
         }
+
+        gFlashmemCtrl.data_addr += sizeof(flash_data_entry_t);
+        gFlashmemCtrl.num_entries++;
     }
     return retVal;
 }
 
+/**
+ * @brief Program the entries in the partly filled page buffer
+ *
+ * @returns True on failure, false on success
+ *
+ * The page stays open, later entries fill in the rest of it and it's
+ * programmed again when it's full. Fails while a full page the driver
+ * turned down earlier is still waiting to be handed over.
+ */
+Bool flashmem_flush(void)
+{
+    Bool retVal = false;
+    uint8_t nextBuf = (gFlashmemCtrl.fill_buf + 1) % FLASHMEM_NUM_PAGE_BUFS;
+
+    /** A full page the driver turned down is still waiting, try it again first */
+    if(flashmem_retry_page())
+    {
+        retVal = true;
+    }
+    /** Nothing new since the last program */
+    else if(!gFlashmemCtrl.page_dirty)
+    {
+        retVal = false;
+    }
+    else if(!gFlashmemCtrl.page_free[nextBuf])
+    {
+        retVal = true;
+    }
+    else
+    {
+        retVal = flashmem_program_fill_buf(false);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Number of entries in the log
+ *
+ * @return Entries found on the flash at init plus entries written since
+ */
+uint32_t flashmem_get_num_entries(void)
+{
+    return gFlashmemCtrl.num_entries;
+}
+
 /**
  * @brief Read the entry addressed by index
  *
@@ -192,3 +616,67 @@ Bool flashmem_read_entry(flash_data_entry_t *entry, uint32_t index)
 
     return retVal;
 }
+
+/**
+ * @brief Start reading a run of entries
+ *
+ * @param[out] entries Where to put the entries. Must stay untouched until flashmem_read_busy returns false.
+ * @param index First entry to read
+ * @param count Number of entries to read
+ * @param block Use blocking/nonblocking path
+ * @return True on failure (past the end of the log, flash busy), false on success
+ *
+ * Entries are packed back to back, so a run is one flash read however many
+ * pages it crosses.
+ */
+Bool flashmem_read_entries(flash_data_entry_t *entries, uint32_t index, uint16_t count, Bool block)
+{
+    Bool retVal = false;
+    uint32_t addr = INITIAL_DATA_ADDR + (index * sizeof(flash_data_entry_t));
+
+    if((index + count) > gFlashmemCtrl.num_entries)
+    {
+        retVal = true;
+    }
+    else
+    {
+        retVal = extflash_read(addr, (size_t)count * sizeof(flash_data_entry_t), (uint8_t *)entries, block);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Check on a non-blocking flashmem_read_entries
+ *
+ * @return True while the read is still going, false when it's done
+ */
+Bool flashmem_read_busy(void)
+{
+    return extflash_get_status();
+}
+
+/**
+ * @brief Flush the log and wait for every page program to finish
+ *
+ * @return True if a page program failed, false on success
+ *
+ * The page programs are run by the flash driver's background function, so
+ * this runs the background functions itself while it waits.
+ */
+Bool flashmem_sync(void)
+{
+    uint16_t errors = gFlashmemCtrl.write_errors;
+
+    /** Flush only fails while the other page buffer is still being programmed or waiting to be */
+    while(flashmem_flush())
+    {
+        background_task_func();
+    }
+    while(extflash_write_busy())
+    {
+        background_task_func();
+    }
+
+    return (errors != gFlashmemCtrl.write_errors);
+}
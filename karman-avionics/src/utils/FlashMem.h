@@ -16,16 +16,18 @@
 /** Data Entry in the flash memory */
 typedef struct  
 {
-    uint32_t timestamp; /**< Timestamp in ticks since start of the timer */
+    uint64_t timestamp; /**< get_timer_us when the newest data in the entry was measured */
     sensor_data_t data; /**< All the sensor information that will be logged */
-    uint16_t chksum;    /**< 8 bit checksum */
+    uint16_t chksum;    /**< CRC-16-CCITT of timestamp and data, filled in by flashmem_write_entry */
 } flash_data_entry_t;
 
 /** Size of the version string */
 #define VERSION_SIZE (10)
 
-/** Current version string. Change this to clear flash memory */
-#define VERSION_STRING ("DEBUG-001")
+/** Current version string. Change it whenever flash_data_entry_t changes: a
+ * mismatch at init erases the header and starts a new log, erasing each old
+ * sector before it's reused, so an old log is never read as the new layout. */
+#define VERSION_STRING ("DEBUG-004")
 /** Random hex value to check against memory corruption */
 #define MAGIC_NUMBER   (0xCAFE)
 
@@ -35,17 +37,56 @@ typedef struct
     uint16_t magic;                 /**< Stores MAGIC_NUMBER */
     char version_str[VERSION_SIZE]; /**< Stores VERSION_STRING */
     uint16_t entry_size;            /**< The size of each data entry */
-    uint16_t num_entries;           /**< Current number of entries */
+    uint16_t num_entries;           /**< Number of entries when the header was written. Not kept up to date, see flashmem_get_num_entries */
 } flash_data_hdr_t;
 
 /**Address for num_entries */
 #define FLASHMEM_ENTRIES_ADDR (0x0000000EL)
 
+/** Size of a log page buffer. One page program each. */
+#define FLASHMEM_PAGE_SIZE (256)
+
+/** Number of log page buffers. One fills while the other is programmed. */
+#define FLASHMEM_NUM_PAGE_BUFS (2)
+
+/**
+ * Log sectors erased at init, before the scheduler starts. A sector erase
+ * blocks page programs for 0.7s typical, 3s max, so none can happen in
+ * flight without dropping entries.
+ *
+ * 32 by default: 2 MiB, about 38 minutes of log at 35 entries a second, for
+ * the wait on the pad and the flight. Init takes about 22s typical, 96s max,
+ * for a new log, and only as long as the sectors not erased yet after that.
+ * Past these the log falls back to erasing one sector ahead, which drops
+ * entries at each sector.
+ */
+#ifndef FLASHMEM_PREERASE_SECTORS
+#define FLASHMEM_PREERASE_SECTORS (32)
+#endif
+
+/** Erase results waiting to be marked in the erase map. MUST be a power of two. */
+#define FLASHMEM_ERASE_MARKS (4)
+
 /** Control structure for the flash memory */
 typedef struct  
 {
     flash_data_hdr_t header; /**< Local storage of the header */
     uint32_t data_addr;      /**< The current data address to write to next */
+    uint32_t num_entries;    /**< Entries on the flash or waiting in a page buffer */
+    uint8_t  page_buf[FLASHMEM_NUM_PAGE_BUFS][FLASHMEM_PAGE_SIZE]; /**< Log pages */
+    volatile Bool page_free[FLASHMEM_NUM_PAGE_BUFS]; /**< False while a page buffer is being programmed */
+    uint8_t  fill_buf;       /**< Page buffer entries are going into */
+    uint16_t fill_offset;    /**< Where the next entry goes in the fill buffer */
+    Bool     page_dirty;     /**< Fill buffer has entries that haven't been handed to the flash driver */
+    uint32_t page_addr;      /**< Flash address of the page being filled */
+    Bool     retry_page;     /**< A full page the flash driver turned down is waiting in retry_buf */
+    uint8_t  retry_buf;      /**< Page buffer of that page */
+    uint32_t retry_addr;     /**< Flash address of that page */
+    uint16_t dropped;        /**< Entries thrown away because both page buffers were busy */
+    uint16_t write_errors;   /**< Page programs and erases that failed */
+    uint32_t erase_addr;     /**< First log address that hasn't had an erase queued */
+    uint32_t erased_addr;    /**< First log address whose erase and map write haven't finished */
+    uint8_t  erase_mark[FLASHMEM_ERASE_MARKS]; /**< Erase map byte for each erase in flight, 0x00 once it succeeds */
 } flashmem_ctrl_t;
 
 /** Status of reading/parsing the data header */
@@ -68,11 +109,31 @@ flashmem_hdrstatus_t flashmem_verify_header(flash_data_hdr_t *header);
 /**
  * @brief Write a data entry to the flash memory
  * 
- * @param entry Pointer to the data entry to write
+ * @param entry Pointer to the data entry to write. Its chksum is filled in.
  * @returns True on failure, false on success
+ *
+ * The entry is copied into a page buffer, and a full page is programmed in the
+ * background. Fails if the flash is full, or if the entry would need the other
+ * page buffer while it's still being programmed.
  */
 Bool flashmem_write_entry(flash_data_entry_t *entry);
 
+/**
+ * @brief Program the entries in the partly filled page buffer
+ *
+ * @returns True on failure, false on success
+ *
+ * Call before the power goes away (landing, USB dump) so the last page isn't lost.
+ */
+Bool flashmem_flush(void);
+
+/**
+ * @brief Number of entries in the log
+ *
+ * @return Entries found on the flash at init plus entries written since
+ */
+uint32_t flashmem_get_num_entries(void);
+
 /**
  * @brief Read the entry addressed by index
  *
@@ -84,6 +145,34 @@ Bool flashmem_write_entry(flash_data_entry_t *entry);
  */
 Bool flashmem_read_entry(flash_data_entry_t *entry, uint32_t index);
 
+/**
+ * @brief Start reading a run of entries
+ *
+ * @param[out] entries Where to put the entries. Must stay untouched until flashmem_read_busy returns false.
+ * @param index First entry to read
+ * @param count Number of entries to read
+ * @param block Use blocking/nonblocking path
+ * @return True on failure (past the end of the log, flash busy), false on success
+ */
+Bool flashmem_read_entries(flash_data_entry_t *entries, uint32_t index, uint16_t count, Bool block);
+
+/**
+ * @brief Check on a non-blocking flashmem_read_entries
+ *
+ * @return True while the read is still going, false when it's done
+ */
+Bool flashmem_read_busy(void);
+
+/**
+ * @brief Flush the log and wait for every page program to finish
+ *
+ * @return True if a page program failed, false on success
+ *
+ * Runs the background functions while it waits, so it's for when the
+ * scheduler isn't, like before a USB download.
+ */
+Bool flashmem_sync(void);
+
 /** @brief Write the header to flash
  *  @return True on failure, false on success
  * 
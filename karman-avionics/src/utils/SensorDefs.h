@@ -15,14 +15,88 @@
 #define SENSORDEFS_H_
 
 #include "ms5607-02ba03.h"
+#include "Altitude.h"
+#include "Mailbox.h"
 
 /** contains data for every sensor */
 typedef struct
 {
     ms5607_02ba03_data_t altimeter; /**< Temp and pressure */
+    altitude_data_t altitude;       /**< Altitude and vertical speed from the altimeter pressure */
     /* TODO add all sensors' data */
 } sensor_data_t;
 
+/** Message the sensor task posts to its subscribers after a pass with new data */
+typedef struct
+{
+    uint64_t timestamp;     /**< get_timer_us when the newest data in the sample was measured */
+    sensor_data_t data;     /**< All the sensor data, as of that pass */
+} sensor_sample_t;
+
+/**
+ * @brief Newest sensor sample, readable from anywhere without locking
+ *
+ * Two copies of the sample and a sequence count. The sensor task, the only
+ * writer, bumps the count before it writes each copy, so readers always read
+ * the copy that isn't being written, copies[seq & 1]. A reader that sees the
+ * count change while it copies tries again, which only happens to a reader
+ * that gets interrupted by a new sample. An interrupt reading it never waits.
+ */
+typedef struct
+{
+    volatile uint8_t seq;           /**< Bumped before each copy is written. One byte, so reading it is atomic. */
+    sensor_sample_t  copies[2];     /**< copies[seq & 1] is the one to read */
+} sensor_snapshot_t;
+
+/** Most mailboxes that can subscribe to sensor samples */
+#define SENSOR_MAX_SUBSCRIBERS (4)
+
+/**
+ * SPI bytes the sensor task lets its drivers queue in one pass. At the 1 MHz
+ * bus default a 2 ms pass is 250 bytes of bus time. Half goes to the drivers
+ * the task runs, the rest is left for data ready reads (see DataReady.h) and
+ * the gaps between requests.
+ */
+#define SENSOR_SPI_BYTES_PER_PASS (125)
+
+/**
+ * @brief Structure to define a sensor driver
+ *
+ * The sensor task runs the drivers in priority order. A driver with a sample
+ * due gets its run function called once a pass until it returns SENSOR_COMPLETE,
+ * then get_data copies its data out. A driver is skipped for the pass if what it
+ * might queue doesn't fit in what is left of the pass's bus budget or the SPI queue,
+ * so when the bus is full the low priority drivers wait. A call that returns
+ * SENSOR_WAITING queued nothing and gets its share of the budget back.
+ *
+ * Everything a driver puts on the bus has to go through run. Timer callbacks
+ * and the like only flag that something is ready, or the budget can't see it.
+ */
+typedef struct sensor_driver_s
+{
+    void (*init)(spi_master_t *spi_master);     /**< Set up the device. Called once at startup, may block. */
+    sensor_status_t (*run)(void);               /**< Advance the driver's state machine one step */
+    uint64_t (*get_data)(sensor_data_t *out_data); /**< Copy new data out, after run returns SENSOR_COMPLETE. Returns get_timer_us when it was measured. */
+    uint16_t period;        /**< Timer ticks from one sample being due to the next, 0 for back to back */
+    uint8_t  priority;      /**< 0 is highest. Runs first in the pass, so gets the bus first */
+    uint8_t  spi_slots;     /**< Most SPI requests one call to run queues */
+    uint8_t  spi_bytes;     /**< Most bytes one call to run puts on the bus, the longer of send and receive */
+    uint32_t release;       /**< Timer count the sample in progress was due. Set by the sensor task. */
+    Bool     active;        /**< A sample is in progress. Set by the sensor task. */
+    uint16_t samples;       /**< Samples finished. Set by the sensor task. */
+    uint16_t deferrals;     /**< Passes skipped for bus budget or queue space. Set by the sensor task. */
+} sensor_driver_t;
+
+/** Returns a pointer to the sensor driver list */
+sensor_driver_t *get_sensor_list(void);
+
+/** Returns the number of sensor drivers in the list */
+uint8_t get_num_sensors(void);
+
+Bool sensor_subscribe(mailbox_t *box);
+
+uint8_t sensor_get_snapshot(sensor_sample_t *sample);
+
 
 
 #endif /* SENSORDEFS_H_ */
\ No newline at end of file
@@ -25,12 +25,83 @@
 
 #include "Spi_service.h"
 #include "Background.h"
+#include "Timer.h"
 #include <stdint.h>
 #include <string.h>
 
+#ifndef F_CPU
+#define F_CPU (sysclk_get_per_hz()) /**< System clock speed */
+#endif
+
+/**
+ * @brief Control value to write to USART baud control regs
+ *
+ *  Ref https://github.com/abcminiuser/lufa/blob/master/LUFA/Drivers/Peripheral/XMEGA/SerialSPI_XMEGA.h
+ */
+#define SPI_BAUDCTRLVAL(Baud)       ((Baud < (F_CPU / 2)) ? ((F_CPU / (2 * Baud)) - 1) : 0)
+
 /** The size of every SPI master's queue */
 #define SPI_MASTER_QUEUE_SIZE (SPI_MASTER_QUEUE_DEPTH*sizeof(spi_request_t))
 
+#ifndef SPI_DMA_ADDR
+/** Address of a buffer as the DMA controller sees it. The host build (host/) brings its own. */
+#define SPI_DMA_ADDR(ptr) ((uint16_t)(uintptr_t)(ptr))
+#endif
+
+/** Byte clocked out by DMA once a request's send buffer has run dry */
+static uint8_t spiDmaDummyTx = 0x00;
+/** Sink for bytes received by DMA that the caller did not ask for */
+static uint8_t spiDmaDummyRx;
+/** The SPI master that owns each DMA channel, NULL if unused */
+static spi_master_t *spiDmaOwner[DMA_NUMBER_OF_CHANNELS];
+/** dma_enable resets the whole controller, so only do it once */
+static Bool spiDmaControllerEnabled = false;
+
+static void spi_master_finish_front(spi_master_t *spi_interface);
+static void spi_master_dma_start(spi_master_t *spi_interface, volatile spi_request_t *request);
+
+/**
+ * @brief Set up a USART as an SPI master
+ *
+ * @param regSet The USART to set up
+ * @param baudRate The SPI clock rate in Hz
+ *
+ * See XMEGA AU Manual page 146, page 280
+ * NOTE PINS MUST BE SETUP TO USE USART IN SPI MASTER MODE!
+ */
+void spi_master_hw_init(USART_t *regSet, uint32_t baudRate)
+{
+    uint16_t baudrate = SPI_BAUDCTRLVAL(baudRate);
+
+    sysclk_enable_peripheral_clock(regSet);
+    regSet->BAUDCTRLB = (uint8_t)((baudrate) >> 8); /* MSBs of Baud rate value. */
+    regSet->BAUDCTRLA = (uint8_t)(baudrate & 0xFF); /* LSBs of Baud rate value. */
+    regSet->CTRLA = 0x10; /* RXCINTLVL = 1, other 2 disabled */
+    regSet->CTRLB = 0x18; /* Enable RX and TX */
+    regSet->CTRLC = 0xC0; /* MSB first, mode 0. PMODE, SBMODE, CHSIZE ignored by SPI */
+}
+
+/**
+ * @brief Give a device its own SPI clock rate
+ *
+ * @param csInfo Chip select information for the device
+ * @param baudRate The SPI clock rate in Hz, 0 to use the bus default
+ *
+ * The division is done once here, so switching rates between requests is
+ * just two register writes.
+ */
+void spi_master_set_cs_baud(chip_select_info_t *csInfo, uint32_t baudRate)
+{
+    if(baudRate == 0)
+    {
+        csInfo->baudCtrl = 0;
+    }
+    else
+    {
+        csInfo->baudCtrl = (uint16_t)SPI_BAUDCTRLVAL(baudRate) | SPI_CS_BAUD_VALID_bm;
+    }
+}
+
 /** 
  * @brief Initialize an SPI master object
  * @return bool - Whether or not it initialized successfully.
@@ -52,6 +123,17 @@ Bool init_spi_master_service(spi_master_t *masterObj, USART_t *regSet, PORT_t *p
     memset((void *)(masterObj->requestQueue), 0, SPI_MASTER_QUEUE_SIZE);
     masterObj->front = 0;
     masterObj->back = 0;
+    memset((void *)(masterObj->isrRequests), 0, sizeof(masterObj->isrRequests));
+    masterObj->isrPending = 0;
+    masterObj->currRequest = NULL;
+    masterObj->masterBusy = false;
+    masterObj->dma.enabled = false;
+    /* Whatever spi_master_hw_init set up is the rate for devices without their own */
+    masterObj->defaultBaudCtrl = ((uint16_t)(regSet->BAUDCTRLB & 0x0F) << 8) | regSet->BAUDCTRLA;
+    masterObj->currBaudCtrl = masterObj->defaultBaudCtrl;
+#if SPI_MASTER_STATS
+    spi_master_reset_stats(masterObj);
+#endif
 
     if(!is_background_function(taskName))
     {
@@ -64,6 +146,269 @@ Bool init_spi_master_service(spi_master_t *masterObj, USART_t *regSet, PORT_t *p
     return initSuccess;
 }
 
+/**
+ * @brief Program one leg of a DMA transfer and start it
+ *
+ * @param channel DMA channel to use
+ * @param trigger Peripheral trigger source for each byte
+ * @param src Source address
+ * @param srcDir Increment or hold the source address
+ * @param dest Destination address
+ * @param destDir Increment or hold the destination address
+ * @param count Number of bytes to move. Must not be 0, that means 64k to the hardware.
+ * @param intLevel Interrupt level for the transaction complete interrupt
+ *
+ * One byte is moved every time the trigger fires. Both interrupt flags are
+ * cleared as the config is written, so a stale flag from the last leg can't
+ * fire the new one early.
+ */
+static void spi_master_dma_leg(dma_channel_num_t channel,
+                               DMA_CH_TRIGSRC_t trigger,
+                               uint16_t src,
+                               DMA_CH_SRCDIR_t srcDir,
+                               uint16_t dest,
+                               DMA_CH_DESTDIR_t destDir,
+                               uint16_t count,
+                               enum dma_int_level_t intLevel)
+{
+    struct dma_channel_config config;
+
+    memset(&config, 0, sizeof(config));
+
+    dma_channel_set_burst_length(&config, DMA_CH_BURSTLEN_1BYTE_gc);
+    dma_channel_set_single_shot(&config);
+    dma_channel_set_trigger_source(&config, trigger);
+    dma_channel_set_src_reload_mode(&config, DMA_CH_SRCRELOAD_NONE_gc);
+    dma_channel_set_src_dir_mode(&config, srcDir);
+    dma_channel_set_dest_reload_mode(&config, DMA_CH_DESTRELOAD_NONE_gc);
+    dma_channel_set_dest_dir_mode(&config, destDir);
+    dma_channel_set_source_address(&config, src);
+    dma_channel_set_destination_address(&config, dest);
+    dma_channel_set_transfer_count(&config, count);
+    dma_channel_set_interrupt_level(&config, intLevel);
+    config.ctrlb |= DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm;
+
+    dma_channel_write_config(channel, &config);
+    dma_channel_enable(channel);
+}
+
+/**
+ * @brief Hand the request at the front of the queue to the DMA controller
+ *
+ * @param spi_interface The SPI master object in DMA mode
+ * @param request The request to start
+ *
+ * The receive channel is armed first so it is ready for the first byte, then
+ * the transmit channel starts as soon as it sees the data register empty.
+ * The transmit channel only interrupts if it has a dummy leg left to send.
+ */
+static void spi_master_dma_start(spi_master_t *spi_interface, volatile spi_request_t *request)
+{
+    spi_dma_info_t *dma = &(spi_interface->dma);
+    uint16_t dataAddr = SPI_DMA_ADDR(&(spi_interface->master->DATA));
+    uint16_t totalLen = max(request->sendLen, request->recvLen);
+
+    if(request->recvLen > 0)
+    {
+        dma->rxRemaining = totalLen - request->recvLen;
+        spi_master_dma_leg(dma->rxChannel, dma->rxTrigger,
+                           dataAddr, DMA_CH_SRCDIR_FIXED_gc,
+                           SPI_DMA_ADDR(request->recvBuff), DMA_CH_DESTDIR_INC_gc,
+                           request->recvLen, SPI_MASTER_DMA_INT_LVL);
+    }
+    else
+    {
+        dma->rxRemaining = 0;
+        spi_master_dma_leg(dma->rxChannel, dma->rxTrigger,
+                           dataAddr, DMA_CH_SRCDIR_FIXED_gc,
+                           SPI_DMA_ADDR(&spiDmaDummyRx), DMA_CH_DESTDIR_FIXED_gc,
+                           totalLen, SPI_MASTER_DMA_INT_LVL);
+    }
+
+    if(request->sendLen > 0)
+    {
+        dma->txRemaining = totalLen - request->sendLen;
+        spi_master_dma_leg(dma->txChannel, dma->txTrigger,
+                           SPI_DMA_ADDR(request->sendBuff), DMA_CH_SRCDIR_INC_gc,
+                           dataAddr, DMA_CH_DESTDIR_FIXED_gc,
+                           request->sendLen,
+                           (dma->txRemaining > 0) ? SPI_MASTER_DMA_INT_LVL : DMA_INT_LVL_OFF);
+    }
+    else
+    {
+        dma->txRemaining = 0;
+        spi_master_dma_leg(dma->txChannel, dma->txTrigger,
+                           SPI_DMA_ADDR(&spiDmaDummyTx), DMA_CH_SRCDIR_FIXED_gc,
+                           dataAddr, DMA_CH_DESTDIR_FIXED_gc,
+                           totalLen, DMA_INT_LVL_OFF);
+    }
+}
+
+/**
+ * @brief Common DMA transaction complete handler for SPI masters
+ *
+ * @param channel The DMA channel that interrupted
+ * @param status Status of the block transfer
+ *
+ * Runs the dummy leg of the request if the first leg was shorter than the whole
+ * transfer. The request is done when the receive channel finishes, since the
+ * last byte received is also the last byte clocked out.
+ */
+static void spi_master_dma_handler(dma_channel_num_t channel, enum dma_channel_status status)
+{
+    spi_master_t *spi_interface = spiDmaOwner[channel];
+    spi_dma_info_t *dma;
+    uint16_t dataAddr;
+    uint16_t legLen;
+#if SPI_MASTER_STATS
+    uint32_t isrStart = get_timer_fine_count();
+#endif
+
+    if(spi_interface == NULL)
+    {
+        return;
+    }
+
+    dma = &(spi_interface->dma);
+    dataAddr = SPI_DMA_ADDR(&(spi_interface->master->DATA));
+
+    if(status == DMA_CH_TRANSFER_ERROR)
+    {
+        /** Stop both sides and let the caller see the request as finished */
+        dma_channel_disable(dma->txChannel);
+        dma_channel_disable(dma->rxChannel);
+        dma->txRemaining = 0;
+        dma->rxRemaining = 0;
+        spi_master_finish_front(spi_interface);
+    }
+    else if(channel == dma->txChannel)
+    {
+        if(dma->txRemaining > 0)
+        {
+            legLen = dma->txRemaining;
+            dma->txRemaining = 0;
+            spi_master_dma_leg(dma->txChannel, dma->txTrigger,
+                               SPI_DMA_ADDR(&spiDmaDummyTx), DMA_CH_SRCDIR_FIXED_gc,
+                               dataAddr, DMA_CH_DESTDIR_FIXED_gc,
+                               legLen, DMA_INT_LVL_OFF);
+        }
+    }
+    else
+    {
+        if(dma->rxRemaining > 0)
+        {
+            legLen = dma->rxRemaining;
+            dma->rxRemaining = 0;
+            spi_master_dma_leg(dma->rxChannel, dma->rxTrigger,
+                               dataAddr, DMA_CH_SRCDIR_FIXED_gc,
+                               SPI_DMA_ADDR(&spiDmaDummyRx), DMA_CH_DESTDIR_FIXED_gc,
+                               legLen, SPI_MASTER_DMA_INT_LVL);
+        }
+        else
+        {
+            spi_master_finish_front(spi_interface);
+        }
+    }
+
+#if SPI_MASTER_STATS
+    spi_interface->stats.interrupts++;
+    spi_interface->stats.isrCounts += get_timer_fine_count() - isrStart;
+#endif
+}
+
+/** DMA channel 0 callback. The ASF driver gives no context, so look up the owner by channel. */
+static void spi_master_dma_ch0_callback(enum dma_channel_status status)
+{
+    spi_master_dma_handler(0, status);
+}
+
+/** DMA channel 1 callback */
+static void spi_master_dma_ch1_callback(enum dma_channel_status status)
+{
+    spi_master_dma_handler(1, status);
+}
+
+/** DMA channel 2 callback */
+static void spi_master_dma_ch2_callback(enum dma_channel_status status)
+{
+    spi_master_dma_handler(2, status);
+}
+
+/** DMA channel 3 callback */
+static void spi_master_dma_ch3_callback(enum dma_channel_status status)
+{
+    spi_master_dma_handler(3, status);
+}
+
+/** Callback to register for each DMA channel */
+static const dma_callback_t spiDmaCallbacks[DMA_NUMBER_OF_CHANNELS] =
+{
+    spi_master_dma_ch0_callback,
+    spi_master_dma_ch1_callback,
+    spi_master_dma_ch2_callback,
+    spi_master_dma_ch3_callback,
+};
+
+/**
+ * @brief Move an SPI master's transfers onto the DMA controller
+ *
+ * @param spi_interface The SPI master object, already initialized
+ * @param rxChannel DMA channel to use for received data
+ * @param rxTrigger The RXC trigger source of the master's USART
+ * @param txChannel DMA channel to use for sent data
+ * @param txTrigger The DRE trigger source of the master's USART
+ * @return True on success, false on failure
+ *
+ * After this call every request on the master is moved by DMA, and the request
+ * completes from the DMA transaction complete interrupt. The USART RXC interrupt
+ * is turned off, so spi_master_ISR will no longer be called for this master.
+ * The XMEGA only has four DMA channels, so at most two masters can use this.
+ * Give the receive channel the lower number, it has priority over the transmit one.
+ */
+Bool spi_master_enable_dma(spi_master_t *spi_interface,
+                           dma_channel_num_t rxChannel,
+                           DMA_CH_TRIGSRC_t rxTrigger,
+                           dma_channel_num_t txChannel,
+                           DMA_CH_TRIGSRC_t txTrigger)
+{
+    Bool enableStatus = true;
+
+    if((rxChannel >= DMA_NUMBER_OF_CHANNELS) || (txChannel >= DMA_NUMBER_OF_CHANNELS) ||
+       (rxChannel == txChannel) ||
+       (spiDmaOwner[rxChannel] != NULL) || (spiDmaOwner[txChannel] != NULL))
+    {
+        enableStatus = false;
+    }
+    else
+    {
+        if(!spiDmaControllerEnabled)
+        {
+            /** Fixed priority, channel 0 highest. Receive channels get the low numbers. */
+            dma_enable();
+            dma_set_priority_mode(DMA_PRIMODE_CH0123_gc);
+            spiDmaControllerEnabled = true;
+        }
+
+        spi_interface->dma.rxChannel = rxChannel;
+        spi_interface->dma.rxTrigger = rxTrigger;
+        spi_interface->dma.txChannel = txChannel;
+        spi_interface->dma.txTrigger = txTrigger;
+        spi_interface->dma.rxRemaining = 0;
+        spi_interface->dma.txRemaining = 0;
+
+        spiDmaOwner[rxChannel] = spi_interface;
+        spiDmaOwner[txChannel] = spi_interface;
+        dma_set_callback(rxChannel, spiDmaCallbacks[rxChannel]);
+        dma_set_callback(txChannel, spiDmaCallbacks[txChannel]);
+
+        /** The DMA drains DATA now. Leaving RXC on would steal bytes from it. */
+        spi_interface->master->CTRLA &= ~USART_RXCINTLVL_gm;
+        spi_interface->dma.enabled = true;
+    }
+
+    return enableStatus;
+}
+
 /**
  * @brief wrapper for spi_master_enqueue internal with keep_cs_low equal to false
  *
@@ -106,18 +451,12 @@ Bool spi_master_enqueue_cslow(spi_master_t *spi_interface,
  * @param recvLen Number of bytes to receive
  * @param complete Flag to set true when the transaction is complete
  * @param keep_cs_low Flag to determine if we should disable pulling the CS high after the transaction is finished. WARNING: The caller will be required to pull the CS high again or the SPI interface will be broken!!!
- * @return True on success, false on failure
+ * @return True on success, false if the queue is full
  *
- * The queue is wrapping, and so the array acts like a ring buffer
- * This makes detecting collisions a lot more fun. A lot of care is taken.
- * If front and back are the same, this can cause issues. Adding a new entry
- * when there is still an old entry there is bad. So, we check the valid flag
- * of the entry indexed by back. If it's valid, we can't add a new one. back 
- * will always point to the last entry in the queue upon entry to this function.
- * If there are no entries, back and front are the same. If there are three entries, 
- * then back will be the index for the last entry. So to create a new entry at the
- * back of the queue, we check if back + 1 is empty. We only want to update back
- * if we successfully add an entry.
+ * This is the producer side of the ring. Only one context may enqueue on a
+ * given master (the tasks, never an ISR, see spi_master_post_isr_request). The
+ * entry is filled in completely before back is bumped, so the ISR never sees a
+ * half written request, and there is no need to disable interrupts.
  */
 Bool spi_master_enqueue_internal(spi_master_t *spi_interface,
                             chip_select_info_t *csInfo,
@@ -129,35 +468,25 @@ Bool spi_master_enqueue_internal(spi_master_t *spi_interface,
                             Bool keep_cs_low)
 {
     Bool createStatus = true;
-    uint8_t newIndex = spi_interface->back;
+    uint8_t back = spi_interface->back;
     volatile spi_request_t *newRequest = NULL;
 
-    /** first check, Are front and back the same? This should only be true if a) the queue
-     * is empty, or b) the queue is full. If they are, don't modify the new index.
-     * otherwise, add one.
-     */
-    newIndex += (spi_interface->front == spi_interface->back) ? 0 : 1;
-
-    /** Next check for index wrapping */
-    if(newIndex == SPI_MASTER_QUEUE_DEPTH)
-    {
-        newIndex = 0;
-    }
-
-    /** Check for collisions on addition */
-    if((spi_interface->requestQueue[newIndex].valid == true) &&
-        (spi_interface->back == spi_interface->front))
+    /** Full when the producer is a whole lap ahead of the consumer. front only ever
+     * moves forward under us, so the worst case is a stale "full". */
+    if((uint8_t)(back - spi_interface->front) >= SPI_MASTER_QUEUE_DEPTH)
     {
         createStatus = false;
+#if SPI_MASTER_STATS
+        spi_interface->stats.queueFull++;
+#endif
     }
-
-    /** If it's safe, add the new entry */
-    if (createStatus == true)
+    else
     {
-        newRequest = &spi_interface->requestQueue[newIndex];
+        newRequest = &spi_interface->requestQueue[back & SPI_MASTER_QUEUE_MASK];
 
         newRequest->csInfo.csPort = csInfo->csPort;
         newRequest->csInfo.pinBitMask = csInfo->pinBitMask;
+        newRequest->csInfo.baudCtrl = csInfo->baudCtrl;
 
         if(keep_cs_low) {
             newRequest->raise_cs = false;
@@ -175,47 +504,109 @@ Bool spi_master_enqueue_internal(spi_master_t *spi_interface,
 
         newRequest->complete = complete;
         *(newRequest->complete) = false;
-        newRequest->valid = true;
 
-        spi_interface->back = newIndex;
+        /** Publish the entry. The entry must be written out before back moves. */
+        barrier();
+        spi_interface->back = back + 1;
+
+#if SPI_MASTER_STATS
+        if(spi_master_queue_count(spi_interface) > spi_interface->stats.maxQueued)
+        {
+            spi_interface->stats.maxQueued = spi_master_queue_count(spi_interface);
+        }
+#endif
     }
 
     return createStatus;
 }
 
+/**
+ * @brief Post a request from an interrupt
+ *
+ * @param spi_interface The SPI master object to use
+ * @param slot The caller's slot, below SPI_MASTER_ISR_SLOTS. One per interrupt source.
+ * @param csInfo Chip select information for the hardware device to contact
+ * @param sendBuff Caller's buffer containing the data to be sent out
+ * @param sendLen Number of bytes to send
+ * @param[out] recvBuff Caller's buffer to store response from device into
+ * @param recvLen Number of bytes to receive
+ * @param complete Flag to set true when the transaction is complete
+ * @return True on success, false if the slot is still pending or on the bus
+ *
+ * Each slot has one owner, so it needs no claiming, and the ring keeps its
+ * single task-side producer. The slot is only read by spi_master_initate_request,
+ * which runs in the SPI interrupt or with interrupts masked, so this can't
+ * race it at the same interrupt level.
+ */
+Bool spi_master_post_isr_request(spi_master_t *spi_interface,
+                                 uint8_t slot,
+                                 chip_select_info_t *csInfo,
+                                 volatile void *sendBuff,
+                                 uint16_t sendLen,
+                                 volatile void *recvBuff,
+                                 uint16_t recvLen,
+                                 volatile Bool *complete)
+{
+    Bool postStatus = true;
+    uint8_t slotBit = (uint8_t)(1 << slot);
+    volatile spi_request_t *newRequest;
+
+    if((slot >= SPI_MASTER_ISR_SLOTS) ||
+       (spi_interface->isrPending & slotBit) ||
+       (spi_interface->masterBusy && (spi_interface->currRequest == &(spi_interface->isrRequests[slot]))))
+    {
+        postStatus = false;
+    }
+    else
+    {
+        newRequest = &(spi_interface->isrRequests[slot]);
+
+        newRequest->csInfo.csPort = csInfo->csPort;
+        newRequest->csInfo.pinBitMask = csInfo->pinBitMask;
+        newRequest->csInfo.baudCtrl = csInfo->baudCtrl;
+        newRequest->raise_cs = true;
+
+        newRequest->sendBuff = sendBuff;
+        newRequest->sendLen = sendLen;
+        newRequest->bytesSent = 0;
+
+        newRequest->recvBuff = recvBuff;
+        newRequest->recvLen = recvLen;
+        newRequest->bytesRecv = 0;
+
+        newRequest->complete = complete;
+        *(newRequest->complete) = false;
+
+        spi_interface->isrPending |= slotBit;
+    }
+
+    return postStatus;
+}
+
 /** 
  * @brief Dequeue an item from an SPI master's queue
  * 
  * @param spi_interface The SPI master to dequeue from
- * @return True on success, false on failure 
+ * @return True on success, false if the queue was empty
  *
- * Pop an item from the request queue by invalidating the entry, then fix up the
- * front and back indexes
+ * This is the consumer side of the ring, called from the ISR once the request
+ * at the front is finished. Bumping front hands the slot back to the producer.
 */
 Bool spi_master_dequeue(spi_master_t *spi_interface)
 {
     Bool popStatus = true;
-    uint8_t oldFront = spi_interface->front;
-    /* If front == back, there's one entry or no entries */
-    uint8_t newFront = (oldFront == spi_interface->back) ? (oldFront) : (oldFront + 1);
-
-    /* Handle wrap-around */
-    if(newFront >= SPI_MASTER_QUEUE_DEPTH)
-    {
-       newFront = 0;
-    }
+    uint8_t front = spi_interface->front;
 
     /* If there wasn't an entry to pop */
-    if(spi_interface->requestQueue[oldFront].valid == false)
+    if(front == spi_interface->back)
     {
         popStatus = false;
     }
     else
     {
-        /* Invalidate the old front */
-        spi_interface->requestQueue[oldFront].valid = false;
-        /* Change the new front index to be one further in the queue (assuming no wrapping, else 0) */
-        spi_interface->front = newFront;
+        /** Done with the entry before the producer may reuse the slot */
+        barrier();
+        spi_interface->front = front + 1;
     }
 
     return popStatus;
@@ -227,15 +618,38 @@ Bool spi_master_dequeue(spi_master_t *spi_interface)
  * @param spi_interface The SPI master object that controls the desired interface
  * @return True on success, false on failure
  *
- * Instructs the SPI interface to start the request at the beginning of its queue.
- * Also pulls the chip select line low for the enqueued request.
+ * Instructs the SPI interface to start a posted interrupt slot, lowest first,
+ * or else the request at the beginning of its queue.
+ * Also switches the USART to the device's clock rate and pulls the chip select
+ * line low for the enqueued request.
+ * Call from the SPI interrupt or with interrupts masked, see spi_master_start_if_idle.
  */
 Bool spi_master_initate_request(spi_master_t *spi_interface)
 {
     Bool initiateSuccess = true;
-    volatile spi_request_t *frontQueue = &spi_interface->requestQueue[spi_interface->front];
-    
-    if(frontQueue->valid == false)
+    volatile spi_request_t *frontQueue = NULL;
+    uint8_t pending = spi_interface->isrPending;
+    uint8_t slot;
+    uint16_t baudCtrl;
+#if SPI_MASTER_STATS
+    uint32_t setupStart = get_timer_fine_count();
+#endif
+
+    if(pending != 0)
+    {
+        for(slot = 0; !(pending & (1 << slot)); slot++)
+        {
+            ;
+        }
+        spi_interface->isrPending = pending & ~(1 << slot);
+        frontQueue = &(spi_interface->isrRequests[slot]);
+    }
+    else if(spi_master_queue_count(spi_interface) != 0)
+    {
+        frontQueue = spi_master_front_request(spi_interface);
+    }
+
+    if(frontQueue == NULL)
     {
         initiateSuccess = false;
     }
@@ -247,18 +661,67 @@ Bool spi_master_initate_request(spi_master_t *spi_interface)
         frontQueue->bytesSent = 0;
         
         /** Mark this device as "busy" */
+        spi_interface->currRequest = frontQueue;
         spi_interface->masterBusy = true;
+
+        /** Switch to this device's clock rate. The bus is idle between requests, so this is safe. */
+        baudCtrl = (frontQueue->csInfo.baudCtrl & SPI_CS_BAUD_VALID_bm) ?
+                   (frontQueue->csInfo.baudCtrl & ~SPI_CS_BAUD_VALID_bm) :
+                   spi_interface->defaultBaudCtrl;
+        if(baudCtrl != spi_interface->currBaudCtrl)
+        {
+            spi_interface->master->BAUDCTRLB = (uint8_t)(baudCtrl >> 8);
+            spi_interface->master->BAUDCTRLA = (uint8_t)(baudCtrl & 0xFF);
+            spi_interface->currBaudCtrl = baudCtrl;
+        }
         /** Enable chip select for the device in this request */
         frontQueue->csInfo.csPort->OUTCLR = frontQueue->csInfo.pinBitMask;
 
-        /** Write to the spi master data. this will send the first byte. */
-        spi_interface->master->DATA = ((uint8_t *)(frontQueue->sendBuff))[0];
-        frontQueue->bytesSent++;
+        if(spi_interface->dma.enabled)
+        {
+            /** The DMA moves every byte, we only hear back when it's all done. */
+            spi_master_dma_start(spi_interface, frontQueue);
+        }
+        else
+        {
+            /** Write to the spi master data. this will send the first byte. */
+            spi_interface->master->DATA = ((uint8_t *)(frontQueue->sendBuff))[0];
+            frontQueue->bytesSent++;
+        }
 
+#if SPI_MASTER_STATS
+        spi_interface->stats.requests++;
+        spi_interface->stats.bytes += max(frontQueue->sendLen, frontQueue->recvLen);
+        spi_interface->stats.busyStart = setupStart;
+        spi_interface->stats.setupCounts += get_timer_fine_count() - setupStart;
+#endif
     }
     return initiateSuccess;
 }
 
+/**
+ * @brief Start the front request if the bus is idle
+ *
+ * @param spi_interface The SPI master object that controls the desired interface
+ * @return True if a request was started, false if the bus was busy or nothing was waiting
+ *
+ * The check and the start happen with interrupts off, so the background task
+ * and a data ready interrupt can't both start a request.
+ */
+Bool spi_master_start_if_idle(spi_master_t *spi_interface)
+{
+    Bool started = false;
+    irqflags_t flags = cpu_irq_save();
+
+    if(!spi_interface->masterBusy)
+    {
+        started = spi_master_initate_request(spi_interface);
+    }
+    cpu_irq_restore(flags);
+
+    return started;
+}
+
 /**
  * @brief Generic SPI Interrupt Service Routine
  *
@@ -271,12 +734,15 @@ Bool spi_master_initate_request(spi_master_t *spi_interface)
  */
 void spi_master_ISR(spi_master_t *spi_interface)
 {
-    volatile uint8_t *dataSent, *dataRecv;
+    volatile uint16_t *dataSent, *dataRecv;
     uint16_t dataToSend, dataToRecv, dummyByte;
     Bool moreToDo;
+#if SPI_MASTER_STATS
+    uint32_t isrStart = get_timer_fine_count();
+#endif
 
-    /** Look at the front of the queue */
-    volatile spi_request_t *currRequest = &spi_interface->requestQueue[spi_interface->front];
+    /** Look at the request on the bus */
+    volatile spi_request_t *currRequest = spi_interface->currRequest;
     dataSent = &(currRequest->bytesSent);
     dataRecv = &(currRequest->bytesRecv);
     dataToSend = currRequest->sendLen;
@@ -315,19 +781,51 @@ void spi_master_ISR(spi_master_t *spi_interface)
 
     if(!moreToDo)
     {
-        /** If we're done, raise chip select again. NOTE: This is enabled by default. 
-         * There are a few special cases (i.e. Altimeter Reset procedure) that
-         * require it to be held low.
-        */
-        if(currRequest->raise_cs){
-            spi_master_finish_request(currRequest);
-        }
-        /** Inform the initiator that the request has completed*/
-        spi_interface->masterBusy = false;
-        spi_master_request_complete(spi_interface);
-        /** Dequeue the request from the list*/
+        spi_master_finish_front(spi_interface);
+    }
+
+#if SPI_MASTER_STATS
+    spi_interface->stats.interrupts++;
+    spi_interface->stats.isrCounts += get_timer_fine_count() - isrStart;
+#endif
+}
+
+/**
+ * @brief Wrap up the request on the bus
+ *
+ * @param spi_interface The SPI master object that controls the bus.
+ *
+ * Called from interrupt context once the last byte of a request is in,
+ * either from spi_master_ISR or from the DMA complete interrupt. Starts the
+ * next posted interrupt slot right away, the queue waits for the background task.
+ */
+static void spi_master_finish_front(spi_master_t *spi_interface)
+{
+    volatile spi_request_t *currRequest = spi_interface->currRequest;
+
+    /** If we're done, raise chip select again. NOTE: This is enabled by default. 
+     * There are a few special cases (i.e. Altimeter Reset procedure) that
+     * require it to be held low.
+    */
+    if(currRequest->raise_cs){
+        spi_master_finish_request(currRequest);
+    }
+#if SPI_MASTER_STATS
+    spi_interface->stats.busyCounts += get_timer_fine_count() - spi_interface->stats.busyStart;
+#endif
+    /** Inform the initiator that the request has completed*/
+    spi_interface->masterBusy = false;
+    spi_master_request_complete(spi_interface);
+    /** Dequeue the request from the list, unless it came from a slot */
+    if(currRequest == spi_master_front_request(spi_interface))
+    {
         spi_master_dequeue(spi_interface);
     }
+
+    if(spi_interface->isrPending != 0)
+    {
+        (void)spi_master_initate_request(spi_interface);
+    }
 }
 
 /*****************************************************************************/
@@ -365,14 +863,19 @@ Bool spi_master_blocking_send_request(spi_master_t *spi_interface,
     /** In the future we might add a timeout..? */
     Bool retVal = true;
 
-    spi_master_enqueue_internal(spi_interface, csInfo, sendBuff, sendLen, recvBuff, recvLen, complete, false);
-    spi_master_initate_request(spi_interface);
-
-    while((*complete) != true)
+    if(!spi_master_enqueue_internal(spi_interface, csInfo, sendBuff, sendLen, recvBuff, recvLen, complete, false))
     {
-        asm("");/** Do nothing while waitng. empty Asm here just to make sure we keep the loop as a loop.
-                 * The fact that complete is a pointer to a volatile variable should be enough though.
-                 */
+        /** Queue is full, the request was never made */
+        retVal = false;
+    }
+    else
+    {
+        /** Anything already queued goes first. Keep the bus moving ourselves,
+         * the background task may not be running yet. */
+        while((*complete) != true)
+        {
+            (void)spi_master_start_if_idle(spi_interface);
+        }
     }
     
     /** The ISR routine dequeues the request */
@@ -411,17 +914,52 @@ Bool spi_master_blocking_send_req_cslow(spi_master_t *spi_interface,
     /** In the future we might add a timeout..? */
     Bool retVal = true;
 
-    spi_master_enqueue_internal(spi_interface, csInfo, sendBuff, sendLen, recvBuff, recvLen, complete, true);
-    spi_master_initate_request(spi_interface);
-
-    while((*complete) != true)
+    if(!spi_master_enqueue_internal(spi_interface, csInfo, sendBuff, sendLen, recvBuff, recvLen, complete, true))
     {
-        asm("");/** Do nothing while waitng. empty Asm here just to make sure we keep the loop as a loop.
-                 * The fact that complete is a pointer to a volatile variable should be enough though.
-                 */
+        /** Queue is full, the request was never made */
+        retVal = false;
+    }
+    else
+    {
+        /** Anything already queued goes first. Keep the bus moving ourselves,
+         * the background task may not be running yet. */
+        while((*complete) != true)
+        {
+            (void)spi_master_start_if_idle(spi_interface);
+        }
     }
     
     /** The ISR routine dequeues the request */
 
     return retVal;
 }
+
+#if SPI_MASTER_STATS
+/**
+ * @brief Copy out an SPI master's bus statistics
+ *
+ * @param spi_interface The SPI master object
+ * @param[out] stats Where to copy the statistics
+ *
+ * The interrupts update the statistics, so they're copied with interrupts off
+ * to get a consistent set.
+ */
+void spi_master_get_stats(spi_master_t *spi_interface, spi_master_stats_t *stats)
+{
+    irqflags_t flags = cpu_irq_save();
+    memcpy((void *)stats, (void *)&(spi_interface->stats), sizeof(spi_master_stats_t));
+    cpu_irq_restore(flags);
+}
+
+/**
+ * @brief Zero an SPI master's bus statistics
+ *
+ * @param spi_interface The SPI master object
+ */
+void spi_master_reset_stats(spi_master_t *spi_interface)
+{
+    irqflags_t flags = cpu_irq_save();
+    memset((void *)&(spi_interface->stats), 0, sizeof(spi_master_stats_t));
+    cpu_irq_restore(flags);
+}
+#endif
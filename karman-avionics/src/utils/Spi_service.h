@@ -30,8 +30,32 @@
 #include <asf.h>
 #include "Background.h"
 
-/** Max number of entries in the queue */
-#define SPI_MASTER_QUEUE_DEPTH (10)
+/** Max number of entries in the queue. MUST be a power of two, no more than 128.
+ * host/bench/bench_spi shows what a bus gets out of each depth. */
+#ifndef SPI_MASTER_QUEUE_DEPTH
+#define SPI_MASTER_QUEUE_DEPTH (8)
+#endif
+/** Turns a free-running queue counter into an index into the queue array */
+#define SPI_MASTER_QUEUE_MASK (SPI_MASTER_QUEUE_DEPTH - 1)
+
+#if ((SPI_MASTER_QUEUE_DEPTH & SPI_MASTER_QUEUE_MASK) != 0) || (SPI_MASTER_QUEUE_DEPTH > 128)
+#error "SPI_MASTER_QUEUE_DEPTH must be a power of two, no more than 128"
+#endif
+
+/** Request slots for interrupts on each master, outside the queue. No more than 8. */
+#define SPI_MASTER_ISR_SLOTS (4)
+
+/** Set to 0 to compile out the per-master bus statistics */
+#define SPI_MASTER_STATS (1)
+
+/** SPI clock rate every bus is set up with. Devices that can go faster ask for it with spi_master_set_cs_baud */
+#define SPI_MASTER_DEFAULT_BAUD (1000000) /**< 1MHz */
+
+/** Set in chip_select_info_t.baudCtrl when the device has its own clock rate */
+#define SPI_CS_BAUD_VALID_bm (0x8000)
+
+/** Interrupt level for the DMA channels of an SPI master. Keep it the same as RXCINTLVL. */
+#define SPI_MASTER_DMA_INT_LVL (DMA_INT_LVL_LO)
 
 
 /** Information about the chip select pin for the device to be contacted */
@@ -39,6 +63,7 @@ typedef struct
 {
     PORT_t      *csPort;        /**< The port that the chip select pin is on */
     uint8_t     pinBitMask;     /**< The bitmask for the pin. (1 << pinNum) */
+    uint16_t    baudCtrl;       /**< USART BAUDCTRL value for the device, with SPI_CS_BAUD_VALID_bm. 0 means the bus default */
 } chip_select_info_t;
 
 /** Structure to define parameters to give to the SPI service */
@@ -47,15 +72,56 @@ typedef struct
   chip_select_info_t    csInfo;     /**< Information about chip select pin */
   volatile void         *sendBuff;  /**< Buffer to send data from */
   uint16_t               sendLen;   /**< How many bytes to send */
-  volatile uint8_t      bytesSent;  /**< How many bytes have already been sent */
+  volatile uint16_t     bytesSent;  /**< How many bytes have already been sent */
   volatile void         *recvBuff;  /**< Buffer to store the result in */
   uint16_t               recvLen;   /**< How many bytes to expect from the device */
-  volatile uint8_t      bytesRecv;  /**< How many bytes have actually been received */
+  volatile uint16_t     bytesRecv;  /**< How many bytes have actually been received */
   volatile Bool         *complete;  /**< Complete flag */
-  Bool                  valid;      /**< Valid flag. Is this a valid request? */
   Bool                  raise_cs;   /**< */
 } spi_request_t;
 
+/**
+ * @brief DMA information for an SPI master
+ *
+ * A master in DMA mode moves whole buffers with two DMA channels instead of
+ * taking an RXC interrupt for every byte. When the send and receive lengths
+ * of a request differ, the shorter side is padded: dummy bytes are clocked out
+ * after the send buffer runs dry, and bytes nobody asked for are thrown away
+ * after the receive buffer is full. That second leg costs one extra DMA interrupt.
+ */
+typedef struct
+{
+    Bool                enabled;     /**< Is this master moving data with DMA? */
+    dma_channel_num_t   rxChannel;   /**< Channel copying USART DATA into the receive buffer */
+    DMA_CH_TRIGSRC_t    rxTrigger;   /**< RXC trigger source of the USART */
+    dma_channel_num_t   txChannel;   /**< Channel copying the send buffer into USART DATA */
+    DMA_CH_TRIGSRC_t    txTrigger;   /**< DRE trigger source of the USART */
+    volatile uint16_t   rxRemaining; /**< Bytes to discard once the receive buffer is full */
+    volatile uint16_t   txRemaining; /**< Dummy bytes to send once the send buffer is empty */
+} spi_dma_info_t;
+
+/**
+ * @brief Bus statistics for an SPI master
+ *
+ * Times are in TCC0 counts (1/32 us), see get_timer_fine_count.
+ * bytes / busyCounts is the achieved throughput, setupCounts / requests is the
+ * cost of starting a request, and isrCounts / interrupts is the cost of each
+ * interrupt. In ISR mode there is one interrupt per byte, in DMA mode one or two
+ * per request. maxQueued and queueFull show whether SPI_MASTER_QUEUE_DEPTH is enough.
+ */
+typedef struct
+{
+    uint32_t    requests;       /**< Requests started on the bus */
+    uint32_t    bytes;          /**< Bytes clocked on the bus */
+    uint32_t    interrupts;     /**< RXC or DMA interrupts taken */
+    uint32_t    setupCounts;    /**< Time spent in spi_master_initate_request */
+    uint32_t    isrCounts;      /**< Time spent in the RXC or DMA interrupt handlers */
+    uint32_t    busyCounts;     /**< Time from starting a request to finishing it, summed */
+    uint32_t    busyStart;      /**< When the current request was started */
+    uint16_t    queueFull;      /**< Enqueues refused because the queue was full */
+    uint8_t     maxQueued;      /**< Most requests ever waiting in the queue */
+} spi_master_stats_t;
+
 /** @brief Struct to define the SPI interface to use. 
  *
  * Note that there needs to exist one
@@ -66,15 +132,53 @@ typedef struct
 {
     USART_t *master; /**< The USART module associated with this master */
     PORT_t *port;    /**< The port the master is on */
-    /* The fields necessary to implement a queue. An array, and two indecies */
+    /* Single producer/single consumer ring. back is only written by the task that
+     * enqueues, front is only written by the ISR that finishes requests. Both count up
+     * forever and wrap at 256, so back - front is always the number of entries. */
     volatile spi_request_t  requestQueue[SPI_MASTER_QUEUE_DEPTH]; /**< Array to hold queue items */
-    volatile uint8_t        front; /**< Index of the front of the queue */
-    volatile uint8_t        back;  /**< Index of the back of the queue */
+    volatile uint8_t        front; /**< Free-running count of requests dequeued */
+    volatile uint8_t        back;  /**< Free-running count of requests enqueued */
+    /* Interrupts don't touch the ring. Each one that needs the bus owns a slot here,
+     * only written with interrupts at the SPI level or masked. */
+    volatile spi_request_t  isrRequests[SPI_MASTER_ISR_SLOTS]; /**< One request per interrupt slot */
+    volatile uint8_t        isrPending; /**< Bit per slot posted and not started yet */
+    volatile spi_request_t  *currRequest; /**< Request on the bus, from the ring or a slot */
     volatile Bool           masterBusy; /**< Flag to indicate if the master is busy or not */
+    spi_dma_info_t          dma;   /**< DMA channels, if the master was put in DMA mode */
+    uint16_t                defaultBaudCtrl; /**< BAUDCTRL value the bus was set up with */
+    uint16_t                currBaudCtrl;    /**< BAUDCTRL value in the USART right now */
+#if SPI_MASTER_STATS
+    volatile spi_master_stats_t stats; /**< Bus statistics */
+#endif
 } spi_master_t;
 
 
 
+/**
+ * @brief Set up a USART as an SPI master
+ *
+ * @param regSet The USART to set up
+ * @param baudRate The SPI clock rate in Hz
+ *
+ * Turns on the peripheral clock, sets the baud rate, and puts the USART in
+ * SPI master mode 0, MSB first, with the RXC interrupt at low level.
+ * This is the only place the USART control registers are written at startup,
+ * so every bus comes up the same way.
+ */
+void spi_master_hw_init(USART_t *regSet, uint32_t baudRate);
+
+/**
+ * @brief Give a device its own SPI clock rate
+ *
+ * @param csInfo Chip select information for the device
+ * @param baudRate The SPI clock rate in Hz, 0 to use the bus default
+ *
+ * The service switches the USART to this rate before every request to the
+ * device, and back to the bus default for devices that don't set one.
+ * Rates above half the peripheral clock are clamped to half the peripheral clock.
+ */
+void spi_master_set_cs_baud(chip_select_info_t *csInfo, uint32_t baudRate);
+
 /** 
  * @brief Intialize an SPI master object
  * @return bool - Whether or not it initialized successfully.
@@ -90,6 +194,27 @@ Bool init_spi_master_service(spi_master_t *master,
                              PORT_t *port,
                              background_func_t taskName);
 
+/**
+ * @brief Move an SPI master's transfers onto the DMA controller
+ *
+ * @param spi_interface The SPI master object, already initialized
+ * @param rxChannel DMA channel to use for received data
+ * @param rxTrigger The RXC trigger source of the master's USART
+ * @param txChannel DMA channel to use for sent data
+ * @param txTrigger The DRE trigger source of the master's USART
+ * @return True on success, false on failure
+ *
+ * After this call every request on the master is moved by DMA, and the request
+ * completes from the DMA transaction complete interrupt. The USART RXC interrupt
+ * is turned off, so spi_master_ISR will no longer be called for this master.
+ * The XMEGA only has four DMA channels, so at most two masters can use this.
+ * Give the receive channel the lower number, it has priority over the transmit one.
+ */
+Bool spi_master_enable_dma(spi_master_t *spi_interface,
+                           dma_channel_num_t rxChannel,
+                           DMA_CH_TRIGSRC_t rxTrigger,
+                           dma_channel_num_t txChannel,
+                           DMA_CH_TRIGSRC_t txTrigger);
 
 /**
  * @brief wrapper for spi_master_enqueue_internal with keep_cs_low equal to false
@@ -127,18 +252,12 @@ Bool spi_master_enqueue_cslow(spi_master_t *spi_interface,
  * @param recvLen Number of bytes to receive
  * @param complete Flag to set true when the transaction is complete
  * @param keep_cs_low Flag to determine if we should disable pulling the CS high after the transaction is finished. WARNING: The caller will be required to pull the CS high again or the SPI interface will be broken!!!
- * @return True on success, false on failure
+ * @return True on success, false if the queue is full
  *
- * The queue is wrapping, and so the array acts like a ring buffer
- * This makes detecting collisions a lot more fun. A lot of care is taken.
- * If front and back are the same, this can cause issues. Adding a new entry
- * when there is still an old entry there is bad. So, we check the valid flag
- * of the entry indexed by back. If it's valid, we can't add a new one. back 
- * will always point to the last entry in the queue upon entry to this function.
- * If there are no entries, back and front are the same. If there are three entries, 
- * then back will be the index for the last entry. So to create a new entry at the
- * back of the queue, we check if back + 1 is empty. We only want to update back
- * if we successfully add an entry.
+ * This is the producer side of the ring. Only one context may enqueue on a
+ * given master (the tasks, never an ISR, see spi_master_post_isr_request). The
+ * entry is filled in completely before back is bumped, so the ISR never sees a
+ * half written request, and there is no need to disable interrupts.
  */
 Bool spi_master_enqueue_internal(spi_master_t *spi_interface,
                         chip_select_info_t *csInfo,
@@ -149,14 +268,40 @@ Bool spi_master_enqueue_internal(spi_master_t *spi_interface,
                         volatile Bool *complete,
                         Bool keep_cs_low);
 
+/**
+ * @brief Post a request from an interrupt
+ *
+ * @param spi_interface The SPI master object to use
+ * @param slot The caller's slot, below SPI_MASTER_ISR_SLOTS. One per interrupt source.
+ * @param csInfo Chip select information for the hardware device to contact
+ * @param sendBuff Caller's buffer containing the data to be sent out
+ * @param sendLen Number of bytes to send
+ * @param[out] recvBuff Caller's buffer to store response from device into
+ * @param recvLen Number of bytes to receive
+ * @param complete Flag to set true when the transaction is complete
+ * @return True on success, false if the slot is still pending or on the bus
+ *
+ * Call from an interrupt at the SPI level, then spi_master_start_if_idle.
+ * Posted slots go on the bus before the queue, and the SPI interrupt starts
+ * the next one as it finishes a request.
+ */
+Bool spi_master_post_isr_request(spi_master_t *spi_interface,
+                                 uint8_t slot,
+                                 chip_select_info_t *csInfo,
+                                 volatile void *sendBuff,
+                                 uint16_t sendLen,
+                                 volatile void *recvBuff,
+                                 uint16_t recvLen,
+                                 volatile Bool *complete);
+
 /** 
  * @brief Dequeue an item from an SPI master's queue
  * 
  * @param spi_interface The SPI master to dequeue from
- * @return True on success, false on failure 
+ * @return True on success, false if the queue was empty
  *
- * Pop an item from the request queue by invalidating the entry, then fix up the
- * front and back indexes
+ * This is the consumer side of the ring, called from the ISR once the request
+ * at the front is finished. Bumping front hands the slot back to the producer.
 */
 Bool spi_master_dequeue(spi_master_t *spi_interface);
 
@@ -179,10 +324,22 @@ void spi_master_ISR(spi_master_t *spi_interface);
  * @return True on success, false on failure
  *
  * Instructs the SPI interface to start the request at the beginning of its queue.
- * Also pulls the chip select line low for the enqueued request.
+ * Also switches the USART to the device's clock rate and pulls the chip select
+ * line low for the enqueued request. In DMA mode the
+ * whole request is handed to the DMA controller here.
  */
 Bool spi_master_initate_request(spi_master_t *spi_interface);
 
+/**
+ * @brief Start the front request if the bus is idle
+ *
+ * @param spi_interface The SPI master object that controls the desired interface
+ * @return True if a request was started, false if the bus was busy or nothing was waiting
+ *
+ * Safe to call from tasks and from low level interrupts.
+ */
+Bool spi_master_start_if_idle(spi_master_t *spi_interface);
+
 /**
  * @brief Send a request, but block the whole time while waiting for it to finish
  *
@@ -236,9 +393,30 @@ Bool spi_master_blocking_send_req_cslow(spi_master_t *spi_interface,
                                  uint16_t recvLen,
                                  volatile Bool *complete);
 
+#if SPI_MASTER_STATS
+/**
+ * @brief Copy out an SPI master's bus statistics
+ *
+ * @param spi_interface The SPI master object
+ * @param[out] stats Where to copy the statistics
+ */
+void spi_master_get_stats(spi_master_t *spi_interface, spi_master_stats_t *stats);
+
+/**
+ * @brief Zero an SPI master's bus statistics
+ *
+ * @param spi_interface The SPI master object
+ */
+void spi_master_reset_stats(spi_master_t *spi_interface);
+#endif
+
 /** Pull the chip select pin high to de-select the device */
 #define spi_master_finish_request(reqPtr)       (reqPtr->csInfo.csPort->OUTSET = reqPtr->csInfo.pinBitMask)
-/** Set the master's complete flag to true so it is ready to initiate a new request */
-#define spi_master_request_complete(master)     (*(master->requestQueue[master->front].complete) = true)
+/** The request at the front of the master's queue */
+#define spi_master_front_request(master)        (&((master)->requestQueue[(master)->front & SPI_MASTER_QUEUE_MASK]))
+/** Number of requests in the master's queue */
+#define spi_master_queue_count(master)          ((uint8_t)((master)->back - (master)->front))
+/** Set the complete flag of the request on the bus */
+#define spi_master_request_complete(master)     (*((master)->currRequest->complete) = true)
 
 #endif /* SPI_SERVICE_H_ */
@@ -16,20 +16,37 @@
 #include "USBUtils.h"
 #include "conf_usb.h"
 #include "FlashMem.h"
+#include "Crc.h"
 #include "Timer.h"
+#include "Tasks.h"
+#include "Scheduler.h"
+#include "Background.h"
+#include "Spi_bg_task.h"
 #include <compiler.h>
+#include <string.h>
 
-/** Size of the USB message buffer. TX/RX? TODO */
-#define USB_MSG_BUF_SIZE (200)
+/** Size of the USB message buffer. Holds the message of a packet from the host. */
+#define USB_MSG_BUF_SIZE (USB_RX_MSG_MAX_SIZE)
 
 /* Global Variables */
 Bool gIsUSBActive; /**< Flag to know if USB is ready for communication */
 volatile Bool gIsUSBConnected = false; /**< Flag to know if USB sense pin is high */
 volatile uint32_t gUSBConnectTime; /**< Time for debouncing USB sense pin */
-uint8_t gUSBMsgBuf[USB_MSG_BUF_SIZE]; /**< For holding USB data */
+uint8_t gUSBMsgBuf[USB_MSG_BUF_SIZE]; /**< For holding the message of the last packet from the host */
+
+/** Number of download blocks. One is read from the flash while the other is sent. */
+#define USB_NUM_FLASHBLOCKS (2)
+/** How long to wait on the host or the flash before giving up on a download, in ticks (1 s) */
+#define USB_TX_TIMEOUT (5000)
+/** How long to wait on the host's half of a handshake before starting over, in ticks (1 s) */
+#define USB_HANDSHAKE_TIMEOUT (5000)
+
+usb_msg_flashblock_t gUsbFlashBlocks[USB_NUM_FLASHBLOCKS]; /**< Download blocks */
 
 usb_utils_state_t gUsbUtilsState; /**< Main state machine for USB */
-usb_utils_messageparse_state_t gUSBUtilsMessageState; /**< TX message parsing state machine */
+uint16_t gUsbExecMode; /**< Execution mode the host asked for, waiting on its confirmation */
+uint32_t gUsbStateTime; /**< When the state machine started waiting on the host */
+usb_rx_ctrl_t gUsbRxCtrl; /**< Receive ring, framer and packet queue */
 
 /** 
  * @brief Initialize the USB driver
@@ -94,6 +111,7 @@ bool usb_utils_cdc_enabled(uint8_t port)
 {
     gIsUSBActive= true;
     gUsbUtilsState = USB_STATE_INITIAL;
+    memset((void *)&gUsbRxCtrl, 0, sizeof(gUsbRxCtrl));
     return true;
 }
 
@@ -132,7 +150,7 @@ Bool usb_utils_create_packet(uint16_t id, uint16_t len, uint8_t *message, usb_pa
         packet->hdr.packet_id = id;
         packet->hdr.message_len = len;
         packet->message = message;
-        retVal = usb_utils_calculate_checksum(&(packet->checksum), message, len);
+        retVal = usb_utils_calculate_checksum(&(packet->checksum), &(packet->hdr), message);
     }
     else
     {
@@ -142,94 +160,370 @@ Bool usb_utils_create_packet(uint16_t id, uint16_t len, uint8_t *message, usb_pa
 }
 
 /**
- * @brief Calculate 8-bit checksum
+ * @brief Calculate packet checksum
  *
- * @param[out] checksum The checksum of the message
+ * @param[out] checksum The checksum of the packet
+ * @param hdr The packet header, with message_len filled in
  * @param message Pointer to where the message is
- * @param len The length of the message
  *
  * @return True on failure, false on success
  *
- * Takes in message and computes checksum.
+ * CRC-16-CCITT of the header then the message, so a bad ID or length is
+ * caught as well as a bad message.
  */
-Bool usb_utils_calculate_checksum(uint16_t *checksum, uint8_t *message, uint16_t len)
+Bool usb_utils_calculate_checksum(uint16_t *checksum, usb_packet_header_t *hdr, uint8_t *message)
 {
     Bool retVal = false;
-    uint16_t word_idx = 0;
-    uint8_t byte_idx = 0;
-    
-    if(NULL == checksum || NULL == message)
+
+    if(NULL == checksum || NULL == hdr || (NULL == message && hdr->message_len > 0))
     {
-        return retVal;
+        retVal = true;
     }
-    
-    *checksum = 0;
+    else
+    {
+        *checksum = crc16_update(CRC16_INIT, (uint8_t *)hdr, USB_PACKET_HDR_SIZE);
+        *checksum = crc16_update(*checksum, message, hdr->message_len);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Write bytes to the CDC port, running the background functions while it's full
+ *
+ * @param buf Bytes to write
+ * @param len Number of bytes
+ * @return True on failure (USB went away or stopped taking data), false on success
+ *
+ * udi_cdc_write_buf spins when the CDC buffer is full. Only hand it what
+ * fits, and let the SPI queues and the flash driver get on with things
+ * while the host drains the buffer.
+ */
+static Bool usb_utils_write(const uint8_t *buf, iram_size_t len)
+{
+    Bool retVal = false;
+    iram_size_t chunk;
+    uint32_t startTime = get_timer_count();
 
-    if(len < 1)
+    while(len > 0)
     {
-        retVal = true;
-        *checksum = 0xFFFF;
+        chunk = udi_cdc_get_free_tx_buffer();
+        chunk = min(len, chunk);
+        if(chunk > 0)
+        {
+            /* udi_cdc_write_buf returns the number of bytes it could NOT write */
+            chunk -= udi_cdc_write_buf(buf, chunk);
+            buf += chunk;
+            len -= chunk;
+            startTime = get_timer_count();
+        }
+        else if(!gIsUSBActive || ((get_timer_count() - startTime) > USB_TX_TIMEOUT))
+        {
+            retVal = true;
+            break;
+        }
+        else
+        {
+            background_task_func();
+        }
     }
-    else /* Message length greater than 0 */
+
+    return retVal;
+}
+
+/**
+ * @brief Start reading the next download block from the flash
+ *
+ * @param[out] block The block to fill
+ * @param first Sequence number of the first entry in the block
+ * @param end Sequence number one past the last entry to be sent
+ * @param numEntries Total number of entries in the log
+ * @return True on failure, false on success
+ *
+ * The read is non-blocking, the entries land in the block while the other
+ * block goes out over USB.
+ */
+static Bool usb_utils_start_block_read(usb_msg_flashblock_t *block, uint32_t first, uint32_t end, uint32_t numEntries)
+{
+    Bool retVal = false;
+    uint32_t startTime = get_timer_count();
+
+    block->num_entries = numEntries;
+    block->entry_num = first;
+    block->entry_count = (uint16_t)min(end - first, USB_FLASHBLOCK_ENTRIES);
+    block->entry_size = sizeof(flash_data_entry_t);
+
+    /* Refused while the SPI queue is too full to take it */
+    while(flashmem_read_entries(block->entries, first, block->entry_count, false))
     {
-        /* Iterate over 2 byte words */
-        while(word_idx < (len >> 1))
+        if((get_timer_count() - startTime) > USB_TX_TIMEOUT)
         {
-            *checksum += ((uint16_t *)message)[word_idx];
-            word_idx++;
+            retVal = true;
+            break;
         }
-        /* handle last word if odd number of bytes*/
-        if(len & 1) /* if(len%2 == 1) */
+        background_task_func();
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Wait for a download block read to finish
+ *
+ * @return True on failure (timeout), false on success
+ */
+static Bool usb_utils_wait_block_read(void)
+{
+    Bool retVal = false;
+    uint32_t startTime = get_timer_count();
+
+    while(flashmem_read_busy())
+    {
+        if((get_timer_count() - startTime) > USB_TX_TIMEOUT)
         {
-            byte_idx = len - 1;
-            *checksum+= (((uint16_t)(message[byte_idx])) << 8);
+            retVal = true;
+            break;
         }
+        background_task_func();
     }
 
     return retVal;
 }
 
 /** 
- * @brief Transfers flash memory contents to host
+ * @brief Transfers a range of flash memory entries to host
+ *
+ * @param firstEntry Sequence number of the first entry to send
+ * @param entryCount Number of entries to send, USB_DNLD_ALL for the rest of the log
+ * @return True on failure, false on success
+ *
+ * Checks the Flash memory for a valid header, and then streams the
+ * entries over USB to the host, a flash page of entries per packet.
+ * The range is clamped to the log, so asking past the end sends nothing.
+ *
+ * Does not transfer the header, only the entries. Each block contains
+ * the number of its first entry, the total number of entries and a CRC-32
+ * of its entries, so the host can ask for just the blocks that went bad.
+ * A USB_ID_DNLD_DONE message follows the last block. Two blocks are used,
+ * one is read from the flash while the other is sent.
+ */
+Bool dump_to_usb(uint32_t firstEntry, uint32_t entryCount)
+{
+    Bool retVal = false;
+    usb_packet_t packet;
+    usb_msg_flashblock_t *block = gUsbFlashBlocks;
+    usb_msg_dnld_done_t done;
+    uint8_t blockIdx = 0;
+    uint32_t numEntries;
+    uint32_t end;
+    uint32_t first;
+    flash_data_hdr_t header;
+
+    /* Get the last partial page onto the flash */
+    (void)flashmem_sync();
+
+    if(HDR_VALID != flashmem_verify_header(&header))
+    {
+        return true;
+    }
+
+    /* Clamp the range to the log */
+    numEntries = flashmem_get_num_entries();
+    firstEntry = min(firstEntry, numEntries);
+    end = ((numEntries - firstEntry) < entryCount) ? numEntries : (firstEntry + entryCount);
+
+    done.num_entries = numEntries;
+    done.first_entry = firstEntry;
+    done.entry_count = end - firstEntry;
+    done.num_blocks = 0;
+    done.reserved = 0;
+
+    if(firstEntry < end)
+    {
+        retVal = usb_utils_start_block_read(&(gUsbFlashBlocks[blockIdx]), firstEntry, end, numEntries);
+    }
+
+    for(first = firstEntry; (first < end) && !retVal; first += block->entry_count)
+    {
+        block = &(gUsbFlashBlocks[blockIdx]);
+        retVal = usb_utils_wait_block_read();
+
+        /* Read the next block into the other buffer while this one goes out */
+        blockIdx = (blockIdx + 1) % USB_NUM_FLASHBLOCKS;
+        if(!retVal && ((first + block->entry_count) < end))
+        {
+            retVal = usb_utils_start_block_read(&(gUsbFlashBlocks[blockIdx]), first + block->entry_count, end, numEntries);
+        }
+
+        if(!retVal)
+        {
+            /* Worked out while the next block is read from the flash */
+            block->crc = crc32_final(crc32_update(CRC32_INIT, (uint8_t *)block->entries, block->entry_count * sizeof(flash_data_entry_t)));
+            usb_utils_create_packet(USB_ID_FLASHBLOCK,
+                                    USB_FLASHBLOCK_HDR_SIZE + (block->entry_count * sizeof(flash_data_entry_t)),
+                                    (uint8_t *)block,
+                                    &packet);
+            retVal = usb_utils_send_packet(&packet);
+            done.num_blocks++;
+        }
+    }
+
+    /* Don't leave a read going into a buffer we're done with */
+    (void)usb_utils_wait_block_read();
+
+    if(!retVal)
+    {
+        usb_utils_create_packet(USB_ID_DNLD_DONE, sizeof(usb_msg_dnld_done_t), (uint8_t *)&done, &packet);
+        retVal = usb_utils_send_packet(&packet);
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Write a whole packet to the CDC port
  *
- * Checks the Flash memory for a valid header, and then copies the
- * contents over USB to the host, one entry at a time.
+ * @param packet The packet to send, made by usb_utils_create_packet
+ * @return True on failure, false on success
  *
- * Does not transfer the header, only the packets. Each packet contains
- * a packet number and the total number of packets.
+ * Sends the header, the message the packet points to, then the checksum.
+ * Returns once the CDC driver has taken all of it.
  */
-void dump_to_usb(void) {
-  usb_packet_t packet;
-  usb_msg_flashentry_t payload;
-  flash_data_entry_t *entry = &(payload.entry);
-
-  flash_data_hdr_t header;
-  flashmem_hdrstatus_t hdr_status = flashmem_verify_header(&header);
-
-  switch(hdr_status) {
-    case HDR_VALID:
-      payload.num_entries = header.num_entries;
-      for (int i = 0; i < header.num_entries; i++) {
-        flashmem_read_entry(entry, i);
-        payload.entry_num = i;
-        usb_utils_create_packet(USB_ID_FLASHENTRY,
-                                sizeof(usb_msg_flashentry_t),
-                                (uint8_t *)&payload,
-                                &packet);
-        while (!udi_cdc_is_tx_ready()) {
-          asm volatile ("nop \n\t");
+Bool usb_utils_send_packet(usb_packet_t *packet)
+{
+    Bool retVal = false;
+
+    if(usb_utils_write((uint8_t *)&(packet->hdr), USB_PACKET_HDR_SIZE))
+    {
+        retVal = true;
+    }
+    else if(usb_utils_write(packet->message, packet->hdr.message_len))
+    {
+        retVal = true;
+    }
+    else if(usb_utils_write((uint8_t *)&(packet->checksum), USB_PACKET_CHKSUM_SIZE))
+    {
+        retVal = true;
+    }
+
+    return retVal;
+}
+
+/**
+ * @brief Fill a profile message from a profile
+ *
+ * @param[out] msg The message to fill
+ * @param profile The profile to copy from
+ */
+static void usb_utils_fill_profile(usb_msg_profile_t *msg, exec_profile_t *profile)
+{
+    msg->num_calls = profile->numCalls;
+    msg->min_counts = (profile->numCalls != 0) ? profile->minCounts : 0;
+    msg->max_counts = profile->maxCounts;
+    msg->mean_counts = profiler_mean(profile);
+    msg->overruns = profile->overruns;
+    memcpy((void *)msg->histogram, (void *)profile->histogram, sizeof(msg->histogram));
+}
+
+/** 
+ * @brief Transfers task execution profiles to host
+ *
+ * Sends one USB_ID_PROFILE packet per task in the task list, then one per
+ * registered background function, then one USB_ID_SPI_STATS packet per SPI bus.
+ */
+void dump_profile_to_usb(void)
+{
+    usb_packet_t packet;
+    usb_msg_profile_t payload;
+#if SPI_MASTER_STATS
+    usb_msg_spi_stats_t spiPayload;
+    spi_master_stats_t spiStats;
+#endif
+    simple_task_t *taskList = get_task_list();
+    uint8_t numTasks = get_num_tasks();
+    uint8_t numBackground = get_num_background_funcs();
+    uint8_t idx;
+
+    memset((void *)&payload, 0, sizeof(payload));
+    payload.idle_percent = scheduler_get_idle_percent();
+
+    payload.kind = USB_PROFILE_TASK;
+    for(idx = 0; idx < numTasks; idx++)
+    {
+        payload.index = idx;
+        payload.task_freq = taskList[idx].taskFreq;
+        payload.deadline_misses = taskList[idx].deadlineMisses;
+        usb_utils_fill_profile(&payload, &(taskList[idx].profile));
+
+        usb_utils_create_packet(USB_ID_PROFILE, sizeof(usb_msg_profile_t), (uint8_t *)&payload, &packet);
+        usb_utils_send_packet(&packet);
+    }
+
+    payload.kind = USB_PROFILE_BACKGROUND;
+    payload.task_freq = TASK_FREQ_BACKGROUND;
+    payload.deadline_misses = 0;
+    for(idx = 0; idx < numBackground; idx++)
+    {
+        payload.index = idx;
+        usb_utils_fill_profile(&payload, get_background_profile(idx));
+
+        usb_utils_create_packet(USB_ID_PROFILE, sizeof(usb_msg_profile_t), (uint8_t *)&payload, &packet);
+        usb_utils_send_packet(&packet);
+    }
+
+#if SPI_MASTER_STATS
+    for(idx = 0; idx < MAX_SPI_MASTER_MODULES; idx++)
+    {
+        if(gSpiMasters[idx] == NULL)
+        {
+            continue;
         }
-        udi_cdc_write_buf(&packet, sizeof(packet));
-        //udi_cdc_putc, getc, write_buff, read_buff
-      }
-      break;
-    case HDR_INVALID:
-      break;
-    case HDR_ZERO:
-      break;
-    case HDR_READFAIL:
-      break;
-  }
+        spi_master_get_stats(gSpiMasters[idx], &spiStats);
+
+        spiPayload.index = idx;
+        spiPayload.max_queued = spiStats.maxQueued;
+        spiPayload.queue_full = spiStats.queueFull;
+        spiPayload.requests = spiStats.requests;
+        spiPayload.bytes = spiStats.bytes;
+        spiPayload.interrupts = spiStats.interrupts;
+        spiPayload.setup_counts = spiStats.setupCounts;
+        spiPayload.isr_counts = spiStats.isrCounts;
+        spiPayload.busy_counts = spiStats.busyCounts;
+
+        usb_utils_create_packet(USB_ID_SPI_STATS, sizeof(usb_msg_spi_stats_t), (uint8_t *)&spiPayload, &packet);
+        usb_utils_send_packet(&packet);
+    }
+#endif
+}
+
+/**
+ * @brief Find the state that carries out an execution mode
+ *
+ * @param mode usb_execution_mode_t from the host
+ * @param[out] state The state for it
+ * @return True if it isn't a mode we can do, false on success
+ *
+ * Data acquisition and the ejection test don't do anything yet, so they're
+ * turned down rather than left waiting in a state that never finishes.
+ */
+static Bool usb_utils_mode_state(uint16_t mode, usb_utils_state_t *state)
+{
+    Bool retVal = false;
+
+    switch(mode)
+    {
+        case USB_EXEC_MODE_DNLD:
+            *state = USB_STATE_TRANSMIT_FLASH;
+            break;
+        case USB_EXEC_MODE_PROFILE:
+            *state = USB_STATE_TRANSMIT_PROFILE;
+            break;
+        default:
+            retVal = true;
+            break;
+    }
+
+    return retVal;
 }
 
 /**
@@ -252,38 +546,153 @@ void dump_to_usb(void) {
  * before triggering the corresponding pyrotechnics. The test is ended with an
  * end test message. While in data acquistion mode, the OS will keep
  * collecting data and keep running the main application. In the other three 
- * modes, the main app is not running. 
- *
+ * modes, the main app is not running. The profile mode sends one profile
+ * packet per task and background function, then waits for a new mode request.
+ * In download mode the host asks for ranges of entries, and can ask again for
+ * any block whose CRC didn't match. A request for no entries ends the mode.
+ * The host has a second to answer each step of a handshake, except picking
+ * the mode, and a NACK goes back whenever the app starts over. Modes that
+ * aren't written yet are NACKed, see usb_utils_mode_state.
  */
 void usb_utils_state_mach(void)
 {
     nack_error_t error_code = NACK_UNKNOWN;
     Bool is_nack_required = false;
+    usb_packet_t rxPacket;
+    usb_packet_t txPacket;
+    usb_msg_init_t initMsg;
+    usb_msg_req_mode_t reqMode;
+    usb_msg_ack_mode_t ackMode;
+    usb_msg_recv_mode_t *recvMode;
+    usb_msg_ack_mode_resp_t *ackModeResp;
+    usb_msg_dnld_req_t *dnldReq;
+    usb_utils_state_t modeState;
+
+    rxPacket.message = gUSBMsgBuf;
 
     switch(gUsbUtilsState)
     {
         case USB_STATE_INITIAL:
-            /* Send usb_msg_init */
+            /* Say hello. Sent again every time the host doesn't answer in time. */
+            memcpy((void *)initMsg.init_str, USB_INIT_STR, USB_INIT_STR_SIZE);
+            usb_utils_create_packet(USB_ID_INIT, sizeof(usb_msg_init_t), (uint8_t *)&initMsg, &txPacket);
+            if(!usb_utils_send_packet(&txPacket))
+            {
+                gUsbStateTime = get_timer_count();
+                gUsbUtilsState = USB_STATE_WAIT_INIT_ACK;
+            }
             break;
         case USB_STATE_WAIT_INIT_ACK:
-            /* wait for usb_msg_init_ack */
-            /* on success, send usb_req_mode */
-            /* on timeout/failure, send usb_msg_nack */
-            error_code = NACK_TIMEOUT; /* for example */
+            if(!usb_utils_check_for_message(&rxPacket))
+            {
+                if((get_timer_count() - gUsbStateTime) > USB_HANDSHAKE_TIMEOUT)
+                {
+                    is_nack_required = true;
+                    error_code = NACK_TIMEOUT;
+                    gUsbUtilsState = USB_STATE_INITIAL;
+                }
+            }
+            else if((rxPacket.hdr.packet_id != USB_ID_INIT_ACK) || (rxPacket.hdr.message_len != sizeof(usb_msg_init_ack_t)))
+            {
+                is_nack_required = true;
+                error_code = NACK_UNEXP_HOST_MSG;
+                gUsbUtilsState = USB_STATE_INITIAL;
+            }
+            else if(strncmp(((usb_msg_init_ack_t *)rxPacket.message)->init_ack_str, USB_INIT_ACK_STR, USB_INIT_ACK_STR_SIZE) != 0)
+            {
+                is_nack_required = true;
+                error_code = NACK_INVALID_PAYLD;
+                gUsbUtilsState = USB_STATE_INITIAL;
+            }
+            else
+            {
+                /* Have the host ask the user for a mode */
+                reqMode.mode_req_magicnum = USB_REQ_MODE_MAGIC;
+                usb_utils_create_packet(USB_ID_REQ_MODE, sizeof(usb_msg_req_mode_t), (uint8_t *)&reqMode, &txPacket);
+                gUsbUtilsState = usb_utils_send_packet(&txPacket) ? USB_STATE_INITIAL : USB_STATE_WAIT_RECV_MODE;
+            }
             break;
         case USB_STATE_WAIT_RECV_MODE:
-            /* wait for message usb_msg_recv_mode */
-            /* on success, send usb_msg_ack_mode */
-            /* on timeout/failure, send usb_msg_nack */
+            /* No timeout, the user takes as long as they like to pick a mode */
+            if(!usb_utils_check_for_message(&rxPacket))
+            {
+                break;
+            }
+            recvMode = (usb_msg_recv_mode_t *)(rxPacket.message);
+            if((rxPacket.hdr.packet_id != USB_ID_RECV_MODE) || (rxPacket.hdr.message_len != sizeof(usb_msg_recv_mode_t)))
+            {
+                is_nack_required = true;
+                error_code = NACK_UNEXP_HOST_MSG;
+                gUsbUtilsState = USB_STATE_INITIAL;
+            }
+            else if(usb_utils_mode_state(recvMode->execution_mode, &modeState))
+            {
+                is_nack_required = true;
+                error_code = NACK_INVALID_PAYLD;
+                gUsbUtilsState = USB_STATE_INITIAL;
+            }
+            else
+            {
+                /* Echo the mode back, and wait for the host to confirm it */
+                gUsbExecMode = recvMode->execution_mode;
+                ackMode.ack_num = USB_MODE_ACK_NUM;
+                ackMode.execution_mode = gUsbExecMode;
+                usb_utils_create_packet(USB_ID_ACK_MODE, sizeof(usb_msg_ack_mode_t), (uint8_t *)&ackMode, &txPacket);
+                gUsbStateTime = get_timer_count();
+                gUsbUtilsState = usb_utils_send_packet(&txPacket) ? USB_STATE_INITIAL : USB_STATE_WAIT_ACK_MODE_RESP;
+            }
             break;
         case USB_STATE_WAIT_ACK_MODE_RESP:
-            /* wait for message ack_mode_resp */
-            /* on success, set next mode based on message */
-            /* on timeout/failure, send usb_msg_nack */
+            ackModeResp = (usb_msg_ack_mode_resp_t *)(rxPacket.message);
+            if(!usb_utils_check_for_message(&rxPacket))
+            {
+                if((get_timer_count() - gUsbStateTime) > USB_HANDSHAKE_TIMEOUT)
+                {
+                    is_nack_required = true;
+                    error_code = NACK_TIMEOUT;
+                    gUsbUtilsState = USB_STATE_INITIAL;
+                }
+            }
+            else if((rxPacket.hdr.packet_id != USB_ID_ACK_MODE_RESP) || (rxPacket.hdr.message_len != sizeof(usb_msg_ack_mode_resp_t)))
+            {
+                is_nack_required = true;
+                error_code = NACK_UNEXP_HOST_MSG;
+                gUsbUtilsState = USB_STATE_INITIAL;
+            }
+            else if((ackModeResp->ackresp_num != USB_MODE_ACKRESP_NUM) ||
+                    (ackModeResp->execution_mode != gUsbExecMode) ||
+                    usb_utils_mode_state(gUsbExecMode, &modeState))
+            {
+                is_nack_required = true;
+                error_code = NACK_INVALID_PAYLD;
+                gUsbUtilsState = USB_STATE_INITIAL;
+            }
+            else
+            {
+                gUsbUtilsState = modeState;
+            }
             break;
         case USB_STATE_TRANSMIT_FLASH:
-            /* call dump_to_usb */
-            /* on failure, send usb_msg_nack */
+            /* Send each range the host asks for, until it asks for none */
+            if(!usb_utils_check_for_message(&rxPacket))
+            {
+                break;
+            }
+            dnldReq = (usb_msg_dnld_req_t *)(rxPacket.message);
+            if((rxPacket.hdr.packet_id != USB_ID_DNLD_REQ) || (rxPacket.hdr.message_len != sizeof(usb_msg_dnld_req_t)))
+            {
+                is_nack_required = true;
+                error_code = NACK_UNEXP_HOST_MSG;
+            }
+            else if(dnldReq->entry_count == USB_DNLD_END)
+            {
+                gUsbUtilsState = USB_STATE_WAIT_RECV_MODE;
+            }
+            else if(dump_to_usb(dnldReq->first_entry, dnldReq->entry_count))
+            {
+                is_nack_required = true;
+                error_code = NACK_FLASH_HDR_ERR;
+            }
             break;
         case USB_STATE_EJECTIONTEST:
             /* wait for ejection test messages */
@@ -292,6 +701,11 @@ void usb_utils_state_mach(void)
         case USB_STATE_DO_ACQ:
             /*  */
             break;
+        case USB_STATE_TRANSMIT_PROFILE:
+            /* Send every task's profile, then wait for the next mode */
+            dump_profile_to_usb();
+            gUsbUtilsState = USB_STATE_WAIT_RECV_MODE;
+            break;
         default:
             /* ERROR */
             break;
@@ -312,58 +726,179 @@ void usb_utils_state_mach(void)
  */
 void usb_utils_send_nack(nack_error_t error_code)
 {
-    /* Send nack message over usb */
+    usb_packet_t packet;
+    usb_msg_nack_t nack;
+
+    nack.error_code = error_code;
+    usb_utils_create_packet(USB_ID_MSG_NACK, sizeof(usb_msg_nack_t), (uint8_t *)&nack, &packet);
+
+    /* Nothing more to do if the host is gone too */
+    (void)usb_utils_send_packet(&packet);
 }
 
 /**
- * @brief Message parsing state machine
- *
- * @param[out] packet_out Rx'd packet is copied into this pointer
- * @returns True if packet RX, false otherwise
+ * @brief Copy what the CDC driver has received into the ring
  *
- * TODO
- * uses global variable gUSBMsgBuf. Think about buffer of packets
+ * Stops when the ring is full. The rest stays in the CDC buffers, and the
+ * host is held off until there's room.
  */
-bool usb_utils_check_for_message(usb_packet_t *packet_out)
+static void usb_utils_rx_fill(void)
 {
-    /* Check how much data is ready to be processed */
-    iram_size_t num_bytes_recv = udi_cdc_get_nb_received_data();
-    iram_size_t num_rem_bytes;
+    usb_rx_ctrl_t *rx = &gUsbRxCtrl;
+    uint8_t back = rx->ring_back;
+    iram_size_t numBytes;
+    iram_size_t room;
 
-    switch(gUSBUtilsMessageState)
+    if(rx->filling)
     {
-        case MSG_STATE_READ_HEADER:
-            if(num_bytes_recv >= USB_PACKET_HDR_SIZE)
-            {
-                num_rem_bytes = udi_cdc_read_buf((uint8_t *)&(packet_out->hdr), USB_PACKET_HDR_SIZE);
-                if(num_rem_bytes >= packet_out->hdr.packet_id)
-                {
-                    num_rem_bytes = udi_cdc_read_buf(&(packet_out->message), (packet_out->hdr.message_len + USB_PACKET_CHKSUM_SIZE));
-                }
-                else
-                {
-                    gUSBUtilsMessageState = MSG_STATE_WAIT_MSG;
-                }
-            }
+        /* Reading the CDC buffer can call the notify again, the outer call carries on */
+        return;
+    }
+    rx->filling = true;
+
+    while((numBytes = udi_cdc_get_nb_received_data()) > 0)
+    {
+        room = USB_RX_RING_SIZE - (uint8_t)(back - rx->ring_front);
+        if(room == 0)
+        {
             break;
-        case MSG_STATE_WAIT_MSG:
+        }
+        /* Don't wrap inside a read */
+        room = min(room, (iram_size_t)(USB_RX_RING_SIZE - (back & USB_RX_RING_MASK)));
+        numBytes = min(numBytes, room);
+        numBytes -= udi_cdc_read_buf(&(rx->ring[back & USB_RX_RING_MASK]), numBytes);
+        back += (uint8_t)numBytes;
+        rx->ring_back = back;
+    }
+
+    rx->filling = false;
+}
+
+/**
+ * @brief CDC receive callback
+ *
+ * @param port Ignored, only one CDC port
+ *
+ * Called from the USB interrupt when data arrives from the host.
+ */
+void usb_utils_rx_notify(uint8_t port)
+{
+    usb_utils_rx_fill();
+}
+
+/**
+ * @brief Copy bytes out of the ring without taking them out
+ *
+ * @param offset Bytes from the front of the ring to start at
+ * @param[out] buf Where to put them
+ * @param len How many bytes
+ */
+static void usb_utils_rx_peek(uint8_t offset, uint8_t *buf, uint8_t len)
+{
+    uint8_t idx = gUsbRxCtrl.ring_front + offset;
+
+    while(len > 0)
+    {
+        *buf = gUsbRxCtrl.ring[idx & USB_RX_RING_MASK];
+        buf++;
+        idx++;
+        len--;
+    }
+}
+
+/**
+ * @brief Find packets in the ring and queue them for the state machine
+ *
+ * A packet is only taken out of the ring once the whole thing is there and
+ * its magic, ID, length and checksum are good. Anything else drops one byte
+ * and looks again, so a corrupt packet costs nothing but itself. Looks at no
+ * more than the bytes in the ring, and stops when the queue is full, so the
+ * time it takes is bounded.
+ */
+static void usb_utils_rx_frame(void)
+{
+    usb_rx_ctrl_t *rx = &gUsbRxCtrl;
+    usb_rx_packet_t *packet;
+    uint8_t numBytes;
+    uint8_t packetLen;
+    uint16_t checksum;
+
+    while((uint8_t)(rx->queue_back - rx->queue_front) < USB_RX_QUEUE_DEPTH)
+    {
+        numBytes = (uint8_t)(rx->ring_back - rx->ring_front);
+        if(numBytes < USB_PACKET_HDR_SIZE)
+        {
             break;
-        default:
+        }
+
+        packet = &(rx->queue[rx->queue_back & USB_RX_QUEUE_MASK]);
+        usb_utils_rx_peek(0, (uint8_t *)&(packet->hdr), USB_PACKET_HDR_SIZE);
+
+        if((packet->hdr.packet_magic != 0xDEADBEEF) ||
+           (packet->hdr.packet_id >= NUM_USB_MSG_ID) ||
+           (packet->hdr.message_len > USB_RX_MSG_MAX_SIZE))
+        {
+            rx->resync_bytes++;
+            rx->ring_front++;
+            continue;
+        }
+
+        packetLen = USB_PACKET_HDR_SIZE + packet->hdr.message_len + USB_PACKET_CHKSUM_SIZE;
+        if(numBytes < packetLen)
+        {
+            /* The rest hasn't come in yet */
             break;
+        }
+
+        usb_utils_rx_peek(USB_PACKET_HDR_SIZE, packet->message, packet->hdr.message_len);
+        usb_utils_rx_peek(USB_PACKET_HDR_SIZE + packet->hdr.message_len, (uint8_t *)&(packet->checksum), USB_PACKET_CHKSUM_SIZE);
+        (void)usb_utils_calculate_checksum(&checksum, &(packet->hdr), packet->message);
+
+        if(checksum != packet->checksum)
+        {
+            rx->bad_checksums++;
+            rx->ring_front++;
+            continue;
+        }
+
+        rx->ring_front += packetLen;
+        rx->queue_back++;
+    }
+}
+
+/**
+ * @brief Get the next packet from the host
+ *
+ * @param[out] packet_out Rx'd packet is copied into this pointer. Its message
+ *             pointer must point at USB_RX_MSG_MAX_SIZE bytes.
+ * @returns True if packet RX, false otherwise
+ *
+ * Never waits. Picks up anything the CDC callback left behind, runs the
+ * framer over the ring, then hands back the oldest queued packet.
+ */
+bool usb_utils_check_for_message(usb_packet_t *packet_out)
+{
+    usb_rx_ctrl_t *rx = &gUsbRxCtrl;
+    usb_rx_packet_t *packet;
+    irqflags_t flags;
+    bool retVal = false;
+
+    /* The callback only fires when new data comes in, so take what it couldn't fit */
+    flags = cpu_irq_save();
+    usb_utils_rx_fill();
+    cpu_irq_restore(flags);
+
+    usb_utils_rx_frame();
+
+    if(rx->queue_back != rx->queue_front)
+    {
+        packet = &(rx->queue[rx->queue_front & USB_RX_QUEUE_MASK]);
+        packet_out->hdr = packet->hdr;
+        packet_out->checksum = packet->checksum;
+        memcpy((void *)packet_out->message, (void *)packet->message, packet->hdr.message_len);
+        rx->queue_front++;
+        retVal = true;
     }
-    // state: read header
-    //      If there are USB_PACKET_HDR_SIZE bytes to read
-    //          Read USB_PACKET_HDR_SIZE bytes
-    //          If there are message_len bytes to read
-    //              Read message_len bytes
-    //              parse message
-    //          else
-    //              Next state = wait message          
-    //
-    // state: wait message
-    //      If there are message_len bytes
-    //          Read mesage_len bytes
-    //          parse message
-
-    return false;
+
+    return retVal;
 }
@@ -13,6 +13,7 @@
 
 #include <asf.h>
 #include "FlashMem.h"
+#include "Profiler.h"
 
 /** Header to be sent before each packet */
 typedef struct
@@ -24,7 +25,7 @@ typedef struct
 
 /** Size in bytes of USB packet header */
 #define USB_PACKET_HDR_SIZE (8)
-/** Size in bytes of USB checksum */
+/** Size in bytes of USB checksum, a CRC-16-CCITT of the header and message */
 #define USB_PACKET_CHKSUM_SIZE (2)
 
 /** USB packet. 8 bytes for header, 2 for checksum, plus message */
@@ -45,14 +46,55 @@ typedef enum
     USB_STATE_TRANSMIT_FLASH,       /**< Upload flash contents to host */
     USB_STATE_EJECTIONTEST,         /**< Perform ejection test */
     USB_STATE_DO_ACQ,               /**< Perform data acquistion */
+    USB_STATE_TRANSMIT_PROFILE,     /**< Upload task execution profiles to host */
 } usb_utils_state_t;
 
-/** Message parsing state machine */
-typedef enum
+/** Size of the CDC receive ring buffer. Power of 2, at most 256. */
+#define USB_RX_RING_SIZE (128)
+/** Index mask for the CDC receive ring buffer */
+#define USB_RX_RING_MASK (USB_RX_RING_SIZE - 1)
+/** Largest message the host sends. Longer ones are treated as a bad header. */
+#define USB_RX_MSG_MAX_SIZE (32)
+/** Number of received packets waiting for the state machine. Power of 2. */
+#define USB_RX_QUEUE_DEPTH (4)
+/** Index mask for the received packet queue */
+#define USB_RX_QUEUE_MASK (USB_RX_QUEUE_DEPTH - 1)
+
+#if ((USB_RX_RING_SIZE & USB_RX_RING_MASK) != 0) || (USB_RX_RING_SIZE > 256)
+#error "USB_RX_RING_SIZE must be a power of 2, at most 256"
+#endif
+#if (USB_RX_QUEUE_DEPTH & USB_RX_QUEUE_MASK) != 0
+#error "USB_RX_QUEUE_DEPTH must be a power of 2"
+#endif
+
+/** A received packet with its message copied in */
+typedef struct
+{
+    usb_packet_header_t hdr;                  /**< Packet header */
+    uint16_t checksum;                        /**< Checksum, already verified */
+    uint8_t message[USB_RX_MSG_MAX_SIZE];     /**< The message */
+} usb_rx_packet_t;
+
+/**
+ * @brief Receive side of the USB port
+ *
+ * The CDC receive callback copies bytes into the ring. The framer takes them
+ * out, finds packets, and puts the good ones in the queue for the state machine.
+ * Each index is only written from one side, and they run freely, so the
+ * number of bytes or packets waiting is back minus front.
+ */
+typedef struct
 {
-    MSG_STATE_READ_HEADER, /**< Read the header */
-    MSG_STATE_WAIT_MSG,    /**< Wait for the num bytes in the message */
-} usb_utils_messageparse_state_t;
+    uint8_t ring[USB_RX_RING_SIZE];           /**< Bytes from the host */
+    volatile uint8_t ring_back;               /**< Where the next byte goes. Written by the CDC callback */
+    volatile uint8_t ring_front;              /**< Oldest byte. Written by the framer */
+    volatile Bool filling;                    /**< Ring is being filled, keeps the callback from nesting */
+    usb_rx_packet_t queue[USB_RX_QUEUE_DEPTH];/**< Complete packets */
+    uint8_t queue_back;                       /**< Where the next packet goes */
+    uint8_t queue_front;                      /**< Oldest packet */
+    uint16_t resync_bytes;                    /**< Bytes thrown away looking for a packet */
+    uint16_t bad_checksums;                   /**< Packets thrown away for a bad checksum */
+} usb_rx_ctrl_t;
 
 /** Possible messages over USB */
 typedef enum
@@ -63,11 +105,15 @@ typedef enum
     USB_ID_RECV_MODE,      /**< Mode reciept from mcu to host */
     USB_ID_ACK_MODE,       /**< ACK of the mode  */
     USB_ID_ACK_MODE_RESP,  /**< Response to the ACK */
-    USB_ID_FLASHENTRY,     /**< Message contains a flash entry */
+    USB_ID_FLASHBLOCK,     /**< Message contains a block of flash entries */
     USB_ID_EJTEST_MAIN,    /**< Request for Main ejection test */
     USB_ID_EJTEST_DROG,    /**< Request for Drogue ejection test */
     USB_ID_EJTEST_END,     /**< End of ejection tests */
     USB_ID_MSG_NACK,       /**< NACK message */
+    USB_ID_PROFILE,        /**< Message contains one task's execution profile */
+    USB_ID_SPI_STATS,      /**< Message contains one SPI bus's statistics */
+    USB_ID_DNLD_REQ,       /**< Range of entries requested by host in download mode */
+    USB_ID_DNLD_DONE,      /**< End of the blocks for a download request */
     NUM_USB_MSG_ID,        /**< Not an actual message, # of messages */
 } usb_id_t;
 
@@ -129,6 +175,7 @@ typedef enum
     USB_EXEC_MODE_DACQ = 0x111,     /**< Data acquistion */
     USB_EXEC_MODE_DNLD = 0x222,     /**< Download data */
     USB_EXEC_MODE_EJTEST = 0x999,   /**< Ejection test */
+    USB_EXEC_MODE_PROFILE = 0x333,  /**< Send task execution profiles */
 } usb_execution_mode_t;
 
 /** Host message with initial mode for handshake */
@@ -157,13 +204,88 @@ typedef struct
     uint16_t execution_mode;    /**< Exection mode */
 } usb_msg_ack_mode_resp_t;
 
-/** Data packet for download mode */
+/** Most entries in one download block. A block is at most a flash page of whole entries. */
+#define USB_FLASHBLOCK_ENTRIES (FLASHMEM_PAGE_SIZE / sizeof(flash_data_entry_t))
+
+/** Size in bytes of a download block in front of the entries */
+#define USB_FLASHBLOCK_HDR_SIZE (16)
+
+/** Data packet for download mode. Only the first entry_count entries are sent. */
 typedef struct
 {
-    uint32_t num_entries;       /**< Total number of entries to be sent */
-    uint32_t entry_num;         /**< Sequence number */
-    flash_data_entry_t entry;   /**< The actual packet */
-} usb_msg_flashentry_t;
+    uint32_t num_entries;       /**< Total number of entries in the log */
+    uint32_t entry_num;         /**< Sequence number of the first entry in the block */
+    uint16_t entry_count;       /**< Number of entries in this block */
+    uint16_t entry_size;        /**< Size in bytes of each entry */
+    uint32_t crc;               /**< CRC-32 of the entries in this block */
+    flash_data_entry_t entries[USB_FLASHBLOCK_ENTRIES]; /**< Entries, straight from the flash */
+} usb_msg_flashblock_t;
+
+/** entry_count of a download request that ends download mode */
+#define USB_DNLD_END (0)
+/** entry_count of a download request for everything from first_entry on */
+#define USB_DNLD_ALL (0xFFFFFFFFUL)
+
+/**
+ * @brief Host message asking for a range of entries in download mode
+ *
+ * To resume, ask for everything from the first entry not received yet.
+ * To retransmit a block that failed its CRC, ask for the entry_num and
+ * entry_count of that block.
+ */
+typedef struct
+{
+    uint32_t first_entry;       /**< Sequence number of the first entry wanted */
+    uint32_t entry_count;       /**< How many entries, USB_DNLD_ALL or USB_DNLD_END */
+} usb_msg_dnld_req_t;
+
+/** Sent after the last block of a download request */
+typedef struct
+{
+    uint32_t num_entries;       /**< Total number of entries in the log */
+    uint32_t first_entry;       /**< First entry sent */
+    uint32_t entry_count;       /**< Entries sent, after clamping the request to the log */
+    uint16_t num_blocks;        /**< Blocks sent */
+    uint16_t reserved;          /**< Padding */
+} usb_msg_dnld_done_t;
+
+/** What a profile message describes */
+typedef enum
+{
+    USB_PROFILE_TASK = 0,       /**< An entry in the scheduler's task list */
+    USB_PROFILE_BACKGROUND,     /**< A registered background function */
+} usb_profile_kind_t;
+
+/** Execution profile of one task or background function. Times are in TCC0 counts (1/32 us). */
+typedef struct
+{
+    uint8_t  kind;              /**< usb_profile_kind_t, 8 bits tho */
+    uint8_t  index;             /**< Index in the task list or background function list */
+    uint8_t  idle_percent;      /**< CPU idle percentage over the last second */
+    uint8_t  reserved;          /**< Padding */
+    uint16_t task_freq;         /**< Task period in ticks, 0 for background */
+    uint16_t deadline_misses;   /**< Times the task finished after its deadline */
+    uint32_t num_calls;         /**< How many times it ran */
+    uint32_t min_counts;        /**< Shortest run */
+    uint32_t max_counts;        /**< Longest run */
+    uint32_t mean_counts;       /**< Mean run */
+    uint16_t overruns;          /**< Runs longer than the task period */
+    uint16_t histogram[PROFILE_NUM_BUCKETS]; /**< Runs per bucket, see Profiler.h */
+} usb_msg_profile_t;
+
+/** Statistics of one SPI bus. Times are in TCC0 counts (1/32 us), see spi_master_stats_t. */
+typedef struct
+{
+    uint8_t  index;             /**< Index in gSpiMasters */
+    uint8_t  max_queued;        /**< Most requests ever waiting in the queue */
+    uint16_t queue_full;        /**< Enqueues refused because the queue was full */
+    uint32_t requests;          /**< Requests started */
+    uint32_t bytes;             /**< Bytes clocked on the bus */
+    uint32_t interrupts;        /**< RXC or DMA interrupts taken */
+    uint32_t setup_counts;      /**< Time spent starting requests */
+    uint32_t isr_counts;        /**< Time spent in interrupts */
+    uint32_t busy_counts;       /**< Time the bus spent busy */
+} usb_msg_spi_stats_t;
 
 /** Not-Acknowlege message */
 typedef struct
@@ -176,10 +298,14 @@ typedef struct
 /* Computes checksum for message and fills packet pointer */
 Bool usb_utils_create_packet(uint16_t id, uint16_t len, uint8_t *message, usb_packet_t *packet);
 
-/* Takes in message and computes checksum */
-Bool usb_utils_calculate_checksum(uint16_t *checksum, uint8_t *message, uint16_t len);
+/* CRC-16-CCITT of the packet header and message */
+Bool usb_utils_calculate_checksum(uint16_t *checksum, usb_packet_header_t *hdr, uint8_t *message);
 
-void dump_to_usb(void);
+Bool dump_to_usb(uint32_t firstEntry, uint32_t entryCount);
+
+void dump_profile_to_usb(void);
+
+Bool usb_utils_send_packet(usb_packet_t *packet);
 
 bool usb_utils_cdc_enabled(uint8_t port);
 
@@ -189,6 +315,8 @@ void usb_utils_state_mach(void);
 
 void init_usb(void);
 
+void usb_utils_rx_notify(uint8_t port);
+
 bool usb_utils_check_for_message(usb_packet_t *packet_out); 
 
 void usb_utils_send_nack(nack_error_t error_code);